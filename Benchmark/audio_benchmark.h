@@ -0,0 +1,165 @@
+#pragma once
+
+#include <cmath>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "utils.h"
+#include "audio_mixer.h"
+#include "audio_waveform.h"
+#include "benchmark_result.h"
+
+namespace audio_benchmark_detail {
+
+const int kSourceRate = 44100;
+const int kSourceSeconds = 20;
+const double kTwoPi = 6.28318530717958648;
+
+inline void WriteLe(std::ofstream& file, uint32_t n, int nBytes) {
+    for (int i = 0; i < nBytes; i++) {
+        file.put((char)((n >> (8 * i)) & 0xFF));
+    }
+}
+
+/**
+* @brief Stereo 16-bit WAV of two detuned tones. 44.1 kHz on purpose, so mixing into a 48 kHz
+* project goes through the resampler like most camera and music sources do.
+*/
+inline bool GenerateWav(const std::string& strPath) {
+    std::ofstream file(strPath, std::ios::binary);
+    uint32_t nData = (uint32_t)kSourceRate * kSourceSeconds * 2 * 2;
+    file.write("RIFF", 4);
+    WriteLe(file, 36 + nData, 4);
+    file.write("WAVEfmt ", 8);
+    WriteLe(file, 16, 4);
+    WriteLe(file, 1, 2);
+    WriteLe(file, 2, 2);
+    WriteLe(file, kSourceRate, 4);
+    WriteLe(file, kSourceRate * 4, 4);
+    WriteLe(file, 4, 2);
+    WriteLe(file, 16, 2);
+    file.write("data", 4);
+    WriteLe(file, nData, 4);
+    for (int i = 0; i < kSourceRate * kSourceSeconds; i++) {
+        double t = (double)i / kSourceRate;
+        WriteLe(file, (uint16_t)(int16_t)(8000.0 * sin(kTwoPi * 440.0 * t)), 2);
+        WriteLe(file, (uint16_t)(int16_t)(8000.0 * sin(kTwoPi * 443.0 * t)), 2);
+    }
+    return (bool)file;
+}
+
+/**
+* @brief Builds the peak pyramid of strPath, a file with no video stream, and checks it against the
+* known tones: every sample counted, both channels, and an overall peak at the generated amplitude
+*/
+inline bool CheckWaveform(const std::string& strPath, std::vector<BenchmarkResult>& vResults) {
+    std::string strPyramid = AudioWaveform::PyramidPath(strPath.c_str());
+    StopWatch sw;
+    sw.Start();
+    if (AudioWaveform::Build(strPath.c_str(), strPyramid.c_str()) < 0) {
+        LOG(ERROR) << "No waveform for audio-only " << strPath;
+        return false;
+    }
+    double dSeconds = sw.Stop();
+    AudioWaveform waveform(strPath.c_str());
+    int64_t nBuckets = 0;
+    const WaveformPeak* pTop = waveform.IsValid() ? waveform.GetLevel(waveform.GetLevelCount() - 1, &nBuckets) : nullptr;
+    if (!pTop || nBuckets != 1 || waveform.GetChannels() != 2
+        || waveform.GetSampleCount() != (int64_t)kSourceRate * kSourceSeconds) {
+        LOG(ERROR) << "Waveform of " << strPath << " does not match the source";
+        return false;
+    }
+    for (int c = 0; c < 2; c++) {
+        if (std::abs(pTop[c].max - 8000) > 80 || std::abs(pTop[c].min + 8000) > 80) {
+            LOG(ERROR) << "Waveform channel " << c << " peaks at " << pTop[c].min << "/" << pTop[c].max << ", expected 8000";
+            return false;
+        }
+    }
+    if (dSeconds > 0.0) {
+        vResults.push_back({ "audio.waveform_build", kSourceSeconds / dSeconds, "x realtime" });
+    }
+    return true;
+}
+
+}
+
+/**
+* @brief Mixes nTracks tracks of the same source on one thread, each with its own offset and a
+* gain/pan ramp, and reports how many times faster than realtime the timeline is produced.
+* Includes decoding and resampling; audio.mix_kernel isolates the SIMD bus summing.
+* Fails when the source cannot be written or any clip cannot be opened: silent tracks would time nothing.
+* The same audio-only source also checks and times the waveform peak pyramid.
+*/
+inline bool RunAudioBenchmark(const std::string& strDir, std::vector<BenchmarkResult>& vResults, int nTracks = 16) {
+    using namespace audio_benchmark_detail;
+    std::string strPath = strDir + "/tones_44100.wav";
+    std::ifstream probe(strPath);
+    if (!probe && !GenerateWav(strPath)) {
+        LOG(ERROR) << "Cannot write " << strPath;
+        return false;
+    }
+    if (!CheckWaveform(strPath, vResults)) {
+        return false;
+    }
+
+    std::vector<AudioTrack> vTracks(nTracks);
+    for (int i = 0; i < nTracks; i++) {
+        AudioClip clip;
+        clip.path = strPath;
+        clip.start = i * 50;
+        clip.in = i * 100;
+        clip.duration = (kSourceSeconds - 2) * 1000 - i * 50;
+        vTracks[i].clips.push_back(clip);
+        vTracks[i].gain = 1.0f / nTracks;
+        AudioEnvelopePoint a, b;
+        a.time = 0;
+        a.pan = -1.0f + 2.0f * i / nTracks;
+        b.time = (kSourceSeconds - 2) * 1000;
+        b.gain = 0.5f;
+        b.pan = -a.pan;
+        vTracks[i].envelope = { a, b };
+    }
+
+    const int nRate = 48000;
+    AudioMixer mixer(vTracks, nRate, 2);
+    std::vector<float> vBus(2 * 1024);
+    float* ppBus[2] = { vBus.data(), vBus.data() + 1024 };
+    int64_t nSamples = 0;
+    StopWatch sw;
+    sw.Start();
+    int n;
+    while ((n = mixer.Mix(ppBus, 1024)) > 0) {
+        nSamples += n;
+    }
+    double dSeconds = sw.Stop();
+    if (mixer.GetOpenFailures() > 0) {
+        LOG(ERROR) << mixer.GetOpenFailures() << " of " << nTracks << " clips could not be opened";
+        return false;
+    }
+    if (nSamples > 0 && dSeconds > 0.0) {
+        vResults.push_back({ "audio.mix_" + std::to_string(nTracks) + "_tracks", nSamples / (double)nRate / dSeconds, "x realtime" });
+    }
+
+    // bus summing alone: nTracks ramps into the same block
+    const simd::AudioKernels& kernels = simd::GetAudioKernels();
+    std::vector<float> vTrack(1024, 0.25f);
+    const int nBlocks = 20000;
+    sw.Start();
+    for (int b = 0; b < nBlocks; b++) {
+        for (int t = 0; t < nTracks; t++) {
+            for (int c = 0; c < 2; c++) {
+                kernels.MixRamp(vTrack.data(), ppBus[c], 1024, 0.5f, 1e-5f);
+            }
+        }
+    }
+    for (int c = 0; c < 2; c++) {
+        kernels.ClampUnit(ppBus[c], 1024);
+    }
+    dSeconds = sw.Stop();
+    if (dSeconds > 0.0) {
+        double dRealtime = (double)nBlocks * 1024 / nRate / dSeconds;
+        vResults.push_back({ "audio.mix_kernel_" + std::to_string(nTracks) + "_tracks", dRealtime, "x realtime" });
+    }
+    return true;
+}
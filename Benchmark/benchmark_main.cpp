@@ -0,0 +1,116 @@
+#include <filesystem>
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "benchmark_result.h"
+#include "queue_benchmark.h"
+#include "yuv_benchmark.h"
+#include "media_benchmark.h"
+#include "audio_benchmark.h"
+#include "preview_benchmark.h"
+
+simplelogger::Logger* logger = simplelogger::LoggerFactory::CreateConsoleLogger();
+
+int main(int argc, char* argv[])
+{
+    // benchmark [--json out.json] [--baseline base.json] [--tolerance 0.10] [--media-dir dir] [--quick] [suite...]
+    // suites: queue yuv audio decode scrub mux export preview; none runs everything
+    const char* szJson = nullptr;
+    const char* szBaseline = nullptr;
+    double dTolerance = 0.10;
+    std::string strMediaDir = "benchmark_media";
+    bool bQuick = false;
+    std::vector<std::string> vSuites;
+    for (int i = 1; i < argc; i++) {
+        bool bHasValue = i + 1 < argc;
+        if (!strcmp(argv[i], "--json") && bHasValue) {
+            szJson = argv[++i];
+        } else if (!strcmp(argv[i], "--baseline") && bHasValue) {
+            szBaseline = argv[++i];
+        } else if (!strcmp(argv[i], "--tolerance") && bHasValue) {
+            dTolerance = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "--media-dir") && bHasValue) {
+            strMediaDir = argv[++i];
+        } else if (!strcmp(argv[i], "--quick")) {
+            bQuick = true;
+        } else {
+            vSuites.push_back(argv[i]);
+        }
+    }
+    auto selected = [&](const char* szName) {
+        if (vSuites.empty()) {
+            return true;
+        }
+        for (const std::string& s : vSuites) {
+            if (s == szName) {
+                return true;
+            }
+        }
+        return false;
+    };
+
+    std::vector<BenchmarkResult> vResults;
+    bool bOk = true;
+    if (selected("queue")) {
+        RunQueueBenchmark(vResults);
+    }
+    if (selected("yuv")) {
+        if (!RunYuvBenchmark(vResults)) {
+            LOG(ERROR) << "YUV kernel verification failed";
+            bOk = false;
+        }
+    }
+    if (selected("audio")) {
+        std::error_code ec;
+        std::filesystem::create_directories(strMediaDir, ec);
+        if (!RunAudioBenchmark(strMediaDir, vResults)) {
+            LOG(ERROR) << "Audio benchmark failed";
+            bOk = false;
+        }
+    }
+    if (selected("decode") || selected("scrub") || selected("mux") || selected("export") || selected("preview")) {
+        std::error_code ec;
+        std::filesystem::create_directories(strMediaDir, ec);
+        std::vector<MediaClip> vClips = PrepareMediaClips(strMediaDir, bQuick);
+        if (selected("decode")) {
+            RunDecodeBenchmark(vClips, vResults);
+        }
+        if (selected("scrub")) {
+            RunScrubBenchmark(vClips, vResults);
+        }
+        if (selected("mux")) {
+            RunMuxBenchmark(vClips, strMediaDir, vResults);
+        }
+        if (selected("export")) {
+            if (!RunExportBenchmark(vClips, strMediaDir, vResults)) {
+                LOG(ERROR) << "Export verification failed";
+                bOk = false;
+            }
+        }
+        if (selected("preview")) {
+            RunPreviewBenchmark(vClips, vResults);
+        }
+    }
+
+    for (const BenchmarkResult& r : vResults) {
+        std::cout << std::left << std::setw(32) << r.name << std::right << std::setw(12) << std::fixed
+            << std::setprecision(2) << r.value << " " << r.unit << std::endl;
+    }
+    if (szJson && !WriteResultsJson(szJson, vResults)) {
+        LOG(ERROR) << "Cannot write " << szJson;
+        bOk = false;
+    }
+    if (szBaseline) {
+        std::vector<BenchmarkResult> vBaseline;
+        if (!LoadResultsJson(szBaseline, vBaseline)) {
+            LOG(ERROR) << "Cannot read baseline " << szBaseline;
+            bOk = false;
+        } else if (!CompareWithBaseline(vResults, vBaseline, dTolerance, std::cout)) {
+            LOG(ERROR) << "Performance regressed by more than " << dTolerance * 100.0 << "% against " << szBaseline;
+            bOk = false;
+        }
+    }
+    return bOk ? 0 : 1;
+}
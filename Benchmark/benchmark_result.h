@@ -0,0 +1,113 @@
+#pragma once
+
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/**
+* @brief One named measurement. Higher is better for every metric the suite reports.
+*/
+struct BenchmarkResult {
+    std::string name;
+    double value;
+    std::string unit;
+};
+
+/**
+* @brief {"results": [{"name": ..., "value": ..., "unit": ...}, ...]}, one result per line
+*/
+inline bool WriteResultsJson(const char* szPath, const std::vector<BenchmarkResult>& vResults) {
+    std::ofstream file(szPath);
+    file << "{\n  \"results\": [";
+    for (size_t i = 0; i < vResults.size(); i++) {
+        const BenchmarkResult& r = vResults[i];
+        file << (i ? ",\n" : "\n") << "    {\"name\": \"" << r.name << "\", \"value\": " << std::setprecision(6)
+            << r.value << ", \"unit\": \"" << r.unit << "\"}";
+    }
+    file << "\n  ]\n}\n";
+    return (bool)file;
+}
+
+/**
+* @brief Reads a file written by WriteResultsJson. Only understands that layout, not JSON in general.
+*/
+inline bool LoadResultsJson(const char* szPath, std::vector<BenchmarkResult>& vResults) {
+    std::ifstream file(szPath);
+    if (!file) {
+        return false;
+    }
+    std::stringstream ss;
+    ss << file.rdbuf();
+    std::string s = ss.str();
+
+    auto field = [&s](size_t nFrom, size_t nTo, const char* szKey, std::string& strValue) {
+        std::string strKey = std::string("\"") + szKey + "\":";
+        size_t pos = s.find(strKey, nFrom);
+        if (pos == std::string::npos || pos >= nTo) {
+            return false;
+        }
+        pos = s.find_first_not_of(" \t", pos + strKey.size());
+        if (s[pos] == '"') {
+            size_t nEnd = s.find('"', pos + 1);
+            strValue = s.substr(pos + 1, nEnd - pos - 1);
+        } else {
+            size_t nEnd = s.find_first_of(",}", pos);
+            strValue = s.substr(pos, nEnd - pos);
+        }
+        return true;
+    };
+
+    size_t pos = 0;
+    while ((pos = s.find('{', pos + 1)) != std::string::npos) {
+        size_t nEnd = s.find('}', pos);
+        BenchmarkResult r;
+        std::string strValue;
+        if (field(pos, nEnd, "name", r.name) && field(pos, nEnd, "value", strValue) && field(pos, nEnd, "unit", r.unit)) {
+            r.value = atof(strValue.c_str());
+            vResults.push_back(r);
+        }
+    }
+    return true;
+}
+
+/**
+* @brief Flags every result that fell more than dTolerance (fraction) below its baseline.
+* New results are reported; baseline results that are no longer produced fail the check, since a
+* benchmark that stopped running must not pass as one that did not regress.
+*/
+inline bool CompareWithBaseline(const std::vector<BenchmarkResult>& vResults, const std::vector<BenchmarkResult>& vBaseline,
+    double dTolerance, std::ostream& os) {
+    bool bOk = true;
+    for (const BenchmarkResult& r : vResults) {
+        const BenchmarkResult* pBase = nullptr;
+        for (const BenchmarkResult& b : vBaseline) {
+            if (b.name == r.name) {
+                pBase = &b;
+                break;
+            }
+        }
+        if (!pBase) {
+            os << "NEW        " << r.name << std::endl;
+            continue;
+        }
+        double dChange = pBase->value > 0.0 ? r.value / pBase->value - 1.0 : 0.0;
+        bool bRegressed = dChange < -dTolerance;
+        bOk = bOk && !bRegressed;
+        os << (bRegressed ? "REGRESSION " : "ok         ") << std::left << std::setw(32) << r.name << std::right
+            << std::fixed << std::setprecision(2) << std::setw(12) << pBase->value << " -> " << std::setw(12) << r.value
+            << " " << r.unit << " (" << std::showpos << dChange * 100.0 << std::noshowpos << "%)" << std::endl;
+    }
+    for (const BenchmarkResult& b : vBaseline) {
+        bool bFound = false;
+        for (const BenchmarkResult& r : vResults) {
+            bFound = bFound || r.name == b.name;
+        }
+        if (!bFound) {
+            bOk = false;
+            os << "MISSING    " << b.name << std::endl;
+        }
+    }
+    return bOk;
+}
@@ -0,0 +1,390 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+
+#include "utils.h"
+#include "ffmpeg_decoder.h"
+#include "ffmpeg_encoder.h"
+#include "ffmpeg_streamer.h"
+#include "export_pipeline.h"
+#include "frame_cache.h"
+#include "segmented_export.h"
+#include "smart_render.h"
+#include "benchmark_result.h"
+
+/**
+* @brief One synthetic test clip. Clips are generated locally and deterministically, so results
+* only depend on the build and the machine.
+*/
+struct MediaClip {
+    AVCodecID eCodecId;
+    int nWidth;
+    int nHeight;
+    int nFrames;
+    std::string strPath;
+
+    std::string Name() const {
+        return std::string(avcodec_get_name(eCodecId)) + "_" + std::to_string(nHeight) + "p";
+    }
+};
+
+namespace media_benchmark_detail {
+
+const int kFps = 30;
+
+inline bool FileExists(const std::string& strPath) {
+    struct stat st;
+    return stat(strPath.c_str(), &st) == 0 && st.st_size > 0;
+}
+
+/**
+* @brief Moving luma gradient, a sliding box, drifting chroma and low-amplitude hashed noise:
+* cheap to generate, but with enough motion and texture to keep the encoder and decoder honest
+*/
+inline void FillSyntheticFrame(AVFrame* frame, int nFrame) {
+    for (int y = 0; y < frame->height; y++) {
+        uint8_t* p = frame->data[0] + (size_t)y * frame->linesize[0];
+        for (int x = 0; x < frame->width; x++) {
+            uint32_t h = (uint32_t)(x * 73856093) ^ (uint32_t)(y * 19349663) ^ (uint32_t)(nFrame * 83492791);
+            p[x] = (uint8_t)(((x + 2 * y + 4 * nFrame) >> 2) + (h >> 29));
+        }
+    }
+    int nBox = frame->height / 4;
+    int bx = (nFrame * 8) % std::max(1, frame->width - nBox), by = frame->height / 3;
+    for (int y = by; y < by + nBox; y++) {
+        memset(frame->data[0] + (size_t)y * frame->linesize[0] + bx, 235, nBox);
+    }
+    for (int plane = 1; plane < 3; plane++) {
+        for (int y = 0; y < (frame->height + 1) / 2; y++) {
+            uint8_t* p = frame->data[plane] + (size_t)y * frame->linesize[plane];
+            for (int x = 0; x < (frame->width + 1) / 2; x++) {
+                p[x] = (uint8_t)(128 + ((plane == 1 ? x : y) + nFrame) % 64 - 32);
+            }
+        }
+    }
+}
+
+/**
+* @brief Encodes clip with the fastest preset of the available software encoder
+*/
+inline bool GenerateClip(const MediaClip& clip) {
+    FFmpegStreamer streamer(clip.eCodecId, clip.nWidth, clip.nHeight, kFps, clip.strPath.c_str());
+    EncoderOptions options;
+    options.preset = "ultrafast";
+    options.gop_size = kFps;
+    options.rate_control = EncoderOptions::RC_CRF;
+    options.crf = 28;
+    FFmpegEncoder encoder(clip.eCodecId, clip.nWidth, clip.nHeight, kFps, AV_PIX_FMT_YUV420P, options, &streamer);
+    if (!encoder.IsValid()) {
+        return false;
+    }
+
+    AVFrame* frame = av_frame_alloc();
+    frame->width = clip.nWidth;
+    frame->height = clip.nHeight;
+    frame->format = AV_PIX_FMT_YUV420P;
+    bool bOk = av_frame_get_buffer(frame, 0) >= 0;
+    for (int i = 0; bOk && i < clip.nFrames; i++) {
+        // the encoder may still reference the previous frame's buffer
+        bOk = av_frame_make_writable(frame) >= 0;
+        FillSyntheticFrame(frame, i);
+        frame->pts = i;
+        bOk = bOk && encoder.EncodeFrame(frame) >= 0;
+    }
+    bOk = bOk && encoder.EncodeFrame(nullptr) >= 0;
+    av_frame_free(&frame);
+    return bOk;
+}
+
+inline std::string OutputPath(const std::string& strDir, const MediaClip& clip, const char* szSuffix) {
+    return strDir + "/" + clip.Name() + szSuffix + (clip.eCodecId == AV_CODEC_ID_AV1 ? ".ivf" : ".ts");
+}
+
+/**
+* @brief Checks an export that was cut and joined: dts strictly increasing over every packet, so no
+* seam repeats or goes back in time, and exactly nFrames frames decoded from it
+*/
+inline bool CheckSplicedOutput(const std::string& strPath, int nFrames) {
+    FFmpegDecoder demuxer(strPath.c_str());
+    if (!demuxer.IsValid()) {
+        LOG(ERROR) << "Cannot open " << strPath;
+        return false;
+    }
+    AVPacket* pkt = av_packet_alloc();
+    int64_t nLastDts = AV_NOPTS_VALUE;
+    bool bOk = true;
+    for (int n = 0; demuxer.Demux(pkt) == 0; n++) {
+        if (pkt->dts != AV_NOPTS_VALUE) {
+            if (nLastDts != AV_NOPTS_VALUE && pkt->dts <= nLastDts) {
+                LOG(ERROR) << strPath << ": packet " << n << " has dts " << pkt->dts << " after " << nLastDts;
+                bOk = false;
+            }
+            nLastDts = pkt->dts;
+        }
+        av_packet_unref(pkt);
+    }
+    av_packet_free(&pkt);
+
+    FFmpegDecoder decoder(strPath.c_str());
+    AVFrame* frame = av_frame_alloc();
+    int nDecoded = 0;
+    while (decoder.IsValid() && decoder.DecodeNextFrame(frame) == 0) {
+        av_frame_unref(frame);
+        nDecoded++;
+    }
+    av_frame_free(&frame);
+    if (nDecoded != nFrames) {
+        LOG(ERROR) << strPath << ": decoded " << nDecoded << " frames, expected " << nFrames;
+        bOk = false;
+    }
+    return bOk;
+}
+
+}
+
+/**
+* @brief Generates whatever clips are missing in strDir. Codecs without an encoder in this build
+* are skipped with a warning; the returned list only holds clips that exist.
+*/
+inline std::vector<MediaClip> PrepareMediaClips(const std::string& strDir, bool bQuick) {
+    using namespace media_benchmark_detail;
+    const AVCodecID aCodecs[] = { AV_CODEC_ID_H264, AV_CODEC_ID_HEVC, AV_CODEC_ID_AV1 };
+    // frame counts keep every clip at a few seconds of encoding with the fastest presets
+    const int aSizes[][3] = { { 1280, 720, 120 }, { 1920, 1080, 90 }, { 3840, 2160, 30 } };
+
+    std::vector<MediaClip> vClips;
+    for (AVCodecID eCodecId : aCodecs) {
+        for (int i = 0; i < (bQuick ? 1 : 3); i++) {
+            MediaClip clip = { eCodecId, aSizes[i][0], aSizes[i][1], aSizes[i][2] };
+            clip.strPath = OutputPath(strDir, clip, "");
+            if (!FileExists(clip.strPath)) {
+                LOG(INFO) << "Generating " << clip.strPath;
+                // written under a temporary name, so an interrupted run never leaves a short clip behind
+                MediaClip part = clip;
+                part.strPath += ".part";
+                if (!GenerateClip(part)) {
+                    LOG(WARNING) << "No " << avcodec_get_name(eCodecId) << " encoder, skipping " << clip.Name();
+                    remove(part.strPath.c_str());
+                    break;
+                }
+                remove(clip.strPath.c_str());
+                if (rename(part.strPath.c_str(), clip.strPath.c_str()) != 0) {
+                    LOG(ERROR) << "Cannot rename " << part.strPath << " to " << clip.strPath;
+                    remove(part.strPath.c_str());
+                    break;
+                }
+            }
+            vClips.push_back(clip);
+        }
+    }
+    return vClips;
+}
+
+/**
+* @brief Single-pass decode of every clip with default decoder options, in frames per second
+*/
+inline void RunDecodeBenchmark(const std::vector<MediaClip>& vClips, std::vector<BenchmarkResult>& vResults) {
+    for (const MediaClip& clip : vClips) {
+        FFmpegDecoder decoder(clip.strPath.c_str());
+        if (!decoder.IsValid()) {
+            continue;
+        }
+        AVFrame* frame = av_frame_alloc();
+        int nFrames = 0;
+        StopWatch sw;
+        sw.Start();
+        while (decoder.DecodeNextFrame(frame) == 0) {
+            av_frame_unref(frame);
+            nFrames++;
+        }
+        double dSeconds = sw.Stop();
+        av_frame_free(&frame);
+        if (nFrames != clip.nFrames) {
+            LOG(WARNING) << clip.Name() << ": decoded " << nFrames << " of " << clip.nFrames << " frames";
+        }
+        vResults.push_back({ "decode." + clip.Name(), nFrames / dSeconds, "fps" });
+    }
+}
+
+/**
+* @brief FFmpegStreamer packet rate: packets are demuxed into memory first, so only muxing is timed
+*/
+inline void RunMuxBenchmark(const std::vector<MediaClip>& vClips, const std::string& strDir,
+    std::vector<BenchmarkResult>& vResults, int nRepeat = 20) {
+    using namespace media_benchmark_detail;
+    for (const MediaClip& clip : vClips) {
+        FFmpegDecoder decoder(clip.strPath.c_str());
+        if (!decoder.IsValid()) {
+            continue;
+        }
+        AVRational tb = decoder.GetVideoTimeBase();
+        std::vector<AVPacket*> vPackets;
+        AVPacket* pkt = av_packet_alloc();
+        while (decoder.Demux(pkt) == 0) {
+            vPackets.push_back(av_packet_clone(pkt));
+            av_packet_unref(pkt);
+        }
+
+        // timestamps keep increasing across repeats, as in one long stream
+        int64_t nSpan = vPackets.empty() ? 0 : vPackets.back()->dts - vPackets.front()->dts
+            + av_rescale_q(1, AVRational{ 1, kFps }, tb);
+        std::string strOut = OutputPath(strDir, clip, "_mux");
+        int64_t nPackets = 0;
+        StopWatch sw;
+        {
+            FFmpegStreamer streamer(clip.eCodecId, clip.nWidth, clip.nHeight, kFps, strOut.c_str());
+            sw.Start();
+            for (int r = 0; r < nRepeat; r++) {
+                for (AVPacket* p : vPackets) {
+                    av_packet_ref(pkt, p);
+                    pkt->pts += r * nSpan;
+                    pkt->dts += r * nSpan;
+                    streamer.Stream(pkt, tb);
+                    av_packet_unref(pkt);
+                    nPackets++;
+                }
+            }
+        }
+        // includes writing the trailer and closing the file
+        double dSeconds = sw.Stop();
+        remove(strOut.c_str());
+        for (AVPacket* p : vPackets) {
+            av_packet_free(&p);
+        }
+        av_packet_free(&pkt);
+        vResults.push_back({ "mux." + clip.Name(), nPackets / dSeconds, "pkt/s" });
+    }
+}
+
+/**
+* @brief End-to-end ExportPipeline (decode, passthrough effect, H.264 ultrafast encode, mux) per clip,
+* then SegmentedExport with the same settings, and a SmartRender trim of the middle half that cuts
+* inside GOPs at both ends. Fails when the segmented export or the trim does not decode to exactly
+* the frames it keeps, with increasing dts across its seams.
+*/
+inline bool RunExportBenchmark(const std::vector<MediaClip>& vClips, const std::string& strDir,
+    std::vector<BenchmarkResult>& vResults) {
+    using namespace media_benchmark_detail;
+    bool bOk = true;
+    for (const MediaClip& clip : vClips) {
+        // one row per size is enough; the source codec only changes the decode cost
+        if (clip.eCodecId != AV_CODEC_ID_H264) {
+            continue;
+        }
+        FFmpegDecoder decoder(clip.strPath.c_str());
+        if (!decoder.IsValid()) {
+            continue;
+        }
+        std::string strOut = OutputPath(strDir, clip, "_export");
+        EncoderOptions options;
+        options.preset = "ultrafast";
+        options.gop_size = kFps;
+        double dFps = 0.0;
+        {
+            FFmpegStreamer streamer(AV_CODEC_ID_H264, clip.nWidth, clip.nHeight, kFps, strOut.c_str());
+            FFmpegEncoder encoder(AV_CODEC_ID_H264, clip.nWidth, clip.nHeight, kFps, decoder.GetChromaFormat(), options);
+            if (!encoder.IsValid()) {
+                continue;
+            }
+            ExportPipeline pipeline(&decoder, &encoder, &streamer);
+            if (pipeline.Run()) {
+                dFps = pipeline.GetExportFps();
+            }
+        }
+        remove(strOut.c_str());
+        vResults.push_back({ "export." + clip.Name(), dFps, "fps" });
+
+        // the same export cut at every source GOP and encoded concurrently
+        SegmentedExportOptions segmented_options;
+        segmented_options.encoder = options;
+        segmented_options.segment_frames = kFps;
+        SegmentedExport segmented(clip.strPath.c_str(), strOut.c_str(), segmented_options);
+        if (segmented.Run()) {
+            dFps = segmented.GetExportFps();
+            // the synthetic clips start on a keyframe, so no frame is left out
+            bOk = CheckSplicedOutput(strOut, clip.nFrames) && bOk;
+        } else {
+            dFps = 0.0;
+            bOk = false;
+        }
+        remove(strOut.c_str());
+        vResults.push_back({ "export_segmented." + clip.Name(), dFps, "fps" });
+
+        SmartRenderClip trim;
+        trim.path = clip.strPath;
+        trim.in = clip.nFrames / 4 * 1000 / kFps + 500 / kFps;
+        trim.out = clip.nFrames * 3 / 4 * 1000 / kFps + 500 / kFps;
+        SmartRenderOptions smart_options;
+        smart_options.encoder = options;
+        StopWatch sw;
+        sw.Start();
+        SmartRender smart(std::vector<SmartRenderClip>{ trim }, strOut.c_str(), smart_options);
+        bool bRendered = smart.Run();
+        double dSeconds = sw.Stop();
+        // copied middle GOPs spliced to re-encoded partial GOPs at both ends: frame n shows at n * 1000 / kFps ms
+        int nKept = 0;
+        for (int n = 0; n < clip.nFrames; n++) {
+            nKept += n * 1000 >= trim.in * kFps && n * 1000 < trim.out * kFps;
+        }
+        bOk = bRendered && CheckSplicedOutput(strOut, nKept) && bOk;
+        remove(strOut.c_str());
+        dFps = bRendered && dSeconds > 0.0 ? (trim.out - trim.in) * kFps / 1000.0 / dSeconds : 0.0;
+        vResults.push_back({ "smart_render." + clip.Name(), dFps, "fps" });
+    }
+    return bOk;
+}
+
+/**
+* @brief Back-and-forth scrubbing across a GOP boundary, as when trimming an edit point: frame-accurate
+* seeks per second without a cache, and with a FrameCache after the first sweep has filled it
+*/
+inline void RunScrubBenchmark(const std::vector<MediaClip>& vClips, std::vector<BenchmarkResult>& vResults,
+    int nSweeps = 10) {
+    using namespace media_benchmark_detail;
+    for (const MediaClip& clip : vClips) {
+        // the boundary between the first two GOPs, with kFps / 4 frames on either side
+        std::vector<int> vFrames;
+        for (int n = kFps - kFps / 4; n < kFps + kFps / 4 && n < clip.nFrames; n++) {
+            vFrames.push_back(n);
+        }
+        if (vFrames.empty()) {
+            continue;
+        }
+        double aSeeksPerSecond[2] = {};
+        for (int bCached = 0; bCached < 2; bCached++) {
+            FFmpegDecoder decoder(clip.strPath.c_str());
+            if (!decoder.IsValid() || decoder.BuildIndex() < 0) {
+                break;
+            }
+            FrameCache cache((size_t)decoder.GetFrameSize() * kFps * 2);
+            if (bCached) {
+                decoder.SetFrameCache(&cache);
+            }
+            AVFrame* frame = av_frame_alloc();
+            int nSeeks = 0;
+            StopWatch sw;
+            for (int s = 0; s <= nSweeps; s++) {
+                // the first sweep is untimed: it fills the cache in the cached run
+                if (s == 1) {
+                    sw.Start();
+                }
+                for (size_t i = 0; i < vFrames.size(); i++) {
+                    int n = s % 2 ? vFrames[vFrames.size() - 1 - i] : vFrames[i];
+                    // as a scrub bar does: the cache first, a decoding seek on a miss
+                    bool bHit = bCached && cache.Get(decoder.GetClipId(), decoder.GetIndex().GetFramePts(n), frame);
+                    if (bHit || decoder.SeekToFrame(n, frame) == 0) {
+                        nSeeks += s > 0;
+                    }
+                    av_frame_unref(frame);
+                }
+            }
+            double dSeconds = sw.Stop();
+            av_frame_free(&frame);
+            aSeeksPerSecond[bCached] = dSeconds > 0.0 ? nSeeks / dSeconds : 0.0;
+        }
+        vResults.push_back({ "scrub." + clip.Name(), aSeeksPerSecond[0], "seek/s" });
+        vResults.push_back({ "scrub_cached." + clip.Name(), aSeeksPerSecond[1], "seek/s" });
+    }
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "utils.h"
+#include "preview_player.h"
+#include "media_benchmark.h"
+#include "benchmark_result.h"
+
+/**
+* @brief Real-time headless playback of every clip (SDL dummy video, disk audio to the null device):
+* the share of the clip's frames that reached the screen on time, in percent. Frames dropped late
+* and frames the decoder skipped under load both count against it; the dropped count and the skip
+* level reached are logged by the player.
+*/
+inline void RunPreviewBenchmark(const std::vector<MediaClip>& vClips, std::vector<BenchmarkResult>& vResults) {
+    for (const MediaClip& clip : vClips) {
+        PreviewOptions options;
+        options.headless = true;
+        PreviewPlayer player(clip.strPath.c_str(), options);
+        if (!player.IsValid() || !player.Play()) {
+            LOG(WARNING) << clip.Name() << ": preview failed";
+            continue;
+        }
+        PreviewPlayer::Stats stats = player.GetStats();
+        vResults.push_back({ "preview." + clip.Name() + ".on_time", 100.0 * stats.displayed / clip.nFrames, "%" });
+    }
+}
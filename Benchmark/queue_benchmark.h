@@ -0,0 +1,98 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "utils.h"
+#include "benchmark_result.h"
+
+/**
+* @brief Moves nItems pointer-sized payloads (what the pipeline passes around as AVFrame*) through q
+* with the given number of producer and consumer threads. Returns million items per second.
+*/
+template<typename Queue>
+double MeasureQueueThroughput(Queue& q, int nProducers, int nConsumers, size_t nItems, size_t nBatch) {
+    std::atomic<size_t> nConsumed{ 0 };
+    std::atomic<int> nProducersLeft{ nProducers };
+    size_t nPerProducer = nItems / nProducers;
+
+    StopWatch sw;
+    sw.Start();
+    {
+        std::vector<NvThread> vThreads;
+        for (int p = 0; p < nProducers; p++) {
+            vThreads.emplace_back(std::thread([&, p]() {
+                std::vector<void*> vBatch(nBatch);
+                uintptr_t next = (uintptr_t)p * nPerProducer + 1;
+                for (size_t i = 0; i < nPerProducer; i += nBatch) {
+                    size_t n = std::min(nBatch, nPerProducer - i);
+                    for (size_t j = 0; j < n; j++) {
+                        vBatch[j] = reinterpret_cast<void*>(next++);
+                    }
+                    if (nBatch == 1) {
+                        q.push(vBatch[0]);
+                    } else {
+                        q.push_many(vBatch.data(), n);
+                    }
+                }
+                if (--nProducersLeft == 0) {
+                    q.close();
+                }
+            }));
+        }
+        for (int c = 0; c < nConsumers; c++) {
+            vThreads.emplace_back(std::thread([&]() {
+                std::vector<void*> vBatch(nBatch);
+                size_t nLocal = 0;
+                if (nBatch == 1) {
+                    while (q.pop(vBatch[0])) {
+                        nLocal++;
+                    }
+                } else {
+                    size_t n;
+                    while ((n = q.pop_many(vBatch.data(), nBatch)) != 0) {
+                        nLocal += n;
+                    }
+                }
+                nConsumed += nLocal;
+            }));
+        }
+    }
+    double dSeconds = sw.Stop();
+    if (nConsumed != nPerProducer * nProducers) {
+        LOG(ERROR) << "Queue benchmark lost items: " << nConsumed << " of " << nPerProducer * nProducers;
+    }
+    return nConsumed / dSeconds / 1.0e6;
+}
+
+/**
+* @brief ConcurrentQueue vs SpscRingBuffer vs MpmcRingBuffer, single items and batches of 32
+*/
+inline void RunQueueBenchmark(std::vector<BenchmarkResult>& vResults, size_t nItems = 4000000) {
+    const size_t nDepth = 256;
+    const size_t aBatch[] = { 1, 32 };
+    for (size_t nBatch : aBatch) {
+        std::string strSuffix = nBatch == 1 ? "" : "_batch" + std::to_string(nBatch);
+        {
+            ConcurrentQueue<void*> q(nDepth);
+            vResults.push_back({ "queue.list_1p1c" + strSuffix, MeasureQueueThroughput(q, 1, 1, nItems, nBatch), "Mops/s" });
+        }
+        {
+            SpscRingBuffer<void*> q(nDepth);
+            vResults.push_back({ "queue.spsc_1p1c" + strSuffix, MeasureQueueThroughput(q, 1, 1, nItems, nBatch), "Mops/s" });
+        }
+        {
+            MpmcRingBuffer<void*> q(nDepth);
+            vResults.push_back({ "queue.mpmc_1p1c" + strSuffix, MeasureQueueThroughput(q, 1, 1, nItems, nBatch), "Mops/s" });
+        }
+        {
+            ConcurrentQueue<void*> q(nDepth);
+            vResults.push_back({ "queue.list_4p4c" + strSuffix, MeasureQueueThroughput(q, 4, 4, nItems, nBatch), "Mops/s" });
+        }
+        {
+            MpmcRingBuffer<void*> q(nDepth);
+            vResults.push_back({ "queue.mpmc_4p4c" + strSuffix, MeasureQueueThroughput(q, 4, 4, nItems, nBatch), "Mops/s" });
+        }
+    }
+}
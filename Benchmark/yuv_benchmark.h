@@ -0,0 +1,264 @@
+#pragma once
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include "utils.h"
+#include "yuv_converter.h"
+#include "simd_kernels.h"
+#include "benchmark_result.h"
+
+namespace yuv_benchmark_detail {
+
+template<typename T>
+void FillRandom(std::vector<T>& v, std::mt19937& rng) {
+    for (T& x : v) {
+        x = (T)rng();
+    }
+}
+
+/**
+* @brief Compares one ISA's chroma kernels against the scalar reference, byte for byte,
+* over widths that exercise every vector tail.
+*/
+template<typename T>
+bool VerifyKernels(const simd::YuvKernels& k, const simd::YuvKernels& ref, const char* szIsa) {
+    std::mt19937 rng(1234);
+    auto interleave = [](const simd::YuvKernels& kk, const T* pU, const T* pV, T* pUV, int n) {
+        if (sizeof(T) == 1) {
+            kk.InterleaveUV8((const uint8_t*)pU, (const uint8_t*)pV, (uint8_t*)pUV, n);
+        } else {
+            kk.InterleaveUV16((const uint16_t*)pU, (const uint16_t*)pV, (uint16_t*)pUV, n);
+        }
+    };
+    auto deinterleave = [](const simd::YuvKernels& kk, const T* pUV, T* pU, T* pV, int n) {
+        if (sizeof(T) == 1) {
+            kk.DeinterleaveUV8((const uint8_t*)pUV, (uint8_t*)pU, (uint8_t*)pV, n);
+        } else {
+            kk.DeinterleaveUV16((const uint16_t*)pUV, (uint16_t*)pU, (uint16_t*)pV, n);
+        }
+    };
+
+    for (int n = 0; n <= 200; n++) {
+        std::vector<T> vU(n), vV(n), vUV(n * 2);
+        FillRandom(vU, rng);
+        FillRandom(vV, rng);
+        FillRandom(vUV, rng);
+
+        std::vector<T> vOut(n * 2), vRef(n * 2);
+        interleave(k, vU.data(), vV.data(), vOut.data(), n);
+        interleave(ref, vU.data(), vV.data(), vRef.data(), n);
+        if (memcmp(vOut.data(), vRef.data(), vOut.size() * sizeof(T))) {
+            LOG(ERROR) << szIsa << " InterleaveUV" << sizeof(T) * 8 << " mismatch at n=" << n;
+            return false;
+        }
+
+        std::vector<T> vOutU(n), vOutV(n), vRefU(n), vRefV(n);
+        deinterleave(k, vUV.data(), vOutU.data(), vOutV.data(), n);
+        deinterleave(ref, vUV.data(), vRefU.data(), vRefV.data(), n);
+        if (memcmp(vOutU.data(), vRefU.data(), n * sizeof(T)) || memcmp(vOutV.data(), vRefV.data(), n * sizeof(T))) {
+            LOG(ERROR) << szIsa << " DeinterleaveUV" << sizeof(T) * 8 << " mismatch at n=" << n;
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+* @brief Compares one ISA's blend kernels against scalar: constant and per-pixel alpha at several
+* opacities, 8, 10 and 12-bit, every blend mode, over lengths that exercise every vector tail
+*/
+inline bool VerifyBlendKernels(const simd::BlendKernels& k, const simd::BlendKernels& ref, const char* szIsa) {
+    std::mt19937 rng(4321);
+    const int aOpacity[] = { 0, 1, 128, 255, 256 };
+    for (int n = 0; n <= 100; n++) {
+        std::vector<uint8_t> vSrc(n), vDst(n), vAlpha(n);
+        FillRandom(vSrc, rng);
+        FillRandom(vDst, rng);
+        FillRandom(vAlpha, rng);
+        for (int nOpacity : aOpacity) {
+            for (int bAlpha = 0; bAlpha < 2; bAlpha++) {
+                std::vector<uint8_t> vOut = vDst, vRef = vDst;
+                k.Blend8(vSrc.data(), bAlpha ? vAlpha.data() : nullptr, vOut.data(), n, nOpacity);
+                ref.Blend8(vSrc.data(), bAlpha ? vAlpha.data() : nullptr, vRef.data(), n, nOpacity);
+                if (vOut != vRef) {
+                    LOG(ERROR) << szIsa << " Blend8 mismatch at n=" << n << " opacity=" << nOpacity;
+                    return false;
+                }
+            }
+        }
+        for (int nBits = 10; nBits <= 12; nBits += 2) {
+            std::vector<uint16_t> vSrc16(n), vDst16(n), vAlpha16(n);
+            FillRandom(vSrc16, rng);
+            FillRandom(vDst16, rng);
+            FillRandom(vAlpha16, rng);
+            for (int i = 0; i < n; i++) {
+                vSrc16[i] &= (1 << nBits) - 1;
+                vDst16[i] &= (1 << nBits) - 1;
+                vAlpha16[i] &= (1 << nBits) - 1;
+            }
+            for (int nOpacity : aOpacity) {
+                std::vector<uint16_t> vOut = vDst16, vRef = vDst16;
+                k.Blend16(vSrc16.data(), vAlpha16.data(), vOut.data(), n, nOpacity, nBits);
+                ref.Blend16(vSrc16.data(), vAlpha16.data(), vRef.data(), n, nOpacity, nBits);
+                if (vOut != vRef) {
+                    LOG(ERROR) << szIsa << " Blend16 mismatch at n=" << n << " bits=" << nBits << " opacity=" << nOpacity;
+                    return false;
+                }
+            }
+            for (int m = 0; m < simd::BLEND_MODE_COUNT; m++) {
+                std::vector<uint16_t> vOut(n), vRef(n);
+                int nBlack = 16 << (nBits - 8), nWhite = 235 << (nBits - 8);
+                k.Mode16(vSrc16.data(), vDst16.data(), vOut.data(), n, (simd::BlendMode)m, nBlack, nWhite);
+                ref.Mode16(vSrc16.data(), vDst16.data(), vRef.data(), n, (simd::BlendMode)m, nBlack, nWhite);
+                if (vOut != vRef) {
+                    LOG(ERROR) << szIsa << " Mode16 mismatch at n=" << n << " mode=" << m;
+                    return false;
+                }
+            }
+        }
+        for (int m = 0; m < simd::BLEND_MODE_COUNT; m++) {
+            std::vector<uint8_t> vOut(n), vRef(n);
+            k.Mode8(vSrc.data(), vDst.data(), vOut.data(), n, (simd::BlendMode)m, 16, 235);
+            ref.Mode8(vSrc.data(), vDst.data(), vRef.data(), n, (simd::BlendMode)m, 16, 235);
+            if (vOut != vRef) {
+                LOG(ERROR) << szIsa << " Mode8 mismatch at n=" << n << " mode=" << m;
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/**
+* @brief In-place and out-of-place YuvConverter must agree, for odd sizes and padded pitches too.
+* An odd width needs a pitch of at least 2 * ((w + 1) / 2) to hold an interleaved chroma row.
+*/
+template<typename T>
+bool VerifyConverter() {
+    std::mt19937 rng(99);
+    const int aSize[][3] = { { 64, 36, 0 }, { 33, 17, 34 }, { 33, 17, 48 }, { 1920, 1080, 0 }, { 1921, 1081, 2048 } };
+    for (auto& size : aSize) {
+        int w = size[0], h = size[1], pitch = size[2] ? size[2] : w;
+        size_t nFrame = (size_t)pitch * h + 2 * ((pitch + 1) / 2) * ((h + 1) / 2);
+        std::vector<T> vSrc(nFrame), vInPlace, vOut(nFrame);
+        FillRandom(vSrc, rng);
+
+        YuvConverter<T> conv(w, h, 4);
+        vInPlace = vSrc;
+        conv.PlanarToUVInterleaved(vInPlace.data(), pitch);
+        conv.PlanarToUVInterleaved(vSrc.data(), vOut.data(), pitch);
+        // only compare the rows' visible samples; padding is undefined in the in-place path
+        for (int y = 0; y < h + (h + 1) / 2; y++) {
+            int n = y < h ? w : ((w + 1) / 2) * 2;
+            if (memcmp(&vInPlace[(size_t)y * pitch], &vOut[(size_t)y * pitch], n * sizeof(T))) {
+                LOG(ERROR) << "YuvConverter<" << sizeof(T) * 8 << "> PlanarToUVInterleaved mismatch " << w << "x" << h << " row " << y;
+                return false;
+            }
+        }
+
+        std::vector<T> vBack(nFrame);
+        conv.UVInterleavedToPlanar(vInPlace.data(), pitch);
+        conv.UVInterleavedToPlanar(vOut.data(), vBack.data(), pitch);
+        int cw = (w + 1) / 2, cp = (pitch + 1) / 2, ch = (h + 1) / 2;
+        for (int plane = 0; plane < 2; plane++) {
+            for (int y = 0; y < ch; y++) {
+                size_t off = (size_t)pitch * h + (size_t)plane * cp * ch + (size_t)y * cp;
+                if (memcmp(&vInPlace[off], &vBack[off], cw * sizeof(T)) || memcmp(&vBack[off], &vSrc[off], cw * sizeof(T))) {
+                    LOG(ERROR) << "YuvConverter<" << sizeof(T) * 8 << "> UVInterleavedToPlanar mismatch " << w << "x" << h;
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+}
+
+/**
+* @brief Verifies every available kernel against scalar, then reports GB/s of chroma interleaving
+* and Gpix/s of alpha blending per ISA, and GB/s of whole-frame YuvConverter conversions at 4K.
+* Returns false on a mismatch.
+*/
+inline bool RunYuvBenchmark(std::vector<BenchmarkResult>& vResults, int nIterations = 50) {
+    using namespace yuv_benchmark_detail;
+    const simd::YuvKernels& ref = simd::GetYuvKernels(simd::ISA_SCALAR);
+    bool bOk = VerifyConverter<uint8_t>() && VerifyConverter<uint16_t>();
+    for (int i = 1; i < simd::ISA_COUNT; i++) {
+        simd::Isa eIsa = (simd::Isa)i;
+        if (!simd::IsIsaAvailable(eIsa)) {
+            continue;
+        }
+        const simd::YuvKernels& k = simd::GetYuvKernels(eIsa);
+        bOk = VerifyKernels<uint8_t>(k, ref, simd::IsaName(eIsa)) && VerifyKernels<uint16_t>(k, ref, simd::IsaName(eIsa)) && bOk;
+        bOk = VerifyBlendKernels(simd::GetBlendKernels(eIsa), simd::GetBlendKernels(simd::ISA_SCALAR), simd::IsaName(eIsa)) && bOk;
+    }
+    if (!bOk) {
+        return false;
+    }
+
+    const int w = 3840, h = 2160, cw = w / 2, ch = h / 2;
+    std::vector<uint16_t> vU(cw * ch), vV(cw * ch), vUV(cw * ch * 2);
+    std::vector<uint8_t> vPlane((size_t)w * h, 16), vLayer((size_t)w * h, 200), vAlpha((size_t)w * h, 128);
+    for (int i = 0; i < simd::ISA_COUNT; i++) {
+        simd::Isa eIsa = (simd::Isa)i;
+        if (!simd::IsIsaAvailable(eIsa)) {
+            continue;
+        }
+        const simd::YuvKernels& k = simd::GetYuvKernels(eIsa);
+        std::string strIsa = simd::IsaName(eIsa);
+
+        StopWatch sw;
+        sw.Start();
+        for (int it = 0; it < nIterations; it++) {
+            for (int y = 0; y < ch; y++) {
+                k.InterleaveUV8((uint8_t*)vU.data() + y * cw, (uint8_t*)vV.data() + y * cw, (uint8_t*)vUV.data() + y * w, cw);
+            }
+        }
+        vResults.push_back({ "yuv.interleave8." + strIsa, 2.0 * cw * ch * nIterations / sw.Stop() / 1.0e9, "GB/s" });
+
+        sw.Start();
+        for (int it = 0; it < nIterations; it++) {
+            for (int y = 0; y < ch; y++) {
+                k.DeinterleaveUV16(vUV.data() + y * w, vU.data() + y * cw, vV.data() + y * cw, cw);
+            }
+        }
+        vResults.push_back({ "yuv.deinterleave16." + strIsa, 4.0 * cw * ch * nIterations / sw.Stop() / 1.0e9, "GB/s" });
+
+        // a full 4K luma plane of per-pixel alpha blending, as for a title overlay
+        const simd::BlendKernels& blend = simd::GetBlendKernels(eIsa);
+        sw.Start();
+        for (int it = 0; it < nIterations; it++) {
+            for (int y = 0; y < h; y++) {
+                size_t nRow = (size_t)y * w;
+                blend.Blend8(vLayer.data() + nRow, vAlpha.data() + nRow, vPlane.data() + nRow, w, 200);
+            }
+        }
+        vResults.push_back({ "yuv.blend8_alpha." + strIsa, (double)w * h * nIterations / sw.Stop() / 1.0e9, "Gpix/s" });
+    }
+
+    size_t nFrame = (size_t)w * h * 3 / 2;
+    std::vector<uint8_t> vSrc(nFrame, 128), vDst(nFrame);
+    const int aThreads[] = { 1, 4 };
+    {
+        YuvConverter<uint8_t> conv(w, h);
+        StopWatch sw;
+        sw.Start();
+        for (int it = 0; it < nIterations; it++) {
+            conv.PlanarToUVInterleaved(vSrc.data());
+        }
+        vResults.push_back({ "yuv.converter8.inplace", (double)nFrame * nIterations / sw.Stop() / 1.0e9, "GB/s" });
+    }
+    for (int nThreads : aThreads) {
+        YuvConverter<uint8_t> conv(w, h, nThreads);
+        StopWatch sw;
+        sw.Start();
+        for (int it = 0; it < nIterations; it++) {
+            conv.PlanarToUVInterleaved(vSrc.data(), vDst.data());
+        }
+        vResults.push_back({ "yuv.converter8.outofplace_t" + std::to_string(nThreads), (double)nFrame * nIterations / sw.Stop() / 1.0e9, "GB/s" });
+    }
+    return true;
+}
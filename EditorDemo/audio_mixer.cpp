@@ -0,0 +1,401 @@
+#include "audio_mixer.h"
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+
+namespace {
+
+// samples mixed per pass; one track's block stays in L1 for the ramp kernel
+const int kBlockSamples = 1024;
+// resamplers kept for reuse beyond the ones in use
+const size_t kMaxPooledResamplers = 16;
+
+float Lerp(float a, float b, double t) {
+	return (float)(a + (b - a) * t);
+}
+
+}
+
+AudioMixer::AudioMixer(const std::vector<AudioTrack>& vTracks, int nSampleRate, int nChannels)
+	: nSampleRate(nSampleRate), nChannels(nChannels), kernels(simd::GetAudioKernels())
+{
+	av_channel_layout_default(&layout, nChannels);
+	this->vTracks.resize(vTracks.size());
+	for (size_t i = 0; i < vTracks.size(); i++) {
+		TrackState& state = this->vTracks[i];
+		state.track = vTracks[i];
+		std::sort(state.track.envelope.begin(), state.track.envelope.end(),
+			[](const AudioEnvelopePoint& a, const AudioEnvelopePoint& b) { return a.time < b.time; });
+		// built after the copy so the clip pointers stay valid
+		for (const AudioClip& clip : state.track.clips) {
+			Source source;
+			source.clip = &clip;
+			source.start = av_rescale(clip.start, nSampleRate, 1000);
+			source.end = clip.duration >= 0 ? source.start + av_rescale(clip.duration, nSampleRate, 1000) : INT64_MAX;
+			state.sources.push_back(source);
+		}
+	}
+	frame = av_frame_alloc();
+	vTrackBuffer.resize((size_t)nChannels * kBlockSamples);
+	vBusBuffer.resize((size_t)nChannels * kBlockSamples);
+}
+
+AudioMixer::~AudioMixer()
+{
+	for (TrackState& state : vTracks) {
+		for (Source& source : state.sources) {
+			Close(source);
+		}
+	}
+	for (PooledResampler& pooled : vResamplers) {
+		swr_free(&pooled.swr);
+		av_channel_layout_uninit(&pooled.layout);
+	}
+	av_channel_layout_uninit(&layout);
+	av_frame_free(&frame);
+}
+
+SwrContext* AudioMixer::AcquireResampler(const AVFrame* pFrame)
+{
+	for (size_t i = 0; i < vResamplers.size(); i++) {
+		PooledResampler& pooled = vResamplers[i];
+		if (pooled.format == pFrame->format && pooled.sample_rate == pFrame->sample_rate
+			&& !av_channel_layout_compare(&pooled.layout, &pFrame->ch_layout)) {
+			SwrContext* swr = pooled.swr;
+			av_channel_layout_uninit(&pooled.layout);
+			vResamplers.erase(vResamplers.begin() + i);
+			// same parameters: resets the delay line but keeps the filter bank
+			if (swr_init(swr) < 0) {
+				swr_free(&swr);
+				break;
+			}
+			nResamplerReuses++;
+			return swr;
+		}
+	}
+
+	SwrContext* swr = nullptr;
+	int ret = swr_alloc_set_opts2(&swr, &layout, AV_SAMPLE_FMT_FLTP, nSampleRate,
+		(AVChannelLayout*)&pFrame->ch_layout, (AVSampleFormat)pFrame->format, pFrame->sample_rate, 0, nullptr);
+	if (ret < 0 || (ret = swr_init(swr)) < 0) {
+		LOG(ERROR) << "swr_init failed " << ret;
+		swr_free(&swr);
+		return nullptr;
+	}
+	nResamplers++;
+	return swr;
+}
+
+void AudioMixer::ReleaseResampler(Source& source)
+{
+	if (!source.swr) {
+		return;
+	}
+	if (vResamplers.size() >= kMaxPooledResamplers) {
+		PooledResampler& oldest = vResamplers.front();
+		swr_free(&oldest.swr);
+		av_channel_layout_uninit(&oldest.layout);
+		vResamplers.erase(vResamplers.begin());
+	}
+	PooledResampler pooled;
+	pooled.layout = source.in_layout;
+	source.in_layout = AVChannelLayout();
+	pooled.format = source.in_format;
+	pooled.sample_rate = source.in_rate;
+	pooled.swr = source.swr;
+	source.swr = nullptr;
+	vResamplers.push_back(pooled);
+}
+
+bool AudioMixer::Open(Source& source, int64_t nAt)
+{
+	DecoderOptions options;
+	options.audio_only = true;
+	// many clips decode side by side; the mixer is the unit of parallelism
+	options.threads = 1;
+	source.decoder = new FFmpegDecoder(source.clip->path.c_str(), options);
+	if (!source.decoder->IsValid()) {
+		LOG(ERROR) << "Audio mixer: no audio in " << source.clip->path;
+		nOpenFailures++;
+		Close(source);
+		// leave the clip silent rather than retrying it every block
+		source.end = source.start;
+		return false;
+	}
+	int64_t nSourceMs = source.clip->in + av_rescale(nAt - source.start, 1000, nSampleRate);
+	// if the seek fails, decoding starts at the beginning and the trim covers the whole distance
+	if (nSourceMs > 0) {
+		source.decoder->SeekAudio(nSourceMs);
+	}
+	source.fifo = av_audio_fifo_alloc(AV_SAMPLE_FMT_FLTP, nChannels, kBlockSamples * 2);
+	// set from the first frame's timestamp in Convert()
+	source.trim = -1;
+	source.target = av_rescale(nSourceMs, nSampleRate, 1000);
+	source.next = nAt;
+	source.eof = false;
+	return source.fifo != nullptr;
+}
+
+void AudioMixer::Close(Source& source)
+{
+	ReleaseResampler(source);
+	av_channel_layout_uninit(&source.in_layout);
+	if (source.fifo) {
+		av_audio_fifo_free(source.fifo);
+		source.fifo = nullptr;
+	}
+	delete source.decoder;
+	source.decoder = nullptr;
+}
+
+int AudioMixer::Convert(Source& source, AVFrame* pFrame)
+{
+	if (pFrame && (!source.swr || pFrame->format != source.in_format || pFrame->sample_rate != source.in_rate
+		|| av_channel_layout_compare(&pFrame->ch_layout, &source.in_layout))) {
+		// first frame, or the stream changed format midway
+		ReleaseResampler(source);
+		av_channel_layout_uninit(&source.in_layout);
+		if (!(source.swr = AcquireResampler(pFrame))) {
+			return AVERROR(EINVAL);
+		}
+		av_channel_layout_copy(&source.in_layout, &pFrame->ch_layout);
+		source.in_format = (AVSampleFormat)pFrame->format;
+		source.in_rate = pFrame->sample_rate;
+	}
+	if (!source.swr) {
+		return 0;
+	}
+	if (pFrame && source.trim < 0) {
+		int64_t nFirst = source.decoder->GetAudioFrameTime(pFrame, AVRational{ 1, nSampleRate });
+		source.trim = nFirst != AV_NOPTS_VALUE ? std::max<int64_t>(0, source.target - nFirst) : 0;
+	}
+
+	// nullptr input drains what swresample still buffers
+	int nIn = pFrame ? pFrame->nb_samples : 0;
+	int nCap = swr_get_out_samples(source.swr, nIn);
+	if (nCap <= 0) {
+		return 0;
+	}
+	if ((int)vConvertBuffer.size() < nCap * nChannels) {
+		vConvertBuffer.resize((size_t)nCap * nChannels);
+	}
+	std::vector<float*> vOut(nChannels);
+	for (int c = 0; c < nChannels; c++) {
+		vOut[c] = vConvertBuffer.data() + (size_t)c * nCap;
+	}
+	int n = swr_convert(source.swr, (uint8_t**)vOut.data(), nCap,
+		pFrame ? (const uint8_t**)pFrame->extended_data : nullptr, nIn);
+	if (n < 0) {
+		LOG(ERROR) << "swr_convert failed " << n;
+		return n;
+	}
+	// samples before the clip's in point, decoded from the keyframe the seek landed on
+	int nSkip = (int)std::min<int64_t>(std::max<int64_t>(source.trim, 0), n);
+	source.trim -= nSkip;
+	if (n > nSkip) {
+		for (int c = 0; c < nChannels; c++) {
+			vOut[c] += nSkip;
+		}
+		if (av_audio_fifo_write(source.fifo, (void**)vOut.data(), n - nSkip) < n - nSkip) {
+			return AVERROR(ENOMEM);
+		}
+	}
+	return 0;
+}
+
+int AudioMixer::Fill(Source& source, int nSamples)
+{
+	while (av_audio_fifo_size(source.fifo) < nSamples && !source.eof) {
+		int ret = source.decoder->DecodeNextAudioFrame(frame);
+		if (ret == AVERROR_EOF) {
+			source.eof = true;
+			ret = Convert(source, nullptr);
+		} else if (ret == 0) {
+			ret = Convert(source, frame);
+			av_frame_unref(frame);
+		}
+		if (ret < 0) {
+			LOG(ERROR) << "Audio mixer: decoding " << source.clip->path << " failed " << ret;
+			source.eof = true;
+			return ret;
+		}
+	}
+	return 0;
+}
+
+void AudioMixer::GetGains(const TrackState& state, int64_t nSample, float* pGains)
+{
+	const std::vector<AudioEnvelopePoint>& vPoints = state.track.envelope;
+	float fGain = 1.0f, fPan = 0.0f;
+	if (!vPoints.empty()) {
+		int64_t nMs = av_rescale(nSample, 1000, nSampleRate);
+		auto it = std::upper_bound(vPoints.begin(), vPoints.end(), nMs,
+			[](int64_t t, const AudioEnvelopePoint& p) { return t < p.time; });
+		if (it == vPoints.begin()) {
+			fGain = it->gain;
+			fPan = it->pan;
+		} else if (it == vPoints.end()) {
+			fGain = vPoints.back().gain;
+			fPan = vPoints.back().pan;
+		} else {
+			const AudioEnvelopePoint& a = *(it - 1);
+			const AudioEnvelopePoint& b = *it;
+			// interpolate in samples, not milliseconds, so ramps are smooth within a millisecond
+			double t = (double)(nSample - av_rescale(a.time, nSampleRate, 1000))
+				/ std::max<int64_t>(1, av_rescale(b.time - a.time, nSampleRate, 1000));
+			t = std::min(1.0, std::max(0.0, t));
+			fGain = Lerp(a.gain, b.gain, t);
+			fPan = Lerp(a.pan, b.pan, t);
+		}
+	}
+	fGain *= state.track.gain;
+	fPan = std::min(1.0f, std::max(-1.0f, fPan + state.track.pan));
+
+	for (int c = 0; c < nChannels; c++) {
+		pGains[c] = fGain;
+	}
+	if (nChannels >= 2) {
+		// constant power pan law, normalized to unity at the center
+		const double kQuarterPi = 0.78539816339744831;
+		double theta = (fPan + 1.0) * kQuarterPi;
+		pGains[0] = (float)(fGain * std::cos(theta) * std::sqrt(2.0));
+		pGains[1] = (float)(fGain * std::sin(theta) * std::sqrt(2.0));
+	}
+}
+
+void AudioMixer::MixTrack(TrackState& state, int64_t nFrom, int nSamples, float* const* ppOut)
+{
+	int64_t nTo = nFrom + nSamples;
+	bool bAny = false;
+	for (Source& source : state.sources) {
+		if (source.end <= nFrom || source.start >= nTo) {
+			if (source.decoder && source.end <= nFrom) {
+				Close(source);
+			}
+			continue;
+		}
+		int64_t a = std::max(nFrom, source.start);
+		int64_t b = std::min(nTo, source.end);
+		if (source.decoder && source.next != a) {
+			// the playhead moved
+			Close(source);
+		}
+		if (!source.decoder && !Open(source, a)) {
+			continue;
+		}
+		if (!bAny) {
+			std::fill(vTrackBuffer.begin(), vTrackBuffer.end(), 0.0f);
+			bAny = true;
+		}
+		int nWant = (int)(b - a);
+		Fill(source, nWant);
+		int nOffset = (int)(a - nFrom);
+		std::vector<float*> vDst(nChannels);
+		for (int c = 0; c < nChannels; c++) {
+			vDst[c] = vTrackBuffer.data() + (size_t)c * kBlockSamples + nOffset;
+		}
+		int nRead = std::max(0, av_audio_fifo_read(source.fifo, (void**)vDst.data(), nWant));
+		source.next = a + nRead;
+		if (nRead < nWant && source.eof) {
+			// an open-ended clip ran out: its length is known now
+			source.end = source.next;
+		}
+	}
+	if (!bAny || state.track.mute) {
+		return;
+	}
+
+	// split the block at envelope points so every piece is a straight gain ramp
+	std::vector<int64_t> vCuts;
+	vCuts.push_back(nFrom);
+	for (const AudioEnvelopePoint& point : state.track.envelope) {
+		int64_t nAt = av_rescale(point.time, nSampleRate, 1000);
+		if (nAt > nFrom && nAt < nTo) {
+			vCuts.push_back(nAt);
+		}
+	}
+	vCuts.push_back(nTo);
+
+	std::vector<float> vGain0(nChannels), vGain1(nChannels);
+	GetGains(state, nFrom, vGain0.data());
+	for (size_t i = 1; i < vCuts.size(); i++) {
+		int nOffset = (int)(vCuts[i - 1] - nFrom);
+		int n = (int)(vCuts[i] - vCuts[i - 1]);
+		if (n <= 0) {
+			continue;
+		}
+		GetGains(state, vCuts[i], vGain1.data());
+		for (int c = 0; c < nChannels; c++) {
+			const float* pSrc = vTrackBuffer.data() + (size_t)c * kBlockSamples + nOffset;
+			kernels.MixRamp(pSrc, ppOut[c] + nOffset, n, vGain0[c], (vGain1[c] - vGain0[c]) / n);
+		}
+		vGain0.swap(vGain1);
+	}
+}
+
+int AudioMixer::Mix(float* const* ppOut, int nSamples)
+{
+	// the timeline ends with the last clip; clips whose end is not known yet keep it open
+	int64_t nEnd = 0;
+	for (const TrackState& state : vTracks) {
+		for (const Source& source : state.sources) {
+			nEnd = std::max(nEnd, source.end);
+		}
+	}
+	nSamples = (int)std::min<int64_t>(nSamples, std::max<int64_t>(0, nEnd - nPosition));
+	if (nSamples <= 0) {
+		return 0;
+	}
+
+	for (int nDone = 0; nDone < nSamples;) {
+		int n = std::min(kBlockSamples, nSamples - nDone);
+		std::vector<float*> vOut(nChannels);
+		for (int c = 0; c < nChannels; c++) {
+			vOut[c] = ppOut[c] + nDone;
+			std::fill(vOut[c], vOut[c] + n, 0.0f);
+		}
+		for (TrackState& state : vTracks) {
+			MixTrack(state, nPosition, n, vOut.data());
+		}
+		for (int c = 0; c < nChannels; c++) {
+			kernels.ClampUnit(vOut[c], n);
+		}
+		nPosition += n;
+		nDone += n;
+	}
+	return nSamples;
+}
+
+int AudioMixer::Encode(FFmpegAudioEncoder& encoder, double dUntil, std::vector<AVPacket*>& vPackets)
+{
+	if (bFlushed) {
+		return 0;
+	}
+	std::vector<float*> vBus(nChannels);
+	for (int c = 0; c < nChannels; c++) {
+		vBus[c] = vBusBuffer.data() + (size_t)c * kBlockSamples;
+	}
+	while (nPosition < dUntil * nSampleRate) {
+		int n = Mix(vBus.data(), kBlockSamples);
+		if (n < 0) {
+			return n;
+		}
+		if (n == 0) {
+			bFlushed = true;
+			return encoder.Encode(nullptr, 0, vPackets);
+		}
+		int ret = encoder.Encode(vBus.data(), n, vPackets);
+		if (ret < 0) {
+			return ret;
+		}
+	}
+	return 0;
+}
+
+void AudioMixer::SetPosition(int64_t nMs)
+{
+	// sources notice the jump on their next block and reopen at the new position
+	nPosition = av_rescale(nMs, nSampleRate, 1000);
+	bFlushed = false;
+}
@@ -0,0 +1,183 @@
+#pragma once
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavutil/audio_fifo.h>
+#include <libswresample/swresample.h>
+}
+
+#include <string>
+#include <vector>
+
+#include "utils.h"
+#include "ffmpeg_decoder.h"
+#include "ffmpeg_encoder.h"
+#include "simd_kernels.h"
+
+/**
+* @brief Gain and pan of a track at one point of the timeline; both are interpolated linearly
+* between points and held before the first and after the last
+*/
+struct AudioEnvelopePoint
+{
+	// milliseconds on the timeline
+	int64_t time = 0;
+	// linear gain, 1 = unity
+	float gain = 1.0f;
+	// -1 full left .. 1 full right
+	float pan = 0.0f;
+};
+
+/**
+* @brief The audio of one media file placed on a track
+*/
+struct AudioClip
+{
+	std::string path;
+	// milliseconds: position on the timeline, and where in the source the clip starts
+	int64_t start = 0;
+	int64_t in = 0;
+	// -1 plays to the end of the source
+	int64_t duration = -1;
+};
+
+struct AudioTrack
+{
+	// must not overlap
+	std::vector<AudioClip> clips;
+	// sorted by time; empty for a flat unity gain, centered track
+	std::vector<AudioEnvelopePoint> envelope;
+	// applied on top of the envelope
+	float gain = 1.0f;
+	float pan = 0.0f;
+	bool mute = false;
+};
+
+/**
+* @brief Mixes any number of tracks into planar float audio at the project rate.
+*
+* Every clip is decoded by an audio-only FFmpegDecoder of its own, opened when the playhead reaches
+* it and closed after it ends, and converted to the project rate and layout by swresample. Resamplers
+* are pooled by input format: a clip whose format matches one seen before reuses its context, and
+* swr_init keeps the filter bank when the parameters are unchanged, so only the state is reset.
+*
+* Mixing runs a block at a time. Each track's samples are scaled by its gain/pan envelope and
+* summed into the bus with the SIMD ramp kernel; envelope points inside a block split it, so gain
+* changes are sample accurate and free of zipper noise. The bus is hard clipped to [-1, 1].
+*/
+class AudioMixer
+{
+public:
+	AudioMixer(const std::vector<AudioTrack>& vTracks, int nSampleRate = 48000, int nChannels = 2);
+	AudioMixer(const AudioMixer&) = delete;
+	AudioMixer& operator=(const AudioMixer&) = delete;
+	~AudioMixer();
+
+	/**
+	* @brief Mixes the next nSamples samples into ppOut, one plane per channel. Returns the number
+	* of samples written, 0 once every clip has ended, or a negative error.
+	*/
+	int Mix(float* const* ppOut, int nSamples);
+	/**
+	* @brief Mixes up to dUntil seconds of timeline and encodes it into vPackets. Once the timeline
+	* ends, the encoder is flushed; later calls return no packets.
+	*/
+	int Encode(FFmpegAudioEncoder& encoder, double dUntil, std::vector<AVPacket*>& vPackets);
+	/**
+	* @brief Moves the playhead; clips are reopened and seeked as the next blocks reach them
+	*/
+	void SetPosition(int64_t nMs);
+
+	int64_t GetPosition() {
+		return nPosition;
+	}
+	int GetSampleRate() {
+		return nSampleRate;
+	}
+	int GetChannels() {
+		return nChannels;
+	}
+	/**
+	* @brief Resamplers created, and clips that reused a pooled one instead
+	*/
+	int GetResamplerCount() {
+		return nResamplers;
+	}
+	int GetResamplerReuses() {
+		return nResamplerReuses;
+	}
+	/**
+	* @brief Clips that could not be opened and were left silent
+	*/
+	int GetOpenFailures() {
+		return nOpenFailures;
+	}
+
+private:
+	// one clip of a track; decoder state exists only while the playhead is inside it
+	struct Source
+	{
+		const AudioClip* clip;
+		// timeline samples; end is INT64_MAX until the end of an open-ended clip has been decoded
+		int64_t start, end;
+		// timeline sample of the next sample read from fifo
+		int64_t next = 0;
+		FFmpegDecoder* decoder = nullptr;
+		SwrContext* swr = nullptr;
+		AVAudioFifo* fifo = nullptr;
+		// input format swr was set up for
+		AVChannelLayout in_layout = AVChannelLayout();
+		AVSampleFormat in_format = AV_SAMPLE_FMT_NONE;
+		int in_rate = 0;
+		// source position to start at, in output samples from the start of the stream
+		int64_t target = 0;
+		// output samples before target still to be dropped, -1 until the first frame
+		int64_t trim = -1;
+		bool eof = false;
+	};
+	struct TrackState
+	{
+		AudioTrack track;
+		std::vector<Source> sources;
+	};
+	struct PooledResampler
+	{
+		AVChannelLayout layout;
+		AVSampleFormat format;
+		int sample_rate;
+		SwrContext* swr;
+	};
+
+	bool Open(Source& source, int64_t nAt);
+	void Close(Source& source);
+	// fills source's fifo with at least nSamples samples unless the clip ends first
+	int Fill(Source& source, int nSamples);
+	int Convert(Source& source, AVFrame* pFrame);
+	// a pooled resampler for pFrame's format, or a new one
+	SwrContext* AcquireResampler(const AVFrame* pFrame);
+	// returns source's resampler to the pool
+	void ReleaseResampler(Source& source);
+	// gain of every channel at a timeline sample
+	void GetGains(const TrackState& state, int64_t nSample, float* pGains);
+	void MixTrack(TrackState& state, int64_t nFrom, int nSamples, float* const* ppOut);
+
+private:
+	std::vector<TrackState> vTracks;
+	int nSampleRate;
+	int nChannels;
+	AVChannelLayout layout;
+	int64_t nPosition = 0;
+	bool bFlushed = false;
+
+	std::vector<PooledResampler> vResamplers;
+	int nResamplers = 0;
+	int nResamplerReuses = 0;
+	int nOpenFailures = 0;
+
+	AVFrame* frame = nullptr;
+	// one block of one track, nChannels planes of kBlockSamples
+	std::vector<float> vTrackBuffer;
+	std::vector<float> vBusBuffer;
+	std::vector<float> vConvertBuffer;
+	const simd::AudioKernels& kernels;
+};
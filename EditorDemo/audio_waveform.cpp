@@ -0,0 +1,330 @@
+#include "audio_waveform.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+
+#include "simd_kernels.h"
+
+namespace {
+
+#pragma pack(push, 1)
+struct PyramidHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t media_size;
+	int64_t media_mtime;
+	int32_t sample_rate;
+	int32_t channels;
+	int32_t bucket_samples;
+	int32_t levels;
+	int64_t samples;
+};
+struct LevelEntry
+{
+	uint64_t offset;
+	int64_t buckets;
+};
+#pragma pack(pop)
+
+const uint32_t kPyramidMagic = MAKE_FOURCC('V', 'W', 'A', 'V');
+const uint32_t kPyramidVersion = 1;
+
+int16_t Quantize(float f) {
+	f = std::min(1.0f, std::max(-1.0f, f));
+	return (int16_t)lrintf(f * 32767.0f);
+}
+
+WaveformPeak Merge(const WaveformPeak& a, const WaveformPeak& b) {
+	WaveformPeak p;
+	p.min = std::min(a.min, b.min);
+	p.max = std::max(a.max, b.max);
+	// buckets of a level are the same length, so the mean square is the mean of the two
+	p.rms = (int16_t)lrintf(std::sqrt(((float)a.rms * a.rms + (float)b.rms * b.rms) * 0.5f));
+	return p;
+}
+
+/**
+* @brief Running min/max/sum of squares per channel for the level 0 bucket being filled
+*/
+class BucketAccumulator
+{
+public:
+	BucketAccumulator(int nChannels, int nBucketSamples, std::vector<WaveformPeak>& vOut)
+		: nChannels(nChannels), nBucketSamples(nBucketSamples), vOut(vOut),
+		vMin(nChannels), vMax(nChannels), vSumSq(nChannels), kernels(simd::GetAudioKernels()) {
+		Reset();
+	}
+
+	// ppPlanes: one float plane per channel
+	void Add(const float* const* ppPlanes, int nCount) {
+		int nDone = 0;
+		while (nDone < nCount) {
+			int n = std::min(nCount - nDone, nBucketSamples - nFill);
+			for (int c = 0; c < nChannels; c++) {
+				kernels.PeakReduce(ppPlanes[c] + nDone, n, &vMin[c], &vMax[c], &vSumSq[c]);
+			}
+			nFill += n;
+			nDone += n;
+			if (nFill == nBucketSamples) {
+				Emit();
+			}
+		}
+	}
+
+	void Finish() {
+		if (nFill) {
+			Emit();
+		}
+	}
+
+private:
+	void Emit() {
+		for (int c = 0; c < nChannels; c++) {
+			vOut.push_back({ Quantize(vMin[c]), Quantize(vMax[c]), Quantize(std::sqrt(vSumSq[c] / nFill)) });
+		}
+		Reset();
+	}
+	void Reset() {
+		std::fill(vMin.begin(), vMin.end(), 1.0f);
+		std::fill(vMax.begin(), vMax.end(), -1.0f);
+		std::fill(vSumSq.begin(), vSumSq.end(), 0.0f);
+		nFill = 0;
+	}
+
+private:
+	int nChannels, nBucketSamples;
+	std::vector<WaveformPeak>& vOut;
+	std::vector<float> vMin, vMax, vSumSq;
+	int nFill = 0;
+	const simd::AudioKernels& kernels;
+};
+
+}
+
+AudioWaveform::AudioWaveform(const char* szMediaPath, const WaveformOptions& options)
+{
+	std::string strPath = PyramidPath(szMediaPath);
+	if (Map(strPath.c_str(), szMediaPath)) {
+		return;
+	}
+	if (Build(szMediaPath, strPath.c_str(), options) < 0 || !Map(strPath.c_str(), szMediaPath)) {
+		LOG(ERROR) << "No waveform for " << szMediaPath;
+	}
+}
+
+AudioWaveform::~AudioWaveform()
+{
+	delete pReader;
+}
+
+int AudioWaveform::Build(const char* szMediaPath, const char* szPyramidPath, const WaveformOptions& options)
+{
+	StopWatch sw;
+	sw.Start();
+
+	DecoderOptions decoder_options;
+	decoder_options.audio_only = true;
+	FFmpegDecoder decoder(szMediaPath, decoder_options);
+	if (!decoder.IsValid()) {
+		LOG(ERROR) << szMediaPath << " has no decodable audio";
+		return AVERROR_STREAM_NOT_FOUND;
+	}
+	AVCodecContext* avctx = decoder.GetAudioContext();
+
+	// float planar at the source rate: the reductions read each channel contiguously
+	AVChannelLayout out_layout;
+	int nChannels = options.channels > 0 ? options.channels : avctx->ch_layout.nb_channels;
+	av_channel_layout_default(&out_layout, nChannels);
+	SwrContext* swr = nullptr;
+	int ret = swr_alloc_set_opts2(&swr, &out_layout, AV_SAMPLE_FMT_FLTP, avctx->sample_rate,
+		&avctx->ch_layout, avctx->sample_fmt, avctx->sample_rate, 0, nullptr);
+	if (ret < 0 || (ret = swr_init(swr)) < 0) {
+		LOG(ERROR) << "swr_init failed " << ret;
+		swr_free(&swr);
+		av_channel_layout_uninit(&out_layout);
+		return ret;
+	}
+
+	std::vector<WaveformPeak> vLevel0;
+	BucketAccumulator acc(nChannels, options.bucket_samples, vLevel0);
+	std::vector<std::vector<float>> vPlanes(nChannels);
+	std::vector<float*> vOut(nChannels);
+	int64_t nSamples = 0;
+
+	AVFrame* frame = av_frame_alloc();
+	for (;;) {
+		ret = decoder.DecodeNextAudioFrame(frame);
+		if (ret < 0 && ret != AVERROR_EOF) {
+			break;
+		}
+		bool bEof = ret == AVERROR_EOF;
+		// nullptr input drains what swresample still buffers
+		int nIn = bEof ? 0 : frame->nb_samples;
+		int nCap = swr_get_out_samples(swr, nIn);
+		for (int c = 0; c < nChannels; c++) {
+			if ((int)vPlanes[c].size() < nCap) {
+				vPlanes[c].resize(nCap);
+			}
+			vOut[c] = vPlanes[c].data();
+		}
+		int n = swr_convert(swr, (uint8_t**)vOut.data(), nCap,
+			bEof ? nullptr : (const uint8_t**)frame->extended_data, nIn);
+		av_frame_unref(frame);
+		if (n < 0) {
+			ret = n;
+			break;
+		}
+		acc.Add(vOut.data(), n);
+		nSamples += n;
+		if (bEof) {
+			ret = 0;
+			break;
+		}
+	}
+	av_frame_free(&frame);
+	swr_free(&swr);
+	av_channel_layout_uninit(&out_layout);
+	if (ret < 0) {
+		LOG(ERROR) << "Audio decode failed for " << szMediaPath << ": " << ret;
+		return ret;
+	}
+	acc.Finish();
+
+	// coarser levels by pairwise merging, down to a single bucket
+	std::vector<std::vector<WaveformPeak>> vLevels(1);
+	vLevels[0].swap(vLevel0);
+	while (vLevels.back().size() > (size_t)nChannels) {
+		const std::vector<WaveformPeak>& vFine = vLevels.back();
+		int64_t nFine = vFine.size() / nChannels;
+		std::vector<WaveformPeak> vCoarse;
+		vCoarse.reserve((nFine + 1) / 2 * nChannels);
+		for (int64_t b = 0; b < nFine; b += 2) {
+			for (int c = 0; c < nChannels; c++) {
+				const WaveformPeak& a = vFine[b * nChannels + c];
+				vCoarse.push_back(b + 1 < nFine ? Merge(a, vFine[(b + 1) * nChannels + c]) : a);
+			}
+		}
+		vLevels.push_back(std::move(vCoarse));
+	}
+
+	PyramidHeader header = { kPyramidMagic, kPyramidVersion };
+	if (!PacketIndex::GetMediaIdentity(szMediaPath, &header.media_size, &header.media_mtime)) {
+		return AVERROR(ENOENT);
+	}
+	header.sample_rate = avctx->sample_rate;
+	header.channels = nChannels;
+	header.bucket_samples = options.bucket_samples;
+	header.levels = (int32_t)vLevels.size();
+	header.samples = nSamples;
+
+	std::ofstream file(szPyramidPath, std::ios::binary | std::ios::trunc);
+	file.write((const char*)&header, sizeof(header));
+	uint64_t nOffset = sizeof(header) + sizeof(LevelEntry) * vLevels.size();
+	for (const std::vector<WaveformPeak>& v : vLevels) {
+		LevelEntry e = { nOffset, (int64_t)(v.size() / nChannels) };
+		file.write((const char*)&e, sizeof(e));
+		nOffset += v.size() * sizeof(WaveformPeak);
+	}
+	for (const std::vector<WaveformPeak>& v : vLevels) {
+		file.write((const char*)v.data(), v.size() * sizeof(WaveformPeak));
+	}
+	if (!file) {
+		LOG(ERROR) << "Cannot write " << szPyramidPath;
+		return AVERROR(EIO);
+	}
+	LOG(INFO) << "Waveform of " << szMediaPath << ": " << nSamples << " samples, " << vLevels.size()
+		<< " levels in " << sw.Stop() << "s";
+	return 0;
+}
+
+bool AudioWaveform::Map(const char* szPyramidPath, const char* szMediaPath)
+{
+	uint64_t nMediaSize;
+	int64_t nMediaMtime;
+	if (!PacketIndex::GetMediaIdentity(szMediaPath, &nMediaSize, &nMediaMtime)) {
+		return false;
+	}
+
+	delete pReader;
+	pReader = new BufferedFileReader(szPyramidPath);
+	vLevels.clear();
+	uint8_t* pBuf;
+	uint64_t nSize;
+	if (!pReader->GetBuffer(&pBuf, &nSize) || nSize < sizeof(PyramidHeader)) {
+		return false;
+	}
+	const PyramidHeader* header = (const PyramidHeader*)pBuf;
+	if (header->magic != kPyramidMagic || header->version != kPyramidVersion
+		|| header->media_size != nMediaSize || header->media_mtime != nMediaMtime
+		|| header->channels <= 0 || header->levels <= 0
+		|| nSize < sizeof(PyramidHeader) + sizeof(LevelEntry) * (uint64_t)header->levels) {
+		return false;
+	}
+
+	const LevelEntry* pEntries = (const LevelEntry*)(pBuf + sizeof(PyramidHeader));
+	for (int i = 0; i < header->levels; i++) {
+		uint64_t nBytes = (uint64_t)pEntries[i].buckets * header->channels * sizeof(WaveformPeak);
+		if (pEntries[i].offset + nBytes > nSize) {
+			vLevels.clear();
+			return false;
+		}
+		vLevels.push_back({ (const WaveformPeak*)(pBuf + pEntries[i].offset), pEntries[i].buckets });
+	}
+	nSampleRate = header->sample_rate;
+	nChannels = header->channels;
+	nBucketSamples = header->bucket_samples;
+	nSamples = header->samples;
+	return true;
+}
+
+const WaveformPeak* AudioWaveform::GetLevel(int nLevel, int64_t* pnBuckets)
+{
+	if (nLevel < 0 || nLevel >= (int)vLevels.size()) {
+		*pnBuckets = 0;
+		return nullptr;
+	}
+	*pnBuckets = vLevels[nLevel].nBuckets;
+	return vLevels[nLevel].pPeaks;
+}
+
+void AudioWaveform::Render(int nChannel, int64_t nStartSample, double dSamplesPerPixel, int nPixels, WaveformPeak* pPeaks)
+{
+	const WaveformPeak silence = { 0, 0, 0 };
+	if (!IsValid() || nChannel < 0 || nChannel >= nChannels || dSamplesPerPixel <= 0.0) {
+		std::fill(pPeaks, pPeaks + nPixels, silence);
+		return;
+	}
+
+	// coarsest level whose buckets still fit in a pixel: at most two or three buckets per pixel
+	int nLevel = 0;
+	while (nLevel + 1 < (int)vLevels.size() && GetBucketSamples(nLevel + 1) <= dSamplesPerPixel) {
+		nLevel++;
+	}
+	const Level& level = vLevels[nLevel];
+	int64_t nBucket = GetBucketSamples(nLevel);
+
+	for (int i = 0; i < nPixels; i++) {
+		int64_t s0 = nStartSample + (int64_t)(i * dSamplesPerPixel);
+		int64_t s1 = nStartSample + (int64_t)((i + 1) * dSamplesPerPixel);
+		int64_t b0 = s0 / nBucket, b1 = std::max(b0 + 1, (s1 + nBucket - 1) / nBucket);
+		b0 = std::max<int64_t>(b0, 0);
+		b1 = std::min(b1, level.nBuckets);
+		if (b0 >= b1) {
+			pPeaks[i] = silence;
+			continue;
+		}
+		// the rms of a pixel is the mean square over its buckets
+		WaveformPeak p = level.pPeaks[b0 * nChannels + nChannel];
+		float fSumSq = (float)p.rms * p.rms;
+		for (int64_t b = b0 + 1; b < b1; b++) {
+			const WaveformPeak& q = level.pPeaks[b * nChannels + nChannel];
+			p.min = std::min(p.min, q.min);
+			p.max = std::max(p.max, q.max);
+			fSumSq += (float)q.rms * q.rms;
+		}
+		p.rms = (int16_t)lrintf(std::sqrt(fSumSq / (b1 - b0)));
+		pPeaks[i] = p;
+	}
+}
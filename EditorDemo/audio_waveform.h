@@ -0,0 +1,106 @@
+#pragma once
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libswresample/swresample.h>
+}
+
+#include <string>
+#include <vector>
+
+#include "utils.h"
+#include "ffmpeg_decoder.h"
+
+#pragma pack(push, 1)
+/**
+* @brief One waveform bucket of one channel, full scale = 32767
+*/
+struct WaveformPeak
+{
+	int16_t min;
+	int16_t max;
+	int16_t rms;
+};
+#pragma pack(pop)
+
+struct WaveformOptions
+{
+	// 0 keeps the source channels, 1 mixes down to mono, 2 to stereo
+	int channels = 0;
+	// samples per bucket at the finest level
+	int bucket_samples = 256;
+};
+
+/**
+* @brief Min/max/RMS peak pyramid of an audio stream. Level 0 holds one WaveformPeak per channel
+* for every bucket_samples samples, each further level halves the bucket count, so any zoom is
+* drawn from a level with one or two buckets per pixel.
+*
+* The pyramid is built in a single decode pass and stored in a memory-mappable file:
+* header, level table, then the levels back to back with channels interleaved per bucket.
+*/
+class AudioWaveform
+{
+public:
+	/**
+	* @brief Maps the pyramid file for szMediaPath, building it first if it is missing or stale
+	*/
+	AudioWaveform(const char* szMediaPath, const WaveformOptions& options = WaveformOptions());
+	AudioWaveform(const AudioWaveform&) = delete;
+	AudioWaveform& operator=(const AudioWaveform&) = delete;
+	~AudioWaveform();
+
+	/**
+	* @brief Decodes the audio of szMediaPath once and writes its pyramid to szPyramidPath
+	*/
+	static int Build(const char* szMediaPath, const char* szPyramidPath, const WaveformOptions& options = WaveformOptions());
+	static std::string PyramidPath(const char* szMediaPath) {
+		return std::string(szMediaPath) + ".peaks";
+	}
+
+	bool IsValid() {
+		return !vLevels.empty();
+	}
+	int GetSampleRate() {
+		return nSampleRate;
+	}
+	int GetChannels() {
+		return nChannels;
+	}
+	int64_t GetSampleCount() {
+		return nSamples;
+	}
+	int GetLevelCount() {
+		return (int)vLevels.size();
+	}
+	int64_t GetBucketSamples(int nLevel) {
+		return (int64_t)nBucketSamples << nLevel;
+	}
+	/**
+	* @brief Buckets of a level, channels interleaved; points into the mapping
+	*/
+	const WaveformPeak* GetLevel(int nLevel, int64_t* pnBuckets);
+
+	/**
+	* @brief Fills pPeaks with nPixels peaks of nChannel, pixel i covering the samples
+	* [nStartSample + i * dSamplesPerPixel, nStartSample + (i + 1) * dSamplesPerPixel).
+	* Cost depends on nPixels only. Below bucket_samples per pixel, buckets repeat across pixels.
+	*/
+	void Render(int nChannel, int64_t nStartSample, double dSamplesPerPixel, int nPixels, WaveformPeak* pPeaks);
+
+private:
+	struct Level {
+		const WaveformPeak* pPeaks;
+		int64_t nBuckets;
+	};
+
+	bool Map(const char* szPyramidPath, const char* szMediaPath);
+
+private:
+	BufferedFileReader* pReader = nullptr;
+	std::vector<Level> vLevels;
+	int nSampleRate = 0;
+	int nChannels = 0;
+	int nBucketSamples = 0;
+	int64_t nSamples = 0;
+};
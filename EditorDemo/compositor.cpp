@@ -0,0 +1,296 @@
+#include "compositor.h"
+
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+
+#include <opencv2/core.hpp>
+
+namespace {
+
+bool IsPlanarYuv(const AVPixFmtDescriptor* desc) {
+	return desc && (desc->flags & AV_PIX_FMT_FLAG_PLANAR) && !(desc->flags & (AV_PIX_FMT_FLAG_RGB | AV_PIX_FMT_FLAG_BE))
+		&& desc->nb_components >= 3;
+}
+
+/**
+* @brief The planar YUV format with the same subsampling and depth as desc plus an alpha plane
+*/
+AVPixelFormat FindAlphaFormat(const AVPixFmtDescriptor* desc) {
+	for (const AVPixFmtDescriptor* d = av_pix_fmt_desc_next(nullptr); d; d = av_pix_fmt_desc_next(d)) {
+		if (IsPlanarYuv(d) && d->nb_components == 4 && (d->flags & AV_PIX_FMT_FLAG_ALPHA)
+			&& d->log2_chroma_w == desc->log2_chroma_w && d->log2_chroma_h == desc->log2_chroma_h
+			&& d->comp[0].depth == desc->comp[0].depth && d->comp[3].plane == 3) {
+			return av_pix_fmt_desc_get_id(d);
+		}
+	}
+	return AV_PIX_FMT_NONE;
+}
+
+}
+
+Compositor::Compositor(int nWidth, int nHeight, AVPixelFormat eFormat)
+	: nWidth(nWidth), nHeight(nHeight), eFormat(eFormat), kernels(simd::GetBlendKernels())
+{
+	const AVPixFmtDescriptor* d = av_pix_fmt_desc_get(eFormat);
+	if (!IsPlanarYuv(d) || (d->flags & AV_PIX_FMT_FLAG_ALPHA) || d->comp[0].depth < 8 || d->comp[0].depth > 12) {
+		LOG(ERROR) << "Compositor: unsupported canvas format " << av_get_pix_fmt_name(eFormat);
+		return;
+	}
+	desc = d;
+	nDepth = d->comp[0].depth;
+	nShiftX = d->log2_chroma_w;
+	nShiftY = d->log2_chroma_h;
+	eAlphaFormat = FindAlphaFormat(d);
+	SetBandRows(nBandRows);
+}
+
+Compositor::~Compositor()
+{
+	for (Scaler& scaler : vScalers) {
+		sws_freeContext(scaler.sws);
+		av_frame_free(&scaler.frame);
+	}
+}
+
+void Compositor::SetBandRows(int nRows)
+{
+	int nAlign = 1 << nShiftY;
+	nBandRows = std::max(nAlign, (nRows + nAlign - 1) / nAlign * nAlign);
+}
+
+bool Compositor::Prepare(const CompositorLayer& layer, size_t nIndex, Prepared& prepared)
+{
+	const AVFrame* frame = layer.frame;
+	int nOpacity = (int)lrintf(std::min(1.0f, std::max(0.0f, layer.opacity)) * 256.0f);
+	if (!frame || !frame->data[0] || nOpacity == 0) {
+		return false;
+	}
+	int nAlignX = (1 << nShiftX) - 1, nAlignY = (1 << nShiftY) - 1;
+	// chroma samples cover whole blocks of luma, so rectangles snap to the chroma grid
+	int x = layer.x & ~nAlignX, y = layer.y & ~nAlignY;
+	int w = layer.width > 0 ? layer.width : frame->width;
+	int h = layer.height > 0 ? layer.height : frame->height;
+
+	AVPixelFormat eLayerFormat = (AVPixelFormat)frame->format;
+	if ((eLayerFormat == eFormat || (eLayerFormat == eAlphaFormat && eAlphaFormat != AV_PIX_FMT_NONE))
+		&& w == frame->width && h == frame->height) {
+		prepared.frame = frame;
+		prepared.alpha = eLayerFormat == eAlphaFormat;
+	} else {
+		const AVPixFmtDescriptor* layer_desc = av_pix_fmt_desc_get(eLayerFormat);
+		bool bAlpha = layer_desc && (layer_desc->flags & AV_PIX_FMT_FLAG_ALPHA) && eAlphaFormat != AV_PIX_FMT_NONE;
+		AVPixelFormat eTarget = bAlpha ? eAlphaFormat : eFormat;
+		w = (w + nAlignX) & ~nAlignX;
+		h = (h + nAlignY) & ~nAlignY;
+		if (vScalers.size() <= nIndex) {
+			vScalers.resize(nIndex + 1);
+		}
+		Scaler& scaler = vScalers[nIndex];
+		if (!scaler.frame) {
+			scaler.frame = av_frame_alloc();
+		}
+		if (scaler.frame->width != w || scaler.frame->height != h || scaler.frame->format != eTarget) {
+			av_frame_unref(scaler.frame);
+			scaler.frame->width = w;
+			scaler.frame->height = h;
+			scaler.frame->format = eTarget;
+			if (av_frame_get_buffer(scaler.frame, 0) < 0) {
+				LOG(ERROR) << "Compositor: cannot allocate a " << w << "x" << h << " layer";
+				return false;
+			}
+		}
+		scaler.sws = sws_getCachedContext(scaler.sws, frame->width, frame->height, eLayerFormat,
+			w, h, eTarget, SWS_BILINEAR, nullptr, nullptr, nullptr);
+		if (!scaler.sws) {
+			LOG(ERROR) << "Compositor: cannot convert layer from " << av_get_pix_fmt_name(eLayerFormat);
+			return false;
+		}
+		sws_scale(scaler.sws, frame->data, frame->linesize, 0, frame->height, scaler.frame->data, scaler.frame->linesize);
+		prepared.frame = scaler.frame;
+		prepared.alpha = bAlpha;
+	}
+
+	int x0 = std::max(x, 0), y0 = std::max(y, 0);
+	int x1 = std::min(x + w, nWidth), y1 = std::min(y + h, nHeight);
+	if (x1 <= x0 || y1 <= y0) {
+		return false;
+	}
+	prepared.x = x0;
+	prepared.y = y0;
+	prepared.width = x1 - x0;
+	prepared.height = y1 - y0;
+	prepared.src_x = x0 - x;
+	prepared.src_y = y0 - y;
+	prepared.opacity = nOpacity;
+	prepared.mode = layer.mode;
+	return true;
+}
+
+void Compositor::Clear(AVFrame* out, int y0, int y1)
+{
+	bool bFull = out->color_range == AVCOL_RANGE_JPEG;
+	int nBlack = bFull ? 0 : 16 << (nDepth - 8);
+	for (int p = 0; p < 3; p++) {
+		int r0 = p ? y0 >> nShiftY : y0;
+		int r1 = p ? -((-y1) >> nShiftY) : y1;
+		int w = p ? -((-nWidth) >> nShiftX) : nWidth;
+		int nValue = p ? 1 << (nDepth - 1) : nBlack;
+		for (int r = r0; r < r1; r++) {
+			uint8_t* pRow = out->data[p] + (size_t)r * out->linesize[p];
+			if (nDepth == 8) {
+				memset(pRow, nValue, w);
+			} else {
+				std::fill((uint16_t*)pRow, (uint16_t*)pRow + w, (uint16_t)nValue);
+			}
+		}
+	}
+}
+
+template<typename T>
+void Compositor::BlendRows(const Prepared& layer, AVFrame* out, int nPlane, int r0, int r1, std::vector<uint16_t>& vScratch)
+{
+	int sx = nPlane ? nShiftX : 0, sy = nPlane ? nShiftY : 0;
+	// layer rectangle in this plane's samples; right and bottom edges round up like the plane size
+	int cx = layer.x >> sx;
+	int cw = -((-(layer.x + layer.width)) >> sx) - cx;
+	int cy = layer.y >> sy;
+	int src_x = layer.src_x >> sx, src_y = layer.src_y >> sy;
+	const AVFrame* frame = layer.frame;
+
+	// vScratch holds two canvas-wide rows
+	T* pAlphaRow = (T*)vScratch.data();
+	T* pModeRow = pAlphaRow + nWidth;
+	bool bFull = out->color_range == AVCOL_RANGE_JPEG;
+	int nBlack = bFull ? 0 : 16 << (nDepth - 8);
+	int nWhite = bFull ? (1 << nDepth) - 1 : 235 << (nDepth - 8);
+
+	for (int r = r0; r < r1; r++) {
+		int sr = r - cy + src_y;
+		const T* pSrc = (const T*)(frame->data[nPlane] + (size_t)sr * frame->linesize[nPlane]) + src_x;
+		T* pDst = (T*)(out->data[nPlane] + (size_t)r * out->linesize[nPlane]) + cx;
+
+		const T* pAlpha = nullptr;
+		if (layer.alpha) {
+			if (!sx && !sy) {
+				pAlpha = (const T*)(frame->data[3] + (size_t)sr * frame->linesize[3]) + src_x;
+			} else {
+				// the alpha plane is full resolution: average it over each chroma sample's block
+				int nRows = 1 << sy, nCols = 1 << sx;
+				int ar0 = sr << sy, ar1 = std::min(ar0 + nRows, frame->height);
+				for (int i = 0; i < cw; i++) {
+					int ac0 = (src_x + i) << sx, ac1 = std::min(ac0 + nCols, frame->width);
+					int nSum = 0, nCount = 0;
+					for (int ar = ar0; ar < ar1; ar++) {
+						const T* pA = (const T*)(frame->data[3] + (size_t)ar * frame->linesize[3]);
+						for (int ac = ac0; ac < ac1; ac++) {
+							nSum += pA[ac];
+							nCount++;
+						}
+					}
+					pAlphaRow[i] = (T)(nCount ? (nSum + nCount / 2) / nCount : 0);
+				}
+				pAlpha = pAlphaRow;
+			}
+		}
+		if (nPlane == 0 && layer.mode != simd::BLEND_NORMAL) {
+			if (sizeof(T) == 1) {
+				kernels.Mode8((const uint8_t*)pSrc, (const uint8_t*)pDst, (uint8_t*)pModeRow, cw, layer.mode, nBlack, nWhite);
+			} else {
+				kernels.Mode16((const uint16_t*)pSrc, (const uint16_t*)pDst, (uint16_t*)pModeRow, cw, layer.mode, nBlack, nWhite);
+			}
+			pSrc = pModeRow;
+		}
+		if (sizeof(T) == 1) {
+			kernels.Blend8((const uint8_t*)pSrc, (const uint8_t*)pAlpha, (uint8_t*)pDst, cw, layer.opacity);
+		} else {
+			kernels.Blend16((const uint16_t*)pSrc, (const uint16_t*)pAlpha, (uint16_t*)pDst, cw, layer.opacity, nDepth);
+		}
+	}
+}
+
+void Compositor::BlendBand(const Prepared& layer, AVFrame* out, int y0, int y1, std::vector<uint16_t>& vScratch)
+{
+	int ly0 = std::max(y0, layer.y), ly1 = std::min(y1, layer.y + layer.height);
+	if (ly1 <= ly0) {
+		return;
+	}
+	for (int p = 0; p < 3; p++) {
+		// bands and layers both start on the chroma grid, so chroma rows split the same way
+		int r0 = p ? ly0 >> nShiftY : ly0;
+		int r1 = p ? -((-ly1) >> nShiftY) : ly1;
+		if (nDepth == 8) {
+			BlendRows<uint8_t>(layer, out, p, r0, r1, vScratch);
+		} else {
+			BlendRows<uint16_t>(layer, out, p, r0, r1, vScratch);
+		}
+	}
+}
+
+int Compositor::Composite(const std::vector<CompositorLayer>& vLayers, AVFrame* out)
+{
+	if (!IsValid()) {
+		return AVERROR(EINVAL);
+	}
+	int ret;
+	if (!out->buf[0] || out->format != eFormat || out->width != nWidth || out->height != nHeight) {
+		av_frame_unref(out);
+		out->format = eFormat;
+		out->width = nWidth;
+		out->height = nHeight;
+		ret = av_frame_get_buffer(out, 0);
+	} else {
+		ret = av_frame_make_writable(out);
+	}
+	if (ret < 0) {
+		LOG(ERROR) << "Compositor: cannot allocate the canvas " << ret;
+		return ret;
+	}
+	// the canvas takes the bottom layer's range, which also decides the blend modes' black and white
+	out->color_range = !vLayers.empty() && vLayers[0].frame ? vLayers[0].frame->color_range : AVCOL_RANGE_MPEG;
+
+	std::vector<Prepared> vPrepared;
+	for (size_t i = 0; i < vLayers.size(); i++) {
+		Prepared prepared;
+		if (Prepare(vLayers[i], i, prepared)) {
+			vPrepared.push_back(prepared);
+		}
+	}
+	// an opaque full-canvas bottom layer is copied rather than blended over black
+	bool bCopyBase = !vPrepared.empty() && !vPrepared[0].alpha && vPrepared[0].opacity == 256
+		&& vPrepared[0].mode == simd::BLEND_NORMAL && vPrepared[0].x == 0 && vPrepared[0].y == 0
+		&& vPrepared[0].width == nWidth && vPrepared[0].height == nHeight;
+
+	int nBands = (nHeight + nBandRows - 1) / nBandRows;
+	size_t nBytesPerSample = nDepth == 8 ? 1 : 2;
+	TaskScheduler::Global().ParallelFor(nBands, [&](int nBegin, int nEnd) {
+		// alpha and blend mode rows for BlendRows
+		std::vector<uint16_t> vScratch((size_t)nWidth * 2);
+		for (int b = nBegin; b < nEnd; b++) {
+			int y0 = b * nBandRows, y1 = std::min(nHeight, y0 + nBandRows);
+			size_t nFirst = 0;
+			if (bCopyBase) {
+				const Prepared& base = vPrepared[0];
+				for (int p = 0; p < 3; p++) {
+					int r0 = p ? y0 >> nShiftY : y0;
+					int r1 = p ? -((-y1) >> nShiftY) : y1;
+					int w = p ? -((-nWidth) >> nShiftX) : nWidth;
+					int src_y = p ? base.src_y >> nShiftY : base.src_y;
+					int src_x = p ? base.src_x >> nShiftX : base.src_x;
+					for (int r = r0; r < r1; r++) {
+						memcpy(out->data[p] + (size_t)r * out->linesize[p],
+							base.frame->data[p] + (size_t)(r + src_y) * base.frame->linesize[p] + src_x * nBytesPerSample,
+							w * nBytesPerSample);
+					}
+				}
+				nFirst = 1;
+			} else {
+				Clear(out, y0, y1);
+			}
+			for (size_t i = nFirst; i < vPrepared.size(); i++) {
+				BlendBand(vPrepared[i], out, y0, y1, vScratch);
+			}
+		}
+	});
+	return 0;
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+extern "C" {
+#include <libavutil/frame.h>
+#include <libavutil/pixdesc.h>
+#include <libswscale/swscale.h>
+}
+
+#include <vector>
+
+#include "utils.h"
+#include "simd_kernels.h"
+#include "task_scheduler.h"
+
+/**
+* @brief One layer of a composition. The frame is planar YUV in the canvas' format or any other
+* swscale understands; formats with an alpha plane (yuva420p, yuva444p10, ...) blend per pixel.
+*/
+struct CompositorLayer
+{
+	const AVFrame* frame = nullptr;
+	// destination rectangle on the canvas; width/height 0 keep the frame's size. Positions are
+	// rounded down to the chroma grid and the part outside the canvas is cropped.
+	int x = 0, y = 0;
+	int width = 0, height = 0;
+	// 0..1, multiplied with the layer's alpha plane if it has one
+	float opacity = 1.0f;
+	simd::BlendMode mode = simd::BLEND_NORMAL;
+};
+
+/**
+* @brief Stacks video layers bottom to top onto a planar YUV canvas without leaving YUV: layers are
+* blended plane by plane with the SIMD kernels of simd::BlendKernels, in bands of rows run in
+* parallel on TaskScheduler::Global(). The canvas is any 8 to 12-bit planar 4:2:0, 4:2:2 or 4:4:4
+* format, i.e. everything FFmpegDecoder::GetChromaFormat() reports.
+*
+* A layer whose size and format already match its rectangle is read in place. Others (scaled
+* picture-in-picture, titles rendered in another format) go through swscale once per frame into a
+* per-layer buffer, converting to the canvas format plus an alpha plane when the layer has one.
+* Blend modes other than normal combine luma only; chroma is always alpha blended, which keeps
+* the colour of the top layer the way editors working in YUV do.
+*/
+class Compositor
+{
+public:
+	Compositor(int nWidth, int nHeight, AVPixelFormat eFormat);
+	Compositor(const Compositor&) = delete;
+	Compositor& operator=(const Compositor&) = delete;
+	~Compositor();
+
+	bool IsValid() {
+		return desc != nullptr;
+	}
+	/**
+	* @brief Composites vLayers, the first at the bottom, into out. out receives a new canvas buffer
+	* unless it already holds a writable one of the right size and format. Uncovered areas are black.
+	*/
+	int Composite(const std::vector<CompositorLayer>& vLayers, AVFrame* out);
+
+	/**
+	* @brief Rows per band handed to one thread; a multiple of the vertical chroma subsampling
+	*/
+	void SetBandRows(int nRows);
+
+private:
+	// a layer converted to what the blend kernels read
+	struct Prepared
+	{
+		const AVFrame* frame;
+		// true when frame carries an alpha plane at data[3]
+		bool alpha;
+		// destination rectangle after cropping, and the offset into frame it starts at
+		int x, y, width, height;
+		int src_x, src_y;
+		int opacity;
+		simd::BlendMode mode;
+	};
+	struct Scaler
+	{
+		SwsContext* sws = nullptr;
+		AVFrame* frame = nullptr;
+	};
+
+	bool Prepare(const CompositorLayer& layer, size_t nIndex, Prepared& prepared);
+	void Clear(AVFrame* out, int y0, int y1);
+	void BlendBand(const Prepared& layer, AVFrame* out, int y0, int y1, std::vector<uint16_t>& vScratch);
+	template<typename T>
+	void BlendRows(const Prepared& layer, AVFrame* out, int nPlane, int r0, int r1, std::vector<uint16_t>& vScratch);
+
+private:
+	int nWidth, nHeight;
+	AVPixelFormat eFormat;
+	// the same layout with an alpha plane, AV_PIX_FMT_NONE if FFmpeg has none
+	AVPixelFormat eAlphaFormat = AV_PIX_FMT_NONE;
+	const AVPixFmtDescriptor* desc = nullptr;
+	int nDepth = 8;
+	int nShiftX = 0, nShiftY = 0;
+	int nBandRows = 64;
+	std::vector<Scaler> vScalers;
+	const simd::BlendKernels& kernels;
+};
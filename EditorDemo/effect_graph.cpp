@@ -0,0 +1,376 @@
+#include "effect_graph.h"
+
+extern "C" {
+#include <libavutil/pixdesc.h>
+}
+
+#include <math.h>
+#include <opencv2/imgproc.hpp>
+
+namespace {
+
+uint64_t Mix(uint64_t h, uint64_t v) {
+	// splitmix64 finalizer over the running hash
+	h ^= v + 0x9E3779B97F4A7C15ULL + (h << 6) + (h >> 2);
+	h ^= h >> 30;
+	h *= 0xBF58476D1CE4E5B9ULL;
+	h ^= h >> 27;
+	h *= 0x94D049BB133111EBULL;
+	return h ^ (h >> 31);
+}
+
+/**
+* @brief Makes m a private buffer shaped like like. Planes still shared with another node's output,
+* or wrapping memory the graph does not own, are swapped for a fresh allocation instead of overwritten.
+*/
+void PrepareWrite(cv::Mat& m, const cv::Mat& like) {
+	if (!m.u || m.u->refcount > 1) {
+		m.release();
+	}
+	m.create(like.size(), like.type());
+}
+
+/**
+* @brief Passes a plane through unchanged: shares graph-owned buffers, copies external ones
+*/
+void PassThrough(cv::Mat& m, const cv::Mat& src) {
+	if (src.u) {
+		m = src;
+	} else {
+		PrepareWrite(m, src);
+		src.copyTo(m);
+	}
+}
+
+int ClampValue(double v, int nMax) {
+	return v <= 0.0 ? 0 : v >= nMax ? nMax : (int)(v + 0.5);
+}
+
+void IdentityLut(int nDepth, std::vector<uint16_t>& vLut) {
+	vLut.resize((size_t)1 << nDepth);
+	for (size_t i = 0; i < vLut.size(); i++) {
+		vLut[i] = (uint16_t)i;
+	}
+}
+
+}
+
+bool YuvPlanes::Wrap(const AVFrame* frame)
+{
+	const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get((AVPixelFormat)frame->format);
+	if (!desc || !(desc->flags & AV_PIX_FMT_FLAG_PLANAR) || (desc->flags & (AV_PIX_FMT_FLAG_RGB | AV_PIX_FMT_FLAG_BE))
+		|| desc->nb_components < 3 || desc->comp[1].plane == desc->comp[2].plane) {
+		return false;
+	}
+	depth = desc->comp[0].depth;
+	int type = depth > 8 ? CV_16UC1 : CV_8UC1;
+	for (int p = 0; p < 3; p++) {
+		int w = p ? AV_CEIL_RSHIFT(frame->width, desc->log2_chroma_w) : frame->width;
+		int h = p ? AV_CEIL_RSHIFT(frame->height, desc->log2_chroma_h) : frame->height;
+		plane[p] = cv::Mat(h, w, type, frame->data[p], frame->linesize[p]);
+	}
+	return true;
+}
+
+void YuvPlanes::CreateLike(const YuvPlanes& other)
+{
+	depth = other.depth;
+	for (int p = 0; p < 3; p++) {
+		PrepareWrite(plane[p], other.plane[p]);
+	}
+}
+
+void BrightnessContrastNode::BuildLut(int nPlane, int nDepth, std::vector<uint16_t>& vLut) const
+{
+	IdentityLut(nDepth, vLut);
+	if (nPlane != 0) {
+		return;
+	}
+	int nMax = (1 << nDepth) - 1;
+	double dMid = (double)(1 << (nDepth - 1));
+	for (size_t i = 0; i < vLut.size(); i++) {
+		vLut[i] = (uint16_t)ClampValue((i - dMid) * fContrast + dMid + fBrightness * nMax, nMax);
+	}
+}
+
+void SaturationNode::BuildLut(int nPlane, int nDepth, std::vector<uint16_t>& vLut) const
+{
+	IdentityLut(nDepth, vLut);
+	if (nPlane == 0) {
+		return;
+	}
+	int nMax = (1 << nDepth) - 1;
+	double dMid = (double)(1 << (nDepth - 1));
+	for (size_t i = 0; i < vLut.size(); i++) {
+		vLut[i] = (uint16_t)ClampValue((i - dMid) * fSaturation + dMid, nMax);
+	}
+}
+
+void GammaNode::BuildLut(int nPlane, int nDepth, std::vector<uint16_t>& vLut) const
+{
+	IdentityLut(nDepth, vLut);
+	if (nPlane != 0 || fGamma <= 0.0f) {
+		return;
+	}
+	int nMax = (1 << nDepth) - 1;
+	for (size_t i = 0; i < vLut.size(); i++) {
+		vLut[i] = (uint16_t)ClampValue(pow((double)i / nMax, 1.0 / fGamma) * nMax, nMax);
+	}
+}
+
+void GaussianBlurNode::ProcessTile(const std::vector<const YuvPlanes*>& vInputs, YuvPlanes& out,
+	int nPlane, int r0, int r1) const
+{
+	const YuvPlanes& in = *vInputs[0];
+	double dScaled = dSigma * in.plane[nPlane].cols / in.plane[0].cols;
+	cv::Mat dst = out.plane[nPlane].rowRange(r0, r1);
+	// a row range keeps its parent, so the filter reads real neighbours across tile edges
+	cv::GaussianBlur(in.plane[nPlane].rowRange(r0, r1), dst, cv::Size(), dScaled, dScaled, cv::BORDER_REFLECT_101);
+}
+
+void SharpenNode::ProcessTile(const std::vector<const YuvPlanes*>& vInputs, YuvPlanes& out,
+	int nPlane, int r0, int r1) const
+{
+	const YuvPlanes& in = *vInputs[0];
+	if (nPlane != 0) {
+		in.plane[nPlane].rowRange(r0, r1).copyTo(out.plane[nPlane].rowRange(r0, r1));
+		return;
+	}
+	cv::Mat src = in.plane[0].rowRange(r0, r1);
+	cv::Mat dst = out.plane[0].rowRange(r0, r1);
+	cv::Mat blur;
+	cv::GaussianBlur(src, blur, cv::Size(), dSigma, dSigma, cv::BORDER_REFLECT_101);
+	cv::addWeighted(src, 1.0 + dAmount, blur, -dAmount, 0.0, dst);
+	if (in.depth > 8 && in.depth < 16) {
+		cv::min(dst, in.MaxValue(), dst);
+	}
+}
+
+void MixNode::ProcessTile(const std::vector<const YuvPlanes*>& vInputs, YuvPlanes& out,
+	int nPlane, int r0, int r1) const
+{
+	cv::Mat dst = out.plane[nPlane].rowRange(r0, r1);
+	cv::addWeighted(vInputs[0]->plane[nPlane].rowRange(r0, r1), 1.0 - dMix,
+		vInputs[1]->plane[nPlane].rowRange(r0, r1), dMix, 0.0, dst);
+}
+
+EffectGraph::EffectGraph(int nTileRows) : nTileRows(std::max(nTileRows, 8))
+{
+	// the source occupies id 0 and is never computed
+	vNodes.resize(1);
+}
+
+int EffectGraph::AddNode(std::shared_ptr<EffectNode> pNode, const std::vector<int>& vInputs)
+{
+	int nId = (int)vNodes.size();
+	if (!pNode || (int)vInputs.size() != pNode->GetInputCount()) {
+		LOG(ERROR) << "Effect node " << (pNode ? pNode->GetName() : "null") << ": wrong number of inputs";
+		return -1;
+	}
+	for (int nInput : vInputs) {
+		// ids only point backwards, so the graph cannot have cycles
+		if (nInput < 0 || nInput >= nId) {
+			LOG(ERROR) << "Effect node " << pNode->GetName() << ": invalid input " << nInput;
+			return -1;
+		}
+	}
+	Node node;
+	node.pNode = pNode;
+	node.vInputs = vInputs;
+	vNodes.push_back(std::move(node));
+	return nId;
+}
+
+void EffectGraph::Invalidate()
+{
+	for (Node& node : vNodes) {
+		node.nSignature = 0;
+		for (cv::Mat& m : node.output.plane) {
+			m.release();
+		}
+	}
+}
+
+uint64_t EffectGraph::Signature(int nId)
+{
+	if (nId == kSource) {
+		return nSourceSignature;
+	}
+	// shared ancestors of diamonds and long chains are hashed once per evaluation
+	if (vSignatures[nId]) {
+		return vSignatures[nId];
+	}
+	const Node& node = vNodes[nId];
+	uint64_t h = Mix((uint64_t)nId, node.pNode->GetVersion());
+	for (int nInput : node.vInputs) {
+		h = Mix(h, Signature(nInput));
+	}
+	vSignatures[nId] = h ? h : 1;
+	return vSignatures[nId];
+}
+
+const YuvPlanes* EffectGraph::Evaluate(int nOutput, const YuvPlanes& source, uint64_t nSourceId, int64_t nSourceKey)
+{
+	if (nOutput < 0 || nOutput >= (int)vNodes.size()) {
+		return nullptr;
+	}
+	pSource = &source;
+	nSourceSignature = Mix(Mix(Mix(nSourceId, (uint64_t)nSourceKey), (uint64_t)source.plane[0].cols << 32 | source.plane[0].rows),
+		(uint64_t)source.depth);
+	vSignatures.assign(vNodes.size(), 0);
+	nPasses = 0;
+	return EvaluateNode(nOutput);
+}
+
+const YuvPlanes* EffectGraph::EvaluateNode(int nId)
+{
+	if (nId == kSource) {
+		return pSource;
+	}
+	Node& node = vNodes[nId];
+	uint64_t nSignature = Signature(nId);
+	if (node.nSignature == nSignature) {
+		return &node.output;
+	}
+
+	if (node.pNode->IsPointOp()) {
+		// climb through point operations without a valid cached output; they all fold into this pass
+		std::vector<int> vChain = { nId };
+		int nBase = node.vInputs[0];
+		while (nBase != kSource && vNodes[nBase].pNode->IsPointOp() && vNodes[nBase].nSignature != Signature(nBase)) {
+			vChain.push_back(nBase);
+			nBase = vNodes[nBase].vInputs[0];
+		}
+		const YuvPlanes* in = EvaluateNode(nBase);
+		std::vector<uint16_t> vLuts[3], vNodeLut;
+		for (int p = 0; p < 3; p++) {
+			IdentityLut(in->depth, vLuts[p]);
+			for (auto it = vChain.rbegin(); it != vChain.rend(); ++it) {
+				vNodes[*it].pNode->BuildLut(p, in->depth, vNodeLut);
+				for (uint16_t& v : vLuts[p]) {
+					v = vNodeLut[v];
+				}
+			}
+		}
+		RunLuts(*in, node.output, vLuts);
+	} else {
+		std::vector<const YuvPlanes*> vInputs;
+		for (int nInput : node.vInputs) {
+			vInputs.push_back(EvaluateNode(nInput));
+		}
+		for (size_t i = 1; i < vInputs.size(); i++) {
+			if (vInputs[i]->plane[0].size() != vInputs[0]->plane[0].size() || vInputs[i]->depth != vInputs[0]->depth) {
+				LOG(ERROR) << "Effect node " << node.pNode->GetName() << ": inputs differ in size or depth";
+				return nullptr;
+			}
+		}
+		RunTiles(node, vInputs);
+	}
+	node.nSignature = nSignature;
+	nPasses++;
+	return &node.output;
+}
+
+void EffectGraph::RunLuts(const YuvPlanes& in, YuvPlanes& out, const std::vector<uint16_t> (&vLuts)[3])
+{
+	out.depth = in.depth;
+	cv::Mat lut8[3];
+	bool bIdentity[3];
+	for (int p = 0; p < 3; p++) {
+		bIdentity[p] = true;
+		for (size_t i = 0; i < vLuts[p].size() && bIdentity[p]; i++) {
+			bIdentity[p] = vLuts[p][i] == i;
+		}
+		if (bIdentity[p]) {
+			PassThrough(out.plane[p], in.plane[p]);
+			continue;
+		}
+		PrepareWrite(out.plane[p], in.plane[p]);
+		if (in.depth == 8) {
+			lut8[p].create(1, 256, CV_8UC1);
+			for (int i = 0; i < 256; i++) {
+				lut8[p].data[i] = (uint8_t)vLuts[p][i];
+			}
+		}
+	}
+
+	std::vector<cv::Vec3i> vTiles;
+	for (int p = 0; p < 3; p++) {
+		for (int r = 0; !bIdentity[p] && r < in.plane[p].rows; r += nTileRows) {
+			vTiles.push_back(cv::Vec3i(p, r, std::min(r + nTileRows, in.plane[p].rows)));
+		}
+	}
+	int nMax = in.MaxValue();
+	TaskScheduler::Global().ParallelFor((int)vTiles.size(), [&](int nBegin, int nEnd) {
+		for (int t = nBegin; t < nEnd; t++) {
+			int p = vTiles[t][0], r0 = vTiles[t][1], r1 = vTiles[t][2];
+			if (in.depth == 8) {
+				cv::Mat dst = out.plane[p].rowRange(r0, r1);
+				cv::LUT(in.plane[p].rowRange(r0, r1), lut8[p], dst);
+				continue;
+			}
+			const uint16_t* pLut = vLuts[p].data();
+			for (int y = r0; y < r1; y++) {
+				const uint16_t* s = in.plane[p].ptr<uint16_t>(y);
+				uint16_t* d = out.plane[p].ptr<uint16_t>(y);
+				for (int x = 0; x < in.plane[p].cols; x++) {
+					d[x] = pLut[std::min((int)s[x], nMax)];
+				}
+			}
+		}
+	});
+}
+
+void EffectGraph::RunTiles(Node& node, const std::vector<const YuvPlanes*>& vInputs)
+{
+	node.output.CreateLike(*vInputs[0]);
+	std::vector<cv::Vec3i> vTiles;
+	for (int p = 0; p < 3; p++) {
+		for (int r = 0; r < vInputs[0]->plane[p].rows; r += nTileRows) {
+			vTiles.push_back(cv::Vec3i(p, r, std::min(r + nTileRows, vInputs[0]->plane[p].rows)));
+		}
+	}
+	EffectNode* pNode = node.pNode.get();
+	YuvPlanes& out = node.output;
+	TaskScheduler::Global().ParallelFor((int)vTiles.size(), [&](int nBegin, int nEnd) {
+		for (int t = nBegin; t < nEnd; t++) {
+			pNode->ProcessTile(vInputs, out, vTiles[t][0], vTiles[t][1], vTiles[t][2]);
+		}
+	});
+}
+
+bool EffectGraph::Apply(int nOutput, AVFrame* frame, uint64_t nSourceId)
+{
+	if (!frameIn.Wrap(frame)) {
+		LOG(ERROR) << "Effects need planar YUV, got " << av_get_pix_fmt_name((AVPixelFormat)frame->format);
+		return false;
+	}
+	// without a timestamp there is nothing to recognise the frame by next time
+	static std::atomic<int64_t> nUnkeyed{ INT64_MIN };
+	int64_t nKey = frame->pts != AV_NOPTS_VALUE ? frame->pts : nUnkeyed++;
+	const YuvPlanes* result = Evaluate(nOutput, frameIn, nSourceId, nKey);
+	if (!result) {
+		return false;
+	}
+	if (result == &frameIn) {
+		return true;
+	}
+	// the result planes become the frame's buffers instead of being copied into it. The frame's
+	// reference makes PrepareWrite() allocate afresh when the graph next writes those nodes.
+	cv::Mat planes[4] = { result->plane[0], result->plane[1], result->plane[2] };
+	int nPlanes = av_pix_fmt_count_planes((AVPixelFormat)frame->format);
+	FrameMat source;
+	if (nPlanes == 4 && source.Wrap(frame)) {
+		// alpha passes through untouched; being the frame's memory, it is the one plane copied
+		planes[3] = source.GetPlane(3);
+	}
+	AVFrame* out = MatsToFrame(planes, nPlanes, (AVPixelFormat)frame->format, frame->width, frame->height);
+	if (!out || av_frame_copy_props(out, frame) < 0) {
+		av_frame_free(&out);
+		return false;
+	}
+	av_frame_unref(frame);
+	av_frame_move_ref(frame, out);
+	av_frame_free(&out);
+	return true;
+}
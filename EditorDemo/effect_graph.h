@@ -0,0 +1,316 @@
+#pragma once
+
+extern "C" {
+#include <libavutil/frame.h>
+}
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+#include "utils.h"
+#include "task_scheduler.h"
+#include "frame_mat.h"
+
+/**
+* @brief The three planes of a planar YUV image (4:2:0, 4:2:2 or 4:4:4). depth 8 uses CV_8UC1 planes,
+* 9 to 16 CV_16UC1 planes holding depth-bit values, as in FFmpeg's yuv*p10/12/16 formats.
+*/
+struct YuvPlanes
+{
+	cv::Mat plane[3];
+	int depth = 8;
+
+	int MaxValue() const {
+		return (1 << depth) - 1;
+	}
+	/**
+	* @brief Wraps frame's planes without copying; false for formats other than planar YUV
+	*/
+	bool Wrap(const AVFrame* frame);
+	/**
+	* @brief Allocates planes of the same geometry as other, unless they already match
+	*/
+	void CreateLike(const YuvPlanes& other);
+};
+
+/**
+* @brief One operation of an effect graph, working directly on YUV planes. Nodes whose output pixel
+* only depends on the same pixel of the same plane of their single input are point operations: they
+* describe themselves as a per-plane lookup table and are fused with their neighbours into one pass.
+* Other nodes fill their output one tile (a band of rows of one plane) at a time.
+* Setters must call Touch() so the graph knows cached results went stale.
+*/
+class EffectNode
+{
+public:
+	virtual ~EffectNode() {}
+	virtual const char* GetName() const = 0;
+	virtual int GetInputCount() const {
+		return 1;
+	}
+	virtual bool IsPointOp() const {
+		return false;
+	}
+	/**
+	* @brief Point operations: maps every value of plane nPlane; vLut has 1 << nDepth entries
+	*/
+	virtual void BuildLut(int nPlane, int nDepth, std::vector<uint16_t>& vLut) const {}
+	/**
+	* @brief Other operations: writes rows [r0, r1) of plane nPlane of out. Inputs are complete, so
+	* neighbourhood filters may read outside the band.
+	*/
+	virtual void ProcessTile(const std::vector<const YuvPlanes*>& vInputs, YuvPlanes& out,
+		int nPlane, int r0, int r1) const {}
+
+	uint64_t GetVersion() const {
+		return nVersion.load(std::memory_order_acquire);
+	}
+
+protected:
+	void Touch() {
+		nVersion.fetch_add(1, std::memory_order_acq_rel);
+	}
+
+private:
+	std::atomic<uint64_t> nVersion{ 1 };
+};
+
+/**
+* @brief y' = (y - mid) * contrast + mid + brightness * max, on luma only
+*/
+class BrightnessContrastNode : public EffectNode
+{
+public:
+	BrightnessContrastNode(float fBrightness = 0.0f, float fContrast = 1.0f)
+		: fBrightness(fBrightness), fContrast(fContrast) {}
+	const char* GetName() const override {
+		return "brightness_contrast";
+	}
+	bool IsPointOp() const override {
+		return true;
+	}
+	void BuildLut(int nPlane, int nDepth, std::vector<uint16_t>& vLut) const override;
+	// brightness in [-1, 1] of the full range
+	void Set(float fBrightness, float fContrast) {
+		this->fBrightness = fBrightness;
+		this->fContrast = fContrast;
+		Touch();
+	}
+
+private:
+	float fBrightness, fContrast;
+};
+
+/**
+* @brief Scales chroma around its neutral value; 0 is greyscale
+*/
+class SaturationNode : public EffectNode
+{
+public:
+	SaturationNode(float fSaturation = 1.0f) : fSaturation(fSaturation) {}
+	const char* GetName() const override {
+		return "saturation";
+	}
+	bool IsPointOp() const override {
+		return true;
+	}
+	void BuildLut(int nPlane, int nDepth, std::vector<uint16_t>& vLut) const override;
+	void Set(float fSaturation) {
+		this->fSaturation = fSaturation;
+		Touch();
+	}
+
+private:
+	float fSaturation;
+};
+
+/**
+* @brief Power curve on normalized luma
+*/
+class GammaNode : public EffectNode
+{
+public:
+	GammaNode(float fGamma = 1.0f) : fGamma(fGamma) {}
+	const char* GetName() const override {
+		return "gamma";
+	}
+	bool IsPointOp() const override {
+		return true;
+	}
+	void BuildLut(int nPlane, int nDepth, std::vector<uint16_t>& vLut) const override;
+	void Set(float fGamma) {
+		this->fGamma = fGamma;
+		Touch();
+	}
+
+private:
+	float fGamma;
+};
+
+/**
+* @brief Gaussian blur; sigma is in luma pixels and scaled down on subsampled chroma planes
+*/
+class GaussianBlurNode : public EffectNode
+{
+public:
+	GaussianBlurNode(double dSigma = 2.0) : dSigma(dSigma) {}
+	const char* GetName() const override {
+		return "gaussian_blur";
+	}
+	void ProcessTile(const std::vector<const YuvPlanes*>& vInputs, YuvPlanes& out,
+		int nPlane, int r0, int r1) const override;
+	void Set(double dSigma) {
+		this->dSigma = dSigma;
+		Touch();
+	}
+
+private:
+	double dSigma;
+};
+
+/**
+* @brief Unsharp mask on luma: y + amount * (y - blur(y))
+*/
+class SharpenNode : public EffectNode
+{
+public:
+	SharpenNode(double dAmount = 0.5, double dSigma = 1.5) : dAmount(dAmount), dSigma(dSigma) {}
+	const char* GetName() const override {
+		return "sharpen";
+	}
+	void ProcessTile(const std::vector<const YuvPlanes*>& vInputs, YuvPlanes& out,
+		int nPlane, int r0, int r1) const override;
+	void Set(double dAmount, double dSigma) {
+		this->dAmount = dAmount;
+		this->dSigma = dSigma;
+		Touch();
+	}
+
+private:
+	double dAmount, dSigma;
+};
+
+/**
+* @brief Cross-fade of two inputs: (1 - mix) * a + mix * b
+*/
+class MixNode : public EffectNode
+{
+public:
+	MixNode(double dMix = 0.5) : dMix(dMix) {}
+	const char* GetName() const override {
+		return "mix";
+	}
+	int GetInputCount() const override {
+		return 2;
+	}
+	void ProcessTile(const std::vector<const YuvPlanes*>& vInputs, YuvPlanes& out,
+		int nPlane, int r0, int r1) const override;
+	void Set(double dMix) {
+		this->dMix = dMix;
+		Touch();
+	}
+
+private:
+	double dMix;
+};
+
+/**
+* @brief DAG of effect nodes fed by one source frame (node kSource).
+* Evaluation is lazy and pulls from the requested output: only its ancestors are computed.
+* Chains of point operations are composed into a single lookup table per plane and applied in one
+* pass, and their intermediate images are never materialized. Every other node keeps its last
+* output with a signature of the source id and key, its own version and its inputs' signatures, so
+* re-rendering a frame after tweaking the last effect recomputes the last effect only.
+* Tiles of all three planes are processed in parallel on TaskScheduler::Global(), at the priority
+* of the caller: preview when called from the UI, export from an export task or stage thread.
+* A graph is not meant to be rendered from several threads at once.
+*/
+class EffectGraph
+{
+public:
+	static const int kSource = 0;
+
+	/**
+	* @brief nTileRows is the height of a tile, in rows of the plane being processed
+	*/
+	EffectGraph(int nTileRows = 64);
+	EffectGraph(const EffectGraph&) = delete;
+	EffectGraph& operator=(const EffectGraph&) = delete;
+
+	/**
+	* @brief Adds pNode reading from vInputs (ids of earlier nodes or kSource); returns its id, -1 on error
+	*/
+	int AddNode(std::shared_ptr<EffectNode> pNode, const std::vector<int>& vInputs);
+	int AddNode(std::shared_ptr<EffectNode> pNode, int nInput) {
+		return AddNode(pNode, std::vector<int>{ nInput });
+	}
+	/**
+	* @brief Appends pNode to the last node added, the usual way to build an effect stack
+	*/
+	int Append(std::shared_ptr<EffectNode> pNode) {
+		return AddNode(pNode, (int)vNodes.size() - 1);
+	}
+	EffectNode* GetNode(int nId) {
+		return nId > kSource && nId < (int)vNodes.size() ? vNodes[nId].pNode.get() : nullptr;
+	}
+	int GetOutput() {
+		return (int)vNodes.size() - 1;
+	}
+
+	/**
+	* @brief Evaluates nOutput for source. nSourceId identifies the clip or stream the image comes
+	* from (e.g. FrameCache::ClipId) and nSourceKey the image within it, e.g. its pts; a pair seen on
+	* the previous call lets unchanged nodes reuse their cached output.
+	* The result stays valid until the next call.
+	*/
+	const YuvPlanes* Evaluate(int nOutput, const YuvPlanes& source, uint64_t nSourceId, int64_t nSourceKey);
+	/**
+	* @brief Renders nOutput over frame, keyed by nSourceId and frame->pts. Usable as an ExportPipeline
+	* effect. The frame's buffers are replaced by read-only references to the result planes rather
+	* than written.
+	*/
+	bool Apply(int nOutput, AVFrame* frame, uint64_t nSourceId);
+	bool Apply(AVFrame* frame, uint64_t nSourceId) {
+		return Apply(GetOutput(), frame, nSourceId);
+	}
+
+	/**
+	* @brief Full-image passes run by the last Evaluate, after fusion and cache hits
+	*/
+	int GetPassCount() {
+		return nPasses;
+	}
+	/**
+	* @brief Drops every cached intermediate
+	*/
+	void Invalidate();
+
+private:
+	struct Node
+	{
+		std::shared_ptr<EffectNode> pNode;
+		std::vector<int> vInputs;
+		YuvPlanes output;
+		// signature output was computed for, 0 when empty
+		uint64_t nSignature = 0;
+	};
+
+	const YuvPlanes* EvaluateNode(int nId);
+	uint64_t Signature(int nId);
+	void RunLuts(const YuvPlanes& in, YuvPlanes& out, const std::vector<uint16_t> (&vLuts)[3]);
+	void RunTiles(Node& node, const std::vector<const YuvPlanes*>& vInputs);
+
+private:
+	int nTileRows;
+	std::vector<Node> vNodes;
+	const YuvPlanes* pSource = nullptr;
+	uint64_t nSourceSignature = 0;
+	// signatures computed by the current Evaluate, 0 while unknown
+	std::vector<uint64_t> vSignatures;
+	int nPasses = 0;
+	// scratch for Apply
+	YuvPlanes frameIn;
+};
@@ -0,0 +1,303 @@
+#include "export_pipeline.h"
+#include "task_scheduler.h"
+
+#include <cmath>
+
+ExportPipeline::ExportPipeline(FFmpegDecoder* pDecoder, FFmpegStreamer* pStreamer, EncodeFunc encode,
+	EffectFunc effect, int nQueueDepth)
+	: pDecoder(pDecoder), pStreamer(pStreamer), encode(encode), effect(effect),
+	qDemuxed(nQueueDepth), qDecoded(nQueueDepth), qProcessed(nQueueDepth), qEncoded(nQueueDepth * 4)
+{
+	const char* szNames[STAGE_COUNT] = { "demux", "decode", "process", "encode", "mux" };
+	for (int i = 0; i < STAGE_COUNT; i++) {
+		aStats[i].name = szNames[i];
+	}
+}
+
+ExportPipeline::ExportPipeline(FFmpegDecoder* pDecoder, FFmpegEncoder* pEncoder, FFmpegStreamer* pStreamer,
+	EffectFunc effect, int nQueueDepth)
+	: ExportPipeline(pDecoder, pStreamer, [pDecoder, pEncoder, nLastPts = (int64_t)AV_NOPTS_VALUE](AVFrame* frame,
+		std::vector<AVPacket*>& vPackets) mutable {
+		if (frame) {
+			frame->pts = pDecoder->GetFrameTime(frame, pEncoder->GetTimeBase());
+			// VFR sources and rates above the rounded encoder rate can map two frames onto one tick
+			if (nLastPts != AV_NOPTS_VALUE && frame->pts <= nLastPts) {
+				frame->pts = nLastPts + 1;
+			}
+			nLastPts = frame->pts;
+		}
+		return pEncoder->EncodeFrame(frame, vPackets);
+	}, effect, nQueueDepth)
+{
+}
+
+ExportPipeline::~ExportPipeline()
+{
+}
+
+template<typename T>
+void ExportPipeline::Push(StageQueue<T>& queue, T item, Stage stage)
+{
+	StopWatch sw;
+	sw.Start();
+	queue.push_back(item);
+	double dStall = sw.Stop();
+
+	std::lock_guard<std::mutex> lock(mtxStats);
+	aStats[stage].stall_seconds += dStall;
+	if (item) {
+		aStats[stage].items++;
+	}
+}
+
+template<typename T>
+T ExportPipeline::Pop(StageQueue<T>& queue, Stage stage)
+{
+	size_t nDepth = queue.size();
+	StopWatch sw;
+	sw.Start();
+	T item = queue.pop_front();
+	double dStall = sw.Stop();
+
+	std::lock_guard<std::mutex> lock(mtxStats);
+	StageStats& stats = aStats[stage];
+	stats.stall_seconds += dStall;
+	stats.max_queue_depth = std::max(stats.max_queue_depth, nDepth);
+	// running mean over every pop, including the final end-of-stream marker
+	stats.avg_queue_depth += (nDepth - stats.avg_queue_depth) / ++aPops[stage];
+	return item;
+}
+
+void ExportPipeline::Fail(const char* szStage, int nError)
+{
+	LOG(ERROR) << "Export pipeline " << szStage << " stage failed: " << AvErrorToString(nError);
+	bError = true;
+	bCancel = true;
+}
+
+void ExportPipeline::DemuxStage()
+{
+	StopWatch sw;
+	for (;;) {
+		if (bCancel) {
+			break;
+		}
+		sw.Start();
+		AVPacket* pkt = av_packet_alloc();
+		if (!pkt) {
+			Fail("demux", AVERROR(ENOMEM));
+			break;
+		}
+		int ret = pDecoder->Demux(pkt);
+		double dBusy = sw.Stop(STAGE_DEMUX);
+		{
+			std::lock_guard<std::mutex> lock(mtxStats);
+			aStats[DEMUX].busy_seconds += dBusy;
+		}
+		if (ret < 0) {
+			av_packet_free(&pkt);
+			if (ret != AVERROR_EOF) {
+				Fail("demux", ret);
+			}
+			break;
+		}
+		Push(qDemuxed, pkt, DEMUX);
+	}
+	Push(qDemuxed, (AVPacket*)nullptr, DEMUX);
+}
+
+void ExportPipeline::DecodeStage()
+{
+	StopWatch sw;
+	bool bEnd = false;
+	while (!bEnd) {
+		AVPacket* pkt = Pop(qDemuxed, DECODE);
+		bEnd = pkt == nullptr;
+		if (bCancel) {
+			av_packet_free(&pkt);
+			continue;
+		}
+
+		int64_t nStart = MonotonicNs();
+		sw.Start();
+		// nullptr drains the decoder
+		int ret = pDecoder->SendPacket(pkt);
+		av_packet_free(&pkt);
+		double dBusy = sw.Stop();
+		if (ret < 0 && ret != AVERROR_INVALIDDATA && ret != AVERROR_EOF) {
+			Fail("decode", ret);
+			continue;
+		}
+
+		for (;;) {
+			AVFrame* frame = av_frame_alloc();
+			sw.Start();
+			ret = frame ? pDecoder->ReceiveFrame(frame) : AVERROR(ENOMEM);
+			dBusy += sw.Stop();
+			if (ret < 0) {
+				av_frame_free(&frame);
+				if (ret != AVERROR(EAGAIN) && ret != AVERROR_EOF) {
+					Fail("decode", ret);
+				}
+				break;
+			}
+			Push(qDecoded, frame, DECODE);
+		}
+		// one sample per packet: send plus every receive it unblocked, queue stalls excluded
+		Instrumentation::Get().Record(STAGE_DECODE, nStart, (int64_t)(dBusy * 1e9));
+		std::lock_guard<std::mutex> lock(mtxStats);
+		aStats[DECODE].busy_seconds += dBusy;
+	}
+	Push(qDecoded, (AVFrame*)nullptr, DECODE);
+}
+
+void ExportPipeline::ProcessStage()
+{
+	// effect tiles fan out on the shared pool; queue them as export, not as preview
+	TaskScheduler::PriorityScope priority(TaskScheduler::PRIORITY_NORMAL);
+	StopWatch sw;
+	for (;;) {
+		AVFrame* frame = Pop(qDecoded, PROCESS);
+		if (!frame) {
+			break;
+		}
+		if (bCancel) {
+			av_frame_free(&frame);
+			continue;
+		}
+
+		sw.Start();
+		bool bKeep = !effect || effect(frame);
+		double dBusy = sw.Stop(STAGE_EFFECT);
+		{
+			std::lock_guard<std::mutex> lock(mtxStats);
+			aStats[PROCESS].busy_seconds += dBusy;
+		}
+		if (!bKeep) {
+			av_frame_free(&frame);
+			continue;
+		}
+		Push(qProcessed, frame, PROCESS);
+	}
+	Push(qProcessed, (AVFrame*)nullptr, PROCESS);
+}
+
+void ExportPipeline::EncodeStage()
+{
+	StopWatch sw;
+	std::vector<AVPacket*> vPackets;
+	bool bEnd = false;
+	while (!bEnd) {
+		AVFrame* frame = Pop(qProcessed, ENCODE);
+		bEnd = frame == nullptr;
+		if (bCancel) {
+			av_frame_free(&frame);
+			continue;
+		}
+
+		sw.Start();
+		// nullptr flushes the encoder
+		int ret = encode(frame, vPackets);
+		double dBusy = sw.Stop(STAGE_ENCODE);
+		{
+			std::lock_guard<std::mutex> lock(mtxStats);
+			aStats[ENCODE].busy_seconds += dBusy;
+		}
+		av_frame_free(&frame);
+		if (ret < 0 && ret != AVERROR_EOF) {
+			Fail("encode", ret);
+		}
+		for (AVPacket* pkt : vPackets) {
+			Push(qEncoded, pkt, ENCODE);
+		}
+		vPackets.clear();
+	}
+	Push(qEncoded, (AVPacket*)nullptr, ENCODE);
+}
+
+bool ExportPipeline::MuxAudio(double dUntil)
+{
+	std::vector<AVPacket*> vPackets;
+	int ret = audio(dUntil, vPackets);
+	bool bOk = ret >= 0;
+	for (AVPacket* pkt : vPackets) {
+		bOk = bOk && pStreamer->StreamAudio(pkt, pkt->time_base);
+		av_packet_free(&pkt);
+	}
+	if (!bOk) {
+		Fail("mux audio", ret < 0 ? ret : AVERROR(EIO));
+	}
+	return bOk;
+}
+
+void ExportPipeline::MuxStage()
+{
+	StopWatch sw;
+	for (;;) {
+		AVPacket* pkt = Pop(qEncoded, MUX);
+		if (!pkt) {
+			if (audio && !bCancel) {
+				MuxAudio(INFINITY);
+			}
+			break;
+		}
+		if (bCancel) {
+			av_packet_free(&pkt);
+			continue;
+		}
+
+		sw.Start();
+		bool bOk;
+		// keep the audio just ahead of the video so the muxer's interleaving queue stays short
+		if (audio && pkt->time_base.num && pkt->dts != AV_NOPTS_VALUE && !MuxAudio(pkt->dts * av_q2d(pkt->time_base))) {
+			av_packet_free(&pkt);
+			continue;
+		}
+		if (pkt->time_base.num) {
+			// consumes the packet's reference; the struct is freed below
+			bOk = pStreamer->Stream(pkt, pkt->time_base);
+		} else {
+			bOk = pStreamer->Stream(pkt->data, pkt->size, (int)pkt->pts);
+		}
+		av_packet_free(&pkt);
+		double dBusy = sw.Stop(STAGE_MUX);
+		if (!bOk) {
+			Fail("mux", AVERROR(EIO));
+			continue;
+		}
+		std::lock_guard<std::mutex> lock(mtxStats);
+		aStats[MUX].busy_seconds += dBusy;
+		aStats[MUX].items++;
+	}
+}
+
+bool ExportPipeline::Run()
+{
+	StopWatch sw;
+	sw.Start();
+	{
+		// every stage forwards the end-of-stream marker, so joining never deadlocks on cancel
+		NvThread tDemux(std::thread(&ExportPipeline::DemuxStage, this));
+		NvThread tDecode(std::thread(&ExportPipeline::DecodeStage, this));
+		NvThread tProcess(std::thread(&ExportPipeline::ProcessStage, this));
+		NvThread tEncode(std::thread(&ExportPipeline::EncodeStage, this));
+		NvThread tMux(std::thread(&ExportPipeline::MuxStage, this));
+	}
+	dElapsed = sw.Stop();
+	// frames handed to the encoder; the encode and mux stages count packets
+	nFramesOut = aStats[PROCESS].items;
+
+	for (const StageStats& stats : GetStats()) {
+		LOG(INFO) << "Stage " << stats.name << ": " << stats.items << " items, busy " << stats.busy_seconds
+			<< "s, stalled " << stats.stall_seconds << "s, queue depth avg " << stats.avg_queue_depth
+			<< " max " << stats.max_queue_depth;
+	}
+	LOG(INFO) << "Exported " << nFramesOut << " frames in " << dElapsed << "s (" << GetExportFps() << " fps)";
+	return !bCancel && !bError;
+}
+
+std::vector<StageStats> ExportPipeline::GetStats()
+{
+	std::lock_guard<std::mutex> lock(mtxStats);
+	return std::vector<StageStats>(aStats, aStats + STAGE_COUNT);
+}
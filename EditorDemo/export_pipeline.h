@@ -0,0 +1,132 @@
+#pragma once
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "utils.h"
+#include "ffmpeg_decoder.h"
+#include "ffmpeg_streamer.h"
+#include "ffmpeg_encoder.h"
+
+/**
+* @brief Queue type placed between pipeline stages. nullptr items mark the end of the stream.
+* Every queue has exactly one producer and one consumer thread. ConcurrentQueue and
+* MpmcRingBuffer share the interface and can be dropped in instead.
+*/
+template<typename T>
+using StageQueue = SpscRingBuffer<T>;
+
+/**
+* @brief Per-stage counters collected while the pipeline runs
+*/
+struct StageStats
+{
+	std::string name;
+	int64_t items = 0;
+	// time spent doing the stage's own work
+	double busy_seconds = 0.0;
+	// time blocked waiting on an empty input queue or a full output queue
+	double stall_seconds = 0.0;
+	// depth of the input queue sampled at every pop
+	size_t max_queue_depth = 0;
+	double avg_queue_depth = 0.0;
+};
+
+/**
+* @brief demux -> decode -> process -> encode -> mux, one thread per stage, bounded queues in between.
+* A full queue blocks its producer, so steady state runs at the speed of the slowest stage.
+*/
+class ExportPipeline
+{
+public:
+	// Processes a decoded frame in place. Returning false drops the frame.
+	using EffectFunc = std::function<bool(AVFrame* frame)>;
+	// Encodes frame and appends the packets produced to vPackets; frame is nullptr once to flush.
+	// Packets with a time_base set are muxed with their own timestamps, others as frame numbers.
+	using EncodeFunc = std::function<int(AVFrame* frame, std::vector<AVPacket*>& vPackets)>;
+	// Appends the encoded audio up to dUntil seconds of output to vPackets; called from the mux
+	// stage ahead of each video packet and once with INFINITY at the end to drain. Packets need a time_base.
+	using AudioFunc = std::function<int(double dUntil, std::vector<AVPacket*>& vPackets)>;
+
+	ExportPipeline(FFmpegDecoder* pDecoder, FFmpegStreamer* pStreamer, EncodeFunc encode,
+		EffectFunc effect = nullptr, int nQueueDepth = 8);
+	/**
+	* @brief Encodes with pEncoder; source timestamps are carried over in the encoder's time base
+	*/
+	ExportPipeline(FFmpegDecoder* pDecoder, FFmpegEncoder* pEncoder, FFmpegStreamer* pStreamer,
+		EffectFunc effect = nullptr, int nQueueDepth = 8);
+	ExportPipeline(const ExportPipeline&) = delete;
+	ExportPipeline& operator=(const ExportPipeline&) = delete;
+	~ExportPipeline();
+
+	/**
+	* @brief Runs all stages to completion. Returns false on error or cancellation.
+	*/
+	bool Run();
+	/**
+	* @brief Asks every stage to stop. Queued items are released and Run() returns promptly.
+	*/
+	void Cancel() {
+		bCancel = true;
+	}
+	bool IsCancelled() {
+		return bCancel;
+	}
+
+	/**
+	* @brief Muxes an audio stream alongside the video, e.g. from AudioMixer::Encode. The streamer
+	* must have been created with the audio encoder. Set before Run().
+	*/
+	void SetAudio(AudioFunc audio) {
+		this->audio = audio;
+	}
+
+	std::vector<StageStats> GetStats();
+	double GetExportFps() {
+		return dElapsed > 0.0 ? nFramesOut / dElapsed : 0.0;
+	}
+
+private:
+	enum Stage { DEMUX, DECODE, PROCESS, ENCODE, MUX, STAGE_COUNT };
+
+	void DemuxStage();
+	void DecodeStage();
+	void ProcessStage();
+	void EncodeStage();
+	void MuxStage();
+	bool MuxAudio(double dUntil);
+
+	template<typename T>
+	void Push(StageQueue<T>& queue, T item, Stage stage);
+	template<typename T>
+	T Pop(StageQueue<T>& queue, Stage stage);
+	void Fail(const char* szStage, int nError);
+
+private:
+	FFmpegDecoder* pDecoder;
+	FFmpegStreamer* pStreamer;
+	EncodeFunc encode;
+	EffectFunc effect;
+	AudioFunc audio;
+
+	StageQueue<AVPacket*> qDemuxed;
+	StageQueue<AVFrame*> qDecoded;
+	StageQueue<AVFrame*> qProcessed;
+	StageQueue<AVPacket*> qEncoded;
+
+	std::atomic<bool> bCancel{ false };
+	std::atomic<bool> bError{ false };
+
+	std::mutex mtxStats;
+	StageStats aStats[STAGE_COUNT];
+	int64_t aPops[STAGE_COUNT] = {};
+	int64_t nFramesOut = 0;
+	double dElapsed = 0.0;
+};
@@ -1,6 +1,37 @@
 #include "ffmpeg_decoder.h"
+#include "proxy_generator.h"
+#include "frame_cache.h"
 
-FFmpegDecoder::FFmpegDecoder(AVFormatContext* fmtc) : fmtc(fmtc) {
+std::string FFmpegDecoder::ResolveOpenPath(const char* szFilePath, const DecoderOptions& options)
+{
+	if (options.prefer_proxy) {
+		std::string strProxy = ProxyGenerator::ProxyPath(szFilePath, options.proxy_dir);
+		if (ProxyGenerator::IsProxyReady(szFilePath, strProxy.c_str())) {
+			LOG(INFO) << "Using proxy " << strProxy << " for " << szFilePath;
+			return strProxy;
+		}
+	}
+	return szFilePath;
+}
+
+AVFormatContext* FFmpegDecoder::OpenInput(MemoryInput*& pInput, const char* szFilePath)
+{
+	if (!pInput) {
+		return CreateFormatContext(szFilePath);
+	}
+	AVFormatContext* ctx = pInput->IsValid() ? pInput->OpenFormatContext(szFilePath) : nullptr;
+	// caller-owned buffers have no file to fall back to
+	if (ctx || !szFilePath) {
+		return ctx;
+	}
+	// 32-bit address spaces, network shares and files still being written may refuse a mapping
+	LOG(WARNING) << "Cannot demux " << szFilePath << " from a memory mapping, using file I/O";
+	delete pInput;
+	pInput = nullptr;
+	return CreateFormatContext(szFilePath);
+}
+
+FFmpegDecoder::FFmpegDecoder(AVFormatContext* fmtc, const DecoderOptions& options) : fmtc(fmtc), options(options) {
 	if (!fmtc) {
 		LOG(ERROR) << "No AVFormatContext provided.";
 		return;
@@ -16,12 +47,29 @@ FFmpegDecoder::FFmpegDecoder(AVFormatContext* fmtc) : fmtc(fmtc) {
 	avformat_find_stream_info(fmtc, nullptr);
 	video_stream_index = av_find_best_stream(fmtc, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
 	audio_stream_index = av_find_best_stream(fmtc, AVMEDIA_TYPE_AUDIO, -1, -1, nullptr, 0);
-	if (video_stream_index < 0) {
+	if (video_stream_index >= 0) {
+		if (!OpenVideo()) {
+			return;
+		}
+	} else if (!options.audio_only || audio_stream_index < 0) {
+		// audio-only files (music, voice-over) are fine when only audio was asked for
 		LOG(ERROR) << "FFmpeg error: " << __FILE__ << " " << __LINE__ << " " << "Could not find stream in input file";
 		av_packet_free(&pkt);
 		return;
 	}
 
+	if (audio_stream_index >= 0) {
+		audio_stream = fmtc->streams[audio_stream_index];
+		audio_codec_id = audio_stream->codecpar->codec_id;
+
+		if (0 != DecoderOpen(audio_stream)) {
+			return;
+		}
+	}
+}
+
+bool FFmpegDecoder::OpenVideo()
+{
 	video_stream = fmtc->streams[video_stream_index];
 	video_codec_id = video_stream->codecpar->codec_id;
 	width = video_stream->codecpar->width;
@@ -76,18 +124,17 @@ FFmpegDecoder::FFmpegDecoder(AVFormatContext* fmtc) : fmtc(fmtc) {
 		bpp = 1;
 	}
 
-	if (0 != DecoderOpen(video_stream)) {
-		return;
+	// lowres frames never match the pool's full-size layout. The pool takes the format the decoder
+	// really allocates, not chroma_format, which falls back to 4:2:0 for NV12, 4:2:2, P010 and the like.
+	if (options.use_frame_pool && options.lowres == 0 && !options.audio_only) {
+		frame_pool = new FramePool(width, height, (AVPixelFormat)video_stream->codecpar->format, options.frame_pool_cap);
 	}
 
-	if (audio_stream_index >= 0) {
-		audio_stream = fmtc->streams[audio_stream_index];
-		audio_codec_id = audio_stream->codecpar->codec_id;
-
-		if (0 != DecoderOpen(audio_stream)) {
-			return;
-		}
+	if (options.audio_only) {
+		video_stream->discard = AVDISCARD_ALL;
+		return true;
 	}
+	return 0 == DecoderOpen(video_stream);
 }
 
 int FFmpegDecoder::DecoderOpen(AVStream* stream)
@@ -103,13 +150,30 @@ int FFmpegDecoder::DecoderOpen(AVStream* stream)
 	int ret = avcodec_parameters_to_context(temp_avctx, stream->codecpar);
 	if (ret < 0) {
 		LOG(ERROR) << "avcodec_alloc_context3 failed" << AVERROR(ret);
+		avcodec_free_context(&temp_avctx);
 		return ret;
 	}
 	temp_avctx->pkt_timebase = stream->time_base;
 
+	if (temp_avctx->codec_type == AVMEDIA_TYPE_VIDEO) {
+		// Frame threading adds one frame of latency per thread but scales best for
+		// long-GOP 4K; slice threading is used by codecs that cannot do frame threads.
+		temp_avctx->thread_count = options.threads;
+		temp_avctx->thread_type = options.thread_type;
+	}
+
 	temp_codec = avcodec_find_decoder(temp_avctx->codec_id);
+	if (temp_avctx->codec_type == AVMEDIA_TYPE_VIDEO && temp_codec) {
+		temp_avctx->lowres = std::min(options.lowres, (int)temp_codec->max_lowres);
+		temp_avctx->skip_frame = options.skip_frame;
+		temp_avctx->skip_loop_filter = options.skip_loop_filter;
+	}
+	if (temp_avctx->codec_type == AVMEDIA_TYPE_VIDEO && frame_pool) {
+		frame_pool->Install(temp_avctx, temp_codec);
+	}
 	if ((ret = avcodec_open2(temp_avctx, temp_codec, nullptr)) < 0) {
 		LOG(ERROR) << "avcodec_open2 failed" << AVERROR(ret);
+		avcodec_free_context(&temp_avctx);
 		return ret;
 	}
 
@@ -131,3 +195,294 @@ int FFmpegDecoder::DecoderOpen(AVStream* stream)
 
 	return 0;
 }
+
+
+int FFmpegDecoder::Demux(AVPacket* packet)
+{
+	int ret;
+	while ((ret = av_read_frame(fmtc, packet)) >= 0) {
+		if (packet->stream_index == video_stream_index) {
+			return 0;
+		}
+		av_packet_unref(packet);
+	}
+	return ret;
+}
+
+int FFmpegDecoder::SendPacket(const AVPacket* packet)
+{
+	if (!packet) {
+		if (draining) {
+			return AVERROR_EOF;
+		}
+		draining = true;
+	}
+	int ret = avcodec_send_packet(video_avctx, packet);
+	if (ret < 0 && ret != AVERROR(EAGAIN) && ret != AVERROR_EOF) {
+		LOG(ERROR) << "avcodec_send_packet failed " << ret;
+	}
+	return ret;
+}
+
+int FFmpegDecoder::ReceiveFrame(AVFrame* frame)
+{
+	int ret = avcodec_receive_frame(video_avctx, frame);
+	if (ret == 0) {
+		decoded_frames++;
+		last_frame_pts = frame->best_effort_timestamp;
+	}
+	return ret;
+}
+
+int FFmpegDecoder::DecodeNextFrame(AVFrame* frame)
+{
+	if (!video_avctx) {
+		return AVERROR(EINVAL);
+	}
+
+	StopWatch sw;
+	sw.Start();
+	int ret;
+	for (;;) {
+		ret = ReceiveFrame(frame);
+		if (ret != AVERROR(EAGAIN)) {
+			// a frame, AVERROR_EOF after draining, or a decode error
+			break;
+		}
+
+		ret = Demux(pkt);
+		if (ret == AVERROR_EOF) {
+			SendPacket(nullptr);
+			continue;
+		}
+		if (ret < 0) {
+			LOG(ERROR) << "av_read_frame failed " << ret;
+			break;
+		}
+		ret = SendPacket(pkt);
+		av_packet_unref(pkt);
+		if (ret < 0 && ret != AVERROR_INVALIDDATA) {
+			break;
+		}
+	}
+	decode_seconds += sw.Stop();
+	return ret;
+}
+
+int FFmpegDecoder::DecodeNextAudioFrame(AVFrame* frame)
+{
+	if (!audio_avctx) {
+		return AVERROR(EINVAL);
+	}
+
+	int ret;
+	for (;;) {
+		ret = avcodec_receive_frame(audio_avctx, frame);
+		if (ret != AVERROR(EAGAIN)) {
+			break;
+		}
+
+		while ((ret = av_read_frame(fmtc, pkt)) >= 0 && pkt->stream_index != audio_stream_index) {
+			av_packet_unref(pkt);
+		}
+		if (ret == AVERROR_EOF) {
+			avcodec_send_packet(audio_avctx, nullptr);
+			continue;
+		}
+		if (ret < 0) {
+			LOG(ERROR) << "av_read_frame failed " << ret;
+			break;
+		}
+		ret = avcodec_send_packet(audio_avctx, pkt);
+		av_packet_unref(pkt);
+		if (ret < 0 && ret != AVERROR_INVALIDDATA) {
+			break;
+		}
+	}
+	return ret;
+}
+
+int FFmpegDecoder::SeekAudio(int64_t nMs)
+{
+	if (!audio_avctx) {
+		return AVERROR(EINVAL);
+	}
+	int64_t ts = av_rescale_q(nMs, AVRational{ 1, 1000 }, audio_stream->time_base);
+	if (audio_stream->start_time != AV_NOPTS_VALUE) {
+		ts += audio_stream->start_time;
+	}
+	int ret = av_seek_frame(fmtc, audio_stream_index, ts, AVSEEK_FLAG_BACKWARD);
+	if (ret < 0) {
+		LOG(ERROR) << "audio seek to " << nMs << "ms failed " << ret;
+		return ret;
+	}
+	avcodec_flush_buffers(audio_avctx);
+	return 0;
+}
+
+int FFmpegDecoder::DecodeBatch(AVFrame** ppFrames, int nFrames)
+{
+	int n = 0;
+	for (; n < nFrames; n++) {
+		int ret = DecodeNextFrame(ppFrames[n]);
+		if (ret < 0) {
+			return n > 0 ? n : ret;
+		}
+	}
+	return n;
+}
+
+int FFmpegDecoder::BuildIndex(bool bUseSidecar)
+{
+	if (!video_avctx) {
+		return AVERROR_STREAM_NOT_FOUND;
+	}
+	// Memory backed inputs have no url to key a sidecar on
+	bool bSidecar = bUseSidecar && fmtc->url && fmtc->url[0];
+	std::string strIndexPath = bSidecar ? PacketIndex::SidecarPath(fmtc->url) : std::string();
+	if (bSidecar && video_index.Load(strIndexPath.c_str(), fmtc->url)) {
+		LOG(INFO) << "Loaded packet index " << strIndexPath;
+		return 0;
+	}
+
+	int ret = video_index.Build(fmtc, video_stream_index);
+	if (ret < 0) {
+		return ret;
+	}
+	avcodec_flush_buffers(video_avctx);
+	draining = false;
+	last_frame_pts = current_gop_dts = AV_NOPTS_VALUE;
+
+	if (bSidecar) {
+		video_index.Save(strIndexPath.c_str(), fmtc->url);
+	}
+	return 0;
+}
+
+int FFmpegDecoder::DemuxFrom(const PacketIndexEntry& key, AVPacket* packet)
+{
+	// Demuxers seek on either pts or dts. Try pts first; if that lands after the
+	// keyframe, retry on its dts, which is never later than its pts.
+	const int64_t targets[] = { key.pts, key.dts };
+	for (int64_t ts : targets) {
+		if (ts == AV_NOPTS_VALUE || av_seek_frame(fmtc, video_stream_index, ts, AVSEEK_FLAG_BACKWARD) < 0) {
+			continue;
+		}
+		avcodec_flush_buffers(video_avctx);
+		draining = false;
+		last_frame_pts = AV_NOPTS_VALUE;
+		current_gop_dts = AV_NOPTS_VALUE;
+
+		int ret;
+		while ((ret = Demux(packet)) == 0) {
+			int64_t dts = packet->dts != AV_NOPTS_VALUE ? packet->dts : packet->pts;
+			if (dts == key.DecodeTimestamp()) {
+				return 0;
+			}
+			av_packet_unref(packet);
+			if (dts != AV_NOPTS_VALUE && dts > key.DecodeTimestamp()) {
+				break;
+			}
+		}
+	}
+	LOG(ERROR) << "Could not seek to keyframe at pts " << key.pts;
+	return AVERROR(EIO);
+}
+
+int FFmpegDecoder::SeekToKeyframe(const PacketIndexEntry& key)
+{
+	int ret = DemuxFrom(key, pkt);
+	if (ret < 0) {
+		return ret;
+	}
+	ret = SendPacket(pkt);
+	av_packet_unref(pkt);
+	current_gop_dts = key.DecodeTimestamp();
+	return ret;
+}
+
+int FFmpegDecoder::DecodeKeyframe(const PacketIndexEntry& key, AVFrame* frame)
+{
+	StopWatch sw;
+	sw.Start();
+	int ret = SeekToKeyframe(key);
+	if (ret >= 0) {
+		// drain so decoders with a reorder delay release the picture without further input
+		SendPacket(nullptr);
+		ret = ReceiveFrame(frame);
+	}
+	// the decoder is drained, so the next seek must not try to continue this GOP
+	current_gop_dts = AV_NOPTS_VALUE;
+	decode_seconds += sw.Stop();
+	return ret;
+}
+
+int FFmpegDecoder::SeekToStreamPts(int64_t pts, AVFrame* frame)
+{
+	if (video_index.Empty()) {
+		int ret = BuildIndex();
+		if (ret < 0) {
+			return ret;
+		}
+	}
+	const PacketIndexEntry* key = video_index.FindKeyframe(pts);
+	if (!key) {
+		return AVERROR_INVALIDDATA;
+	}
+
+	StopWatch sw;
+	sw.Start();
+	// Moving forward inside the GOP being decoded needs no seek at all
+	bool bContinue = !draining && current_gop_dts == key->DecodeTimestamp()
+		&& last_frame_pts != AV_NOPTS_VALUE && last_frame_pts < pts;
+	if (!bContinue) {
+		int ret = SeekToKeyframe(*key);
+		if (ret < 0) {
+			return ret;
+		}
+	}
+	decode_seconds += sw.Stop();
+
+	int ret;
+	while ((ret = DecodeNextFrame(frame)) == 0) {
+		if (frame_cache) {
+			frame_cache->Put(cache_clip, frame->best_effort_timestamp, frame);
+		}
+		if (frame->best_effort_timestamp >= pts) {
+			return 0;
+		}
+		av_frame_unref(frame);
+	}
+	return ret;
+}
+
+void FFmpegDecoder::SetFrameCache(FrameCache* pCache)
+{
+	std::string key = media_path + (is_proxy ? "#proxy" : "");
+	SetFrameCache(pCache, FrameCache::ClipId(key.c_str()));
+}
+
+int FFmpegDecoder::SeekToFrame(int n, AVFrame* frame)
+{
+	if (video_index.Empty()) {
+		int ret = BuildIndex();
+		if (ret < 0) {
+			return ret;
+		}
+	}
+	int64_t pts = video_index.GetFramePts(n);
+	if (pts == AV_NOPTS_VALUE) {
+		return AVERROR(EINVAL);
+	}
+	return SeekToStreamPts(pts, frame);
+}
+
+int FFmpegDecoder::SeekToPts(int64_t t, AVFrame* frame)
+{
+	if (!video_avctx) {
+		return AVERROR_STREAM_NOT_FOUND;
+	}
+	int64_t start = video_stream->start_time != AV_NOPTS_VALUE ? video_stream->start_time : 0;
+	int64_t pts = start + av_rescale_q(t, AVRational{ 1, (int)user_time_scale }, video_stream->time_base);
+	return SeekToStreamPts(pts, frame);
+}
@@ -5,27 +5,68 @@ extern "C" {
 #include <libavcodec/avcodec.h>
 }
 
-#include "Utils.h"
+#include "utils.h"
+#include "packet_index.h"
+#include "frame_pool.h"
+#include "memory_input.h"
 
+class FrameCache;
+
+/**
+* @brief Settings applied to the video decoder before avcodec_open2
+*/
+struct DecoderOptions
+{
+	// 0 lets libavcodec pick one thread per logical core
+	int threads = 0;
+	// FF_THREAD_FRAME and/or FF_THREAD_SLICE
+	int thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+	// decode into pooled, refcounted buffers instead of per-frame allocations
+	bool use_frame_pool = true;
+	// most buffers the pool may create, 0 for no cap; beyond it frames use default buffers
+	int frame_pool_cap = 0;
+	// demux files through a read-only memory mapping instead of buffered file I/O; files that cannot
+	// be mapped or demuxed from memory still open through file I/O
+	bool memory_map = false;
+	// decode at 1/2^lowres resolution, clamped to what the codec supports (mostly MPEG-1/2/4, MJPEG).
+	// Frames then come out smaller than GetWidth() x GetHeight().
+	int lowres = 0;
+	// AVDISCARD_NONKEY decodes keyframes only
+	AVDiscard skip_frame = AVDISCARD_DEFAULT;
+	AVDiscard skip_loop_filter = AVDISCARD_DEFAULT;
+	// open only the audio decoder and let the demuxer drop video packets
+	bool audio_only = false;
+	// open the clip's proxy (see proxy_generator.h) instead of the original when one is ready.
+	// Meant for preview; export keeps the default and always reads the original.
+	bool prefer_proxy = false;
+	// where proxies live, empty for next to the original
+	std::string proxy_dir;
+};
 
 class FFmpegDecoder
 {
 private:
 	AVFormatContext* fmtc = nullptr;
 	AVPacket* pkt = nullptr;
+	// custom AVIO source, when not reading through avformat's own file protocol
+	MemoryInput* memory_input = nullptr;
 
-	//video
-	int video_stream_index;
-	AVCodecID video_codec_id;
+	// the clip as imported, and whether a proxy of it was opened instead
+	std::string media_path;
+	bool is_proxy = false;
+
+	//video; audio-only files with DecoderOptions::audio_only have none
+	int video_stream_index = -1;
+	AVCodecID video_codec_id = AV_CODEC_ID_NONE;
 	AVStream* video_stream = nullptr;
 	AVCodecContext* video_avctx = nullptr;
 	const AVCodec* video_codec = nullptr;
-	AVPixelFormat chroma_format;
-	int width, height, bit_depth, bpp, chroma_height;
+	AVPixelFormat chroma_format = AV_PIX_FMT_NONE;
+	int width = 0, height = 0, bit_depth = 0, bpp = 0, chroma_height = 0;
 
 	//audio
-	int audio_stream_index;
-	AVCodecID audio_codec_id;
+	int audio_stream_index = -1;
+	AVCodecID audio_codec_id = AV_CODEC_ID_NONE;
 	AVStream* audio_stream = nullptr;
 	AVCodecContext* audio_avctx = nullptr;
 	const AVCodec* audio_codec = nullptr;
@@ -33,6 +74,24 @@ private:
 
 	double time_base = 0.0;
 	int64_t user_time_scale = 1000;
+
+	DecoderOptions options;
+	// set once the null packet has been sent and the decoder is draining
+	bool draining = false;
+
+	int64_t decoded_frames = 0;
+	double decode_seconds = 0.0;
+
+	FramePool* frame_pool = nullptr;
+
+	PacketIndex video_index;
+	// pts of the last frame returned and dts of the keyframe its GOP started from
+	int64_t last_frame_pts = AV_NOPTS_VALUE;
+	int64_t current_gop_dts = AV_NOPTS_VALUE;
+
+	// frames decoded by seeks are added to frame_cache under (cache_clip, pts)
+	FrameCache* frame_cache = nullptr;
+	uint64_t cache_clip = 0;
 private:
 
 	AVFormatContext* CreateFormatContext(const char* file_path) {
@@ -40,16 +99,45 @@ private:
 		avformat_open_input(&ctx, file_path, nullptr, nullptr);
 		return ctx;
 	}
-	FFmpegDecoder(AVFormatContext* fmtc);
+	/**
+	* @brief Demuxer on pInput, or on szFilePath itself when there is no input. A mapped file that cannot
+	* be demuxed from memory falls back to file I/O; pInput is then deleted and set to nullptr.
+	*/
+	AVFormatContext* OpenInput(MemoryInput*& pInput, const char* szFilePath);
+	FFmpegDecoder(AVFormatContext* fmtc, const DecoderOptions& options);
+	FFmpegDecoder(MemoryInput* pInput, const char* szFilePath, const DecoderOptions& options)
+		: FFmpegDecoder(OpenInput(pInput, szFilePath), options) {
+		memory_input = pInput;
+	}
+	FFmpegDecoder(const std::string& strOpenPath, const char* szFilePath, const DecoderOptions& options)
+		: FFmpegDecoder(options.memory_map ? new MemoryInput(strOpenPath.c_str()) : nullptr, strOpenPath.c_str(), options) {
+		media_path = szFilePath;
+		is_proxy = strOpenPath != szFilePath;
+	}
+	/**
+	* @brief The file actually opened for szFilePath: its proxy when preferred and ready
+	*/
+	static std::string ResolveOpenPath(const char* szFilePath, const DecoderOptions& options);
 
+	// sets up video_stream and, unless audio_only, its decoder
+	bool OpenVideo();
 	int DecoderOpen(AVStream* stream);
+	int SeekToKeyframe(const PacketIndexEntry& key);
+	int SeekToStreamPts(int64_t pts, AVFrame* frame);
 
 public:
-	FFmpegDecoder(const char* szFilePath) : FFmpegDecoder(CreateFormatContext(szFilePath)) {}
+	FFmpegDecoder(const char* szFilePath, const DecoderOptions& options = DecoderOptions())
+		: FFmpegDecoder(ResolveOpenPath(szFilePath, options), szFilePath, options) {}
+	/**
+	* @brief Demuxes from memory. pBuf must stay valid for the lifetime of the decoder.
+	*/
+	FFmpegDecoder(const uint8_t* pBuf, uint64_t nSize, const DecoderOptions& options = DecoderOptions())
+		: FFmpegDecoder(new MemoryInput(pBuf, nSize), nullptr, options) {}
 
 	~FFmpegDecoder() {
 
 		if (!fmtc) {
+			delete memory_input;
 			return;
 		}
 
@@ -64,10 +152,53 @@ public:
 		if (audio_avctx) {
 			avcodec_free_context(&audio_avctx);
 		}
+		// after the codec context, which may still call get_buffer2 while closing
+		delete frame_pool;
 
 		avformat_close_input(&fmtc);
+		// avformat_close_input leaves custom AVIO contexts to their owner
+		delete memory_input;
 	}
 
+	bool IsValid() {
+		return options.audio_only ? audio_avctx != nullptr : video_avctx != nullptr;
+	}
+	bool HasAudio() {
+		return audio_avctx != nullptr;
+	}
+	/**
+	* @brief Opened audio decoder; sample rate, format and channel layout of the decoded frames
+	*/
+	AVCodecContext* GetAudioContext() {
+		return audio_avctx;
+	}
+	const std::string& GetMediaPath() {
+		return media_path;
+	}
+	/**
+	* @brief True when decoding a low-resolution proxy; GetWidth()/GetHeight() are then the proxy's
+	*/
+	bool IsProxy() {
+		return is_proxy;
+	}
+	/**
+	* @brief Container parameters of the video stream: profile, level, bitrate, extradata; nullptr without video
+	*/
+	const AVCodecParameters* GetVideoCodecParameters() {
+		return video_stream ? video_stream->codecpar : nullptr;
+	}
+	AVRational GetVideoTimeBase() {
+		return video_stream ? video_stream->time_base : AVRational{ 0, 1 };
+	}
+	/**
+	* @brief Average frame rate of the video stream, {0, 1} when the container does not know it or has no video
+	*/
+	AVRational GetFrameRate() {
+		if (!video_stream) {
+			return AVRational{ 0, 1 };
+		}
+		return video_stream->avg_frame_rate.num ? video_stream->avg_frame_rate : video_stream->r_frame_rate;
+	}
 	AVCodecID GetVideoCodec() {
 		return video_codec_id;
 	}
@@ -86,5 +217,169 @@ public:
 	int GetFrameSize() {
 		return width * (height + chroma_height) * bpp;
 	}
+	/**
+	* @brief Buffer pool backing decoded video frames, nullptr when disabled
+	*/
+	FramePool* GetFramePool() {
+		return frame_pool;
+	}
+	/**
+	* @brief Largest DecoderOptions::lowres the video codec honours, 0 if it cannot decode at reduced size
+	*/
+	int GetMaxLowres() {
+		return video_codec ? video_codec->max_lowres : 0;
+	}
+	/**
+	* @brief Changes what the video decoder discards from the next packet on, e.g. AVDISCARD_NONREF
+	* to drop B-frames while playback falls behind. Call from the thread that decodes.
+	*/
+	void SetSkipFrame(AVDiscard eSkipFrame, AVDiscard eSkipLoopFilter) {
+		if (!video_avctx) {
+			return;
+		}
+		video_avctx->skip_frame = eSkipFrame;
+		video_avctx->skip_loop_filter = eSkipLoopFilter;
+	}
+
+	/**
+	* @brief Reads the next video packet from the container, skipping other streams.
+	* Returns 0 on success, AVERROR_EOF at the end of the file.
+	*/
+	int Demux(AVPacket* packet);
+	/**
+	* @brief Feeds one packet to the video decoder. A null packet starts draining.
+	*/
+	int SendPacket(const AVPacket* packet);
+	/**
+	* @brief Returns 0 when a frame was produced, AVERROR(EAGAIN) when more input is needed,
+	* AVERROR_EOF once the decoder is fully drained.
+	*/
+	int ReceiveFrame(AVFrame* frame);
+
+	/**
+	* @brief Runs demux/send/receive until the next video frame is available.
+	* Returns 0 with a frame, AVERROR_EOF when the stream is drained, or another negative error.
+	*/
+	int DecodeNextFrame(AVFrame* frame);
+	/**
+	* @brief Audio counterpart of DecodeNextFrame. Packets of other streams are dropped, so use
+	* a decoder of its own (ideally with audio_only set) rather than interleaving with video calls.
+	*/
+	int DecodeNextAudioFrame(AVFrame* frame);
+	/**
+	* @brief Seeks the audio stream to the last keyframe at or before nMs (milliseconds from the
+	* stream start) and flushes the audio decoder. Decoding resumes from there, so the caller trims
+	* the samples before nMs using the frame timestamps.
+	*/
+	int SeekAudio(int64_t nMs);
+	/**
+	* @brief Decodes up to nFrames frames into caller allocated ppFrames.
+	* Returns the number of frames decoded, AVERROR_EOF if none are left.
+	*/
+	int DecodeBatch(AVFrame** ppFrames, int nFrames);
+
+	int64_t GetDecodedFrameCount() {
+		return decoded_frames;
+	}
+	/**
+	* @brief Decoded frames per second of time spent inside DecodeNextFrame/DecodeBatch
+	*/
+	double GetDecodeFps() {
+		return decode_seconds > 0.0 ? decoded_frames / decode_seconds : 0.0;
+	}
+	void ResetDecodeStats() {
+		decoded_frames = 0;
+		decode_seconds = 0.0;
+	}
+
+	/**
+	* @brief Loads the packet index from its sidecar or builds it with a demux-only pass.
+	* Scanning rewinds the demuxer, so call it before decoding. Fails without a video decoder.
+	*/
+	int BuildIndex(bool bUseSidecar = true);
+	const PacketIndex& GetIndex() {
+		return video_index;
+	}
+	/**
+	* @brief Repositions the demuxer on the keyframe packet key and returns that packet, without
+	* decoding it; following Demux() calls continue from there. For stream copy.
+	*/
+	int DemuxFrom(const PacketIndexEntry& key, AVPacket* packet);
+	/**
+	* @brief Decodes just the keyframe at key, without touching the rest of its GOP.
+	* Cheap random access for previews; the decoder is left drained until the next seek.
+	*/
+	int DecodeKeyframe(const PacketIndexEntry& key, AVFrame* frame);
+	/**
+	* @brief Adds every frame a seek decodes on its way from the keyframe to the target to pCache.
+	* nClip keys this clip's frames; decoders of the same file share them. Seeks always decode, so
+	* DecodeNextFrame() continues after the frame sought; callers that only need the frame look it up
+	* with FrameCache::Get(GetClipId(), pts) first.
+	*/
+	void SetFrameCache(FrameCache* pCache, uint64_t nClip) {
+		frame_cache = pCache;
+		cache_clip = nClip;
+	}
+	/**
+	* @brief Same, keyed by the file actually opened, so a proxy and its original never mix
+	*/
+	void SetFrameCache(FrameCache* pCache);
+	uint64_t GetClipId() {
+		return cache_clip;
+	}
+	/**
+	* @brief Decodes the n-th frame in presentation order into frame
+	*/
+	int SeekToFrame(int n, AVFrame* frame);
+	/**
+	* @brief Decodes the frame displayed at t, in 1/user_time_scale units from the start of the stream
+	*/
+	int SeekToPts(int64_t t, AVFrame* frame);
+	/**
+	* @brief Presentation time of a decoded frame in 1/user_time_scale units from the start of the stream;
+	* AV_NOPTS_VALUE if unknown or without video
+	*/
+	int64_t GetFrameTime(const AVFrame* frame) {
+		if (!video_stream || frame->best_effort_timestamp == AV_NOPTS_VALUE) {
+			return AV_NOPTS_VALUE;
+		}
+		int64_t start = video_stream->start_time != AV_NOPTS_VALUE ? video_stream->start_time : 0;
+		return (int64_t)((frame->best_effort_timestamp - start) * time_base * user_time_scale + 0.5);
+	}
+	/**
+	* @brief Presentation time of a decoded frame in tb units from the start of the stream;
+	* AV_NOPTS_VALUE if unknown or without video
+	*/
+	int64_t GetFrameTime(const AVFrame* frame, AVRational tb) {
+		if (!video_stream || frame->best_effort_timestamp == AV_NOPTS_VALUE) {
+			return AV_NOPTS_VALUE;
+		}
+		int64_t start = video_stream->start_time != AV_NOPTS_VALUE ? video_stream->start_time : 0;
+		return av_rescale_q(frame->best_effort_timestamp - start, video_stream->time_base, tb);
+	}
+	/**
+	* @brief Same for a decoded audio frame, from the start of the audio stream; AV_NOPTS_VALUE if unknown
+	* or without audio
+	*/
+	int64_t GetAudioFrameTime(const AVFrame* frame, AVRational tb) {
+		if (!audio_stream || frame->best_effort_timestamp == AV_NOPTS_VALUE) {
+			return AV_NOPTS_VALUE;
+		}
+		int64_t start = audio_stream->start_time != AV_NOPTS_VALUE ? audio_stream->start_time : 0;
+		return av_rescale_q(frame->best_effort_timestamp - start, audio_stream->time_base, tb);
+	}
+	/**
+	* @brief Start of the audio stream minus the start of the video stream, in tb units; 0 without either.
+	* Added to GetAudioFrameTime() it puts audio on the GetFrameTime() timeline, for files whose streams
+	* start apart (MP4 edit lists, MPEG-TS).
+	*/
+	int64_t GetAudioStartOffset(AVRational tb) {
+		if (!video_stream || !audio_stream
+			|| video_stream->start_time == AV_NOPTS_VALUE || audio_stream->start_time == AV_NOPTS_VALUE) {
+			return 0;
+		}
+		return av_rescale_q(audio_stream->start_time, audio_stream->time_base, tb)
+			- av_rescale_q(video_stream->start_time, video_stream->time_base, tb);
+	}
 };
 
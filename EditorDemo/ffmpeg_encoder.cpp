@@ -0,0 +1,345 @@
+#include "ffmpeg_encoder.h"
+
+#include <algorithm>
+
+extern "C" {
+#include <libavutil/opt.h>
+}
+
+namespace {
+// packets considered by the rolling fps
+const size_t kFpsWindow = 120;
+
+// x264 preset names to SVT-AV1 presets (0 slowest .. 12 fastest) and libaom cpu-used (0 .. 8)
+int PresetIndex(const std::string& preset) {
+	const char* szPresets[] = { "placebo", "veryslow", "slower", "slow", "medium", "fast", "faster", "veryfast", "superfast", "ultrafast" };
+	for (int i = 0; i < 10; i++) {
+		if (preset == szPresets[i]) {
+			return i;
+		}
+	}
+	return 4;
+}
+}
+
+FFmpegEncoder::FFmpegEncoder(AVCodecID eCodecId, int nWidth, int nHeight, int nFps, AVPixelFormat eFormat,
+	const EncoderOptions& options, FFmpegStreamer* pStreamer) : streamer(pStreamer), options(options)
+{
+	codec = FindEncoder(eCodecId);
+	if (!codec) {
+		LOG(ERROR) << "No encoder found for " << avcodec_get_name(eCodecId);
+		return;
+	}
+
+	pkt = av_packet_alloc();
+	avctx = avcodec_alloc_context3(codec);
+	if (!pkt || !avctx) {
+		LOG(ERROR) << "Encoder allocation failed";
+		return;
+	}
+
+	avctx->width = nWidth;
+	avctx->height = nHeight;
+	avctx->pix_fmt = eFormat;
+	avctx->time_base = AVRational{ 1, nFps };
+	avctx->framerate = AVRational{ nFps, 1 };
+	avctx->gop_size = options.gop_size;
+	if (options.max_b_frames >= 0) {
+		avctx->max_b_frames = options.max_b_frames;
+	}
+	if (options.closed_gop) {
+		avctx->flags |= AV_CODEC_FLAG_CLOSED_GOP;
+	}
+	avctx->profile = options.profile;
+	avctx->level = options.level;
+	avctx->thread_count = options.threads;
+	avctx->thread_type = options.thread_type;
+
+	switch (options.rate_control) {
+	case EncoderOptions::RC_CBR:
+		avctx->bit_rate = avctx->rc_min_rate = avctx->rc_max_rate = options.bitrate;
+		avctx->rc_buffer_size = (int)options.bitrate;
+		break;
+	case EncoderOptions::RC_VBR:
+		avctx->bit_rate = options.bitrate;
+		if (options.max_bitrate > 0) {
+			avctx->rc_max_rate = options.max_bitrate;
+			avctx->rc_buffer_size = (int)options.max_bitrate;
+		}
+		break;
+	default:
+		break;
+	}
+
+	AVDictionary* dict = nullptr;
+	SetEncoderOptions(&dict);
+	int ret = avcodec_open2(avctx, codec, &dict);
+	AVDictionaryEntry* e = nullptr;
+	while ((e = av_dict_get(dict, "", e, AV_DICT_IGNORE_SUFFIX))) {
+		LOG(WARNING) << codec->name << " ignored option " << e->key << "=" << e->value;
+	}
+	av_dict_free(&dict);
+	if (ret < 0) {
+		LOG(ERROR) << "avcodec_open2 failed for " << codec->name << ": " << AvErrorToString(ret);
+		avcodec_free_context(&avctx);
+		return;
+	}
+	LOG(INFO) << "Encoder " << codec->name << " " << nWidth << "x" << nHeight << "@" << nFps
+		<< ", threads " << avctx->thread_count;
+}
+
+const AVCodec* FFmpegEncoder::FindEncoder(AVCodecID eCodecId)
+{
+	if (!options.encoder_name.empty()) {
+		return avcodec_find_encoder_by_name(options.encoder_name.c_str());
+	}
+	// software encoders in order of preference
+	std::vector<const char*> vNames;
+	switch (eCodecId) {
+	case AV_CODEC_ID_H264:
+		vNames = { "libx264" };
+		break;
+	case AV_CODEC_ID_HEVC:
+		vNames = { "libx265" };
+		break;
+	case AV_CODEC_ID_AV1:
+		vNames = { "libsvtav1", "libaom-av1", "librav1e" };
+		break;
+	default:
+		break;
+	}
+	for (const char* szName : vNames) {
+		if (const AVCodec* c = avcodec_find_encoder_by_name(szName)) {
+			return c;
+		}
+	}
+	return avcodec_find_encoder(eCodecId);
+}
+
+void FFmpegEncoder::SetEncoderOptions(AVDictionary** ppOptions)
+{
+	std::string strName = codec->name;
+	bool bCrf = options.rate_control == EncoderOptions::RC_CRF;
+	int nPreset = PresetIndex(options.preset);
+
+	if (strName == "libx264") {
+		av_dict_set(ppOptions, "preset", options.preset.c_str(), 0);
+		if (bCrf) {
+			av_dict_set_int(ppOptions, "crf", options.crf, 0);
+		}
+		if (options.lookahead >= 0) {
+			av_dict_set_int(ppOptions, "rc-lookahead", options.lookahead, 0);
+		}
+	} else if (strName == "libx265") {
+		av_dict_set(ppOptions, "preset", options.preset.c_str(), 0);
+		if (bCrf) {
+			av_dict_set_int(ppOptions, "crf", options.crf, 0);
+		}
+		std::string strParams;
+		if (options.lookahead >= 0) {
+			strParams += "rc-lookahead=" + std::to_string(options.lookahead) + ":";
+		}
+		if (options.closed_gop) {
+			strParams += "open-gop=0:";
+		}
+		if (!strParams.empty()) {
+			strParams.pop_back();
+			av_dict_set(ppOptions, "x265-params", strParams.c_str(), 0);
+		}
+	} else if (strName == "libsvtav1") {
+		av_dict_set_int(ppOptions, "preset", nPreset * 12 / 9, 0);
+		if (bCrf) {
+			av_dict_set_int(ppOptions, "crf", options.crf, 0);
+		}
+		if (options.lookahead >= 0) {
+			av_dict_set_int(ppOptions, "la_depth", options.lookahead, 0);
+		}
+	} else if (strName == "libaom-av1") {
+		av_dict_set_int(ppOptions, "cpu-used", std::min(8, std::max(0, nPreset - 1)), 0);
+		if (bCrf) {
+			av_dict_set_int(ppOptions, "crf", options.crf, 0);
+		}
+		if (options.lookahead >= 0) {
+			av_dict_set_int(ppOptions, "lag-in-frames", options.lookahead, 0);
+		}
+		av_dict_set_int(ppOptions, "row-mt", 1, 0);
+	}
+}
+
+int FFmpegEncoder::EncodeFrame(AVFrame* frame)
+{
+	return Encode(frame, nullptr);
+}
+
+int FFmpegEncoder::EncodeFrame(AVFrame* frame, std::vector<AVPacket*>& vPackets)
+{
+	return Encode(frame, &vPackets);
+}
+
+int FFmpegEncoder::Encode(AVFrame* frame, std::vector<AVPacket*>* pvPackets)
+{
+	if (!IsValid()) {
+		return AVERROR(EINVAL);
+	}
+	if (frame) {
+		if (frame->pts == AV_NOPTS_VALUE) {
+			frame->pts = next_pts;
+		}
+		next_pts = frame->pts + 1;
+		// let the encoder place keyframes; decoded frames still carry their source picture type
+		frame->pict_type = AV_PICTURE_TYPE_NONE;
+		submit_times[frame->pts] = std::chrono::steady_clock::now();
+	}
+
+	// refcounted frames (pooled decoder output) are referenced, not copied
+	int ret = avcodec_send_frame(avctx, frame);
+	if (ret < 0 && ret != AVERROR_EOF) {
+		LOG(ERROR) << "avcodec_send_frame failed: " << AvErrorToString(ret);
+		return ret;
+	}
+
+	for (;;) {
+		ret = avcodec_receive_packet(avctx, pkt);
+		if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
+			return 0;
+		}
+		if (ret < 0) {
+			LOG(ERROR) << "avcodec_receive_packet failed: " << AvErrorToString(ret);
+			return ret;
+		}
+		TrackOutput(pkt);
+
+		if (pvPackets) {
+			AVPacket* out = av_packet_alloc();
+			av_packet_move_ref(out, pkt);
+			out->time_base = avctx->time_base;
+			pvPackets->push_back(out);
+		} else if (streamer) {
+			// consumes the reference
+			if (!streamer->Stream(pkt, avctx->time_base)) {
+				return AVERROR(EIO);
+			}
+		} else {
+			av_packet_unref(pkt);
+		}
+	}
+}
+
+void FFmpegEncoder::TrackOutput(const AVPacket* packet)
+{
+	auto now = std::chrono::steady_clock::now();
+	auto it = submit_times.find(packet->pts);
+	if (it != submit_times.end()) {
+		last_latency = std::chrono::duration<double>(now - it->second).count();
+		total_latency += last_latency;
+		max_latency = std::max(max_latency, last_latency);
+		submit_times.erase(it);
+	}
+	encoded_frames++;
+
+	output_times.push_back(now);
+	if (output_times.size() > kFpsWindow) {
+		output_times.pop_front();
+	}
+}
+
+double FFmpegEncoder::GetEncodeFps()
+{
+	if (output_times.size() < 2) {
+		return 0.0;
+	}
+	double dSeconds = std::chrono::duration<double>(output_times.back() - output_times.front()).count();
+	return dSeconds > 0.0 ? (output_times.size() - 1) / dSeconds : 0.0;
+}
+
+FFmpegAudioEncoder::FFmpegAudioEncoder(int nSampleRate, int nChannels, int64_t nBitrate)
+{
+	// the native encoder takes FLTP, which is what the mixer produces
+	const AVCodec* codec = avcodec_find_encoder(AV_CODEC_ID_AAC);
+	if (!codec) {
+		LOG(ERROR) << "No AAC encoder found";
+		return;
+	}
+	pkt = av_packet_alloc();
+	frame = av_frame_alloc();
+	avctx = avcodec_alloc_context3(codec);
+	if (!pkt || !frame || !avctx) {
+		LOG(ERROR) << "Audio encoder allocation failed";
+		return;
+	}
+	avctx->sample_fmt = AV_SAMPLE_FMT_FLTP;
+	avctx->sample_rate = nSampleRate;
+	av_channel_layout_default(&avctx->ch_layout, nChannels);
+	avctx->bit_rate = nBitrate;
+	avctx->time_base = AVRational{ 1, nSampleRate };
+	int ret = avcodec_open2(avctx, codec, nullptr);
+	if (ret < 0) {
+		LOG(ERROR) << "avcodec_open2 failed for " << codec->name << ": " << AvErrorToString(ret);
+		avcodec_free_context(&avctx);
+		return;
+	}
+	fifo = av_audio_fifo_alloc(AV_SAMPLE_FMT_FLTP, nChannels, std::max(avctx->frame_size, 1024) * 2);
+}
+
+FFmpegAudioEncoder::~FFmpegAudioEncoder()
+{
+	if (fifo) {
+		av_audio_fifo_free(fifo);
+	}
+	av_frame_free(&frame);
+	av_packet_free(&pkt);
+	avcodec_free_context(&avctx);
+}
+
+int FFmpegAudioEncoder::Encode(const float* const* ppPlanes, int nSamples, std::vector<AVPacket*>& vPackets)
+{
+	if (!IsValid() || !fifo) {
+		return AVERROR(EINVAL);
+	}
+	if (ppPlanes && nSamples > 0 && av_audio_fifo_write(fifo, (void**)ppPlanes, nSamples) < nSamples) {
+		return AVERROR(ENOMEM);
+	}
+	int nFrameSize = avctx->frame_size > 0 ? avctx->frame_size : 1024;
+	bool bFlush = ppPlanes == nullptr;
+	while (av_audio_fifo_size(fifo) >= nFrameSize || (bFlush && av_audio_fifo_size(fifo) > 0)) {
+		av_frame_unref(frame);
+		frame->format = avctx->sample_fmt;
+		frame->sample_rate = avctx->sample_rate;
+		frame->nb_samples = std::min(nFrameSize, av_audio_fifo_size(fifo));
+		av_channel_layout_copy(&frame->ch_layout, &avctx->ch_layout);
+		int ret = av_frame_get_buffer(frame, 0);
+		if (ret < 0) {
+			return ret;
+		}
+		av_audio_fifo_read(fifo, (void**)frame->data, frame->nb_samples);
+		frame->pts = next_pts;
+		next_pts += frame->nb_samples;
+		if ((ret = Send(frame, vPackets)) < 0) {
+			return ret;
+		}
+	}
+	return bFlush ? Send(nullptr, vPackets) : 0;
+}
+
+int FFmpegAudioEncoder::Send(AVFrame* pFrame, std::vector<AVPacket*>& vPackets)
+{
+	int ret = avcodec_send_frame(avctx, pFrame);
+	if (ret < 0 && ret != AVERROR_EOF) {
+		LOG(ERROR) << "avcodec_send_frame failed: " << AvErrorToString(ret);
+		return ret;
+	}
+	for (;;) {
+		ret = avcodec_receive_packet(avctx, pkt);
+		if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
+			return 0;
+		}
+		if (ret < 0) {
+			LOG(ERROR) << "avcodec_receive_packet failed: " << AvErrorToString(ret);
+			return ret;
+		}
+		AVPacket* out = av_packet_alloc();
+		av_packet_move_ref(out, pkt);
+		out->time_base = avctx->time_base;
+		vPackets.push_back(out);
+	}
+}
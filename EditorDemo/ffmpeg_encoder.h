@@ -0,0 +1,181 @@
+#pragma once
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavutil/audio_fifo.h>
+}
+
+#include <chrono>
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "utils.h"
+#include "ffmpeg_streamer.h"
+
+/**
+* @brief Settings applied to the encoder before avcodec_open2
+*/
+struct EncoderOptions
+{
+	enum RateControl {
+		// constant quality through crf; bitrate unconstrained
+		RC_CRF,
+		// constant bitrate: bitrate == max_bitrate with a one second VBV
+		RC_CBR,
+		// average bitrate, peaks limited by max_bitrate when set
+		RC_VBR
+	};
+
+	// 0 lets the encoder pick one thread per logical core
+	int threads = 0;
+	int thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+	// x264/x265 preset names; translated for the AV1 encoders
+	std::string preset = "medium";
+	RateControl rate_control = RC_CRF;
+	int crf = 23;
+	int64_t bitrate = 0;
+	int64_t max_bitrate = 0;
+	// rate control lookahead in frames, -1 for the encoder default
+	int lookahead = -1;
+	int gop_size = 250;
+	// -1 for the encoder default
+	int max_b_frames = -1;
+	// no references across GOP boundaries, required to splice GOPs
+	bool closed_gop = false;
+	// FF_PROFILE_* / level_idc, e.g. to match a stream being spliced into; unknown leaves the encoder's choice
+	int profile = FF_PROFILE_UNKNOWN;
+	int level = FF_LEVEL_UNKNOWN;
+	// explicit encoder, e.g. "libx264"; empty picks the best available for the codec
+	std::string encoder_name;
+};
+
+class FFmpegEncoder
+{
+private:
+	AVCodecContext* avctx = nullptr;
+	const AVCodec* codec = nullptr;
+	AVPacket* pkt = nullptr;
+	FFmpegStreamer* streamer = nullptr;
+
+	EncoderOptions options;
+	int64_t next_pts = 0;
+
+	// submit time of every frame in flight, by pts
+	std::unordered_map<int64_t, std::chrono::steady_clock::time_point> submit_times;
+	double last_latency = 0.0;
+	double total_latency = 0.0;
+	double max_latency = 0.0;
+	int64_t encoded_frames = 0;
+	// output times of the most recent packets, for the rolling fps
+	std::deque<std::chrono::steady_clock::time_point> output_times;
+
+private:
+	const AVCodec* FindEncoder(AVCodecID eCodecId);
+	void SetEncoderOptions(AVDictionary** ppOptions);
+	// pvPackets == nullptr streams into the attached streamer
+	int Encode(AVFrame* frame, std::vector<AVPacket*>* pvPackets);
+	void TrackOutput(const AVPacket* packet);
+
+public:
+	/**
+	* @brief Encodes nWidth x nHeight eFormat frames at nFps. When pStreamer is set, packets go straight into it.
+	*/
+	FFmpegEncoder(AVCodecID eCodecId, int nWidth, int nHeight, int nFps, AVPixelFormat eFormat,
+		const EncoderOptions& options = EncoderOptions(), FFmpegStreamer* pStreamer = nullptr);
+	FFmpegEncoder(const FFmpegEncoder&) = delete;
+	FFmpegEncoder& operator=(const FFmpegEncoder&) = delete;
+
+	~FFmpegEncoder() {
+		if (pkt) {
+			av_packet_free(&pkt);
+		}
+		if (avctx) {
+			avcodec_free_context(&avctx);
+		}
+	}
+
+	bool IsValid() {
+		return avctx && avcodec_is_open(avctx);
+	}
+
+	/**
+	* @brief Encodes frame and streams the resulting packets. frame->pts is in 1/nFps units and is
+	* assigned sequentially when unset. The frame is referenced, not copied, so pooled frames can be
+	* released right after the call. nullptr flushes the encoder.
+	*/
+	int EncodeFrame(AVFrame* frame);
+	/**
+	* @brief Same, but hands the packets to the caller, who frees them with av_packet_free
+	*/
+	int EncodeFrame(AVFrame* frame, std::vector<AVPacket*>& vPackets);
+
+	AVCodecContext* GetCodecContext() {
+		return avctx;
+	}
+	AVRational GetTimeBase() {
+		return avctx->time_base;
+	}
+	const char* GetEncoderName() {
+		return codec ? codec->name : "";
+	}
+
+	/**
+	* @brief Seconds between submitting a frame and receiving its packet, for the latest packet
+	*/
+	double GetLastLatency() {
+		return last_latency;
+	}
+	double GetAverageLatency() {
+		return encoded_frames ? total_latency / encoded_frames : 0.0;
+	}
+	double GetMaxLatency() {
+		return max_latency;
+	}
+	int64_t GetEncodedFrameCount() {
+		return encoded_frames;
+	}
+	/**
+	* @brief Packets per second over the most recent packets
+	*/
+	double GetEncodeFps();
+};
+
+/**
+* @brief AAC encoder for the mixed project audio. Takes planar float frames of any length at the
+* project rate and regroups them into the encoder's frame_size; packets carry pts in 1/sample_rate.
+*/
+class FFmpegAudioEncoder
+{
+private:
+	AVCodecContext* avctx = nullptr;
+	AVPacket* pkt = nullptr;
+	AVAudioFifo* fifo = nullptr;
+	AVFrame* frame = nullptr;
+	int64_t next_pts = 0;
+
+	int Send(AVFrame* pFrame, std::vector<AVPacket*>& vPackets);
+
+public:
+	FFmpegAudioEncoder(int nSampleRate, int nChannels, int64_t nBitrate = 192000);
+	FFmpegAudioEncoder(const FFmpegAudioEncoder&) = delete;
+	FFmpegAudioEncoder& operator=(const FFmpegAudioEncoder&) = delete;
+	~FFmpegAudioEncoder();
+
+	bool IsValid() {
+		return avctx && avcodec_is_open(avctx);
+	}
+	/**
+	* @brief Queues nSamples samples of every plane in ppPlanes (AV_SAMPLE_FMT_FLTP) and encodes all
+	* complete frames. ppPlanes == nullptr flushes the remainder and the encoder.
+	*/
+	int Encode(const float* const* ppPlanes, int nSamples, std::vector<AVPacket*>& vPackets);
+
+	AVCodecContext* GetCodecContext() {
+		return avctx;
+	}
+	AVRational GetTimeBase() {
+		return avctx->time_base;
+	}
+};
@@ -1 +1,170 @@
 #include "ffmpeg_streamer.h"
+
+bool FFmpegStreamer::WritePacket(AVPacket* pPacket)
+{
+    bool bKey = (pPacket->flags & AV_PKT_FLAG_KEY) != 0;
+    // A single stream has nothing to interleave, and av_write_frame neither buffers nor copies
+    // non-refcounted data. With several streams the muxer must reorder by dts.
+    int ret = oc->nb_streams > 1 || pPacket->buf ? av_interleaved_write_frame(oc, pPacket) : av_write_frame(oc, pPacket);
+    if (ret < 0) {
+        LOG(ERROR) << "FFMPEG: Error while writing video frame: " << AvErrorToString(ret);
+        return false;
+    }
+
+    nPacketsSinceFlush++;
+    bool bFlush = false;
+    switch (eFlushPolicy) {
+    case FLUSH_EVERY_PACKET:
+        bFlush = true;
+        break;
+    case FLUSH_ON_KEYFRAME:
+        bFlush = bKey;
+        break;
+    case FLUSH_EVERY_N_PACKETS:
+        bFlush = nPacketsSinceFlush >= nFlushInterval;
+        break;
+    default:
+        break;
+    }
+    if (bFlush) {
+        avio_flush(oc->pb);
+        nPacketsSinceFlush = 0;
+    }
+    return true;
+}
+
+bool FFmpegStreamer::Stream(uint8_t* pData, int nBytes, int64_t nPts, int64_t nDts, bool bKeyFrame)
+{
+    if (!oc || !pkt) {
+        return false;
+    }
+    av_packet_unref(pkt);
+    pkt->pts = av_rescale_q(nPts, AVRational{ 1, nFps }, vs->time_base);
+    pkt->dts = av_rescale_q(nDts, AVRational{ 1, nFps }, vs->time_base);
+    pkt->duration = av_rescale_q(1, AVRational{ 1, nFps }, vs->time_base);
+    pkt->stream_index = vs->index;
+    pkt->data = pData;
+    pkt->size = nBytes;
+    if (bKeyFrame) {
+        pkt->flags |= AV_PKT_FLAG_KEY;
+    }
+    return WritePacket(pkt);
+}
+
+bool FFmpegStreamer::Stream(AVPacket* pPacket, AVRational tb)
+{
+    if (!oc) {
+        return false;
+    }
+    av_packet_rescale_ts(pPacket, tb, vs->time_base);
+    pPacket->stream_index = vs->index;
+    if (!(pPacket->flags & AV_PKT_FLAG_KEY) && IsKeyFrame(eCodecId, pPacket->data, pPacket->size)) {
+        pPacket->flags |= AV_PKT_FLAG_KEY;
+    }
+    return WritePacket(pPacket);
+}
+
+bool FFmpegStreamer::StreamAudio(AVPacket* pPacket, AVRational tb)
+{
+    if (!oc || !as) {
+        return false;
+    }
+    av_packet_rescale_ts(pPacket, tb, as->time_base);
+    pPacket->stream_index = as->index;
+    return WritePacket(pPacket);
+}
+
+namespace {
+
+// Position of the first byte after the next 00 00 01 start code at or after i, or nBytes if none
+int NextNalUnit(const uint8_t* p, int nBytes, int i) {
+    for (; i + 2 < nBytes; i++) {
+        if (p[i] == 0 && p[i + 1] == 0) {
+            if (p[i + 2] == 1) {
+                return i + 3;
+            }
+            if (p[i + 2] != 0) {
+                i += 2;
+            }
+        }
+    }
+    return nBytes;
+}
+
+bool IsH264KeyFrame(const uint8_t* p, int nBytes) {
+    for (int i = NextNalUnit(p, nBytes, 0); i < nBytes; i = NextNalUnit(p, nBytes, i)) {
+        int nType = p[i] & 0x1F;
+        if (nType == 5 || nType == 7) {
+            return true;    // IDR slice or SPS
+        }
+        if (nType == 1) {
+            return false;   // the first slice decides
+        }
+    }
+    return false;
+}
+
+bool IsHevcKeyFrame(const uint8_t* p, int nBytes) {
+    for (int i = NextNalUnit(p, nBytes, 0); i < nBytes; i = NextNalUnit(p, nBytes, i)) {
+        int nType = (p[i] >> 1) & 0x3F;
+        if ((nType >= 16 && nType <= 21) || (nType >= 32 && nType <= 34)) {
+            return true;    // BLA/IDR/CRA, or VPS/SPS/PPS
+        }
+        if (nType < 16) {
+            return false;
+        }
+    }
+    return false;
+}
+
+bool IsAv1KeyFrame(const uint8_t* p, int nBytes) {
+    // low-overhead bitstream format: a sequence of OBUs with size fields
+    int i = 0;
+    while (i < nBytes) {
+        int nType = (p[i] >> 3) & 0x0F;
+        bool bExtension = (p[i] & 0x04) != 0;
+        bool bHasSize = (p[i] & 0x02) != 0;
+        i += bExtension ? 2 : 1;
+        uint64_t nSize = nBytes - i;
+        if (bHasSize) {
+            nSize = 0;
+            for (int n = 0; n < 8 && i < nBytes; n++) {
+                nSize |= (uint64_t)(p[i] & 0x7F) << (7 * n);
+                if (!(p[i++] & 0x80)) {
+                    break;
+                }
+            }
+        }
+        if (nType == 1) {
+            return true;    // OBU_SEQUENCE_HEADER
+        }
+        if ((nType == 3 || nType == 6) && i < nBytes) {
+            // OBU_FRAME_HEADER / OBU_FRAME: show_existing_frame(1) then frame_type(2), KEY_FRAME == 0
+            return !(p[i] & 0x80) && ((p[i] >> 5) & 0x03) == 0;
+        }
+        if (nSize > (uint64_t)(nBytes - i)) {
+            break;
+        }
+        i += (int)nSize;
+    }
+    return false;
+}
+
+}
+
+bool FFmpegStreamer::IsKeyFrame(AVCodecID eCodecId, const uint8_t* pData, int nBytes)
+{
+    if (!pData || nBytes <= 0) {
+        return false;
+    }
+    switch (eCodecId) {
+    case AV_CODEC_ID_H264:
+        return IsH264KeyFrame(pData, nBytes);
+    case AV_CODEC_ID_HEVC:
+        return IsHevcKeyFrame(pData, nBytes);
+    case AV_CODEC_ID_AV1:
+        return IsAv1KeyFrame(pData, nBytes);
+    default:
+        return false;
+    }
+}
@@ -3,6 +3,7 @@
 #include <thread>
 #include <mutex>
 extern "C" {
+#include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
 #include <libavutil/opt.h>
 #include <libswresample/swresample.h>
@@ -33,13 +34,42 @@ static string AvErrorToString(int av_error_code) {
 }
 
 class FFmpegStreamer {
+public:
+    /**
+    * @brief When the output is flushed to the protocol. Anything but FLUSH_EVERY_PACKET lets
+    * avio batch writes, which keeps muxing off the critical path at high packet rates.
+    */
+    enum FlushPolicy {
+        // only when the avio buffer fills, and at the end
+        FLUSH_NEVER,
+        FLUSH_EVERY_PACKET,
+        // before each keyframe's GOP leaves the process: latency bounded by the GOP length
+        FLUSH_ON_KEYFRAME,
+        // every nFlushInterval packets
+        FLUSH_EVERY_N_PACKETS
+    };
+
 private:
     AVFormatContext* oc = NULL;
     AVStream* vs = NULL;
+    // optional audio stream, muxed interleaved with the video
+    AVStream* as = NULL;
     int nFps = 0;
+    AVCodecID eCodecId = AV_CODEC_ID_NONE;
+    // reused by every Stream() call
+    AVPacket* pkt = NULL;
+    FlushPolicy eFlushPolicy = FLUSH_ON_KEYFRAME;
+    int nFlushInterval = 1;
+    int64_t nPacketsSinceFlush = 0;
+
+    bool WritePacket(AVPacket* pPacket);
 
 public:
-    FFmpegStreamer(AVCodecID eCodecId, int nWidth, int nHeight, int nFps, const char* szInFilePath) : nFps(nFps) {
+    /**
+    * @brief pAudioCodec, when set, is an opened audio encoder whose packets go out through StreamAudio()
+    */
+    FFmpegStreamer(AVCodecID eCodecId, int nWidth, int nHeight, int nFps, const char* szInFilePath,
+        const AVCodecContext* pAudioCodec = NULL) : nFps(nFps), eCodecId(eCodecId) {
         avformat_network_init();
 
         int ret = 0;
@@ -55,6 +85,14 @@ public:
             return;
         }
 
+        pkt = av_packet_alloc();
+        if (!pkt) {
+            LOG(ERROR) << "AVPacket allocation failed !";
+            return;
+        }
+        // flushing is driven by eFlushPolicy
+        oc->flush_packets = 0;
+
         oc->url = av_strdup(szInFilePath);
         LOG(INFO) << "Streaming destination: " << oc->url;
 
@@ -72,6 +110,20 @@ public:
         vpar->codec_type = AVMEDIA_TYPE_VIDEO;
         vpar->width = nWidth;
         vpar->height = nHeight;
+        vs->time_base = AVRational{ 1, nFps };
+
+        if (pAudioCodec) {
+            if (eCodecId == AV_CODEC_ID_AV1) {
+                LOG(ERROR) << "FFMPEG: the ivf container cannot carry audio";
+            } else if (!(as = avformat_new_stream(oc, NULL))
+                || avcodec_parameters_from_context(as->codecpar, pAudioCodec) < 0) {
+                LOG(ERROR) << "FFMPEG: Could not alloc audio stream";
+                as = NULL;
+            } else {
+                as->id = 1;
+                as->time_base = AVRational{ 1, pAudioCodec->sample_rate };
+            }
+        }
 
         // Everything is ready. Now open the output stream.
         if (avio_open(&oc->pb, oc->url, AVIO_FLAG_WRITE) < 0) {
@@ -91,33 +143,45 @@ public:
             avio_close(oc->pb);
             avformat_free_context(oc);
         }
+        av_packet_free(&pkt);
     }
 
-    bool Stream(uint8_t* pData, int nBytes, int nPts) {
-        AVPacket* pkt = av_packet_alloc();
-        if (!pkt) {
-            LOG(ERROR) << "AVPacket allocation failed !";
-            return false;
-        }
-        pkt->pts = av_rescale_q(nPts++, AVRational{ 1, nFps }, vs->time_base);
-        // No B-frames
-        pkt->dts = pkt->pts;
-        pkt->stream_index = vs->index;
-        pkt->data = pData;
-        pkt->size = nBytes;
-
-        if (!memcmp(pData, "\x00\x00\x00\x01\x67", 5)) {
-            pkt->flags |= AV_PKT_FLAG_KEY;
-        }
+    void SetFlushPolicy(FlushPolicy ePolicy, int nInterval = 1) {
+        eFlushPolicy = ePolicy;
+        nFlushInterval = nInterval > 0 ? nInterval : 1;
+    }
 
-        // Write the compressed frame into the output
-        int ret = av_write_frame(oc, pkt);
-        av_write_frame(oc, NULL);
-        if (ret < 0) {
-            LOG(ERROR) << "FFMPEG: Error while writing video frame";
-        }
+    /**
+    * @brief Legacy entry point for streams without B-frames: dts = pts, keyframes detected from the bitstream
+    */
+    bool Stream(uint8_t* pData, int nBytes, int nPts) {
+        return Stream(pData, nBytes, nPts, nPts, IsKeyFrame(eCodecId, pData, nBytes));
+    }
 
-        av_packet_free(&pkt);
-        return true;
+    /**
+    * @brief Muxes one compressed frame. nPts and nDts are in 1/nFps units. pData is not copied
+    * and only needs to stay valid for the duration of the call.
+    */
+    bool Stream(uint8_t* pData, int nBytes, int64_t nPts, int64_t nDts, bool bKeyFrame);
+
+    /**
+    * @brief Muxes an encoder packet whose timestamps are in tb. The packet's reference is
+    * handed to the muxer: it is blank on return and can be reused.
+    */
+    bool Stream(AVPacket* pPacket, AVRational tb);
+
+    /**
+    * @brief Muxes an audio encoder packet whose timestamps are in tb; the reference is handed over
+    * as with Stream(). Fails if the streamer was created without audio.
+    */
+    bool StreamAudio(AVPacket* pPacket, AVRational tb);
+    bool HasAudio() {
+        return as != NULL;
     }
-};
+
+    /**
+    * @brief Detects random access points: H.264 IDR/SPS, HEVC IRAP/parameter sets, AV1 sequence
+    * header or key frame header. Accepts 3- and 4-byte Annex B start codes.
+    */
+    static bool IsKeyFrame(AVCodecID eCodecId, const uint8_t* pData, int nBytes);
+};
\ No newline at end of file
@@ -0,0 +1,264 @@
+#include "frame_cache.h"
+
+extern "C" {
+#include <libavutil/imgutils.h>
+}
+
+FrameCache::FrameCache(size_t nBudgetBytes, int nProtectedPercent)
+	: nBudget(nBudgetBytes), nProtectedPercent(std::min(std::max(nProtectedPercent, 0), 100))
+{
+}
+
+FrameCache::~FrameCache()
+{
+	Clear();
+}
+
+size_t FrameCache::FrameBytes(const AVFrame* frame)
+{
+	int n = av_image_get_buffer_size((AVPixelFormat)frame->format, frame->width, frame->height, 1);
+	return n > 0 ? (size_t)n : 0;
+}
+
+uint64_t FrameCache::ClipId(const char* szMediaPath)
+{
+	return HashPath(szMediaPath);
+}
+
+bool FrameCache::Get(uint64_t nClip, int64_t pts, AVFrame* frame)
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	auto it = entries.find(Key{ nClip, pts });
+	if (it == entries.end()) {
+		nMisses++;
+		return false;
+	}
+	EntryList::iterator entry = it->second;
+	if (av_frame_ref(frame, entry->frame) < 0) {
+		nMisses++;
+		return false;
+	}
+	nHits++;
+	if (entry->is_protected) {
+		protect.splice(protect.begin(), protect, entry);
+	} else {
+		// second use: promote out of probation
+		entry->is_protected = true;
+		nProbationBytes -= entry->bytes;
+		nProtectedBytes += entry->bytes;
+		protect.splice(protect.begin(), probation, entry);
+		Evict();
+	}
+	return true;
+}
+
+bool FrameCache::Contains(uint64_t nClip, int64_t pts)
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	return entries.find(Key{ nClip, pts }) != entries.end();
+}
+
+void FrameCache::Put(uint64_t nClip, int64_t pts, const AVFrame* frame)
+{
+	size_t nBytes = FrameBytes(frame);
+	if (!nBytes || nBytes > nBudget) {
+		return;
+	}
+	std::lock_guard<std::mutex> lock(mtx);
+	Key key = { nClip, pts };
+	if (entries.find(key) != entries.end()) {
+		return;
+	}
+	AVFrame* ref = av_frame_clone(frame);
+	if (!ref) {
+		return;
+	}
+	probation.push_front(Entry{ key, ref, nBytes, false });
+	nProbationBytes += nBytes;
+	entries.emplace(key, probation.begin());
+	nInsertions++;
+	Evict();
+}
+
+void FrameCache::Evict()
+{
+	// protected frames beyond their share become the most recent probation frames
+	size_t nProtectedCap = nBudget / 100 * nProtectedPercent;
+	while (nProtectedBytes > nProtectedCap && !protect.empty()) {
+		EntryList::iterator entry = std::prev(protect.end());
+		entry->is_protected = false;
+		nProtectedBytes -= entry->bytes;
+		nProbationBytes += entry->bytes;
+		probation.splice(probation.begin(), protect, entry);
+	}
+	while (nProbationBytes + nProtectedBytes > nBudget) {
+		EntryList& victims = !probation.empty() ? probation : protect;
+		Remove(std::prev(victims.end()));
+		nEvictions++;
+	}
+}
+
+void FrameCache::Remove(EntryList::iterator it)
+{
+	entries.erase(it->key);
+	av_frame_free(&it->frame);
+	if (it->is_protected) {
+		nProtectedBytes -= it->bytes;
+		protect.erase(it);
+	} else {
+		nProbationBytes -= it->bytes;
+		probation.erase(it);
+	}
+}
+
+void FrameCache::EraseClip(uint64_t nClip)
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	for (EntryList* pList : { &probation, &protect }) {
+		for (auto it = pList->begin(); it != pList->end();) {
+			auto next = std::next(it);
+			if (it->key.clip == nClip) {
+				Remove(it);
+			}
+			it = next;
+		}
+	}
+}
+
+void FrameCache::Clear()
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	while (!probation.empty()) {
+		Remove(probation.begin());
+	}
+	while (!protect.empty()) {
+		Remove(protect.begin());
+	}
+}
+
+void FrameCache::SetBudget(size_t nBudgetBytes)
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	nBudget = nBudgetBytes;
+	Evict();
+}
+
+FrameCache::Stats FrameCache::GetStats()
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	Stats stats;
+	stats.hits = nHits;
+	stats.misses = nMisses;
+	stats.insertions = nInsertions;
+	stats.evictions = nEvictions;
+	stats.bytes = nProbationBytes + nProtectedBytes;
+	stats.frames = entries.size();
+	return stats;
+}
+
+FramePrefetcher::FramePrefetcher(const char* szFilePath, FrameCache* pCache, int nAhead, int nBehind,
+	const DecoderOptions& options)
+	: pCache(pCache), nAhead(nAhead), nBehind(nBehind)
+{
+	pDecoder = new FFmpegDecoder(szFilePath, options);
+	if (!pDecoder->IsValid() || pDecoder->BuildIndex() < 0) {
+		LOG(ERROR) << "Prefetch: cannot open " << szFilePath;
+		delete pDecoder;
+		pDecoder = nullptr;
+		return;
+	}
+	pDecoder->SetFrameCache(pCache);
+}
+
+FramePrefetcher::~FramePrefetcher()
+{
+	{
+		std::unique_lock<std::mutex> lock(mtx);
+		bStop = true;
+		nGeneration++;
+		cv.notify_all();
+		cv.wait(lock, [this] { return !bRunning; });
+	}
+	delete pDecoder;
+}
+
+void FramePrefetcher::SetPlayhead(int64_t t)
+{
+	bool bStart = false;
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		nPlayhead = t;
+		nGeneration++;
+		if (pDecoder && !bRunning && !bStop) {
+			bRunning = bStart = true;
+		}
+	}
+	cv.notify_all();
+	if (bStart) {
+		TaskScheduler::Global().Submit([this]() { Prefetch(); }, TaskScheduler::PRIORITY_HIGH);
+	}
+}
+
+void FramePrefetcher::WaitIdle()
+{
+	std::unique_lock<std::mutex> lock(mtx);
+	cv.wait(lock, [this] { return bStop || nDoneGeneration == nGeneration; });
+}
+
+bool FramePrefetcher::Fill(int nFrame, int64_t nGen)
+{
+	if (nGeneration.load(std::memory_order_relaxed) != nGen) {
+		return false;
+	}
+	int64_t pts = pDecoder->GetIndex().GetFramePts(nFrame);
+	if (pts == AV_NOPTS_VALUE || pCache->Contains(pDecoder->GetClipId(), pts)) {
+		return true;
+	}
+	AVFrame* frame = av_frame_alloc();
+	int ret = pDecoder->SeekToFrame(nFrame, frame);
+	av_frame_free(&frame);
+	return ret == 0;
+}
+
+void FramePrefetcher::Prefetch()
+{
+	const PacketIndex& index = pDecoder->GetIndex();
+	AVRational tb = index.GetTimeBase();
+	int64_t nStart = index.GetFramePts(0);
+	for (;;) {
+		int64_t nGen, t;
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			if (bStop || nDoneGeneration == nGeneration) {
+				// notify under the lock: the destructor may return as soon as bRunning is cleared
+				bRunning = false;
+				cv.notify_all();
+				return;
+			}
+			nGen = nGeneration;
+			t = nPlayhead;
+		}
+
+		int nFrame = index.FindFrame(nStart + av_rescale_q(t, AVRational{ 1, 1000 }, tb));
+		if (nFrame < 0) {
+			nFrame = index.GetFrameCount() - 1;
+		}
+		// ahead in decode order first, so the GOP under the playhead is decoded only once
+		bool bOk = true;
+		for (int i = 0; i <= nAhead && bOk; i++) {
+			bOk = Fill(nFrame + i, nGen);
+		}
+		// behind: restart from the earliest frame and walk forward through its GOP(s)
+		for (int i = std::min(nBehind, nFrame); i > 0 && bOk; i--) {
+			bOk = Fill(nFrame - i, nGen);
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			if (nGeneration == nGen) {
+				nDoneGeneration = nGen;
+			}
+		}
+		cv.notify_all();
+	}
+}
@@ -0,0 +1,166 @@
+#pragma once
+
+extern "C" {
+#include <libavutil/frame.h>
+}
+
+#include <atomic>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "utils.h"
+#include "ffmpeg_decoder.h"
+#include "task_scheduler.h"
+
+/**
+* @brief Decoded frames keyed by (clip, pts) under a byte budget, for scrubbing around edit points.
+* Entries hold references to the decoder's refcounted buffers, so inserting and hitting never copy
+* pixels. Eviction is segmented LRU: a frame enters the probation segment and moves to the protected
+* segment on its first hit, so a prefetch sweep cannot flush the frames the user keeps returning to.
+* Probation is evicted first; protected frames demoted by the protected cap fall back into probation.
+*/
+class FrameCache
+{
+public:
+	struct Stats
+	{
+		int64_t hits = 0;
+		int64_t misses = 0;
+		int64_t insertions = 0;
+		int64_t evictions = 0;
+		size_t bytes = 0;
+		size_t frames = 0;
+	};
+
+	/**
+	* @brief nProtectedPercent is the share of the budget hit frames may keep from probation evictions
+	*/
+	FrameCache(size_t nBudgetBytes, int nProtectedPercent = 80);
+	FrameCache(const FrameCache&) = delete;
+	FrameCache& operator=(const FrameCache&) = delete;
+	~FrameCache();
+
+	/**
+	* @brief References the cached frame into frame. Returns false on a miss.
+	*/
+	bool Get(uint64_t nClip, int64_t pts, AVFrame* frame);
+	bool Contains(uint64_t nClip, int64_t pts);
+	/**
+	* @brief Caches a new reference to frame; an existing entry for (nClip, pts) is kept
+	*/
+	void Put(uint64_t nClip, int64_t pts, const AVFrame* frame);
+	/**
+	* @brief Drops every frame of a clip, e.g. when its media changed or it left the timeline
+	*/
+	void EraseClip(uint64_t nClip);
+	void Clear();
+
+	void SetBudget(size_t nBudgetBytes);
+	size_t GetBudget() {
+		return nBudget;
+	}
+	Stats GetStats();
+
+	/**
+	* @brief Bytes charged for a frame: the packed size of its planes, as FFmpegDecoder::GetFrameSize()
+	*/
+	static size_t FrameBytes(const AVFrame* frame);
+	/**
+	* @brief Stable clip key for a media path
+	*/
+	static uint64_t ClipId(const char* szMediaPath);
+
+private:
+	struct Key
+	{
+		uint64_t clip;
+		int64_t pts;
+		bool operator==(const Key& other) const {
+			return clip == other.clip && pts == other.pts;
+		}
+	};
+	struct KeyHash
+	{
+		size_t operator()(const Key& key) const {
+			return std::hash<uint64_t>()(key.clip * 0x9E3779B97F4A7C15ULL ^ (uint64_t)key.pts);
+		}
+	};
+	struct Entry
+	{
+		Key key;
+		AVFrame* frame;
+		size_t bytes;
+		bool is_protected;
+	};
+	typedef std::list<Entry> EntryList;
+
+	// callers hold mtx
+	void Evict();
+	void Remove(EntryList::iterator it);
+
+private:
+	std::mutex mtx;
+	size_t nBudget;
+	int nProtectedPercent;
+	// most recently used at the front
+	EntryList probation;
+	EntryList protect;
+	size_t nProbationBytes = 0;
+	size_t nProtectedBytes = 0;
+	std::unordered_map<Key, EntryList::iterator, KeyHash> entries;
+
+	int64_t nHits = 0;
+	int64_t nMisses = 0;
+	int64_t nInsertions = 0;
+	int64_t nEvictions = 0;
+};
+
+/**
+* @brief Keeps the frames around a playhead decoded. A high-priority task of TaskScheduler::Global()
+* with a decoder of its own, started when the playhead moves, fills nAhead frames after the playhead,
+* then nBehind before it. Frames already cached are skipped; the others are decoded by seeks of a
+* decoder attached to the cache, so every frame of each GOP walked through lands in it. A playhead
+* move abandons the current window between two frames.
+*/
+class FramePrefetcher
+{
+public:
+	FramePrefetcher(const char* szFilePath, FrameCache* pCache, int nAhead = 30, int nBehind = 15,
+		const DecoderOptions& options = DecoderOptions());
+	FramePrefetcher(const FramePrefetcher&) = delete;
+	FramePrefetcher& operator=(const FramePrefetcher&) = delete;
+	~FramePrefetcher();
+
+	bool IsValid() {
+		return pDecoder != nullptr;
+	}
+	/**
+	* @brief Moves the window to the frame displayed at t, in milliseconds from the start of the stream
+	*/
+	void SetPlayhead(int64_t t);
+	/**
+	* @brief Blocks until the window of the latest playhead is fully cached or abandoned
+	*/
+	void WaitIdle();
+
+private:
+	// runs while windows are outstanding, then ends the task
+	void Prefetch();
+	// false when the playhead moved or the prefetcher is stopping
+	bool Fill(int nFrame, int64_t nGeneration);
+
+private:
+	FrameCache* pCache;
+	FFmpegDecoder* pDecoder = nullptr;
+	int nAhead, nBehind;
+
+	std::mutex mtx;
+	std::condition_variable cv;
+	int64_t nPlayhead = 0;
+	std::atomic<int64_t> nGeneration{ 0 };
+	int64_t nDoneGeneration = 0;
+	bool bStop = false;
+	bool bRunning = false;
+};
@@ -0,0 +1,154 @@
+#include "frame_mat.h"
+
+#include <limits.h>
+
+namespace {
+
+struct PlaneLayout
+{
+	int nPlanes = 0;
+	int nDepth = 8;
+	int nShift = 0;
+	int rows[4] = {};
+	int cols[4] = {};
+	int type[4] = {};
+};
+
+/**
+* @brief Mat geometry of every plane of eFormat; false for formats that cannot be viewed as Mats
+*/
+bool GetPlaneLayout(AVPixelFormat eFormat, int nWidth, int nHeight, PlaneLayout& layout)
+{
+	const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(eFormat);
+	if (!desc || (desc->flags & (AV_PIX_FMT_FLAG_HWACCEL | AV_PIX_FMT_FLAG_BITSTREAM | AV_PIX_FMT_FLAG_PAL | AV_PIX_FMT_FLAG_BE))) {
+		return false;
+	}
+	layout.nPlanes = av_pix_fmt_count_planes(eFormat);
+	layout.nDepth = desc->comp[0].depth;
+	layout.nShift = desc->comp[0].shift;
+	if (layout.nPlanes <= 0 || layout.nPlanes > 4 || layout.nDepth + layout.nShift > 16) {
+		return false;
+	}
+	int nBytes = layout.nDepth + layout.nShift > 8 ? 2 : 1;
+	int nStep[4] = {};
+	bool bChroma[4] = {};
+	for (int c = 0; c < desc->nb_components; c++) {
+		const AVComponentDescriptor& comp = desc->comp[c];
+		// one sample type per Mat: every component a whole byte or word at the same bit position
+		if (comp.depth != layout.nDepth || comp.shift != layout.nShift || comp.offset % nBytes || comp.step % nBytes
+			|| (nStep[comp.plane] && nStep[comp.plane] != comp.step)) {
+			return false;
+		}
+		nStep[comp.plane] = comp.step;
+		bChroma[comp.plane] = bChroma[comp.plane] || ((c == 1 || c == 2) && !(desc->flags & AV_PIX_FMT_FLAG_RGB));
+	}
+	for (int p = 0; p < layout.nPlanes; p++) {
+		int nChannels = nStep[p] / nBytes;
+		if (nChannels < 1 || nChannels > 4) {
+			return false;
+		}
+		layout.rows[p] = bChroma[p] ? AV_CEIL_RSHIFT(nHeight, desc->log2_chroma_h) : nHeight;
+		layout.cols[p] = bChroma[p] ? AV_CEIL_RSHIFT(nWidth, desc->log2_chroma_w) : nWidth;
+		layout.type[p] = CV_MAKETYPE(nBytes == 1 ? CV_8U : CV_16U, nChannels);
+	}
+	return true;
+}
+
+void ReleaseMat(void* opaque, uint8_t* data)
+{
+	delete (cv::Mat*)opaque;
+}
+
+}
+
+FrameMat::~FrameMat()
+{
+	Release();
+}
+
+bool FrameMat::Wrap(const AVFrame* src)
+{
+	Release();
+	PlaneLayout layout;
+	if (!GetPlaneLayout((AVPixelFormat)src->format, src->width, src->height, layout)) {
+		return false;
+	}
+	for (int p = 0; p < layout.nPlanes; p++) {
+		// bottom-up frames would need negative Mat steps
+		if (src->linesize[p] <= 0) {
+			return false;
+		}
+	}
+	frame = av_frame_alloc();
+	if (av_frame_ref(frame, src) < 0) {
+		av_frame_free(&frame);
+		return false;
+	}
+	nPlanes = layout.nPlanes;
+	nDepth = layout.nDepth;
+	nShift = layout.nShift;
+	BindPlanes();
+	return true;
+}
+
+bool FrameMat::MakeWritable()
+{
+	if (!frame || av_frame_make_writable(frame) < 0) {
+		return false;
+	}
+	BindPlanes();
+	return true;
+}
+
+void FrameMat::Release()
+{
+	for (int p = 0; p < 4; p++) {
+		planes[p].release();
+	}
+	av_frame_free(&frame);
+	nPlanes = 0;
+}
+
+void FrameMat::BindPlanes()
+{
+	PlaneLayout layout;
+	GetPlaneLayout((AVPixelFormat)frame->format, frame->width, frame->height, layout);
+	for (int p = 0; p < nPlanes; p++) {
+		planes[p] = cv::Mat(layout.rows[p], layout.cols[p], layout.type[p], frame->data[p], frame->linesize[p]);
+	}
+}
+
+AVFrame* MatsToFrame(const cv::Mat* pPlanes, int nPlanes, AVPixelFormat eFormat, int nWidth, int nHeight)
+{
+	PlaneLayout layout;
+	if (!GetPlaneLayout(eFormat, nWidth, nHeight, layout) || nPlanes != layout.nPlanes) {
+		LOG(ERROR) << "Cannot wrap " << nPlanes << " Mats as " << av_get_pix_fmt_name(eFormat);
+		return nullptr;
+	}
+	for (int p = 0; p < nPlanes; p++) {
+		const cv::Mat& m = pPlanes[p];
+		if (m.rows != layout.rows[p] || m.cols != layout.cols[p] || m.type() != layout.type[p] || m.step[0] > INT_MAX) {
+			LOG(ERROR) << "Plane " << p << " is " << m.cols << "x" << m.rows << " of type " << m.type() << ", "
+				<< av_get_pix_fmt_name(eFormat) << " needs " << layout.cols[p] << "x" << layout.rows[p] << " of type " << layout.type[p];
+			return nullptr;
+		}
+	}
+
+	AVFrame* frame = av_frame_alloc();
+	frame->format = eFormat;
+	frame->width = nWidth;
+	frame->height = nHeight;
+	for (int p = 0; p < nPlanes; p++) {
+		cv::Mat* pOwner = new cv::Mat(pPlanes[p].u ? pPlanes[p] : pPlanes[p].clone());
+		size_t nSize = pOwner->step[0] * (pOwner->rows - 1) + pOwner->cols * pOwner->elemSize();
+		frame->buf[p] = av_buffer_create(pOwner->data, nSize, ReleaseMat, pOwner, AV_BUFFER_FLAG_READONLY);
+		if (!frame->buf[p]) {
+			delete pOwner;
+			av_frame_free(&frame);
+			return nullptr;
+		}
+		frame->data[p] = pOwner->data;
+		frame->linesize[p] = (int)pOwner->step[0];
+	}
+	return frame;
+}
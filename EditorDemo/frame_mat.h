@@ -0,0 +1,83 @@
+#pragma once
+
+extern "C" {
+#include <libavutil/frame.h>
+#include <libavutil/pixdesc.h>
+}
+
+#include <opencv2/core.hpp>
+
+#include "utils.h"
+
+/**
+* @brief cv::Mat views of the planes of a decoded AVFrame, without copying any pixels. Every plane
+* becomes one Mat at the frame's linesize: planar Y, U, V (and alpha) as single-channel Mats,
+* the interleaved chroma of NV12/P010 as a two-channel Mat, 8-bit formats as CV_8U and 9 to
+* 16-bit ones as CV_16U. Samples keep the frame's bit layout; GetShift() tells how far formats
+* like P010 store them above bit 0.
+*
+* The view holds its own reference to the frame's buffers, so it stays valid after the decoder
+* unrefs or reuses the frame. The buffers may be shared with other references (the frame pool,
+* a cache, the encoder), so the Mats are read-only until MakeWritable().
+*/
+class FrameMat
+{
+public:
+	FrameMat() = default;
+	FrameMat(const FrameMat&) = delete;
+	FrameMat& operator=(const FrameMat&) = delete;
+	~FrameMat();
+
+	/**
+	* @brief Replaces the view with the planes of frame. False for hardware, palette, big-endian
+	* and packed formats whose components are not whole bytes or words (YUYV, RGB565, X2RGB10).
+	* Frames that are not reference counted are copied once by av_frame_ref().
+	*/
+	bool Wrap(const AVFrame* frame);
+	/**
+	* @brief Gives the view buffers of its own, copying the frame only if another reference shares
+	* them. The plane Mats point to the new buffers afterwards.
+	*/
+	bool MakeWritable();
+	void Release();
+
+	int GetPlaneCount() const {
+		return nPlanes;
+	}
+	cv::Mat& GetPlane(int i) {
+		return planes[i];
+	}
+	int GetDepth() const {
+		return nDepth;
+	}
+	int GetShift() const {
+		return nShift;
+	}
+	/**
+	* @brief The view's own reference, e.g. to pass on to the encoder after MakeWritable()
+	*/
+	const AVFrame* GetFrame() const {
+		return frame;
+	}
+
+private:
+	void BindPlanes();
+
+private:
+	AVFrame* frame = nullptr;
+	cv::Mat planes[4];
+	int nPlanes = 0;
+	int nDepth = 8;
+	int nShift = 0;
+};
+
+/**
+* @brief Wraps Mats as the planes of a new frame of eFormat, without copying: each buffer of the
+* frame holds a reference to its Mat's data, released when the last frame reference goes away.
+* pPlanes must match the layout FrameMat uses for eFormat at nWidth x nHeight. The buffers are
+* read-only, so av_frame_make_writable() copies instead of writing into memory that OpenCV may
+* still use; the Mats must not be written while the frame is alive either. Mats over foreign
+* memory (no allocator reference) are cloned, as nothing else would keep that memory alive.
+* Returns nullptr with the mismatch logged.
+*/
+AVFrame* MatsToFrame(const cv::Mat* pPlanes, int nPlanes, AVPixelFormat eFormat, int nWidth, int nHeight);
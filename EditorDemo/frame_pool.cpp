@@ -0,0 +1,153 @@
+#include "frame_pool.h"
+
+extern "C" {
+#include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
+}
+
+#include "utils.h"
+
+namespace {
+// matches the widest SIMD loads used by the decoders and by our own kernels
+const int kAlign = 64;
+
+size_t AlignUp(size_t n, size_t a) {
+	return (n + a - 1) / a * a;
+}
+}
+
+FramePool::FramePool(int nWidth, int nHeight, AVPixelFormat eFormat, int nMaxBuffers)
+	: nWidth(nWidth), nHeight(nHeight), eFormat(eFormat), nMaxBuffers(nMaxBuffers)
+{
+}
+
+FramePool::~FramePool()
+{
+	// Buffers still referenced by frames keep the AVBufferPool alive until they are released
+	av_buffer_pool_uninit(&pool);
+}
+
+bool FramePool::Install(AVCodecContext* avctx, const AVCodec* codec)
+{
+	if (!codec || !(codec->capabilities & AV_CODEC_CAP_DR1)) {
+		LOG(INFO) << "Codec does not support custom frame buffers, frame pool disabled";
+		return false;
+	}
+	avctx->opaque = this;
+	avctx->get_buffer2 = GetBuffer2;
+	return true;
+}
+
+int FramePool::GetBuffer2(AVCodecContext* avctx, AVFrame* frame, int flags)
+{
+	FramePool* pPool = static_cast<FramePool*>(avctx->opaque);
+	return pPool->FillFrame(avctx, frame, flags);
+}
+
+AVBufferRef* FramePool::AllocBuffer(void* opaque, size_t size)
+{
+	FramePool* pPool = static_cast<FramePool*>(opaque);
+	if (pPool->nMaxBuffers > 0 && pPool->nAllocations >= pPool->nMaxBuffers) {
+		return nullptr;
+	}
+	AVBufferRef* buf = av_buffer_alloc(size);
+	if (buf) {
+		pPool->nAllocations++;
+	}
+	return buf;
+}
+
+int FramePool::Setup(AVCodecContext* avctx, const AVFrame* frame)
+{
+	// Pad the coded size the way the codec expects, then align every row and plane
+	int w = frame->width, h = frame->height;
+	int aLinesizeAlign[AV_NUM_DATA_POINTERS];
+	avcodec_align_dimensions2(avctx, &w, &h, aLinesizeAlign);
+
+	int ret = av_image_fill_linesizes(aLinesize, (AVPixelFormat)frame->format, (int)AlignUp(w, kAlign));
+	if (ret < 0) {
+		return ret;
+	}
+	ptrdiff_t aLinesizePtr[4];
+	for (int i = 0; i < 4; i++) {
+		aLinesize[i] = (int)AlignUp(aLinesize[i], kAlign);
+		aLinesizePtr[i] = aLinesize[i];
+	}
+	size_t aPlaneSize[4];
+	ret = av_image_fill_plane_sizes(aPlaneSize, (AVPixelFormat)frame->format, h, aLinesizePtr);
+	if (ret < 0) {
+		return ret;
+	}
+
+	nBufferSize = 0;
+	for (int i = 0; i < 4; i++) {
+		aOffset[i] = nBufferSize;
+		nBufferSize += AlignUp(aPlaneSize[i], kAlign);
+	}
+	// decoders may over-read the last row with wide loads
+	nBufferSize += kAlign;
+
+	nPoolWidth = frame->width;
+	nPoolHeight = frame->height;
+	pool = av_buffer_pool_init2(nBufferSize, this, AllocBuffer, nullptr);
+	if (!pool) {
+		return AVERROR(ENOMEM);
+	}
+	LOG(INFO) << "Frame pool: " << av_get_pix_fmt_name((AVPixelFormat)frame->format) << " " << w << "x" << h
+		<< ", " << nBufferSize << " bytes per buffer";
+	return 0;
+}
+
+int FramePool::FillFrame(AVCodecContext* avctx, AVFrame* frame, int flags)
+{
+	nRequests++;
+
+	// Geometry is fixed by the first frame; get_buffer2 may run on several frame threads at once.
+	// Frame dimensions here are the coded size, at least the display size the pool was created for.
+	int ret = 0;
+	std::call_once(setupFlag, [&]() {
+		// containers that do not record the pixel format leave it to the first frame
+		if (eFormat == AV_PIX_FMT_NONE) {
+			eFormat = (AVPixelFormat)frame->format;
+		}
+		if (frame->format == eFormat && frame->width >= nWidth && frame->height >= nHeight) {
+			ret = Setup(avctx, frame);
+		} else {
+			LOG(WARNING) << "Frame pool bypassed: decoder allocates " << av_get_pix_fmt_name((AVPixelFormat)frame->format)
+				<< " " << frame->width << "x" << frame->height << ", pool expects " << av_get_pix_fmt_name(eFormat)
+				<< " " << nWidth << "x" << nHeight;
+		}
+	});
+	if (ret < 0) {
+		LOG(WARNING) << "Frame pool setup failed, using default buffers";
+	}
+
+	AVBufferRef* buf = nullptr;
+	if (pool && frame->format == eFormat && frame->width == nPoolWidth && frame->height == nPoolHeight) {
+		buf = av_buffer_pool_get(pool);
+	}
+	if (!buf) {
+		nFallbacks++;
+		return avcodec_default_get_buffer2(avctx, frame, flags);
+	}
+
+	frame->buf[0] = buf;
+	int nPlanes = av_pix_fmt_count_planes((AVPixelFormat)frame->format);
+	for (int i = 0; i < nPlanes && i < 4; i++) {
+		frame->data[i] = buf->data + aOffset[i];
+		frame->linesize[i] = aLinesize[i];
+	}
+	frame->extended_data = frame->data;
+	return 0;
+}
+
+FramePool::Stats FramePool::GetStats()
+{
+	Stats stats;
+	stats.requests = nRequests;
+	stats.allocations = nAllocations;
+	stats.fallbacks = nFallbacks;
+	stats.hits = stats.requests - stats.allocations - stats.fallbacks;
+	stats.bytes_allocated = stats.allocations * (int64_t)nBufferSize;
+	return stats;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavutil/buffer.h>
+}
+
+#include <atomic>
+#include <mutex>
+
+/**
+* @brief Pool of 64-byte aligned, refcounted frame buffers handed to libavcodec through get_buffer2.
+* Decoded frames reference pool memory, so they can travel through queues and effects without copies;
+* the buffer goes back to the pool when the last reference is dropped.
+*/
+class FramePool
+{
+public:
+	struct Stats
+	{
+		int64_t requests = 0;
+		// requests served from a recycled buffer
+		int64_t hits = 0;
+		// new buffers allocated by the pool
+		int64_t allocations = 0;
+		// requests passed to avcodec_default_get_buffer2 (cap reached or unexpected geometry)
+		int64_t fallbacks = 0;
+		int64_t bytes_allocated = 0;
+	};
+
+	/**
+	* @brief eFormat is the format the decoder allocates, AV_PIX_FMT_NONE to take it from the first frame.
+	* nMaxBuffers caps the number of buffers the pool creates, 0 means no cap
+	*/
+	FramePool(int nWidth, int nHeight, AVPixelFormat eFormat, int nMaxBuffers = 0);
+	FramePool(const FramePool&) = delete;
+	FramePool& operator=(const FramePool&) = delete;
+	~FramePool();
+
+	/**
+	* @brief Installs the pool on a decoder context. Call before avcodec_open2.
+	* Codecs without AV_CODEC_CAP_DR1 keep the default allocator.
+	*/
+	bool Install(AVCodecContext* avctx, const AVCodec* codec);
+
+	Stats GetStats();
+
+private:
+	static int GetBuffer2(AVCodecContext* avctx, AVFrame* frame, int flags);
+	static AVBufferRef* AllocBuffer(void* opaque, size_t size);
+	int Setup(AVCodecContext* avctx, const AVFrame* frame);
+	int FillFrame(AVCodecContext* avctx, AVFrame* frame, int flags);
+
+private:
+	int nWidth, nHeight;
+	AVPixelFormat eFormat;
+	int nMaxBuffers;
+
+	std::once_flag setupFlag;
+	AVBufferPool* pool = nullptr;
+	int nPoolWidth = 0, nPoolHeight = 0;
+	int aLinesize[4] = {};
+	size_t aOffset[4] = {};
+	size_t nBufferSize = 0;
+
+	std::atomic<int64_t> nRequests{ 0 };
+	std::atomic<int64_t> nAllocations{ 0 };
+	std::atomic<int64_t> nFallbacks{ 0 };
+};
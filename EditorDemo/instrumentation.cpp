@@ -0,0 +1,239 @@
+#include "instrumentation.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <tuple>
+
+#include "logger.h"
+
+extern simplelogger::Logger* logger;
+
+namespace {
+
+// small sequential ids read better in trace viewers than std::thread::id hashes
+uint32_t CurrentThreadId() {
+    static std::atomic<uint32_t> nNext(1);
+    thread_local uint32_t nId = nNext++;
+    return nId;
+}
+
+void AtomicMin(std::atomic<int64_t>& a, int64_t v) {
+    int64_t cur = a.load(std::memory_order_relaxed);
+    while (v < cur && !a.compare_exchange_weak(cur, v, std::memory_order_relaxed)) {
+    }
+}
+
+void AtomicMax(std::atomic<int64_t>& a, int64_t v) {
+    int64_t cur = a.load(std::memory_order_relaxed);
+    while (v > cur && !a.compare_exchange_weak(cur, v, std::memory_order_relaxed)) {
+    }
+}
+
+}
+
+const char* PipelineStageName(PipelineStage eStage) {
+    const char* szNames[STAGE_COUNT] = { "demux", "decode", "convert", "effect", "encode", "mux" };
+    return eStage >= 0 && eStage < STAGE_COUNT ? szNames[eStage] : "unknown";
+}
+
+int LatencyHistogram::BucketIndex(int64_t nValue) {
+    if (nValue < 2 * kSubBuckets) {
+        return nValue < 0 ? 0 : (int)nValue;
+    }
+    int nMsb = 63;
+    while (!((uint64_t)nValue >> nMsb)) {
+        nMsb--;
+    }
+    // nValue >> nShift lands in [kSubBuckets, 2 * kSubBuckets)
+    int nShift = nMsb - kSubBucketBits;
+    return nShift * kSubBuckets + (int)(nValue >> nShift);
+}
+
+int64_t LatencyHistogram::BucketLowerBound(int nIndex) {
+    if (nIndex < 2 * kSubBuckets) {
+        return nIndex;
+    }
+    int nShift = nIndex / kSubBuckets - 1;
+    return (int64_t)(nIndex % kSubBuckets + kSubBuckets) << nShift;
+}
+
+void LatencyHistogram::Record(int64_t nValue) {
+    if (nValue < 0) {
+        nValue = 0;
+    }
+    aBuckets[BucketIndex(nValue)].fetch_add(1, std::memory_order_relaxed);
+    nCount.fetch_add(1, std::memory_order_relaxed);
+    nSum.fetch_add(nValue, std::memory_order_relaxed);
+    AtomicMin(nMin, nValue);
+    AtomicMax(nMax, nValue);
+}
+
+void LatencyHistogram::Reset() {
+    for (auto& b : aBuckets) {
+        b.store(0, std::memory_order_relaxed);
+    }
+    nCount = 0;
+    nSum = 0;
+    nMin = INT64_MAX;
+    nMax = 0;
+}
+
+int64_t LatencyHistogram::GetMin() const {
+    int64_t n = nMin.load(std::memory_order_relaxed);
+    return n == INT64_MAX ? 0 : n;
+}
+
+double LatencyHistogram::GetMean() const {
+    int64_t n = GetCount();
+    return n ? (double)nSum.load(std::memory_order_relaxed) / n : 0.0;
+}
+
+int64_t LatencyHistogram::GetPercentile(double dQ) const {
+    int64_t nTotal = 0;
+    for (const auto& b : aBuckets) {
+        nTotal += b.load(std::memory_order_relaxed);
+    }
+    if (!nTotal) {
+        return 0;
+    }
+    int64_t nRank = std::max<int64_t>(1, (int64_t)(dQ * nTotal + 0.5));
+    int64_t nSeen = 0;
+    for (int i = 0; i < kBuckets; i++) {
+        nSeen += aBuckets[i].load(std::memory_order_relaxed);
+        if (nSeen >= nRank) {
+            int64_t nLow = BucketLowerBound(i);
+            int64_t nHigh = i + 1 < kBuckets ? BucketLowerBound(i + 1) : nLow;
+            // exact recorded extremes beat bucket midpoints at the tails
+            return std::min(std::max((nLow + nHigh) / 2, GetMin()), GetMax());
+        }
+    }
+    return GetMax();
+}
+
+Instrumentation& Instrumentation::Get() {
+    static Instrumentation instance;
+    return instance;
+}
+
+Counter& Instrumentation::GetCounter(const char* szName) {
+    std::lock_guard<std::mutex> lock(mtxCounters);
+    for (auto& c : dqCounters) {
+        if (c.first == szName) {
+            return c.second;
+        }
+    }
+    dqCounters.emplace_back(std::piecewise_construct, std::forward_as_tuple(szName), std::forward_as_tuple());
+    return dqCounters.back().second;
+}
+
+void Instrumentation::StartTrace(size_t nMaxEvents) {
+    std::lock_guard<std::mutex> lock(mtxTrace);
+    MpmcRingBuffer<TraceEvent>* p = pEvents.load();
+    if (!p) {
+        // never freed: a producer may still hold the pointer after StopTrace()
+        pEvents = new MpmcRingBuffer<TraceEvent>(nMaxEvents);
+    } else {
+        TraceEvent e;
+        while (p->try_pop(e)) {
+        }
+    }
+    nDroppedEvents.Reset();
+    nTraceStartNs = MonotonicNs();
+    bTracing = true;
+}
+
+void Instrumentation::AddTraceEvent(const char* szName, int64_t nStartNs, int64_t nDurationNs) {
+    MpmcRingBuffer<TraceEvent>* p = pEvents.load(std::memory_order_acquire);
+    if (!p || !p->try_push(TraceEvent{ szName, nStartNs, nDurationNs, CurrentThreadId() })) {
+        nDroppedEvents.Add();
+    }
+}
+
+std::vector<StageSnapshot> Instrumentation::Snapshot() {
+    std::vector<StageSnapshot> v;
+    for (int i = 0; i < STAGE_COUNT; i++) {
+        const LatencyHistogram& h = aStages[i];
+        StageSnapshot s;
+        s.name = PipelineStageName((PipelineStage)i);
+        s.count = h.GetCount();
+        s.mean = h.GetMean();
+        s.min = h.GetMin();
+        s.p50 = h.GetPercentile(0.50);
+        s.p90 = h.GetPercentile(0.90);
+        s.p99 = h.GetPercentile(0.99);
+        s.p999 = h.GetPercentile(0.999);
+        s.max = h.GetMax();
+        v.push_back(s);
+    }
+    return v;
+}
+
+void Instrumentation::Reset() {
+    for (auto& h : aStages) {
+        h.Reset();
+    }
+    std::lock_guard<std::mutex> lock(mtxCounters);
+    for (auto& c : dqCounters) {
+        c.second.Reset();
+    }
+}
+
+std::string Instrumentation::ToJson() {
+    std::ostringstream oss;
+    oss << "{\n  \"unit\": \"ns\",\n  \"stages\": {";
+    bool bFirst = true;
+    for (const StageSnapshot& s : Snapshot()) {
+        oss << (bFirst ? "\n" : ",\n") << "    \"" << s.name << "\": {\"count\": " << s.count
+            << ", \"mean\": " << (int64_t)s.mean << ", \"min\": " << s.min << ", \"p50\": " << s.p50
+            << ", \"p90\": " << s.p90 << ", \"p99\": " << s.p99 << ", \"p999\": " << s.p999
+            << ", \"max\": " << s.max << "}";
+        bFirst = false;
+    }
+    oss << "\n  },\n  \"counters\": {";
+    bFirst = true;
+    {
+        std::lock_guard<std::mutex> lock(mtxCounters);
+        for (auto& c : dqCounters) {
+            // counter names are identifiers chosen in code; no escaping needed
+            oss << (bFirst ? "\n" : ",\n") << "    \"" << c.first << "\": " << c.second.Get();
+            bFirst = false;
+        }
+    }
+    oss << "\n  }\n}\n";
+    return oss.str();
+}
+
+bool Instrumentation::WriteJson(const char* szPath) {
+    std::ofstream file(szPath);
+    file << ToJson();
+    if (!file) {
+        LOG(ERROR) << "Cannot write " << szPath;
+        return false;
+    }
+    return true;
+}
+
+bool Instrumentation::WriteChromeTrace(const char* szPath) {
+    std::ofstream file(szPath);
+    if (!file) {
+        LOG(ERROR) << "Cannot write " << szPath;
+        return false;
+    }
+    // complete ("X") events, microseconds since StartTrace()
+    file << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+    MpmcRingBuffer<TraceEvent>* p = pEvents.load();
+    TraceEvent e;
+    int64_t n = 0;
+    while (p && p->try_pop(e)) {
+        file << (n++ ? ",\n" : "\n") << "{\"name\": \"" << e.szName << "\", \"cat\": \"pipeline\", \"ph\": \"X\", \"ts\": "
+            << (e.nStartNs - nTraceStartNs) / 1000.0 << ", \"dur\": " << e.nDurationNs / 1000.0
+            << ", \"pid\": 1, \"tid\": " << e.nThread << "}";
+    }
+    file << "\n]}\n";
+    if (nDroppedEvents.Get()) {
+        LOG(WARNING) << "Trace buffer full, " << nDroppedEvents.Get() << " events dropped";
+    }
+    return (bool)file;
+}
@@ -0,0 +1,195 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "ring_buffer.h"
+
+/*
+* Hot-path instrumentation: lock-free counters, log-linear latency histograms per pipeline stage
+* and an optional Chrome trace-event recorder. Recording never takes a lock; snapshots and
+* exports may, and are meant for the UI or the end of a run.
+*/
+
+enum PipelineStage {
+    STAGE_DEMUX,
+    STAGE_DECODE,
+    STAGE_CONVERT,
+    STAGE_EFFECT,
+    STAGE_ENCODE,
+    STAGE_MUX,
+    STAGE_COUNT
+};
+
+const char* PipelineStageName(PipelineStage eStage);
+
+/**
+* @brief Nanoseconds on the monotonic clock; only differences are meaningful
+*/
+inline int64_t MonotonicNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+* @brief Relaxed atomic counter on its own cache line
+*/
+class Counter {
+public:
+    void Add(int64_t n = 1) {
+        nValue.fetch_add(n, std::memory_order_relaxed);
+    }
+    int64_t Get() const {
+        return nValue.load(std::memory_order_relaxed);
+    }
+    void Reset() {
+        nValue.store(0, std::memory_order_relaxed);
+    }
+
+private:
+    alignas(CACHE_LINE_SIZE) std::atomic<int64_t> nValue{ 0 };
+};
+
+/**
+* @brief HDR-style histogram of nanosecond values. Values below 64 are exact; above, every power
+* of two is split into 32 linear sub-buckets, so any percentile is within ~3% of the true value
+* over the whole int64 range. Record() is a handful of relaxed atomics.
+*/
+class LatencyHistogram {
+public:
+    static const int kSubBucketBits = 5;
+    static const int kSubBuckets = 1 << kSubBucketBits;
+    static const int kBuckets = (64 - kSubBucketBits) * kSubBuckets;
+
+    void Record(int64_t nValue);
+    void Reset();
+
+    int64_t GetCount() const {
+        return nCount.load(std::memory_order_relaxed);
+    }
+    int64_t GetMin() const;
+    int64_t GetMax() const {
+        return nMax.load(std::memory_order_relaxed);
+    }
+    double GetMean() const;
+    /**
+    * @brief Value at quantile dQ (0..1), the midpoint of the bucket it falls in
+    */
+    int64_t GetPercentile(double dQ) const;
+
+    static int BucketIndex(int64_t nValue);
+    static int64_t BucketLowerBound(int nIndex);
+
+private:
+    std::atomic<uint64_t> aBuckets[kBuckets] = {};
+    std::atomic<int64_t> nCount{ 0 };
+    std::atomic<int64_t> nSum{ 0 };
+    std::atomic<int64_t> nMin{ INT64_MAX };
+    std::atomic<int64_t> nMax{ 0 };
+};
+
+struct StageSnapshot {
+    std::string name;
+    int64_t count = 0;
+    // nanoseconds
+    double mean = 0.0;
+    int64_t min = 0;
+    int64_t p50 = 0;
+    int64_t p90 = 0;
+    int64_t p99 = 0;
+    int64_t p999 = 0;
+    int64_t max = 0;
+};
+
+/**
+* @brief Process-wide registry of stage histograms, named counters and trace events
+*/
+class Instrumentation {
+public:
+    static Instrumentation& Get();
+
+    /**
+    * @brief One sample of eStage: nDurationNs long, starting at nStartNs (MonotonicNs() time)
+    */
+    void Record(PipelineStage eStage, int64_t nStartNs, int64_t nDurationNs) {
+        aStages[eStage].Record(nDurationNs);
+        if (bTracing.load(std::memory_order_relaxed)) {
+            AddTraceEvent(PipelineStageName(eStage), nStartNs, nDurationNs);
+        }
+    }
+    LatencyHistogram& GetHistogram(PipelineStage eStage) {
+        return aStages[eStage];
+    }
+    /**
+    * @brief Named counter, created on first use. Look it up once and keep the reference.
+    */
+    Counter& GetCounter(const char* szName);
+
+    /**
+    * @brief Starts buffering trace events, up to nMaxEvents; later events are counted and dropped.
+    * The buffer is allocated by the first call and reused afterwards.
+    */
+    void StartTrace(size_t nMaxEvents = 1 << 20);
+    void StopTrace() {
+        bTracing = false;
+    }
+    void AddTraceEvent(const char* szName, int64_t nStartNs, int64_t nDurationNs);
+
+    std::vector<StageSnapshot> Snapshot();
+    void Reset();
+
+    /**
+    * @brief Stage percentiles and counters as a JSON object
+    */
+    std::string ToJson();
+    bool WriteJson(const char* szPath);
+    /**
+    * @brief Drains the buffered events into a Chrome trace-event file (chrome://tracing, Perfetto)
+    */
+    bool WriteChromeTrace(const char* szPath);
+
+private:
+    Instrumentation() {}
+    Instrumentation(const Instrumentation&) = delete;
+    Instrumentation& operator=(const Instrumentation&) = delete;
+
+    struct TraceEvent {
+        // static string: stage names and string literals only
+        const char* szName;
+        int64_t nStartNs;
+        int64_t nDurationNs;
+        uint32_t nThread;
+    };
+
+    LatencyHistogram aStages[STAGE_COUNT];
+
+    std::mutex mtxCounters;
+    std::deque<std::pair<std::string, Counter>> dqCounters;
+
+    std::atomic<bool> bTracing{ false };
+    std::mutex mtxTrace;
+    std::atomic<MpmcRingBuffer<TraceEvent>*> pEvents{ nullptr };
+    Counter nDroppedEvents;
+    int64_t nTraceStartNs = 0;
+};
+
+/**
+* @brief Records the lifetime of the scope as one sample of a stage
+*/
+class ScopedTimer {
+public:
+    explicit ScopedTimer(PipelineStage eStage) : eStage(eStage), nStart(MonotonicNs()) {}
+    ~ScopedTimer() {
+        Instrumentation::Get().Record(eStage, nStart, MonotonicNs() - nStart);
+    }
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+private:
+    PipelineStage eStage;
+    int64_t nStart;
+};
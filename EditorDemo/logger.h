@@ -16,8 +16,18 @@
 #include <string>
 #include <sstream>
 #include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <string.h>
 #include <time.h>
 
+#include "ring_buffer.h"
+
 #ifdef _WIN32
 #include <winsock.h>
 #include <windows.h>
@@ -41,6 +51,14 @@ enum LogLevel {
     FATAL
 };
 
+/*
+* Statements below LOG_MIN_LEVEL compile to nothing, arguments included. Release builds can
+* define LOG_MIN_LEVEL=INFO to strip LOG(TRACE) from hot loops entirely.
+*/
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL TRACE
+#endif
+
 namespace simplelogger{
 class Logger {
 public:
@@ -52,20 +70,32 @@ public:
         return l >= level;
     }
     char* GetLead(LogLevel l, const char *szFile, int nLine, const char *szFunc) {
+        FormatLead(l, time(NULL), szLead);
+        return szLead;
+    }
+    /**
+    * @brief Writes the line prefix into szBuf (80 bytes). localtime only runs when the second changes;
+    * callers serialize, either through the critical section or by being the single async writer.
+    */
+    int FormatLead(LogLevel l, time_t t, char *szBuf) {
         if (l < TRACE || l > FATAL) {
-            sprintf(szLead, "[?????] ");
-            return szLead;
+            return sprintf(szBuf, "[?????] ");
         }
         const char *szLevels[] = {"TRACE", "INFO", "WARN", "ERROR", "FATAL"};
-        if (bPrintTimeStamp) {
-            time_t t = time(NULL);
-            struct tm *ptm = localtime(&t);
-            sprintf(szLead, "[%-5s][%02d:%02d:%02d] ", 
-                szLevels[l], ptm->tm_hour, ptm->tm_min, ptm->tm_sec);
-        } else {
-            sprintf(szLead, "[%-5s] ", szLevels[l]);
+        if (!bPrintTimeStamp) {
+            return sprintf(szBuf, "[%-5s] ", szLevels[l]);
         }
-        return szLead;
+        if (t != tCached) {
+            struct tm tmLocal;
+#ifdef _WIN32
+            localtime_s(&tmLocal, &t);
+#else
+            localtime_r(&t, &tmLocal);
+#endif
+            sprintf(szTime, "%02d:%02d:%02d", tmLocal.tm_hour, tmLocal.tm_min, tmLocal.tm_sec);
+            tCached = t;
+        }
+        return sprintf(szBuf, "[%-5s][%s] ", szLevels[l], szTime);
     }
     void EnterCriticalSection() {
         mtx.lock();
@@ -73,11 +103,246 @@ public:
     void LeaveCriticalSection() {
         mtx.unlock();
     }
+
+    /**
+    * @brief Async loggers take finished lines through Submit() instead of the shared stream
+    */
+    virtual bool IsAsync() {
+        return false;
+    }
+    virtual void Submit(LogLevel l, const char *pText, size_t nLength) {}
+    /**
+    * @brief Returns once every line logged so far has reached the output
+    */
+    virtual void Flush() {}
 private:
     LogLevel level;
     char szLead[80];
     bool bPrintTimeStamp;
     std::mutex mtx;
+    time_t tCached = -1;
+    char szTime[16] = {};
+};
+
+/**
+* @brief Logger decorator that moves formatting of the lead and all I/O to a background thread.
+* Each logging thread owns a lock-free SPSC ring of fixed-size records, so the logging call never
+* takes a lock or allocates. The writer drains all rings, orders the records by time, and hands
+* them to the sink in batches: one stream write and one FlushStream() (one datagram for
+* UdpLogger) per batch instead of per line.
+*/
+class AsyncLogger : public Logger {
+public:
+    AsyncLogger(Logger *pSink, LogLevel level, size_t nRecordsPerThread = 1024)
+        : Logger(level, false), pSink(pSink), nRecordsPerThread(nRecordsPerThread),
+        nId(NextId()), writer(&AsyncLogger::WriterThread, this) {}
+    ~AsyncLogger() {
+        bStop = true;
+        cvWake.notify_all();
+        writer.join();
+        delete pSink;
+    }
+    std::ostream& GetStream() {
+        // only reached through the synchronous path; async lines go through Submit()
+        return pSink->GetStream();
+    }
+    bool IsAsync() {
+        return true;
+    }
+
+    void Submit(LogLevel l, const char *pText, size_t nLength) {
+        ThreadBuffer *pBuffer = GetThreadBuffer();
+        Record rec;
+        rec.level = l;
+        rec.nTime = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        // long lines are split over several records and joined again by the writer
+        do {
+            size_t n = std::min(nLength, sizeof(rec.szText));
+            memcpy(rec.szText, pText, n);
+            rec.nLength = (uint16_t)n;
+            pText += n;
+            nLength -= n;
+            rec.bContinued = nLength > 0;
+            if (!pBuffer->ring.try_push(rec)) {
+                cvWake.notify_one();
+                pBuffer->ring.push(rec);
+            }
+        } while (nLength);
+        if (l >= ERROR) {
+            cvWake.notify_one();
+        }
+    }
+
+    void Flush() {
+        std::unique_lock<std::mutex> lock(mtxFlush);
+        uint64_t nTarget = ++nFlushRequested;
+        cvWake.notify_all();
+        cvFlushed.wait(lock, [&]() { return nFlushDone >= nTarget || bStop; });
+    }
+
+private:
+    struct Record {
+        int64_t nTime;
+        LogLevel level;
+        uint16_t nLength;
+        bool bContinued;
+        char szText[236];
+    };
+    struct ThreadBuffer {
+        ThreadBuffer(size_t nSize) : ring(nSize) {}
+        SpscRingBuffer<Record> ring;
+        // set when the owning thread exits; the writer drops the buffer once drained
+        std::atomic<bool> bExited{false};
+        // partial line carried over when a batch ends inside a split record
+        std::string strPending;
+    };
+    struct ThreadSlot {
+        uint64_t nOwner = 0;
+        std::shared_ptr<ThreadBuffer> pBuffer;
+        ~ThreadSlot() {
+            if (pBuffer) {
+                pBuffer->bExited = true;
+            }
+        }
+    };
+    struct Line {
+        int64_t nTime;
+        LogLevel level;
+        std::string strText;
+    };
+
+    static uint64_t NextId() {
+        static std::atomic<uint64_t> nNext(1);
+        return nNext++;
+    }
+
+    ThreadBuffer *GetThreadBuffer() {
+        // keyed by logger id rather than address, so a new logger never inherits stale buffers
+        thread_local ThreadSlot slot;
+        if (slot.nOwner != nId) {
+            if (slot.pBuffer) {
+                slot.pBuffer->bExited = true;
+            }
+            slot.pBuffer = std::make_shared<ThreadBuffer>(nRecordsPerThread);
+            slot.nOwner = nId;
+            std::lock_guard<std::mutex> lock(mtxBuffers);
+            vBuffers.push_back(slot.pBuffer);
+        }
+        return slot.pBuffer.get();
+    }
+
+    // drains every ring once; returns the number of records taken
+    size_t Collect(std::vector<Line> &vLines) {
+        std::vector<std::shared_ptr<ThreadBuffer>> vSnapshot;
+        {
+            std::lock_guard<std::mutex> lock(mtxBuffers);
+            vSnapshot = vBuffers;
+        }
+        size_t nRecords = 0;
+        Record aRecords[64];
+        for (auto &p : vSnapshot) {
+            size_t n;
+            while ((n = p->ring.try_pop_many(aRecords, 64)) > 0) {
+                nRecords += n;
+                for (size_t i = 0; i < n; i++) {
+                    Record &rec = aRecords[i];
+                    p->strPending.append(rec.szText, rec.nLength);
+                    if (!rec.bContinued) {
+                        vLines.push_back({rec.nTime, rec.level, std::move(p->strPending)});
+                        p->strPending.clear();
+                    }
+                }
+            }
+        }
+        return nRecords;
+    }
+
+    void RemoveExited() {
+        std::lock_guard<std::mutex> lock(mtxBuffers);
+        vBuffers.erase(std::remove_if(vBuffers.begin(), vBuffers.end(), [](const std::shared_ptr<ThreadBuffer> &p) {
+            return p->bExited && p->ring.empty();
+        }), vBuffers.end());
+    }
+
+    void Write(std::vector<Line> &vLines) {
+        // each ring is in order already; the merge restores order across threads
+        std::stable_sort(vLines.begin(), vLines.end(), [](const Line &a, const Line &b) { return a.nTime < b.nTime; });
+        const size_t nMaxBatch = 8192;
+        char szLead[80];
+        bool bUrgent = false;
+        for (Line &line : vLines) {
+            int n = pSink->FormatLead(line.level, (time_t)(line.nTime / 1000000), szLead);
+            strBatch.append(szLead, n);
+            strBatch += line.strText;
+            strBatch += '\n';
+            bUrgent |= line.level >= ERROR;
+            if (strBatch.size() >= nMaxBatch) {
+                EmitBatch();
+            }
+        }
+        EmitBatch();
+        if (bUrgent) {
+            pSink->GetStream().flush();
+        }
+        vLines.clear();
+    }
+
+    void EmitBatch() {
+        if (strBatch.empty()) {
+            return;
+        }
+        pSink->GetStream().write(strBatch.data(), strBatch.size());
+        pSink->FlushStream();
+        strBatch.clear();
+    }
+
+    void WriterThread() {
+        std::vector<Line> vLines;
+        for (;;) {
+            uint64_t nFlushSeen;
+            bool bFlush;
+            {
+                std::unique_lock<std::mutex> lock(mtxFlush);
+                cvWake.wait_for(lock, std::chrono::milliseconds(5),
+                    [&]() { return bStop || nFlushRequested > nFlushDone; });
+                nFlushSeen = nFlushRequested;
+                bFlush = nFlushRequested > nFlushDone;
+            }
+            bool bStopping = bStop;
+            // keep draining until the rings are empty so a flush covers lines logged before it
+            while (Collect(vLines)) {
+                Write(vLines);
+            }
+            RemoveExited();
+            if (bFlush) {
+                pSink->GetStream().flush();
+                std::lock_guard<std::mutex> lock(mtxFlush);
+                nFlushDone = nFlushSeen;
+                cvFlushed.notify_all();
+            }
+            if (bStopping) {
+                pSink->GetStream().flush();
+                break;
+            }
+        }
+    }
+
+private:
+    Logger *pSink;
+    size_t nRecordsPerThread;
+    uint64_t nId;
+
+    std::mutex mtxBuffers;
+    std::vector<std::shared_ptr<ThreadBuffer>> vBuffers;
+    std::string strBatch;
+
+    std::mutex mtxFlush;
+    std::condition_variable cvWake, cvFlushed;
+    uint64_t nFlushRequested = 0, nFlushDone = 0;
+    std::atomic<bool> bStop{false};
+
+    std::thread writer;
 };
 
 class LoggerFactory {
@@ -94,6 +359,12 @@ public:
             bool bPrintTimeStamp = true) {
         return new UdpLogger(szHost, uPort, level, bPrintTimeStamp);
     }
+    /**
+    * @brief Wraps pSink (from one of the factories above) in an AsyncLogger that takes ownership of it
+    */
+    static Logger* CreateAsyncLogger(Logger *pSink, LogLevel level = INFO, size_t nRecordsPerThread = 1024) {
+        return new AsyncLogger(pSink, level, nRecordsPerThread);
+    }
 private:
     LoggerFactory() {}
 
@@ -165,7 +436,11 @@ private:
 #endif
             }
             void Flush() {
-                if (sendto(socket, sb.str().c_str(), (int)sb.str().length() + 1, 
+                std::string str = sb.str();
+                if (str.empty()) {
+                    return;
+                }
+                if (sendto(socket, str.c_str(), (int)str.length() + 1, 
                         0, (struct sockaddr *)&server, (int)sizeof(sockaddr_in)) == -1) {
                     fprintf(stderr, "sendto() failed.\n");
                 }
@@ -191,6 +466,11 @@ private:
     };
 };
 
+/**
+* @brief Collects one line. Synchronous loggers write straight to their stream inside the
+* critical section; async loggers get the finished line through Submit().
+* Only created through LOG(), which skips construction entirely for disabled levels.
+*/
 class LogTransaction {
 public:
     LogTransaction(Logger *pLogger, LogLevel level, const char *szFile, const int nLine, const char *szFunc) : pLogger(pLogger), level(level) {
@@ -198,7 +478,8 @@ public:
             std::cout << "[-----] ";
             return;
         }
-        if (!pLogger->ShouldLogFor(level)) {
+        if (pLogger->IsAsync()) {
+            pLine = AcquireLine();
             return;
         }
         pLogger->EnterCriticalSection();
@@ -206,13 +487,23 @@ public:
     }
     ~LogTransaction() {
         if (!pLogger) {
-            std::cout << std::endl;
+            std::cout << '\n';
             return;
         }
-        if (!pLogger->ShouldLogFor(level)) {
+        if (pLine) {
+            pLogger->Submit(level, pLine->Data(), pLine->Size());
+            ReleaseLine(pLine);
+            if (level == FATAL) {
+                pLogger->Flush();
+                exit(1);
+            }
             return;
         }
-        pLogger->GetStream() << std::endl;
+        // no std::endl: the stream is only flushed for errors, not on every line
+        pLogger->GetStream() << '\n';
+        if (level >= ERROR) {
+            pLogger->GetStream().flush();
+        }
         pLogger->FlushStream();
         pLogger->LeaveCriticalSection();
         if (level == FATAL) {
@@ -223,18 +514,88 @@ public:
         if (!pLogger) {
             return std::cout;
         }
-        if (!pLogger->ShouldLogFor(level)) {
-            return ossNull;
+        if (pLine) {
+            return pLine->stream;
         }
         return pLogger->GetStream();
     }
 private:
+    /**
+    * @brief Reusable per-thread line buffer; keeps its capacity, so steady-state logging does not allocate
+    */
+    class LineBuffer : public std::streambuf {
+    public:
+        LineBuffer() : stream(this) {
+            vBuf.resize(256);
+            Clear();
+        }
+        void Clear() {
+            setp(vBuf.data(), vBuf.data() + vBuf.size());
+        }
+        const char* Data() {
+            return pbase();
+        }
+        size_t Size() {
+            return pptr() - pbase();
+        }
+        std::ostream stream;
+        bool bInUse = false;
+    protected:
+        int_type overflow(int_type ch) {
+            size_t n = Size();
+            vBuf.resize(vBuf.size() * 2);
+            setp(vBuf.data(), vBuf.data() + vBuf.size());
+            pbump((int)n);
+            if (ch != traits_type::eof()) {
+                *pptr() = (char)ch;
+                pbump(1);
+            }
+            return traits_type::not_eof(ch);
+        }
+    private:
+        std::vector<char> vBuf;
+    };
+
+    static LineBuffer& ThreadLine() {
+        thread_local LineBuffer line;
+        return line;
+    }
+    static LineBuffer* AcquireLine() {
+        LineBuffer &line = ThreadLine();
+        // a LOG() evaluated while building another line's arguments gets its own buffer
+        LineBuffer *p = line.bInUse ? new LineBuffer() : &line;
+        p->bInUse = true;
+        p->Clear();
+        p->stream.clear();
+        return p;
+    }
+    static void ReleaseLine(LineBuffer *p) {
+        if (p == &ThreadLine()) {
+            p->bInUse = false;
+        } else {
+            delete p;
+        }
+    }
+
     Logger *pLogger;
     LogLevel level;
-    std::ostringstream ossNull;
+    LineBuffer *pLine = nullptr;
+};
+
+/**
+* @brief Swallows the stream so both branches of the LOG() conditional are void
+*/
+struct LogVoidify {
+    void operator&(std::ostream&) {}
 };
 
+inline bool ShouldLog(Logger *pLogger, LogLevel level) {
+    return level >= LOG_MIN_LEVEL && (!pLogger || pLogger->ShouldLogFor(level));
+}
+
 }
 
 extern simplelogger::Logger *logger;
-#define LOG(level) simplelogger::LogTransaction(logger, level, __FILE__, __LINE__, __FUNCTION__).GetStream()
+// Disabled levels evaluate neither the LogTransaction nor the streamed arguments
+#define LOG(level) !simplelogger::ShouldLog(logger, level) ? (void)0 : \
+    simplelogger::LogVoidify() & simplelogger::LogTransaction(logger, level, __FILE__, __LINE__, __FUNCTION__).GetStream()
@@ -1,10 +1,17 @@
 #include "editor_demo.h"
 #include <QtWidgets/QApplication>
+#include "logger.h"
+
+// Log I/O runs on a background thread so decode and export threads never block on the console
+simplelogger::Logger* logger = simplelogger::LoggerFactory::CreateAsyncLogger(
+    simplelogger::LoggerFactory::CreateConsoleLogger());
 
 int main(int argc, char *argv[])
 {
     QApplication a(argc, argv);
     EditorDemo w;
     w.show();
-    return a.exec();
+    int ret = a.exec();
+    logger->Flush();
+    return ret;
 }
@@ -0,0 +1,127 @@
+#include "memory_input.h"
+
+namespace {
+// AVIO only needs a small bounce buffer: with direct mode reads bypass it
+const int kAvioBufferSize = 64 * 1024;
+// once this much has been consumed, pages behind the read position are released
+const uint64_t kReleaseWindow = 64ull << 20;
+// read-ahead hint issued after every seek
+const uint64_t kSeekReadAhead = 4ull << 20;
+}
+
+MemoryInput::MemoryInput(const char* szFilePath)
+{
+	pReader = new BufferedFileReader(szFilePath);
+	uint8_t* p = nullptr;
+	if (!pReader->GetBuffer(&p, &nSize)) {
+		LOG(WARNING) << "Unable to map " << szFilePath;
+		return;
+	}
+	pBuf = p;
+}
+
+MemoryInput::MemoryInput(const uint8_t* pBuf, uint64_t nSize) : pBuf(pBuf), nSize(nSize)
+{
+}
+
+MemoryInput::~MemoryInput()
+{
+	if (avioc) {
+		av_freep(&avioc->buffer);
+		avio_context_free(&avioc);
+	}
+	delete pReader;
+}
+
+int MemoryInput::ReadPacket(void* opaque, uint8_t* buf, int buf_size)
+{
+	MemoryInput* pInput = static_cast<MemoryInput*>(opaque);
+	if (pInput->nPos >= pInput->nSize) {
+		return AVERROR_EOF;
+	}
+	uint64_t n = pInput->nSize - pInput->nPos;
+	if (n > (uint64_t)buf_size) {
+		n = (uint64_t)buf_size;
+	}
+	memcpy(buf, pInput->pBuf + pInput->nPos, (size_t)n);
+	pInput->nPos += n;
+
+	if (pInput->pReader && pInput->nPos > pInput->nReleased + 2 * kReleaseWindow) {
+		// keep one window behind the read position resident for short backward seeks
+		uint64_t nEnd = pInput->nPos - kReleaseWindow;
+		pInput->pReader->DontNeed(pInput->nReleased, nEnd - pInput->nReleased);
+		pInput->nReleased = nEnd;
+	}
+	return (int)n;
+}
+
+int64_t MemoryInput::Seek(void* opaque, int64_t offset, int whence)
+{
+	MemoryInput* pInput = static_cast<MemoryInput*>(opaque);
+	int64_t nNew;
+	switch (whence & ~AVSEEK_FORCE) {
+	case AVSEEK_SIZE:
+		return (int64_t)pInput->nSize;
+	case SEEK_SET:
+		nNew = offset;
+		break;
+	case SEEK_CUR:
+		nNew = (int64_t)pInput->nPos + offset;
+		break;
+	case SEEK_END:
+		nNew = (int64_t)pInput->nSize + offset;
+		break;
+	default:
+		return AVERROR(EINVAL);
+	}
+	if (nNew < 0 || (uint64_t)nNew > pInput->nSize) {
+		return AVERROR(EINVAL);
+	}
+	pInput->nPos = (uint64_t)nNew;
+	if (pInput->pReader) {
+		pInput->pReader->WillNeed(pInput->nPos, kSeekReadAhead);
+		if (pInput->nPos < pInput->nReleased) {
+			pInput->nReleased = pInput->nPos;
+		}
+	}
+	return nNew;
+}
+
+AVIOContext* MemoryInput::GetAVIOContext()
+{
+	if (avioc || !pBuf) {
+		return avioc;
+	}
+	uint8_t* pAvioBuf = (uint8_t*)av_malloc(kAvioBufferSize);
+	if (!pAvioBuf) {
+		return nullptr;
+	}
+	avioc = avio_alloc_context(pAvioBuf, kAvioBufferSize, 0, this, ReadPacket, nullptr, Seek);
+	if (!avioc) {
+		av_free(pAvioBuf);
+		return nullptr;
+	}
+	// large reads go straight from the mapping into the caller's buffer
+	avioc->direct = 1;
+	return avioc;
+}
+
+AVFormatContext* MemoryInput::OpenFormatContext(const char* szUrl)
+{
+	AVIOContext* pb = GetAVIOContext();
+	if (!pb) {
+		return nullptr;
+	}
+	AVFormatContext* ctx = avformat_alloc_context();
+	if (!ctx) {
+		return nullptr;
+	}
+	ctx->pb = pb;
+	ctx->flags |= AVFMT_FLAG_CUSTOM_IO;
+	// avformat_open_input frees ctx on failure
+	if (avformat_open_input(&ctx, szUrl ? szUrl : "", nullptr, nullptr) < 0) {
+		LOG(ERROR) << "avformat_open_input failed on memory input";
+		return nullptr;
+	}
+	return ctx;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+extern "C" {
+#include <libavformat/avformat.h>
+}
+
+#include "utils.h"
+
+/**
+* @brief Custom AVIOContext reading from memory: a memory-mapped file or a caller-owned buffer.
+* The demuxer copies straight from the mapping into packet buffers, with no stdio buffering in between.
+*/
+class MemoryInput
+{
+private:
+	BufferedFileReader* pReader = nullptr;
+	const uint8_t* pBuf = nullptr;
+	uint64_t nSize = 0;
+	uint64_t nPos = 0;
+	// consumed bytes below this offset have been released from the resident set
+	uint64_t nReleased = 0;
+	AVIOContext* avioc = nullptr;
+
+	static int ReadPacket(void* opaque, uint8_t* buf, int buf_size);
+	static int64_t Seek(void* opaque, int64_t offset, int whence);
+
+public:
+	/**
+	* @brief Maps szFilePath read-only
+	*/
+	explicit MemoryInput(const char* szFilePath);
+	/**
+	* @brief Wraps pBuf, which must stay valid for the lifetime of this object
+	*/
+	MemoryInput(const uint8_t* pBuf, uint64_t nSize);
+	MemoryInput(const MemoryInput&) = delete;
+	MemoryInput& operator=(const MemoryInput&) = delete;
+	~MemoryInput();
+
+	bool IsValid() {
+		return pBuf != nullptr;
+	}
+	AVIOContext* GetAVIOContext();
+	/**
+	* @brief Opens a demuxer on this input. szUrl only names the input (e.g. for the packet index sidecar)
+	* and may be nullptr. The input must outlive the returned context.
+	*/
+	AVFormatContext* OpenFormatContext(const char* szUrl);
+};
@@ -0,0 +1,185 @@
+#include "packet_index.h"
+
+#include <algorithm>
+#include <fstream>
+#include "utils.h"
+
+namespace {
+
+#pragma pack(push, 1)
+struct SidecarHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t media_size;
+	int64_t media_mtime;
+	int32_t tb_num;
+	int32_t tb_den;
+	uint64_t count;
+};
+#pragma pack(pop)
+
+const uint32_t kSidecarMagic = MAKE_FOURCC('V', 'I', 'D', 'X');
+const uint32_t kSidecarVersion = 1;
+
+}
+
+bool PacketIndex::GetMediaIdentity(const char* szMediaPath, uint64_t* pnSize, int64_t* pnMtime)
+{
+	struct _stat64 st;
+	if (_stat64(szMediaPath, &st) != 0) {
+		return false;
+	}
+	*pnSize = (uint64_t)st.st_size;
+	*pnMtime = (int64_t)st.st_mtime;
+	return true;
+}
+
+void PacketIndex::Finalize()
+{
+	keyframes.clear();
+	presentation_pts.clear();
+	presentation_pts.reserve(entries.size());
+	for (int i = 0; i < (int)entries.size(); i++) {
+		if (entries[i].IsKeyframe()) {
+			keyframes.push_back(i);
+		}
+		int64_t pts = entries[i].PresentationTimestamp();
+		if (pts != AV_NOPTS_VALUE) {
+			presentation_pts.push_back(pts);
+		}
+	}
+	std::sort(presentation_pts.begin(), presentation_pts.end());
+}
+
+int PacketIndex::Build(AVFormatContext* fmtc, int stream_index)
+{
+	entries.clear();
+	time_base = fmtc->streams[stream_index]->time_base;
+
+	// Let the demuxer drop the other streams as early as it can
+	std::vector<AVDiscard> discard(fmtc->nb_streams);
+	for (unsigned i = 0; i < fmtc->nb_streams; i++) {
+		discard[i] = fmtc->streams[i]->discard;
+		if ((int)i != stream_index) {
+			fmtc->streams[i]->discard = AVDISCARD_ALL;
+		}
+	}
+
+	AVPacket* pkt = av_packet_alloc();
+	if (!pkt) {
+		LOG(ERROR) << "AVPacket allocation failed";
+		return AVERROR(ENOMEM);
+	}
+	int ret;
+	while ((ret = av_read_frame(fmtc, pkt)) >= 0) {
+		if (pkt->stream_index == stream_index) {
+			PacketIndexEntry e;
+			e.pts = pkt->pts;
+			e.dts = pkt->dts;
+			e.pos = pkt->pos;
+			e.size = pkt->size;
+			e.flags = (uint8_t)pkt->flags;
+			entries.push_back(e);
+		}
+		av_packet_unref(pkt);
+	}
+	av_packet_free(&pkt);
+
+	for (unsigned i = 0; i < fmtc->nb_streams; i++) {
+		fmtc->streams[i]->discard = discard[i];
+	}
+
+	if (ret != AVERROR_EOF) {
+		LOG(ERROR) << "Packet index scan stopped early: " << ret;
+	}
+
+	// Rewind so the caller can decode from the start
+	if (av_seek_frame(fmtc, -1, fmtc->start_time != AV_NOPTS_VALUE ? fmtc->start_time : 0, AVSEEK_FLAG_BACKWARD) < 0) {
+		av_seek_frame(fmtc, -1, 0, AVSEEK_FLAG_BYTE);
+	}
+
+	Finalize();
+	LOG(INFO) << "Indexed " << entries.size() << " packets, " << keyframes.size() << " keyframes";
+	return entries.empty() ? AVERROR_INVALIDDATA : 0;
+}
+
+bool PacketIndex::Save(const char* szIndexPath, const char* szMediaPath)
+{
+	SidecarHeader header = {};
+	if (!GetMediaIdentity(szMediaPath, &header.media_size, &header.media_mtime)) {
+		return false;
+	}
+	header.magic = kSidecarMagic;
+	header.version = kSidecarVersion;
+	header.tb_num = time_base.num;
+	header.tb_den = time_base.den;
+	header.count = entries.size();
+
+	std::ofstream fpOut(szIndexPath, std::ios::out | std::ios::binary);
+	if (!fpOut) {
+		LOG(WARNING) << "Unable to write packet index: " << szIndexPath;
+		return false;
+	}
+	fpOut.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	fpOut.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(PacketIndexEntry));
+	return fpOut.good();
+}
+
+bool PacketIndex::Load(const char* szIndexPath, const char* szMediaPath)
+{
+	uint64_t nSize;
+	int64_t nMtime;
+	if (!GetMediaIdentity(szMediaPath, &nSize, &nMtime)) {
+		return false;
+	}
+
+	std::ifstream fpIn(szIndexPath, std::ios::in | std::ios::binary);
+	if (!fpIn) {
+		return false;
+	}
+	SidecarHeader header;
+	if (!fpIn.read(reinterpret_cast<char*>(&header), sizeof(header))
+		|| header.magic != kSidecarMagic || header.version != kSidecarVersion
+		|| header.media_size != nSize || header.media_mtime != nMtime) {
+		return false;
+	}
+
+	// a truncated or corrupt sidecar must not size the allocation
+	std::streamoff nHeaderEnd = fpIn.tellg();
+	fpIn.seekg(0, std::ios::end);
+	uint64_t nRemaining = (uint64_t)(fpIn.tellg() - nHeaderEnd);
+	if (header.count > nRemaining / sizeof(PacketIndexEntry)) {
+		LOG(WARNING) << "Packet index " << szIndexPath << " is truncated, ignoring it";
+		return false;
+	}
+	fpIn.seekg(nHeaderEnd);
+	entries.resize((size_t)header.count);
+	if (!fpIn.read(reinterpret_cast<char*>(entries.data()), entries.size() * sizeof(PacketIndexEntry))) {
+		entries.clear();
+		return false;
+	}
+	time_base = AVRational{ header.tb_num, header.tb_den };
+	Finalize();
+	return true;
+}
+
+int PacketIndex::FindFrame(int64_t pts) const
+{
+	auto it = std::lower_bound(presentation_pts.begin(), presentation_pts.end(), pts);
+	return it != presentation_pts.end() ? (int)(it - presentation_pts.begin()) : -1;
+}
+
+const PacketIndexEntry* PacketIndex::FindKeyframe(int64_t pts) const
+{
+	if (keyframes.empty()) {
+		return nullptr;
+	}
+	// keyframe pts grows monotonically in decode order
+	auto it = std::upper_bound(keyframes.begin(), keyframes.end(), pts,
+		[this](int64_t t, int k) { return t < entries[k].PresentationTimestamp(); });
+	if (it == keyframes.begin()) {
+		return &entries[keyframes.front()];
+	}
+	return &entries[*(it - 1)];
+}
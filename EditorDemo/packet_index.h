@@ -0,0 +1,105 @@
+#pragma once
+
+extern "C" {
+#include <libavformat/avformat.h>
+}
+
+#include <vector>
+#include <string>
+
+#pragma pack(push, 1)
+/**
+* @brief One demuxed packet of the indexed stream, in decode order
+*/
+struct PacketIndexEntry
+{
+	int64_t pts;
+	int64_t dts;
+	int64_t pos;
+	int32_t size;
+	uint8_t flags;      // AV_PKT_FLAG_*
+
+	bool IsKeyframe() const {
+		return (flags & AV_PKT_FLAG_KEY) != 0;
+	}
+	// dts when the container provides it, pts otherwise
+	int64_t DecodeTimestamp() const {
+		return dts != AV_NOPTS_VALUE ? dts : pts;
+	}
+	// pts, or dts for streams that carry no pts (AVI, raw elementary streams)
+	int64_t PresentationTimestamp() const {
+		return pts != AV_NOPTS_VALUE ? pts : dts;
+	}
+};
+#pragma pack(pop)
+
+/**
+* @brief Packet/GOP index of a single stream, built in one demux-only pass and cached in a binary sidecar
+*/
+class PacketIndex
+{
+private:
+	std::vector<PacketIndexEntry> entries;
+	// positions in entries of the keyframes, in decode order
+	std::vector<int> keyframes;
+	// pts of every packet sorted into presentation order, so frame n has pts presentation_pts[n]
+	std::vector<int64_t> presentation_pts;
+	AVRational time_base = { 0, 1 };
+
+	void Finalize();
+
+public:
+	/**
+	* @brief Reads every packet of stream_index without decoding, then rewinds fmtc to the start
+	*/
+	int Build(AVFormatContext* fmtc, int stream_index);
+	/**
+	* @brief Writes the index to szIndexPath, tagged with the size and mtime of szMediaPath
+	*/
+	bool Save(const char* szIndexPath, const char* szMediaPath);
+	/**
+	* @brief Loads a sidecar, rejecting it if szMediaPath changed since it was written
+	*/
+	bool Load(const char* szIndexPath, const char* szMediaPath);
+
+	static std::string SidecarPath(const char* szMediaPath) {
+		return std::string(szMediaPath) + ".vidx";
+	}
+	/**
+	* @brief Size and modification time of a media file, used to invalidate derived caches
+	*/
+	static bool GetMediaIdentity(const char* szMediaPath, uint64_t* pnSize, int64_t* pnMtime);
+
+	bool Empty() const {
+		return entries.empty();
+	}
+	int GetFrameCount() const {
+		return (int)presentation_pts.size();
+	}
+	AVRational GetTimeBase() const {
+		return time_base;
+	}
+	const std::vector<PacketIndexEntry>& GetEntries() const {
+		return entries;
+	}
+	const std::vector<int>& GetKeyframes() const {
+		return keyframes;
+	}
+	/**
+	* @brief pts of the n-th frame in presentation order, AV_NOPTS_VALUE if out of range
+	*/
+	int64_t GetFramePts(int n) const {
+		if (n < 0 || n >= (int)presentation_pts.size()) {
+			return AV_NOPTS_VALUE;
+		}
+		return presentation_pts[n];
+	}
+	/**
+	* @brief Presentation number of the first frame with pts >= pts, -1 if pts is past the last frame
+	*/
+	int FindFrame(int64_t pts) const;
+	/**
+	* @brief Last keyframe with pts (dts where pts is missing) <= pts, or the first keyframe if pts precedes all of them
+	*/
+	const PacketIndexEntry* FindKeyframe(int64_t pts) const;
+};
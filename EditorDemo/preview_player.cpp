@@ -0,0 +1,400 @@
+#include "preview_player.h"
+
+extern "C" {
+#include <libavutil/pixdesc.h>
+#include <libswscale/swscale.h>
+}
+
+#define SDL_MAIN_HANDLED
+#include <SDL.h>
+
+namespace {
+
+struct SkipLevel
+{
+	AVDiscard skip_frame;
+	AVDiscard skip_loop_filter;
+};
+
+const SkipLevel kSkipLevels[] = {
+	{ AVDISCARD_DEFAULT, AVDISCARD_DEFAULT },
+	{ AVDISCARD_DEFAULT, AVDISCARD_NONREF },
+	{ AVDISCARD_NONREF, AVDISCARD_ALL },
+	{ AVDISCARD_NONKEY, AVDISCARD_ALL },
+};
+const int kMaxSkipLevel = sizeof(kSkipLevels) / sizeof(kSkipLevels[0]) - 1;
+// this many drops within one window of clock time move one step up the ladder, at most one step per window
+const int kDropsToEscalate = 3;
+const int64_t kDropWindowMs = 1000;
+// clock time without a drop that moves one step back down
+const int64_t kRelaxMs = 1000;
+
+bool IsTextureFormat(int format) {
+	return format == AV_PIX_FMT_YUV420P || format == AV_PIX_FMT_YUVJ420P || format == AV_PIX_FMT_NV12;
+}
+
+}
+
+PreviewPlayer::PreviewPlayer(const char* szFilePath, const PreviewOptions& options)
+	: options(options), qFrames(std::max(1, options.queue_frames))
+{
+	pVideo = new FFmpegDecoder(szFilePath, options.decoder);
+	if (!pVideo->IsValid()) {
+		LOG(ERROR) << "Preview: cannot open " << szFilePath;
+		delete pVideo;
+		pVideo = nullptr;
+		return;
+	}
+	AVRational rate = pVideo->GetFrameRate();
+	if (rate.num > 0 && rate.den > 0) {
+		nFrameMs = std::max((int64_t)1, av_rescale(1000, rate.den, rate.num));
+	}
+	if (options.audio) {
+		// proxies are video only, so audio always comes from the original
+		DecoderOptions audio_options;
+		audio_options.audio_only = true;
+		audio_options.memory_map = options.decoder.memory_map;
+		pAudio = new FFmpegDecoder(szFilePath, audio_options);
+		if (!pAudio->IsValid()) {
+			delete pAudio;
+			pAudio = nullptr;
+		} else {
+			nAudioOffsetMs = pAudio->GetAudioStartOffset(AVRational{ 1, 1000 });
+		}
+	}
+}
+
+PreviewPlayer::~PreviewPlayer()
+{
+	swr_free(&swr);
+	delete pAudio;
+	delete pVideo;
+}
+
+bool PreviewPlayer::OpenAudio()
+{
+	AVCodecContext* ctx = pAudio->GetAudioContext();
+	SDL_AudioSpec want = {}, have = {};
+	want.freq = ctx->sample_rate;
+	want.format = AUDIO_F32SYS;
+	want.channels = (Uint8)std::min(2, ctx->ch_layout.nb_channels);
+	want.samples = 1024;
+	nAudioDevice = SDL_OpenAudioDevice(nullptr, 0, &want, &have,
+		SDL_AUDIO_ALLOW_FREQUENCY_CHANGE | SDL_AUDIO_ALLOW_CHANNELS_CHANGE);
+	if (!nAudioDevice) {
+		LOG(WARNING) << "Preview: no audio device (" << SDL_GetError() << "), timing by the wall clock";
+		return false;
+	}
+	AVChannelLayout out_layout;
+	av_channel_layout_default(&out_layout, have.channels);
+	if (swr_alloc_set_opts2(&swr, &out_layout, AV_SAMPLE_FMT_FLT, have.freq,
+		&ctx->ch_layout, ctx->sample_fmt, ctx->sample_rate, 0, nullptr) < 0 || swr_init(swr) < 0) {
+		LOG(ERROR) << "Preview: cannot convert audio to " << have.freq << " Hz, " << (int)have.channels << " channels";
+		SDL_CloseAudioDevice(nAudioDevice);
+		nAudioDevice = 0;
+		return false;
+	}
+	nAudioChannels = have.channels;
+	nBytesPerSecond = have.freq * have.channels * (int)sizeof(float);
+	// samples SDL has taken off the queue but not played yet
+	nDeviceLatencyMs = (int64_t)have.samples * 1000 / have.freq;
+	return true;
+}
+
+bool PreviewPlayer::Play(int64_t nMaxMs)
+{
+	if (!pVideo) {
+		return false;
+	}
+	if (options.headless) {
+		SDL_setenv("SDL_VIDEODRIVER", "dummy", 1);
+		SDL_setenv("SDL_AUDIODRIVER", "disk", 1);
+#ifdef _WIN32
+		SDL_setenv("SDL_DISKAUDIOFILE", "NUL", 1);
+#else
+		SDL_setenv("SDL_DISKAUDIOFILE", "/dev/null", 1);
+#endif
+	}
+	if (SDL_InitSubSystem(SDL_INIT_VIDEO | SDL_INIT_AUDIO) != 0) {
+		LOG(ERROR) << "Preview: SDL_Init failed: " << SDL_GetError();
+		return false;
+	}
+	int nWidth = options.window_width > 0 ? options.window_width : pVideo->GetWidth();
+	int nHeight = (int)((int64_t)nWidth * pVideo->GetHeight() / std::max(1, pVideo->GetWidth()));
+	window = SDL_CreateWindow("Preview", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, nWidth, nHeight,
+		options.headless ? SDL_WINDOW_HIDDEN : SDL_WINDOW_RESIZABLE);
+	renderer = window ? SDL_CreateRenderer(window, -1, 0) : nullptr;
+	if (!renderer) {
+		LOG(ERROR) << "Preview: cannot create a renderer: " << SDL_GetError();
+		if (window) {
+			SDL_DestroyWindow(window);
+			window = nullptr;
+		}
+		SDL_QuitSubSystem(SDL_INIT_VIDEO | SDL_INIT_AUDIO);
+		return false;
+	}
+
+	nClockTicks = SDL_GetTicks64();
+	bool bAudio = pAudio && OpenAudio();
+	NvThread tVideo(std::thread(&PreviewPlayer::DecodeVideo, this));
+	NvThread tAudio;
+	if (bAudio) {
+		tAudio = NvThread(std::thread(&PreviewPlayer::DecodeAudio, this));
+		SDL_PauseAudioDevice(nAudioDevice, 0);
+	} else {
+		std::lock_guard<std::mutex> lock(mtxClock);
+		bAudioDone = true;
+	}
+
+	int64_t nLateMs = options.late_ms > 0 ? options.late_ms : nFrameMs;
+	// clock times, not frame counts: on the keyframe-only rung a second holds only a frame or two
+	int64_t nLastDropMs = 0;
+	int64_t nWindowMs = 0;
+	int nWindowDrops = 0;
+	int nBack = 0;
+	bool bOk = true;
+	AVFrame* next = nullptr;
+	bool bUploaded = false;
+	while (!bStop) {
+		SDL_Event event;
+		while (SDL_PollEvent(&event)) {
+			if (event.type == SDL_QUIT || (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_ESCAPE)) {
+				bStop = true;
+			}
+		}
+		if (!next) {
+			// the decoder closes the queue after its last frame
+			if (!qFrames.pop_for(next, std::chrono::milliseconds(10))) {
+				if (bVideoDone && !qFrames.try_pop(next)) {
+					break;
+				}
+				continue;
+			}
+			bUploaded = false;
+		}
+
+		int64_t nClock = GetClock();
+		if (nMaxMs >= 0 && nClock >= nMaxMs) {
+			break;
+		}
+		if (next->pts < nClock - nLateMs) {
+			av_frame_free(&next);
+			{
+				std::lock_guard<std::mutex> lock(mtxStats);
+				stats.dropped++;
+			}
+			// a single late frame is a hiccup; frames already queued at the old level then keep dropping
+			// for a while after a step up, which the one-step-per-window limit absorbs
+			nLastDropMs = nClock;
+			if (nClock - nWindowMs >= kDropWindowMs) {
+				nWindowMs = nClock;
+				nWindowDrops = 0;
+			}
+			if (++nWindowDrops == kDropsToEscalate) {
+				SetSkipLevel(nSkipLevel + 1);
+			}
+			continue;
+		}
+		// upload into the back texture while the front one is still on screen
+		if (!bUploaded) {
+			if (!Upload(next, slots[nBack])) {
+				LOG(ERROR) << "Preview: texture upload failed: " << SDL_GetError();
+				bOk = false;
+				break;
+			}
+			bUploaded = true;
+			continue;
+		}
+		if (next->pts > nClock) {
+			SDL_Delay((Uint32)std::min(next->pts - nClock, (int64_t)10));
+			continue;
+		}
+		SDL_RenderClear(renderer);
+		SDL_RenderCopy(renderer, slots[nBack].texture, nullptr, nullptr);
+		SDL_RenderPresent(renderer);
+		nBack ^= 1;
+		av_frame_free(&next);
+		{
+			std::lock_guard<std::mutex> lock(mtxStats);
+			stats.displayed++;
+		}
+		if (nSkipLevel > 0 && nClock - nLastDropMs >= kRelaxMs) {
+			// the next step down needs another quiet period of its own
+			nLastDropMs = nClock;
+			SetSkipLevel(nSkipLevel - 1);
+		}
+	}
+
+	bool bInterrupted = bStop;
+	bStop = true;
+	qFrames.close();
+	tVideo.join();
+	tAudio.join();
+	av_frame_free(&next);
+	while (qFrames.try_pop(next)) {
+		av_frame_free(&next);
+	}
+	if (nAudioDevice) {
+		SDL_CloseAudioDevice(nAudioDevice);
+		nAudioDevice = 0;
+	}
+	for (Slot& slot : slots) {
+		if (slot.texture) {
+			SDL_DestroyTexture(slot.texture);
+		}
+		slot = Slot();
+	}
+	SDL_DestroyRenderer(renderer);
+	SDL_DestroyWindow(window);
+	renderer = nullptr;
+	window = nullptr;
+	SDL_QuitSubSystem(SDL_INIT_VIDEO | SDL_INIT_AUDIO);
+
+	Stats s = GetStats();
+	LOG(INFO) << "Preview: " << s.displayed << " frames shown, " << s.dropped << " dropped, skip level up to "
+		<< s.max_skip_level << " (" << s.skip_level_changes << " changes)" << (bInterrupted ? ", stopped" : "");
+	return bOk;
+}
+
+void PreviewPlayer::SetSkipLevel(int nLevel)
+{
+	nLevel = std::max(0, std::min(nLevel, kMaxSkipLevel));
+	if (nSkipLevel.exchange(nLevel) == nLevel) {
+		return;
+	}
+	std::lock_guard<std::mutex> lock(mtxStats);
+	stats.max_skip_level = std::max(stats.max_skip_level, nLevel);
+	stats.skip_level_changes++;
+}
+
+int64_t PreviewPlayer::GetClock()
+{
+	uint64_t nTicks = SDL_GetTicks64();
+	std::lock_guard<std::mutex> lock(mtxClock);
+	Uint32 nQueued = nAudioDevice ? SDL_GetQueuedAudioSize(nAudioDevice) : 0;
+	if (!bAudioDone || nQueued > 0) {
+		// audio is master: the clock stands still until the first samples are queued and
+		// while the device underruns, so video waits for sound rather than running ahead
+		if (nAudioStartMs != AV_NOPTS_VALUE) {
+			int64_t nPlayed = std::max((int64_t)0, nQueuedBytes - (int64_t)nQueued);
+			nClockMs = nAudioStartMs + std::max((int64_t)0, nPlayed * 1000 / nBytesPerSecond - nDeviceLatencyMs);
+		}
+		nClockTicks = nTicks;
+		return nClockMs;
+	}
+	return nClockMs + (int64_t)(nTicks - nClockTicks);
+}
+
+bool PreviewPlayer::Upload(const AVFrame* frame, Slot& slot)
+{
+	uint32_t nFormat = frame->format == AV_PIX_FMT_NV12 ? SDL_PIXELFORMAT_NV12 : SDL_PIXELFORMAT_IYUV;
+	if (!slot.texture || slot.format != nFormat || slot.width != frame->width || slot.height != frame->height) {
+		// lowres and keyframe-only decoding can change the frame size under a running preview
+		if (slot.texture) {
+			SDL_DestroyTexture(slot.texture);
+		}
+		slot.texture = SDL_CreateTexture(renderer, nFormat, SDL_TEXTUREACCESS_STREAMING, frame->width, frame->height);
+		if (!slot.texture) {
+			return false;
+		}
+		slot.format = nFormat;
+		slot.width = frame->width;
+		slot.height = frame->height;
+	}
+	if (nFormat == SDL_PIXELFORMAT_NV12) {
+		return SDL_UpdateNVTexture(slot.texture, nullptr, frame->data[0], frame->linesize[0],
+			frame->data[1], frame->linesize[1]) == 0;
+	}
+	return SDL_UpdateYUVTexture(slot.texture, nullptr, frame->data[0], frame->linesize[0],
+		frame->data[1], frame->linesize[1], frame->data[2], frame->linesize[2]) == 0;
+}
+
+void PreviewPlayer::DecodeVideo()
+{
+	SwsContext* sws = nullptr;
+	int nLevel = 0;
+	while (!bStop) {
+		int nWant = nSkipLevel;
+		if (nWant != nLevel) {
+			nLevel = nWant;
+			pVideo->SetSkipFrame(kSkipLevels[nLevel].skip_frame, kSkipLevels[nLevel].skip_loop_filter);
+		}
+		AVFrame* frame = av_frame_alloc();
+		int ret = pVideo->DecodeNextFrame(frame);
+		if (ret < 0) {
+			if (ret != AVERROR_EOF) {
+				LOG(ERROR) << "Preview: decoding failed: " << ret;
+			}
+			av_frame_free(&frame);
+			break;
+		}
+		int64_t pts = pVideo->GetFrameTime(frame, AVRational{ 1, 1000 });
+		if (!IsTextureFormat(frame->format)) {
+			// 4:2:2, 4:4:4 and high bit depth: to 8-bit 4:2:0, still YUV
+			AVFrame* converted = av_frame_alloc();
+			converted->format = AV_PIX_FMT_YUV420P;
+			converted->width = frame->width;
+			converted->height = frame->height;
+			sws = sws_getCachedContext(sws, frame->width, frame->height, (AVPixelFormat)frame->format,
+				frame->width, frame->height, AV_PIX_FMT_YUV420P, SWS_BILINEAR, nullptr, nullptr, nullptr);
+			if (!sws || av_frame_get_buffer(converted, 0) < 0) {
+				LOG(ERROR) << "Preview: cannot convert " << av_get_pix_fmt_name((AVPixelFormat)frame->format);
+				av_frame_free(&converted);
+				av_frame_free(&frame);
+				break;
+			}
+			sws_scale(sws, frame->data, frame->linesize, 0, frame->height, converted->data, converted->linesize);
+			av_frame_free(&frame);
+			frame = converted;
+		}
+		// the display loop only needs the time, in ms from the start of the clip
+		frame->pts = pts;
+		if (!qFrames.push(frame)) {
+			av_frame_free(&frame);
+			break;
+		}
+	}
+	sws_freeContext(sws);
+	bVideoDone = true;
+	qFrames.close();
+}
+
+void PreviewPlayer::DecodeAudio()
+{
+	AVFrame* frame = av_frame_alloc();
+	std::vector<float> vSamples;
+	while (!bStop) {
+		// a quarter second queued keeps the device fed without decoding far ahead of the picture
+		if ((int)SDL_GetQueuedAudioSize(nAudioDevice) > nBytesPerSecond / 4) {
+			SDL_Delay(5);
+			continue;
+		}
+		if (pAudio->DecodeNextAudioFrame(frame) < 0) {
+			break;
+		}
+		int64_t nStartMs = pAudio->GetAudioFrameTime(frame, AVRational{ 1, 1000 });
+		if (nStartMs != AV_NOPTS_VALUE) {
+			nStartMs += nAudioOffsetMs;
+		}
+		int nOut = swr_get_out_samples(swr, frame->nb_samples);
+		vSamples.resize((size_t)nOut * nAudioChannels);
+		uint8_t* pOut = (uint8_t*)vSamples.data();
+		int n = swr_convert(swr, &pOut, nOut, (const uint8_t**)frame->extended_data, frame->nb_samples);
+		av_frame_unref(frame);
+		if (n <= 0) {
+			continue;
+		}
+		std::lock_guard<std::mutex> lock(mtxClock);
+		if (nAudioStartMs == AV_NOPTS_VALUE) {
+			// audio starting before the video gives a negative clock, which holds the first picture back
+			nAudioStartMs = nStartMs != AV_NOPTS_VALUE ? nStartMs : 0;
+		}
+		int nBytes = n * nAudioChannels * (int)sizeof(float);
+		if (SDL_QueueAudio(nAudioDevice, vSamples.data(), nBytes) == 0) {
+			nQueuedBytes += nBytes;
+		}
+	}
+	av_frame_free(&frame);
+	std::lock_guard<std::mutex> lock(mtxClock);
+	bAudioDone = true;
+}
@@ -0,0 +1,136 @@
+#pragma once
+
+extern "C" {
+#include <libavutil/frame.h>
+#include <libswresample/swresample.h>
+}
+
+#include <atomic>
+#include <mutex>
+
+#include "utils.h"
+#include "ffmpeg_decoder.h"
+
+// SDL stays out of the header: SDL.h redefines main() for every file that includes it
+struct SDL_Window;
+struct SDL_Renderer;
+struct SDL_Texture;
+
+struct PreviewOptions
+{
+	// video decoder settings; prefer_proxy and lowres trade resolution for speed up front
+	DecoderOptions decoder;
+	// window width, the height follows the source aspect ratio; 0 for the source size
+	int window_width = 960;
+	// decoded frames waiting for display
+	int queue_frames = 8;
+	// a frame this far behind the clock is dropped rather than shown; 0 for one frame interval
+	int late_ms = 0;
+	bool audio = true;
+	// no window or sound: SDL's dummy video driver, and its disk audio driver writing to the null
+	// device, which still consumes samples in real time so the audio clock runs as on hardware.
+	// Decided when Play() initializes SDL; the drivers are process-wide.
+	bool headless = false;
+};
+
+/**
+* @brief Plays a clip in an SDL window. A worker thread decodes video through FFmpegDecoder into a
+* small queue; a second decoder feeds the audio device, whose playback position is the master
+* clock (wall time when the clip has no audio, or once it has ended). The display loop uploads
+* the next frame's YUV planes into the back one of two streaming textures while the front one is
+* still on screen, and presents it when the clock reaches its timestamp. YUV 4:2:0 and NV12 frames
+* go to the texture as they are; other formats are converted to 4:2:0 on the decode thread.
+*
+* Under load a frame later than late_ms is dropped, and a few drops within a second of clock time
+* move the decoder one step up a ladder: skip the loop filter on non-reference frames, then drop
+* those frames and skip the loop filter everywhere, then decode keyframes only. It climbs at most
+* one step per second, and a second of clock time without a drop moves it one step back down.
+*/
+class PreviewPlayer
+{
+public:
+	struct Stats
+	{
+		int64_t displayed = 0;
+		// decoded, but too late to be shown
+		int64_t dropped = 0;
+		// highest rung of the skip ladder reached, 0 for none
+		int max_skip_level = 0;
+		int skip_level_changes = 0;
+	};
+
+	PreviewPlayer(const char* szFilePath, const PreviewOptions& options = PreviewOptions());
+	PreviewPlayer(const PreviewPlayer&) = delete;
+	PreviewPlayer& operator=(const PreviewPlayer&) = delete;
+	~PreviewPlayer();
+
+	bool IsValid() {
+		return pVideo != nullptr;
+	}
+	/**
+	* @brief Plays from the start until the end of the clip, nMaxMs of clip time, Stop(), or the
+	* window being closed. Runs the SDL event loop, so it must be called on the thread that owns
+	* the UI; the window lives only for the duration of the call. Once per player.
+	*/
+	bool Play(int64_t nMaxMs = -1);
+	/**
+	* @brief Ends Play() from any thread
+	*/
+	void Stop() {
+		bStop = true;
+	}
+	Stats GetStats() {
+		std::lock_guard<std::mutex> lock(mtxStats);
+		return stats;
+	}
+
+private:
+	struct Slot
+	{
+		SDL_Texture* texture = nullptr;
+		uint32_t format = 0;
+		int width = 0, height = 0;
+	};
+
+	void DecodeVideo();
+	void DecodeAudio();
+	bool OpenAudio();
+	// clip time in ms from the start of the video stream that the viewer is hearing now
+	int64_t GetClock();
+	bool Upload(const AVFrame* frame, Slot& slot);
+	void SetSkipLevel(int nLevel);
+
+private:
+	PreviewOptions options;
+	FFmpegDecoder* pVideo = nullptr;
+	FFmpegDecoder* pAudio = nullptr;
+	int64_t nFrameMs = 40;
+
+	SDL_Window* window = nullptr;
+	SDL_Renderer* renderer = nullptr;
+	Slot slots[2];
+
+	ConcurrentQueue<AVFrame*> qFrames;
+	std::atomic<bool> bStop{ false };
+	std::atomic<bool> bVideoDone{ false };
+	std::atomic<int> nSkipLevel{ 0 };
+
+	// audio device and the clock derived from it, guarded by mtxClock
+	uint32_t nAudioDevice = 0;
+	SwrContext* swr = nullptr;
+	int nAudioChannels = 0;
+	int nBytesPerSecond = 0;
+	int64_t nDeviceLatencyMs = 0;
+	// audio stream start relative to the video stream start, so both run on the video timeline
+	int64_t nAudioOffsetMs = 0;
+	std::mutex mtxClock;
+	int64_t nAudioStartMs = AV_NOPTS_VALUE;
+	int64_t nQueuedBytes = 0;
+	bool bAudioDone = false;
+	// last clock reading and the wall time of it, for extrapolating without audio
+	int64_t nClockMs = 0;
+	uint64_t nClockTicks = 0;
+
+	std::mutex mtxStats;
+	Stats stats;
+};
@@ -0,0 +1,246 @@
+#include "proxy_generator.h"
+#include "ffmpeg_encoder.h"
+#include "ffmpeg_streamer.h"
+
+#include <stdio.h>
+
+std::string ProxyGenerator::ProxyPath(const char* szMediaPath, const std::string& strProxyDir)
+{
+	// mpegts, which is what FFmpegStreamer muxes H.264/HEVC into
+	if (strProxyDir.empty()) {
+		return std::string(szMediaPath) + ".proxy.ts";
+	}
+	char szHash[17];
+	snprintf(szHash, sizeof(szHash), "%016llx", (unsigned long long)HashPath(szMediaPath));
+	return strProxyDir + "/" + szHash + ".proxy.ts";
+}
+
+bool ProxyGenerator::IsProxyReady(const char* szMediaPath, const char* szProxyPath)
+{
+	uint64_t nMediaSize, nProxySize;
+	int64_t nMediaMtime, nProxyMtime;
+	if (!PacketIndex::GetMediaIdentity(szMediaPath, &nMediaSize, &nMediaMtime)
+		|| !PacketIndex::GetMediaIdentity(szProxyPath, &nProxySize, &nProxyMtime)) {
+		return false;
+	}
+	return nProxySize > 0 && nProxyMtime >= nMediaMtime;
+}
+
+ProxyGenerator::ProxyState ProxyGenerator::Transcode(const char* szMediaPath, const char* szProxyPath, const ProxyOptions& options,
+	const std::atomic<bool>* pbAbort)
+{
+	DecoderOptions decoder_options;
+	decoder_options.threads = options.threads_per_job;
+	decoder_options.use_frame_pool = false;
+	FFmpegDecoder probe(szMediaPath, decoder_options);
+	if (!probe.IsValid()) {
+		LOG(ERROR) << "Proxy: cannot open " << szMediaPath;
+		return PROXY_FAILED;
+	}
+	if (probe.GetHeight() <= options.height) {
+		LOG(INFO) << "Proxy: " << szMediaPath << " is " << probe.GetHeight() << " lines, no proxy needed";
+		return PROXY_NOT_NEEDED;
+	}
+	int nHeight = options.height & ~1;
+	int nWidth = (int)((int64_t)probe.GetWidth() * nHeight / probe.GetHeight() + 1) & ~1;
+	AVRational fr = probe.GetFrameRate();
+	int nFps = fr.num && fr.den ? (int)(av_q2d(fr) + 0.5) : 25;
+
+	// decode straight at proxy size when the codec can
+	int nLowres = 0;
+	while (nLowres < probe.GetMaxLowres() && (probe.GetHeight() >> (nLowres + 1)) >= nHeight) {
+		nLowres++;
+	}
+	FFmpegDecoder* pDecoder = &probe;
+	FFmpegDecoder* pLowres = nullptr;
+	if (nLowres) {
+		decoder_options.lowres = nLowres;
+		pLowres = new FFmpegDecoder(szMediaPath, decoder_options);
+		if (pLowres->IsValid()) {
+			pDecoder = pLowres;
+		}
+	}
+
+	std::string strTemp = std::string(szProxyPath) + ".part";
+	EncoderOptions encoder_options;
+	encoder_options.threads = options.threads_per_job;
+	encoder_options.preset = options.preset;
+	encoder_options.crf = options.crf;
+	encoder_options.gop_size = options.all_intra ? 1 : options.gop_size;
+	encoder_options.max_b_frames = 0;
+	encoder_options.closed_gop = true;
+	bool bOk = false;
+	{
+		FFmpegStreamer streamer(options.codec, nWidth, nHeight, nFps, strTemp.c_str());
+		FFmpegEncoder encoder(options.codec, nWidth, nHeight, nFps, AV_PIX_FMT_YUV420P, encoder_options, &streamer);
+		AVFrame* frame = av_frame_alloc();
+		AVFrame* scaled = av_frame_alloc();
+		scaled->format = AV_PIX_FMT_YUV420P;
+		scaled->width = nWidth;
+		scaled->height = nHeight;
+		SwsContext* sws = nullptr;
+		if (!encoder.IsValid() || av_frame_get_buffer(scaled, 0) < 0) {
+			LOG(ERROR) << "Proxy: encoder setup failed for " << szMediaPath;
+		} else {
+			AVRational tb = encoder.GetTimeBase();
+			int64_t nLastPts = AV_NOPTS_VALUE;
+			int64_t nFrames = 0;
+			int ret;
+			while ((ret = pDecoder->DecodeNextFrame(frame)) == 0) {
+				if (pbAbort && pbAbort->load(std::memory_order_relaxed)) {
+					break;
+				}
+				sws = sws_getCachedContext(sws, frame->width, frame->height, (AVPixelFormat)frame->format,
+					nWidth, nHeight, AV_PIX_FMT_YUV420P, SWS_BILINEAR, nullptr, nullptr, nullptr);
+				if (!sws || av_frame_make_writable(scaled) < 0) {
+					break;
+				}
+				sws_scale(sws, frame->data, frame->linesize, 0, frame->height, scaled->data, scaled->linesize);
+				// rounding a fractional rate onto 1/nFps can collide; the encoder needs increasing pts
+				int64_t pts = pDecoder->GetFrameTime(frame, tb);
+				if (nLastPts != AV_NOPTS_VALUE && pts <= nLastPts) {
+					pts = nLastPts + 1;
+				}
+				scaled->pts = nLastPts = pts;
+				av_frame_unref(frame);
+				if (encoder.EncodeFrame(scaled) < 0) {
+					break;
+				}
+				nFrames++;
+			}
+			bOk = ret == AVERROR_EOF && nFrames > 0;
+			if (encoder.EncodeFrame(nullptr) < 0) {
+				bOk = false;
+			}
+			LOG(INFO) << "Proxy: " << nFrames << " frames " << nWidth << "x" << nHeight << " @" << nFps
+				<< " lowres=" << (pDecoder == pLowres ? nLowres : 0) << " for " << szMediaPath;
+		}
+		sws_freeContext(sws);
+		av_frame_free(&scaled);
+		av_frame_free(&frame);
+	}
+	delete pLowres;
+
+	// only complete proxies get the name decoders look for
+	if (bOk) {
+		remove(szProxyPath);
+		bOk = rename(strTemp.c_str(), szProxyPath) == 0;
+	}
+	if (!bOk) {
+		remove(strTemp.c_str());
+		LOG(WARNING) << "Proxy: transcode of " << szMediaPath << " failed";
+	}
+	return bOk ? PROXY_READY : PROXY_FAILED;
+}
+
+ProxyGenerator::ProxyGenerator(const ProxyOptions& options, CompletionFunc completion)
+	: options(options), completion(completion)
+{
+}
+
+ProxyGenerator::~ProxyGenerator()
+{
+	bAbort = true;
+	std::unique_lock<std::mutex> lock(mtx);
+	nPending -= (int)queue.size();
+	queue.clear();
+	cvIdle.wait(lock, [this] { return nTasks == 0; });
+}
+
+ProxyGenerator::ProxyState ProxyGenerator::Enqueue(const char* szMediaPath)
+{
+	std::string strPath = szMediaPath;
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		auto it = states.find(strPath);
+		if (it != states.end() && (it->second == PROXY_QUEUED || it->second == PROXY_RUNNING || it->second == PROXY_NOT_NEEDED)) {
+			return it->second;
+		}
+		if (IsProxyReady(szMediaPath, ProxyPath(szMediaPath, options.proxy_dir).c_str())) {
+			states[strPath] = PROXY_READY;
+			return PROXY_READY;
+		}
+		states[strPath] = PROXY_QUEUED;
+		nPending++;
+		queue.push_back(strPath);
+		if (nTasks >= std::max(1, options.max_jobs)) {
+			return PROXY_QUEUED;
+		}
+		nTasks++;
+	}
+	TaskScheduler::Global().Submit([this]() { RunNext(); }, TaskScheduler::PRIORITY_LOW);
+	return PROXY_QUEUED;
+}
+
+ProxyGenerator::ProxyState ProxyGenerator::GetState(const char* szMediaPath)
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	auto it = states.find(szMediaPath);
+	return it != states.end() ? it->second : PROXY_NONE;
+}
+
+bool ProxyGenerator::Cancel(const char* szMediaPath)
+{
+	// the entry stays in the queue; RunNext skips anything no longer marked queued
+	std::lock_guard<std::mutex> lock(mtx);
+	auto it = states.find(szMediaPath);
+	if (it == states.end() || it->second != PROXY_QUEUED) {
+		return false;
+	}
+	it->second = PROXY_NONE;
+	return true;
+}
+
+void ProxyGenerator::WaitIdle()
+{
+	std::unique_lock<std::mutex> lock(mtx);
+	cvIdle.wait(lock, [this] { return nPending == 0; });
+}
+
+void ProxyGenerator::SetState(const std::string& strMediaPath, ProxyState eState)
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	states[strMediaPath] = eState;
+}
+
+void ProxyGenerator::RunNext()
+{
+	std::string strPath;
+	bool bRun = false;
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		if (!queue.empty()) {
+			strPath = queue.front();
+			queue.pop_front();
+			auto it = states.find(strPath);
+			if (!bAbort && it != states.end() && it->second == PROXY_QUEUED) {
+				it->second = PROXY_RUNNING;
+				bRun = true;
+			}
+		}
+	}
+	if (bRun) {
+		std::string strProxy = ProxyPath(strPath.c_str(), options.proxy_dir);
+		ProxyState eState = Transcode(strPath.c_str(), strProxy.c_str(), options, &bAbort);
+		if (eState == PROXY_FAILED && bAbort) {
+			eState = PROXY_NONE;
+		}
+		SetState(strPath, eState);
+		if (completion && !bAbort) {
+			completion(strPath, eState);
+		}
+	}
+
+	// notify under the lock: the destructor may return as soon as nTasks reaches 0
+	std::lock_guard<std::mutex> lock(mtx);
+	if (!strPath.empty()) {
+		nPending--;
+	}
+	if (!queue.empty() && !bAbort) {
+		// back of the line, so previews and exports queued meanwhile go first
+		TaskScheduler::Global().Submit([this]() { RunNext(); }, TaskScheduler::PRIORITY_LOW);
+	} else {
+		nTasks--;
+	}
+	cvIdle.notify_all();
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libswscale/swscale.h>
+}
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "utils.h"
+#include "ffmpeg_decoder.h"
+#include "task_scheduler.h"
+
+struct ProxyOptions
+{
+	// proxy frame height; the width follows the source aspect ratio. Sources no taller are not proxied.
+	int height = 540;
+	AVCodecID codec = AV_CODEC_ID_H264;
+	// every frame a keyframe: any seek decodes exactly one frame, at roughly twice the file size
+	bool all_intra = false;
+	// keyframe interval when not all-intra; proxies never use B-frames
+	int gop_size = 15;
+	int crf = 26;
+	std::string preset = "veryfast";
+	// CPU budget: clips transcoded at once, and decoder/encoder threads each of them may use
+	int max_jobs = 1;
+	int threads_per_job = 2;
+	// empty keeps proxies next to the original media
+	std::string proxy_dir;
+};
+
+/**
+* @brief Background transcoder producing low-resolution, short-GOP proxies for smooth scrubbing.
+* Clips are queued with Enqueue() and converted as low-priority tasks of TaskScheduler::Global(), at
+* most max_jobs of them at once. A proxy is written to a temporary file and renamed once complete,
+* so a decoder opened with DecoderOptions::prefer_proxy only ever sees finished proxies.
+* Proxies are video only; audio is always taken from the original.
+*/
+class ProxyGenerator
+{
+public:
+	enum ProxyState {
+		PROXY_NONE,
+		PROXY_QUEUED,
+		PROXY_RUNNING,
+		PROXY_READY,
+		PROXY_FAILED,
+		// the source is no taller than the proxy would be; decoders keep using the original
+		PROXY_NOT_NEEDED
+	};
+	// called on a scheduler thread when a clip's proxy is ready or has failed
+	typedef std::function<void(const std::string& strMediaPath, ProxyState eState)> CompletionFunc;
+
+	ProxyGenerator(const ProxyOptions& options = ProxyOptions(), CompletionFunc completion = nullptr);
+	ProxyGenerator(const ProxyGenerator&) = delete;
+	ProxyGenerator& operator=(const ProxyGenerator&) = delete;
+	/**
+	* @brief Abandons queued clips, interrupts running transcodes and waits for their tasks
+	*/
+	~ProxyGenerator();
+
+	/**
+	* @brief Queues szMediaPath unless its proxy is already ready, queued or being built, or the clip
+	* was found to need none. Whether it does is only known once its task has opened the source.
+	*/
+	ProxyState Enqueue(const char* szMediaPath);
+	ProxyState GetState(const char* szMediaPath);
+	/**
+	* @brief Drops a clip that has not started yet; returns false if it is not in the queue
+	*/
+	bool Cancel(const char* szMediaPath);
+	/**
+	* @brief Blocks until the queue is empty and no transcode is running
+	*/
+	void WaitIdle();
+
+	/**
+	* @brief Where the proxy of szMediaPath lives. strProxyDir empty keeps it next to the original.
+	*/
+	static std::string ProxyPath(const char* szMediaPath, const std::string& strProxyDir);
+	/**
+	* @brief A proxy is usable when it exists and is not older than its original
+	*/
+	static bool IsProxyReady(const char* szMediaPath, const char* szProxyPath);
+	/**
+	* @brief Synchronously transcodes szMediaPath into szProxyPath. pbAbort is polled once per frame.
+	* Returns PROXY_READY, PROXY_NOT_NEEDED for sources no taller than options.height, or PROXY_FAILED.
+	*/
+	static ProxyState Transcode(const char* szMediaPath, const char* szProxyPath, const ProxyOptions& options,
+		const std::atomic<bool>* pbAbort = nullptr);
+
+private:
+	// one clip per task; each task submits the next while clips are queued, so max_jobs bounds the tasks
+	void RunNext();
+	void SetState(const std::string& strMediaPath, ProxyState eState);
+
+private:
+	ProxyOptions options;
+	CompletionFunc completion;
+	std::atomic<bool> bAbort{ false };
+
+	std::mutex mtx;
+	std::condition_variable cvIdle;
+	std::unordered_map<std::string, ProxyState> states;
+	std::deque<std::string> queue;
+	// queued plus running clips, and tasks submitted and not yet returned
+	int nPending = 0;
+	int nTasks = 0;
+};
@@ -0,0 +1,400 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+/*
+* Fixed-capacity lock-free queues. Both share the blocking interface of ConcurrentQueue in utils.h
+* (push/pop, try_*, *_for, push_many/pop_many, close) so pipeline code can swap implementations.
+* Blocking calls spin, then yield, then back off to short sleeps; no mutex is taken on any path.
+*/
+
+#ifndef CACHE_LINE_SIZE
+#define CACHE_LINE_SIZE 64
+#endif
+
+namespace ring_buffer_detail {
+
+inline size_t RoundUpPow2(size_t n) {
+    size_t p = 2;
+    while (p < n) {
+        p <<= 1;
+    }
+    return p;
+}
+
+inline void CpuRelax() {
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    _mm_pause();
+#elif defined(__x86_64__) || defined(__i386__)
+    _mm_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+/**
+* @brief Spin -> yield -> sleep backoff used by the blocking calls
+*/
+class Backoff {
+public:
+    void Wait() {
+        if (n < 64) {
+            CpuRelax();
+        } else if (n < 128) {
+            std::this_thread::yield();
+        } else {
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+        n++;
+    }
+private:
+    unsigned n = 0;
+};
+
+/**
+* @brief Blocking, timed and batch calls built on the derived queue's try_* primitives
+*/
+template<typename Derived, typename T>
+class BlockingInterface {
+public:
+    /**
+    * @brief Blocks while the queue is full. Returns false if the queue is closed.
+    */
+    bool push(const T& value) {
+        Backoff backoff;
+        while (!closed()) {
+            if (self().try_push(value)) {
+                return true;
+            }
+            backoff.Wait();
+        }
+        return false;
+    }
+
+    /**
+    * @brief Blocks while the queue is empty. Returns false once the queue is closed and drained.
+    */
+    bool pop(T& value) {
+        Backoff backoff;
+        for (;;) {
+            if (self().try_pop(value)) {
+                return true;
+            }
+            if (closed()) {
+                // items pushed before close() are still delivered
+                return self().try_pop(value);
+            }
+            backoff.Wait();
+        }
+    }
+
+    template<typename Rep, typename Period>
+    bool push_for(const T& value, const std::chrono::duration<Rep, Period>& timeout) {
+        auto deadline = std::chrono::steady_clock::now() + timeout;
+        Backoff backoff;
+        while (!closed()) {
+            if (self().try_push(value)) {
+                return true;
+            }
+            if (std::chrono::steady_clock::now() >= deadline) {
+                return false;
+            }
+            backoff.Wait();
+        }
+        return false;
+    }
+
+    template<typename Rep, typename Period>
+    bool pop_for(T& value, const std::chrono::duration<Rep, Period>& timeout) {
+        auto deadline = std::chrono::steady_clock::now() + timeout;
+        Backoff backoff;
+        for (;;) {
+            if (self().try_pop(value)) {
+                return true;
+            }
+            if (closed()) {
+                return self().try_pop(value);
+            }
+            if (std::chrono::steady_clock::now() >= deadline) {
+                return false;
+            }
+            backoff.Wait();
+        }
+    }
+
+    /**
+    * @brief Blocks until all n items are queued. Returns fewer than n only if the queue was closed.
+    */
+    size_t push_many(const T* pItems, size_t n) {
+        size_t nDone = 0;
+        Backoff backoff;
+        while (nDone < n && !closed()) {
+            size_t nPushed = self().try_push_many(pItems + nDone, n - nDone);
+            nDone += nPushed;
+            if (!nPushed) {
+                backoff.Wait();
+            }
+        }
+        return nDone;
+    }
+
+    /**
+    * @brief Blocks until at least one item is available and pops up to nMax.
+    * Returns 0 once the queue is closed and drained.
+    */
+    size_t pop_many(T* pItems, size_t nMax) {
+        Backoff backoff;
+        for (;;) {
+            size_t n = self().try_pop_many(pItems, nMax);
+            if (n) {
+                return n;
+            }
+            if (closed()) {
+                return self().try_pop_many(pItems, nMax);
+            }
+            backoff.Wait();
+        }
+    }
+
+    // ConcurrentQueue compatible spellings
+    void push_back(const T& value) {
+        push(value);
+    }
+    T pop_front() {
+        T value{};
+        pop(value);
+        return value;
+    }
+
+    /**
+    * @brief Wakes every blocked caller. Further pushes fail; pops drain what is left.
+    */
+    void close() {
+        bClosed.store(true, std::memory_order_release);
+    }
+    bool closed() const {
+        return bClosed.load(std::memory_order_acquire);
+    }
+    bool empty() const {
+        return static_cast<const Derived*>(this)->size() == 0;
+    }
+
+private:
+    Derived& self() {
+        return *static_cast<Derived*>(this);
+    }
+
+    alignas(CACHE_LINE_SIZE) std::atomic<bool> bClosed{ false };
+};
+
+}
+
+/**
+* @brief Single-producer single-consumer ring buffer. Capacity is rounded up to a power of two.
+*/
+template<typename T>
+class SpscRingBuffer : public ring_buffer_detail::BlockingInterface<SpscRingBuffer<T>, T>
+{
+public:
+    explicit SpscRingBuffer(size_t size) : nMask(ring_buffer_detail::RoundUpPow2(size) - 1), vBuf(nMask + 1) {}
+    SpscRingBuffer(const SpscRingBuffer&) = delete;
+    SpscRingBuffer& operator=(const SpscRingBuffer&) = delete;
+
+    bool try_push(const T& value) {
+        size_t tail = nTail.load(std::memory_order_relaxed);
+        if (tail - nHeadCache > nMask) {
+            nHeadCache = nHead.load(std::memory_order_acquire);
+            if (tail - nHeadCache > nMask) {
+                return false;
+            }
+        }
+        vBuf[tail & nMask] = value;
+        nTail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool try_pop(T& value) {
+        size_t head = nHead.load(std::memory_order_relaxed);
+        if (head == nTailCache) {
+            nTailCache = nTail.load(std::memory_order_acquire);
+            if (head == nTailCache) {
+                return false;
+            }
+        }
+        value = std::move(vBuf[head & nMask]);
+        nHead.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    size_t try_push_many(const T* pItems, size_t n) {
+        size_t tail = nTail.load(std::memory_order_relaxed);
+        size_t nFree = nMask + 1 - (tail - nHeadCache);
+        if (nFree < n) {
+            nHeadCache = nHead.load(std::memory_order_acquire);
+            nFree = nMask + 1 - (tail - nHeadCache);
+        }
+        n = n < nFree ? n : nFree;
+        for (size_t i = 0; i < n; i++) {
+            vBuf[(tail + i) & nMask] = pItems[i];
+        }
+        nTail.store(tail + n, std::memory_order_release);
+        return n;
+    }
+
+    size_t try_pop_many(T* pItems, size_t nMax) {
+        size_t head = nHead.load(std::memory_order_relaxed);
+        size_t nAvail = nTailCache - head;
+        if (nAvail < nMax) {
+            nTailCache = nTail.load(std::memory_order_acquire);
+            nAvail = nTailCache - head;
+        }
+        size_t n = nMax < nAvail ? nMax : nAvail;
+        for (size_t i = 0; i < n; i++) {
+            pItems[i] = std::move(vBuf[(head + i) & nMask]);
+        }
+        nHead.store(head + n, std::memory_order_release);
+        return n;
+    }
+
+    size_t size() const {
+        return nTail.load(std::memory_order_acquire) - nHead.load(std::memory_order_acquire);
+    }
+    size_t capacity() const {
+        return nMask + 1;
+    }
+
+private:
+    const size_t nMask;
+    std::vector<T> vBuf;
+
+    // consumer side, with the consumer's last view of the tail
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> nHead{ 0 };
+    size_t nTailCache = 0;
+    // producer side, with the producer's last view of the head
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> nTail{ 0 };
+    size_t nHeadCache = 0;
+};
+
+/**
+* @brief Bounded multi-producer multi-consumer queue (per-cell sequence numbers, D. Vyukov's design).
+* Capacity is rounded up to a power of two.
+*/
+template<typename T>
+class MpmcRingBuffer : public ring_buffer_detail::BlockingInterface<MpmcRingBuffer<T>, T>
+{
+public:
+    explicit MpmcRingBuffer(size_t size) : nMask(ring_buffer_detail::RoundUpPow2(size) - 1), vCells(nMask + 1) {
+        for (size_t i = 0; i <= nMask; i++) {
+            vCells[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+    MpmcRingBuffer(const MpmcRingBuffer&) = delete;
+    MpmcRingBuffer& operator=(const MpmcRingBuffer&) = delete;
+
+    bool try_push(const T& value) {
+        return try_push_many(&value, 1) == 1;
+    }
+
+    bool try_pop(T& value) {
+        return try_pop_many(&value, 1) == 1;
+    }
+
+    /**
+    * @brief Claims a run of free cells with a single CAS on the tail
+    */
+    size_t try_push_many(const T* pItems, size_t n) {
+        size_t pos = nTail.load(std::memory_order_relaxed);
+        size_t nClaim;
+        for (;;) {
+            nClaim = 0;
+            while (nClaim < n) {
+                size_t seq = vCells[(pos + nClaim) & nMask].seq.load(std::memory_order_acquire);
+                if (seq != pos + nClaim) {
+                    break;
+                }
+                nClaim++;
+            }
+            if (nClaim == 0) {
+                size_t seq = vCells[pos & nMask].seq.load(std::memory_order_acquire);
+                if ((intptr_t)seq - (intptr_t)pos < 0) {
+                    return 0;   // full
+                }
+                pos = nTail.load(std::memory_order_relaxed);
+                continue;
+            }
+            if (nTail.compare_exchange_weak(pos, pos + nClaim, std::memory_order_relaxed)) {
+                break;
+            }
+        }
+        for (size_t i = 0; i < nClaim; i++) {
+            Cell& cell = vCells[(pos + i) & nMask];
+            cell.data = pItems[i];
+            cell.seq.store(pos + i + 1, std::memory_order_release);
+        }
+        return nClaim;
+    }
+
+    size_t try_pop_many(T* pItems, size_t nMax) {
+        size_t pos = nHead.load(std::memory_order_relaxed);
+        size_t nClaim;
+        for (;;) {
+            nClaim = 0;
+            while (nClaim < nMax) {
+                size_t seq = vCells[(pos + nClaim) & nMask].seq.load(std::memory_order_acquire);
+                if (seq != pos + nClaim + 1) {
+                    break;
+                }
+                nClaim++;
+            }
+            if (nClaim == 0) {
+                size_t seq = vCells[pos & nMask].seq.load(std::memory_order_acquire);
+                if ((intptr_t)seq - (intptr_t)(pos + 1) < 0) {
+                    return 0;   // empty
+                }
+                pos = nHead.load(std::memory_order_relaxed);
+                continue;
+            }
+            if (nHead.compare_exchange_weak(pos, pos + nClaim, std::memory_order_relaxed)) {
+                break;
+            }
+        }
+        for (size_t i = 0; i < nClaim; i++) {
+            Cell& cell = vCells[(pos + i) & nMask];
+            pItems[i] = std::move(cell.data);
+            cell.seq.store(pos + i + nMask + 1, std::memory_order_release);
+        }
+        return nClaim;
+    }
+
+    size_t size() const {
+        size_t head = nHead.load(std::memory_order_acquire);
+        size_t tail = nTail.load(std::memory_order_acquire);
+        return tail > head ? tail - head : 0;
+    }
+    size_t capacity() const {
+        return nMask + 1;
+    }
+
+private:
+    struct Cell {
+        std::atomic<size_t> seq;
+        T data;
+    };
+
+    const size_t nMask;
+    std::vector<Cell> vCells;
+
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> nHead{ 0 };
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> nTail{ 0 };
+};
@@ -0,0 +1,234 @@
+#include "segmented_export.h"
+
+#include <thread>
+
+SegmentedExport::SegmentedExport(const char* szInFilePath, const char* szOutFilePath,
+	const SegmentedExportOptions& options, EffectFactory effects)
+	: strInFilePath(szInFilePath), strOutFilePath(szOutFilePath), options(options), effects(effects)
+{
+	this->options.encoder.closed_gop = true;
+}
+
+SegmentedExport::~SegmentedExport()
+{
+	for (Segment& segment : vSegments) {
+		for (AVPacket* pkt : segment.packets) {
+			av_packet_free(&pkt);
+		}
+	}
+}
+
+bool SegmentedExport::Plan()
+{
+	FFmpegDecoder probe(strInFilePath.c_str());
+	if (!probe.IsValid() || probe.BuildIndex() < 0) {
+		LOG(ERROR) << "Segmented export: cannot index " << strInFilePath;
+		return false;
+	}
+	nWidth = probe.GetWidth();
+	nHeight = probe.GetHeight();
+	eFormat = probe.GetChromaFormat();
+	AVRational fr = probe.GetFrameRate();
+	nFps = fr.num && fr.den ? (int)(av_q2d(fr) + 0.5) : 25;
+	tb = AVRational{ 1, nFps };
+
+	// keyframe pts in presentation order, each mapped to its frame number
+	const PacketIndex& index = probe.GetIndex();
+	std::vector<int64_t> vKeyPts;
+	for (int k : index.GetKeyframes()) {
+		vKeyPts.push_back(index.GetEntries()[k].PresentationTimestamp());
+	}
+	std::sort(vKeyPts.begin(), vKeyPts.end());
+	int nFrames = index.GetFrameCount();
+	int nMinFrames = std::max(1, options.segment_frames);
+	for (int64_t pts : vKeyPts) {
+		int n = index.FindFrame(pts);
+		if (n < 0) {
+			continue;
+		}
+		if (!vSegments.empty() && n - vSegments.back().first_frame < nMinFrames) {
+			continue;
+		}
+		if (!vSegments.empty()) {
+			vSegments.back().end_pts = pts;
+		}
+		Segment segment;
+		segment.first_frame = n;
+		segment.start_pts = pts;
+		segment.end_pts = AV_NOPTS_VALUE;
+		vSegments.push_back(std::move(segment));
+	}
+	// frames before the first keyframe cannot be decoded on their own and are left out, as in playback
+	if (vSegments.empty() || nFrames == 0) {
+		LOG(ERROR) << "Segmented export: no keyframes in " << strInFilePath;
+		return false;
+	}
+	LOG(INFO) << "Segmented export: " << nFrames << " frames in " << vSegments.size() << " segments";
+	return true;
+}
+
+bool SegmentedExport::EncodeSegment(Segment& segment)
+{
+	// parallelism comes from the segments; each one decodes on a single thread
+	DecoderOptions decoder_options;
+	decoder_options.threads = 1;
+	FFmpegDecoder decoder(strInFilePath.c_str(), decoder_options);
+	FFmpegEncoder encoder(options.codec, nWidth, nHeight, nFps, eFormat, options.encoder);
+	if (!decoder.IsValid() || !encoder.IsValid() || decoder.BuildIndex() < 0) {
+		return false;
+	}
+	ExportPipeline::EffectFunc effect = effects ? effects() : nullptr;
+
+	AVFrame* frame = av_frame_alloc();
+	int ret = decoder.SeekToFrame(segment.first_frame, frame);
+	int64_t nLastPts = AV_NOPTS_VALUE;
+	while (ret == 0 && !bCancel) {
+		int64_t pts = frame->best_effort_timestamp;
+		if (segment.end_pts != AV_NOPTS_VALUE && pts >= segment.end_pts) {
+			break;
+		}
+		// leading pictures of an open source GOP belong to the previous segment
+		if (pts >= segment.start_pts && (!effect || effect(frame))) {
+			frame->pts = decoder.GetFrameTime(frame, tb);
+			if (nLastPts != AV_NOPTS_VALUE && frame->pts <= nLastPts) {
+				frame->pts = nLastPts + 1;
+			}
+			nLastPts = frame->pts;
+			ret = encoder.EncodeFrame(frame, segment.packets);
+			segment.frames++;
+		}
+		av_frame_unref(frame);
+		if (ret >= 0) {
+			ret = decoder.DecodeNextFrame(frame);
+		}
+	}
+	av_frame_free(&frame);
+	if (ret < 0 && ret != AVERROR_EOF) {
+		LOG(ERROR) << "Segmented export: segment at frame " << segment.first_frame << " failed: " << ret;
+		return false;
+	}
+	// the delayed packets of the closing GOP come out of the flush; without them the segment is truncated
+	if (encoder.EncodeFrame(nullptr, segment.packets) < 0) {
+		LOG(ERROR) << "Segmented export: flushing the segment at frame " << segment.first_frame << " failed";
+		return false;
+	}
+	if (!segment.packets.empty() && !(segment.packets.front()->flags & AV_PKT_FLAG_KEY)) {
+		LOG(ERROR) << "Segmented export: segment at frame " << segment.first_frame << " does not start with a keyframe";
+		return false;
+	}
+	return !bCancel;
+}
+
+bool SegmentedExport::MuxSegment(Segment& segment, int64_t& nLastDts)
+{
+	bool bOk = true;
+	for (AVPacket*& pkt : segment.packets) {
+		// equal reordering delays keep seams monotonic; this only guards against rounded timestamps
+		if (nLastDts != AV_NOPTS_VALUE && pkt->dts != AV_NOPTS_VALUE && pkt->dts <= nLastDts) {
+			LOG(WARNING) << "Segmented export: dts " << pkt->dts << " after " << nLastDts << " at a seam";
+			pkt->dts = nLastDts + 1;
+			pkt->pts = std::max(pkt->pts, pkt->dts);
+		}
+		if (pkt->dts != AV_NOPTS_VALUE) {
+			nLastDts = pkt->dts;
+		}
+		bOk = bOk && pStreamer->Stream(pkt, tb);
+		av_packet_free(&pkt);
+	}
+	segment.packets.clear();
+	return bOk;
+}
+
+bool SegmentedExport::Run()
+{
+	std::mutex mtxRun;
+	std::condition_variable cvRun;
+	bool bFinished = false, bResult = false;
+	Start(TaskScheduler::Global(), [&](bool bOk) {
+		// notify under the lock: the wait below may return and end these locals right after
+		std::lock_guard<std::mutex> lock(mtxRun);
+		bResult = bOk;
+		bFinished = true;
+		cvRun.notify_all();
+	});
+	std::unique_lock<std::mutex> lock(mtxRun);
+	cvRun.wait(lock, [&bFinished] { return bFinished; });
+	return bResult;
+}
+
+void SegmentedExport::Start(TaskScheduler& scheduler, std::function<void(bool)> done)
+{
+	this->done = done;
+	swScheduled.Start();
+	scheduler.Submit([this, &scheduler]() {
+		if (!Plan()) {
+			Finish(false);
+			return;
+		}
+		int nConcurrency = options.concurrency > 0 ? options.concurrency : scheduler.GetThreadCount();
+		nConcurrency = std::max(1, std::min(nConcurrency, (int)vSegments.size()));
+		// the scheduler's workers are the parallelism; codecs only get what the segments leave over
+		if (options.encoder.threads == 0) {
+			options.encoder.threads = std::max(1, scheduler.GetThreadCount() / nConcurrency);
+		}
+		pStreamer = new FFmpegStreamer(options.codec, nWidth, nHeight, nFps, strOutFilePath.c_str());
+		for (int i = 0; i < nConcurrency; i++) {
+			SubmitNextSegment(scheduler);
+		}
+	});
+}
+
+void SegmentedExport::SubmitNextSegment(TaskScheduler& scheduler)
+{
+	int i = nNextSegment++;
+	if (i >= (int)vSegments.size()) {
+		return;
+	}
+	scheduler.Submit([this, &scheduler, i]() {
+		bool bOk = !bCancel && EncodeSegment(vSegments[i]);
+		if (!bOk) {
+			bCancel = true;
+		}
+		// before OnSegmentDone, which may finish the export and let the owner delete this
+		SubmitNextSegment(scheduler);
+		OnSegmentDone(i, bOk);
+	}, TaskScheduler::PRIORITY_NORMAL);
+}
+
+void SegmentedExport::OnSegmentDone(int i, bool bOk)
+{
+	std::unique_lock<std::mutex> lock(mtx);
+	vSegments[i].ok = bOk;
+	vSegments[i].done = true;
+	// only the task that completes the segment next in line muxes, so muxing stays serialized
+	if (i != nNextMux) {
+		return;
+	}
+	while (nNextMux < (int)vSegments.size() && vSegments[nNextMux].done) {
+		Segment& segment = vSegments[nNextMux];
+		bMuxOk = bMuxOk && segment.ok && MuxSegment(segment, nMuxLastDts);
+		if (!bMuxOk) {
+			bCancel = true;
+		} else {
+			nFramesOut += segment.frames;
+		}
+		nNextMux++;
+	}
+	if (nNextMux == (int)vSegments.size()) {
+		lock.unlock();
+		Finish(bMuxOk && !bCancel);
+	}
+}
+
+void SegmentedExport::Finish(bool bOk)
+{
+	// closing the streamer writes the trailer
+	delete pStreamer;
+	pStreamer = nullptr;
+	dElapsed = swScheduled.Stop();
+	LOG(INFO) << "Segmented export: " << strOutFilePath << ": " << nFramesOut << " frames in " << dElapsed
+		<< "s (" << GetExportFps() << " fps)";
+	if (done) {
+		done(bOk);
+	}
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "utils.h"
+#include "ffmpeg_decoder.h"
+#include "ffmpeg_encoder.h"
+#include "ffmpeg_streamer.h"
+#include "export_pipeline.h"
+#include "task_scheduler.h"
+
+struct SegmentedExportOptions
+{
+	AVCodecID codec = AV_CODEC_ID_H264;
+	// encoder settings shared by every segment; closed_gop is always forced on.
+	// threads 0 splits the scheduler's threads evenly between the concurrent segments.
+	EncoderOptions encoder;
+	// smallest segment in frames; a segment ends at the first source keyframe past it
+	int segment_frames = 300;
+	// segments encoded at once, 0 for one per scheduler thread
+	int concurrency = 0;
+};
+
+/**
+* @brief Export that cuts the timeline at source keyframes (from the packet index) and encodes the
+* segments concurrently, each with its own decoder and encoder instance. Every segment starts with
+* a fresh encoder, so it opens with an IDR frame and no picture references across a seam. Segments
+* are muxed through one FFmpegStreamer in timeline order as soon as all earlier ones are done.
+* Timestamps are absolute: segment encoders receive the source frame times in their time base, and
+* with identical settings their reordering delay matches, so dts stays monotonic across seams.
+*/
+class SegmentedExport
+{
+public:
+	// Creates the effect for one segment; effects run on segment threads, so each gets its own
+	typedef std::function<ExportPipeline::EffectFunc()> EffectFactory;
+
+	SegmentedExport(const char* szInFilePath, const char* szOutFilePath,
+		const SegmentedExportOptions& options = SegmentedExportOptions(), EffectFactory effects = nullptr);
+	SegmentedExport(const SegmentedExport&) = delete;
+	SegmentedExport& operator=(const SegmentedExport&) = delete;
+	~SegmentedExport();
+
+	/**
+	* @brief Start() on TaskScheduler::Global(), blocking until the file is closed. Not to be called
+	* from a task of that scheduler, which would hold one of the workers the export needs.
+	*/
+	bool Run();
+	/**
+	* @brief Runs the export as tasks of scheduler: one task plans it, then every segment is a task of
+	* its own, concurrency of them queued at a time. Whichever task completes the next segment in
+	* timeline order muxes it. Returns at once; done is called from a scheduler thread with the
+	* result, after the file is closed.
+	*/
+	void Start(TaskScheduler& scheduler, std::function<void(bool)> done);
+	void Cancel() {
+		bCancel = true;
+	}
+
+	int GetSegmentCount() {
+		return (int)vSegments.size();
+	}
+	int64_t GetFramesOut() {
+		return nFramesOut;
+	}
+	double GetExportFps() {
+		return dElapsed > 0.0 ? nFramesOut / dElapsed : 0.0;
+	}
+
+private:
+	struct Segment
+	{
+		// first frame of the segment, by presentation number, and the pts range it covers
+		int first_frame;
+		int64_t start_pts;
+		// AV_NOPTS_VALUE for the last segment
+		int64_t end_pts;
+		std::vector<AVPacket*> packets;
+		int64_t frames = 0;
+		bool done = false;
+		bool ok = false;
+	};
+
+	bool Plan();
+	// queues the next segment not yet started, if any
+	void SubmitNextSegment(TaskScheduler& scheduler);
+	bool EncodeSegment(Segment& segment);
+	bool MuxSegment(Segment& segment, int64_t& nLastDts);
+	// marks segment i done and muxes every finished segment that is next in line
+	void OnSegmentDone(int i, bool bOk);
+	void Finish(bool bOk);
+
+private:
+	std::string strInFilePath, strOutFilePath;
+	SegmentedExportOptions options;
+	EffectFactory effects;
+
+	int nWidth = 0, nHeight = 0, nFps = 25;
+	AVPixelFormat eFormat = AV_PIX_FMT_YUV420P;
+	AVRational tb = { 1, 25 };
+
+	// open from planning until Finish()
+	FFmpegStreamer* pStreamer = nullptr;
+	std::vector<Segment> vSegments;
+	std::atomic<int> nNextSegment{ 0 };
+	std::mutex mtx;
+
+	std::atomic<bool> bCancel{ false };
+	int64_t nFramesOut = 0;
+	double dElapsed = 0.0;
+
+	std::function<void(bool)> done;
+	StopWatch swScheduled;
+	// next segment to mux and the last dts written, guarded by mtx
+	int nNextMux = 0;
+	int64_t nMuxLastDts = AV_NOPTS_VALUE;
+	bool bMuxOk = true;
+};
@@ -0,0 +1,770 @@
+#include "simd_kernels.h"
+
+extern "C" {
+#include <libavutil/cpu.h>
+}
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define SIMD_X86 1
+#include <immintrin.h>
+#endif
+#if defined(__aarch64__) || defined(_M_ARM64) || defined(__ARM_NEON)
+#define SIMD_NEON 1
+#include <arm_neon.h>
+#endif
+
+// GCC and Clang only emit AVX2 instructions in functions built for that target; MSVC always does
+#if defined(__GNUC__) || defined(__clang__)
+#define SIMD_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define SIMD_TARGET_AVX2
+#endif
+
+namespace simd {
+
+namespace {
+
+// ---------------------------------------------------------------- scalar reference
+
+template<typename T>
+void InterleaveUV_Scalar(const T* pU, const T* pV, T* pUV, int n) {
+    for (int x = 0; x < n; x++) {
+        pUV[x * 2] = pU[x];
+        pUV[x * 2 + 1] = pV[x];
+    }
+}
+
+template<typename T>
+void DeinterleaveUV_Scalar(const T* pUV, T* pU, T* pV, int n) {
+    for (int x = 0; x < n; x++) {
+        // read both before writing: pU may alias the start of pUV for in-place conversion
+        T u = pUV[x * 2], v = pUV[x * 2 + 1];
+        pU[x] = u;
+        pV[x] = v;
+    }
+}
+
+void PeakReduce_Scalar(const float* p, int n, float* pMin, float* pMax, float* pSumSq) {
+    float fMin = *pMin, fMax = *pMax, fSum = 0.0f;
+    for (int x = 0; x < n; x++) {
+        fMin = p[x] < fMin ? p[x] : fMin;
+        fMax = p[x] > fMax ? p[x] : fMax;
+        fSum += p[x] * p[x];
+    }
+    *pMin = fMin;
+    *pMax = fMax;
+    *pSumSq += fSum;
+}
+
+// samples [nStart, n); the gain keeps its position-based formula so vector heads and scalar tails agree
+void MixRampFrom(const float* pSrc, float* pDst, int nStart, int n, float fGain, float fStep) {
+    for (int x = nStart; x < n; x++) {
+        pDst[x] += pSrc[x] * (fGain + fStep * (float)x);
+    }
+}
+
+void MixRamp_Scalar(const float* pSrc, float* pDst, int n, float fGain, float fStep) {
+    MixRampFrom(pSrc, pDst, 0, n, fGain, fStep);
+}
+
+void ClampUnit_Scalar(float* p, int n) {
+    for (int x = 0; x < n; x++) {
+        p[x] = p[x] < -1.0f ? -1.0f : p[x] > 1.0f ? 1.0f : p[x];
+    }
+}
+
+// alpha at nBits to 0..256, full scale mapping to exactly 256
+inline int AlphaTo256(int nAlpha, int nBits) {
+    return (nAlpha + (nAlpha >> (nBits - 1))) >> (nBits - 8);
+}
+
+template<typename T>
+void BlendFrom(const T* pSrc, const T* pAlpha, T* pDst, int nStart, int n, int nOpacity, int nBits) {
+    for (int x = nStart; x < n; x++) {
+        int a = nOpacity;
+        if (pAlpha) {
+            a = AlphaTo256(pAlpha[x], nBits);
+            // a * nOpacity stays below 2^16, which the vector versions rely on
+            a = nOpacity < 256 ? (a * nOpacity + 128) >> 8 : a;
+        }
+        pDst[x] = (T)((pSrc[x] * a + pDst[x] * (256 - a) + 128) >> 8);
+    }
+}
+
+void Blend8_Scalar(const uint8_t* pSrc, const uint8_t* pAlpha, uint8_t* pDst, int n, int nOpacity) {
+    BlendFrom(pSrc, pAlpha, pDst, 0, n, nOpacity, 8);
+}
+
+void Blend16_Scalar(const uint16_t* pSrc, const uint16_t* pAlpha, uint16_t* pDst, int n, int nOpacity, int nBits) {
+    BlendFrom(pSrc, pAlpha, pDst, 0, n, nOpacity, nBits);
+}
+
+// 2^16 / (nWhite - nBlack), rounded: products of two normalized samples are divided by the range with it
+inline int RangeReciprocal(int nBlack, int nWhite) {
+    int nRange = nWhite - nBlack > 0 ? nWhite - nBlack : 1;
+    return ((1 << 16) + nRange / 2) / nRange;
+}
+
+template<typename T>
+void ModeFrom(const T* pSrc, const T* pDst, T* pOut, int nStart, int n, BlendMode eMode, int nBlack, int nWhite) {
+    int nRange = nWhite - nBlack, nInv = RangeReciprocal(nBlack, nWhite);
+    for (int x = nStart; x < n; x++) {
+        int s = (pSrc[x] < nBlack ? nBlack : pSrc[x] > nWhite ? nWhite : pSrc[x]) - nBlack;
+        int d = (pDst[x] < nBlack ? nBlack : pDst[x] > nWhite ? nWhite : pDst[x]) - nBlack;
+        int r;
+        switch (eMode) {
+        case BLEND_ADD:
+            r = s + d;
+            break;
+        case BLEND_MULTIPLY:
+            r = (s * d * nInv + 32768) >> 16;
+            break;
+        case BLEND_SCREEN:
+            r = s + d - ((s * d * nInv + 32768) >> 16);
+            break;
+        default:
+            r = s;
+            break;
+        }
+        r = r < 0 ? 0 : r > nRange ? nRange : r;
+        pOut[x] = (T)(r + nBlack);
+    }
+}
+
+void Mode8_Scalar(const uint8_t* pSrc, const uint8_t* pDst, uint8_t* pOut, int n, BlendMode eMode, int nBlack, int nWhite) {
+    ModeFrom(pSrc, pDst, pOut, 0, n, eMode, nBlack, nWhite);
+}
+
+void Mode16_Scalar(const uint16_t* pSrc, const uint16_t* pDst, uint16_t* pOut, int n, BlendMode eMode, int nBlack, int nWhite) {
+    ModeFrom(pSrc, pDst, pOut, 0, n, eMode, nBlack, nWhite);
+}
+
+#ifdef SIMD_X86
+
+// ---------------------------------------------------------------- SSE2
+
+void InterleaveUV8_SSE2(const uint8_t* pU, const uint8_t* pV, uint8_t* pUV, int n) {
+    int x = 0;
+    for (; x + 16 <= n; x += 16) {
+        __m128i u = _mm_loadu_si128((const __m128i*)(pU + x));
+        __m128i v = _mm_loadu_si128((const __m128i*)(pV + x));
+        _mm_storeu_si128((__m128i*)(pUV + x * 2), _mm_unpacklo_epi8(u, v));
+        _mm_storeu_si128((__m128i*)(pUV + x * 2 + 16), _mm_unpackhi_epi8(u, v));
+    }
+    InterleaveUV_Scalar(pU + x, pV + x, pUV + x * 2, n - x);
+}
+
+void InterleaveUV16_SSE2(const uint16_t* pU, const uint16_t* pV, uint16_t* pUV, int n) {
+    int x = 0;
+    for (; x + 8 <= n; x += 8) {
+        __m128i u = _mm_loadu_si128((const __m128i*)(pU + x));
+        __m128i v = _mm_loadu_si128((const __m128i*)(pV + x));
+        _mm_storeu_si128((__m128i*)(pUV + x * 2), _mm_unpacklo_epi16(u, v));
+        _mm_storeu_si128((__m128i*)(pUV + x * 2 + 8), _mm_unpackhi_epi16(u, v));
+    }
+    InterleaveUV_Scalar(pU + x, pV + x, pUV + x * 2, n - x);
+}
+
+void DeinterleaveUV8_SSE2(const uint8_t* pUV, uint8_t* pU, uint8_t* pV, int n) {
+    const __m128i mask = _mm_set1_epi16(0x00FF);
+    int x = 0;
+    for (; x + 16 <= n; x += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(pUV + x * 2));
+        __m128i b = _mm_loadu_si128((const __m128i*)(pUV + x * 2 + 16));
+        __m128i u = _mm_packus_epi16(_mm_and_si128(a, mask), _mm_and_si128(b, mask));
+        __m128i v = _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8));
+        _mm_storeu_si128((__m128i*)(pU + x), u);
+        _mm_storeu_si128((__m128i*)(pV + x), v);
+    }
+    DeinterleaveUV_Scalar(pUV + x * 2, pU + x, pV + x, n - x);
+}
+
+void DeinterleaveUV16_SSE2(const uint16_t* pUV, uint16_t* pU, uint16_t* pV, int n) {
+    int x = 0;
+    for (; x + 8 <= n; x += 8) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(pUV + x * 2));
+        __m128i b = _mm_loadu_si128((const __m128i*)(pUV + x * 2 + 8));
+        // u0 v0 u1 v1 | u2 v2 u3 v3 -> u0 u1 v0 v1 | u2 u3 v2 v3 -> u0 u1 u2 u3 | v0 v1 v2 v3
+        a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(a, _MM_SHUFFLE(3, 1, 2, 0)), _MM_SHUFFLE(3, 1, 2, 0));
+        b = _mm_shufflehi_epi16(_mm_shufflelo_epi16(b, _MM_SHUFFLE(3, 1, 2, 0)), _MM_SHUFFLE(3, 1, 2, 0));
+        a = _mm_shuffle_epi32(a, _MM_SHUFFLE(3, 1, 2, 0));
+        b = _mm_shuffle_epi32(b, _MM_SHUFFLE(3, 1, 2, 0));
+        _mm_storeu_si128((__m128i*)(pU + x), _mm_unpacklo_epi64(a, b));
+        _mm_storeu_si128((__m128i*)(pV + x), _mm_unpackhi_epi64(a, b));
+    }
+    DeinterleaveUV_Scalar(pUV + x * 2, pU + x, pV + x, n - x);
+}
+
+void PeakReduce_SSE2(const float* p, int n, float* pMin, float* pMax, float* pSumSq) {
+    __m128 vMin = _mm_set1_ps(*pMin), vMax = _mm_set1_ps(*pMax), vSum = _mm_setzero_ps();
+    int x = 0;
+    for (; x + 4 <= n; x += 4) {
+        __m128 v = _mm_loadu_ps(p + x);
+        vMin = _mm_min_ps(vMin, v);
+        vMax = _mm_max_ps(vMax, v);
+        vSum = _mm_add_ps(vSum, _mm_mul_ps(v, v));
+    }
+    float aMin[4], aMax[4], aSum[4];
+    _mm_storeu_ps(aMin, vMin);
+    _mm_storeu_ps(aMax, vMax);
+    _mm_storeu_ps(aSum, vSum);
+    for (int i = 1; i < 4; i++) {
+        aMin[0] = aMin[i] < aMin[0] ? aMin[i] : aMin[0];
+        aMax[0] = aMax[i] > aMax[0] ? aMax[i] : aMax[0];
+    }
+    *pMin = aMin[0];
+    *pMax = aMax[0];
+    *pSumSq += (aSum[0] + aSum[1]) + (aSum[2] + aSum[3]);
+    PeakReduce_Scalar(p + x, n - x, pMin, pMax, pSumSq);
+}
+
+void MixRamp_SSE2(const float* pSrc, float* pDst, int n, float fGain, float fStep) {
+    __m128 vGain = _mm_set1_ps(fGain), vStep = _mm_set1_ps(fStep);
+    __m128 vIdx = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f), vFour = _mm_set1_ps(4.0f);
+    int x = 0;
+    for (; x + 4 <= n; x += 4) {
+        __m128 g = _mm_add_ps(vGain, _mm_mul_ps(vStep, vIdx));
+        _mm_storeu_ps(pDst + x, _mm_add_ps(_mm_loadu_ps(pDst + x), _mm_mul_ps(_mm_loadu_ps(pSrc + x), g)));
+        vIdx = _mm_add_ps(vIdx, vFour);
+    }
+    MixRampFrom(pSrc, pDst, x, n, fGain, fStep);
+}
+
+void ClampUnit_SSE2(float* p, int n) {
+    __m128 vLo = _mm_set1_ps(-1.0f), vHi = _mm_set1_ps(1.0f);
+    int x = 0;
+    for (; x + 4 <= n; x += 4) {
+        _mm_storeu_ps(p + x, _mm_min_ps(_mm_max_ps(_mm_loadu_ps(p + x), vLo), vHi));
+    }
+    ClampUnit_Scalar(p + x, n - x);
+}
+
+void Blend8_SSE2(const uint8_t* pSrc, const uint8_t* pAlpha, uint8_t* pDst, int n, int nOpacity) {
+    const __m128i zero = _mm_setzero_si128(), round = _mm_set1_epi16(128), full = _mm_set1_epi16(256);
+    __m128i op = _mm_set1_epi16((short)nOpacity);
+    int x = 0;
+    for (; x + 8 <= n; x += 8) {
+        __m128i s = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(pSrc + x)), zero);
+        __m128i d = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(pDst + x)), zero);
+        __m128i a = op;
+        if (pAlpha) {
+            a = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(pAlpha + x)), zero);
+            a = _mm_add_epi16(a, _mm_srli_epi16(a, 7));
+            if (nOpacity < 256) {
+                a = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(a, op), round), 8);
+            }
+        }
+        // s * a + d * (256 - a) is a convex combination below 2^16, so 16-bit products are exact
+        __m128i r = _mm_add_epi16(_mm_mullo_epi16(s, a), _mm_mullo_epi16(d, _mm_sub_epi16(full, a)));
+        r = _mm_srli_epi16(_mm_add_epi16(r, round), 8);
+        _mm_storel_epi64((__m128i*)(pDst + x), _mm_packus_epi16(r, r));
+    }
+    BlendFrom(pSrc, pAlpha, pDst, x, n, nOpacity, 8);
+}
+
+void Blend16_SSE2(const uint16_t* pSrc, const uint16_t* pAlpha, uint16_t* pDst, int n, int nOpacity, int nBits) {
+    const __m128i round16 = _mm_set1_epi16(128), round32 = _mm_set1_epi32(128), full = _mm_set1_epi16(256);
+    const __m128i shiftHi = _mm_cvtsi32_si128(nBits - 1), shiftDown = _mm_cvtsi32_si128(nBits - 8);
+    __m128i op = _mm_set1_epi16((short)nOpacity);
+    int x = 0;
+    for (; x + 8 <= n; x += 8) {
+        __m128i s = _mm_loadu_si128((const __m128i*)(pSrc + x));
+        __m128i d = _mm_loadu_si128((const __m128i*)(pDst + x));
+        __m128i a = op;
+        if (pAlpha) {
+            a = _mm_loadu_si128((const __m128i*)(pAlpha + x));
+            a = _mm_srl_epi16(_mm_add_epi16(a, _mm_srl_epi16(a, shiftHi)), shiftDown);
+            if (nOpacity < 256) {
+                a = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(a, op), round16), 8);
+            }
+        }
+        // pairs (s, d) . (a, 256 - a) in 32 bits; packs restores the order the unpacks split
+        __m128i ia = _mm_sub_epi16(full, a);
+        __m128i lo = _mm_madd_epi16(_mm_unpacklo_epi16(s, d), _mm_unpacklo_epi16(a, ia));
+        __m128i hi = _mm_madd_epi16(_mm_unpackhi_epi16(s, d), _mm_unpackhi_epi16(a, ia));
+        lo = _mm_srai_epi32(_mm_add_epi32(lo, round32), 8);
+        hi = _mm_srai_epi32(_mm_add_epi32(hi, round32), 8);
+        _mm_storeu_si128((__m128i*)(pDst + x), _mm_packs_epi32(lo, hi));
+    }
+    BlendFrom(pSrc, pAlpha, pDst, x, n, nOpacity, nBits);
+}
+
+// ---------------------------------------------------------------- AVX2
+
+SIMD_TARGET_AVX2 void InterleaveUV8_AVX2(const uint8_t* pU, const uint8_t* pV, uint8_t* pUV, int n) {
+    int x = 0;
+    for (; x + 32 <= n; x += 32) {
+        __m256i u = _mm256_loadu_si256((const __m256i*)(pU + x));
+        __m256i v = _mm256_loadu_si256((const __m256i*)(pV + x));
+        // unpack works per 128-bit lane, so put the lanes back in order afterwards
+        __m256i lo = _mm256_unpacklo_epi8(u, v);
+        __m256i hi = _mm256_unpackhi_epi8(u, v);
+        _mm256_storeu_si256((__m256i*)(pUV + x * 2), _mm256_permute2x128_si256(lo, hi, 0x20));
+        _mm256_storeu_si256((__m256i*)(pUV + x * 2 + 32), _mm256_permute2x128_si256(lo, hi, 0x31));
+    }
+    InterleaveUV8_SSE2(pU + x, pV + x, pUV + x * 2, n - x);
+}
+
+SIMD_TARGET_AVX2 void InterleaveUV16_AVX2(const uint16_t* pU, const uint16_t* pV, uint16_t* pUV, int n) {
+    int x = 0;
+    for (; x + 16 <= n; x += 16) {
+        __m256i u = _mm256_loadu_si256((const __m256i*)(pU + x));
+        __m256i v = _mm256_loadu_si256((const __m256i*)(pV + x));
+        __m256i lo = _mm256_unpacklo_epi16(u, v);
+        __m256i hi = _mm256_unpackhi_epi16(u, v);
+        _mm256_storeu_si256((__m256i*)(pUV + x * 2), _mm256_permute2x128_si256(lo, hi, 0x20));
+        _mm256_storeu_si256((__m256i*)(pUV + x * 2 + 16), _mm256_permute2x128_si256(lo, hi, 0x31));
+    }
+    InterleaveUV16_SSE2(pU + x, pV + x, pUV + x * 2, n - x);
+}
+
+SIMD_TARGET_AVX2 void DeinterleaveUV8_AVX2(const uint8_t* pUV, uint8_t* pU, uint8_t* pV, int n) {
+    // per lane: even bytes to the low 8, odd bytes to the high 8
+    const __m256i shuffle = _mm256_setr_epi8(
+        0, 2, 4, 6, 8, 10, 12, 14, 1, 3, 5, 7, 9, 11, 13, 15,
+        0, 2, 4, 6, 8, 10, 12, 14, 1, 3, 5, 7, 9, 11, 13, 15);
+    int x = 0;
+    for (; x + 32 <= n; x += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(pUV + x * 2));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(pUV + x * 2 + 32));
+        // u0-7 v0-7 | u8-15 v8-15 -> u0-7 u8-15 | v0-7 v8-15
+        a = _mm256_permute4x64_epi64(_mm256_shuffle_epi8(a, shuffle), _MM_SHUFFLE(3, 1, 2, 0));
+        b = _mm256_permute4x64_epi64(_mm256_shuffle_epi8(b, shuffle), _MM_SHUFFLE(3, 1, 2, 0));
+        __m256i u = _mm256_permute2x128_si256(a, b, 0x20);
+        __m256i v = _mm256_permute2x128_si256(a, b, 0x31);
+        _mm256_storeu_si256((__m256i*)(pU + x), u);
+        _mm256_storeu_si256((__m256i*)(pV + x), v);
+    }
+    DeinterleaveUV8_SSE2(pUV + x * 2, pU + x, pV + x, n - x);
+}
+
+SIMD_TARGET_AVX2 void DeinterleaveUV16_AVX2(const uint16_t* pUV, uint16_t* pU, uint16_t* pV, int n) {
+    const __m256i shuffle = _mm256_setr_epi8(
+        0, 1, 4, 5, 8, 9, 12, 13, 2, 3, 6, 7, 10, 11, 14, 15,
+        0, 1, 4, 5, 8, 9, 12, 13, 2, 3, 6, 7, 10, 11, 14, 15);
+    int x = 0;
+    for (; x + 16 <= n; x += 16) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(pUV + x * 2));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(pUV + x * 2 + 16));
+        a = _mm256_permute4x64_epi64(_mm256_shuffle_epi8(a, shuffle), _MM_SHUFFLE(3, 1, 2, 0));
+        b = _mm256_permute4x64_epi64(_mm256_shuffle_epi8(b, shuffle), _MM_SHUFFLE(3, 1, 2, 0));
+        _mm256_storeu_si256((__m256i*)(pU + x), _mm256_permute2x128_si256(a, b, 0x20));
+        _mm256_storeu_si256((__m256i*)(pV + x), _mm256_permute2x128_si256(a, b, 0x31));
+    }
+    DeinterleaveUV16_SSE2(pUV + x * 2, pU + x, pV + x, n - x);
+}
+
+SIMD_TARGET_AVX2 void PeakReduce_AVX2(const float* p, int n, float* pMin, float* pMax, float* pSumSq) {
+    __m256 vMin = _mm256_set1_ps(*pMin), vMax = _mm256_set1_ps(*pMax);
+    // two accumulators hide the add latency
+    __m256 vSum0 = _mm256_setzero_ps(), vSum1 = _mm256_setzero_ps();
+    int x = 0;
+    for (; x + 16 <= n; x += 16) {
+        __m256 a = _mm256_loadu_ps(p + x);
+        __m256 b = _mm256_loadu_ps(p + x + 8);
+        vMin = _mm256_min_ps(vMin, _mm256_min_ps(a, b));
+        vMax = _mm256_max_ps(vMax, _mm256_max_ps(a, b));
+        vSum0 = _mm256_add_ps(vSum0, _mm256_mul_ps(a, a));
+        vSum1 = _mm256_add_ps(vSum1, _mm256_mul_ps(b, b));
+    }
+    __m128 vMin4 = _mm_min_ps(_mm256_castps256_ps128(vMin), _mm256_extractf128_ps(vMin, 1));
+    __m128 vMax4 = _mm_max_ps(_mm256_castps256_ps128(vMax), _mm256_extractf128_ps(vMax, 1));
+    __m256 vSum = _mm256_add_ps(vSum0, vSum1);
+    __m128 vSum4 = _mm_add_ps(_mm256_castps256_ps128(vSum), _mm256_extractf128_ps(vSum, 1));
+    float aMin[4], aMax[4], aSum[4];
+    _mm_storeu_ps(aMin, vMin4);
+    _mm_storeu_ps(aMax, vMax4);
+    _mm_storeu_ps(aSum, vSum4);
+    for (int i = 1; i < 4; i++) {
+        aMin[0] = aMin[i] < aMin[0] ? aMin[i] : aMin[0];
+        aMax[0] = aMax[i] > aMax[0] ? aMax[i] : aMax[0];
+    }
+    *pMin = aMin[0];
+    *pMax = aMax[0];
+    *pSumSq += (aSum[0] + aSum[1]) + (aSum[2] + aSum[3]);
+    PeakReduce_SSE2(p + x, n - x, pMin, pMax, pSumSq);
+}
+
+SIMD_TARGET_AVX2 void MixRamp_AVX2(const float* pSrc, float* pDst, int n, float fGain, float fStep) {
+    __m256 vGain = _mm256_set1_ps(fGain), vStep = _mm256_set1_ps(fStep);
+    __m256 vIdx = _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f), vEight = _mm256_set1_ps(8.0f);
+    int x = 0;
+    for (; x + 8 <= n; x += 8) {
+        // mul + add rather than FMA, so every ISA rounds like the scalar reference
+        __m256 g = _mm256_add_ps(vGain, _mm256_mul_ps(vStep, vIdx));
+        _mm256_storeu_ps(pDst + x, _mm256_add_ps(_mm256_loadu_ps(pDst + x), _mm256_mul_ps(_mm256_loadu_ps(pSrc + x), g)));
+        vIdx = _mm256_add_ps(vIdx, vEight);
+    }
+    MixRampFrom(pSrc, pDst, x, n, fGain, fStep);
+}
+
+SIMD_TARGET_AVX2 void ClampUnit_AVX2(float* p, int n) {
+    __m256 vLo = _mm256_set1_ps(-1.0f), vHi = _mm256_set1_ps(1.0f);
+    int x = 0;
+    for (; x + 8 <= n; x += 8) {
+        _mm256_storeu_ps(p + x, _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(p + x), vLo), vHi));
+    }
+    ClampUnit_Scalar(p + x, n - x);
+}
+
+SIMD_TARGET_AVX2 void Blend8_AVX2(const uint8_t* pSrc, const uint8_t* pAlpha, uint8_t* pDst, int n, int nOpacity) {
+    const __m256i round = _mm256_set1_epi16(128), full = _mm256_set1_epi16(256);
+    __m256i op = _mm256_set1_epi16((short)nOpacity);
+    int x = 0;
+    for (; x + 16 <= n; x += 16) {
+        __m256i s = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(pSrc + x)));
+        __m256i d = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(pDst + x)));
+        __m256i a = op;
+        if (pAlpha) {
+            a = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(pAlpha + x)));
+            a = _mm256_add_epi16(a, _mm256_srli_epi16(a, 7));
+            if (nOpacity < 256) {
+                a = _mm256_srli_epi16(_mm256_add_epi16(_mm256_mullo_epi16(a, op), round), 8);
+            }
+        }
+        __m256i r = _mm256_add_epi16(_mm256_mullo_epi16(s, a), _mm256_mullo_epi16(d, _mm256_sub_epi16(full, a)));
+        r = _mm256_srli_epi16(_mm256_add_epi16(r, round), 8);
+        // packus works per lane: gather both lanes' low halves into the low 128 bits
+        r = _mm256_permute4x64_epi64(_mm256_packus_epi16(r, r), _MM_SHUFFLE(3, 1, 2, 0));
+        _mm_storeu_si128((__m128i*)(pDst + x), _mm256_castsi256_si128(r));
+    }
+    Blend8_SSE2(pSrc + x, pAlpha ? pAlpha + x : nullptr, pDst + x, n - x, nOpacity);
+}
+
+SIMD_TARGET_AVX2 void Blend16_AVX2(const uint16_t* pSrc, const uint16_t* pAlpha, uint16_t* pDst, int n, int nOpacity, int nBits) {
+    const __m256i round16 = _mm256_set1_epi16(128), round32 = _mm256_set1_epi32(128), full = _mm256_set1_epi16(256);
+    const __m128i shiftHi = _mm_cvtsi32_si128(nBits - 1), shiftDown = _mm_cvtsi32_si128(nBits - 8);
+    __m256i op = _mm256_set1_epi16((short)nOpacity);
+    int x = 0;
+    for (; x + 16 <= n; x += 16) {
+        __m256i s = _mm256_loadu_si256((const __m256i*)(pSrc + x));
+        __m256i d = _mm256_loadu_si256((const __m256i*)(pDst + x));
+        __m256i a = op;
+        if (pAlpha) {
+            a = _mm256_loadu_si256((const __m256i*)(pAlpha + x));
+            a = _mm256_srl_epi16(_mm256_add_epi16(a, _mm256_srl_epi16(a, shiftHi)), shiftDown);
+            if (nOpacity < 256) {
+                a = _mm256_srli_epi16(_mm256_add_epi16(_mm256_mullo_epi16(a, op), round16), 8);
+            }
+        }
+        __m256i ia = _mm256_sub_epi16(full, a);
+        __m256i lo = _mm256_madd_epi16(_mm256_unpacklo_epi16(s, d), _mm256_unpacklo_epi16(a, ia));
+        __m256i hi = _mm256_madd_epi16(_mm256_unpackhi_epi16(s, d), _mm256_unpackhi_epi16(a, ia));
+        lo = _mm256_srai_epi32(_mm256_add_epi32(lo, round32), 8);
+        hi = _mm256_srai_epi32(_mm256_add_epi32(hi, round32), 8);
+        _mm256_storeu_si256((__m256i*)(pDst + x), _mm256_packs_epi32(lo, hi));
+    }
+    Blend16_SSE2(pSrc + x, pAlpha ? pAlpha + x : nullptr, pDst + x, n - x, nOpacity, nBits);
+}
+
+// eight samples widened to 32 bits; the same arithmetic as ModeFrom
+SIMD_TARGET_AVX2 inline __m256i Mode8x32_AVX2(__m256i s, __m256i d, BlendMode eMode, __m256i black, __m256i white,
+    __m256i range, __m256i inv) {
+    const __m256i zero = _mm256_setzero_si256(), round = _mm256_set1_epi32(32768);
+    s = _mm256_sub_epi32(_mm256_min_epi32(_mm256_max_epi32(s, black), white), black);
+    d = _mm256_sub_epi32(_mm256_min_epi32(_mm256_max_epi32(d, black), white), black);
+    __m256i r;
+    switch (eMode) {
+    case BLEND_ADD:
+        r = _mm256_add_epi32(s, d);
+        break;
+    case BLEND_MULTIPLY:
+        r = _mm256_srai_epi32(_mm256_add_epi32(_mm256_mullo_epi32(_mm256_mullo_epi32(s, d), inv), round), 16);
+        break;
+    case BLEND_SCREEN:
+        r = _mm256_srai_epi32(_mm256_add_epi32(_mm256_mullo_epi32(_mm256_mullo_epi32(s, d), inv), round), 16);
+        r = _mm256_sub_epi32(_mm256_add_epi32(s, d), r);
+        break;
+    default:
+        r = s;
+        break;
+    }
+    r = _mm256_min_epi32(_mm256_max_epi32(r, zero), range);
+    return _mm256_add_epi32(r, black);
+}
+
+SIMD_TARGET_AVX2 void Mode8_AVX2(const uint8_t* pSrc, const uint8_t* pDst, uint8_t* pOut, int n, BlendMode eMode, int nBlack, int nWhite) {
+    const __m256i black = _mm256_set1_epi32(nBlack), white = _mm256_set1_epi32(nWhite);
+    const __m256i range = _mm256_set1_epi32(nWhite - nBlack), inv = _mm256_set1_epi32(RangeReciprocal(nBlack, nWhite));
+    int x = 0;
+    for (; x + 8 <= n; x += 8) {
+        __m256i s = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(pSrc + x)));
+        __m256i d = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(pDst + x)));
+        __m256i r = Mode8x32_AVX2(s, d, eMode, black, white, range, inv);
+        r = _mm256_permute4x64_epi64(_mm256_packus_epi32(r, r), _MM_SHUFFLE(3, 1, 2, 0));
+        __m128i r16 = _mm256_castsi256_si128(r);
+        _mm_storel_epi64((__m128i*)(pOut + x), _mm_packus_epi16(r16, r16));
+    }
+    ModeFrom(pSrc, pDst, pOut, x, n, eMode, nBlack, nWhite);
+}
+
+SIMD_TARGET_AVX2 void Mode16_AVX2(const uint16_t* pSrc, const uint16_t* pDst, uint16_t* pOut, int n, BlendMode eMode, int nBlack, int nWhite) {
+    const __m256i black = _mm256_set1_epi32(nBlack), white = _mm256_set1_epi32(nWhite);
+    const __m256i range = _mm256_set1_epi32(nWhite - nBlack), inv = _mm256_set1_epi32(RangeReciprocal(nBlack, nWhite));
+    int x = 0;
+    for (; x + 8 <= n; x += 8) {
+        __m256i s = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(pSrc + x)));
+        __m256i d = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(pDst + x)));
+        __m256i r = Mode8x32_AVX2(s, d, eMode, black, white, range, inv);
+        r = _mm256_permute4x64_epi64(_mm256_packus_epi32(r, r), _MM_SHUFFLE(3, 1, 2, 0));
+        _mm_storeu_si128((__m128i*)(pOut + x), _mm256_castsi256_si128(r));
+    }
+    ModeFrom(pSrc, pDst, pOut, x, n, eMode, nBlack, nWhite);
+}
+
+#endif // SIMD_X86
+
+#ifdef SIMD_NEON
+
+// ---------------------------------------------------------------- NEON
+
+void InterleaveUV8_NEON(const uint8_t* pU, const uint8_t* pV, uint8_t* pUV, int n) {
+    int x = 0;
+    for (; x + 16 <= n; x += 16) {
+        uint8x16x2_t uv;
+        uv.val[0] = vld1q_u8(pU + x);
+        uv.val[1] = vld1q_u8(pV + x);
+        vst2q_u8(pUV + x * 2, uv);
+    }
+    InterleaveUV_Scalar(pU + x, pV + x, pUV + x * 2, n - x);
+}
+
+void InterleaveUV16_NEON(const uint16_t* pU, const uint16_t* pV, uint16_t* pUV, int n) {
+    int x = 0;
+    for (; x + 8 <= n; x += 8) {
+        uint16x8x2_t uv;
+        uv.val[0] = vld1q_u16(pU + x);
+        uv.val[1] = vld1q_u16(pV + x);
+        vst2q_u16(pUV + x * 2, uv);
+    }
+    InterleaveUV_Scalar(pU + x, pV + x, pUV + x * 2, n - x);
+}
+
+void DeinterleaveUV8_NEON(const uint8_t* pUV, uint8_t* pU, uint8_t* pV, int n) {
+    int x = 0;
+    for (; x + 16 <= n; x += 16) {
+        uint8x16x2_t uv = vld2q_u8(pUV + x * 2);
+        vst1q_u8(pU + x, uv.val[0]);
+        vst1q_u8(pV + x, uv.val[1]);
+    }
+    DeinterleaveUV_Scalar(pUV + x * 2, pU + x, pV + x, n - x);
+}
+
+void DeinterleaveUV16_NEON(const uint16_t* pUV, uint16_t* pU, uint16_t* pV, int n) {
+    int x = 0;
+    for (; x + 8 <= n; x += 8) {
+        uint16x8x2_t uv = vld2q_u16(pUV + x * 2);
+        vst1q_u16(pU + x, uv.val[0]);
+        vst1q_u16(pV + x, uv.val[1]);
+    }
+    DeinterleaveUV_Scalar(pUV + x * 2, pU + x, pV + x, n - x);
+}
+
+void PeakReduce_NEON(const float* p, int n, float* pMin, float* pMax, float* pSumSq) {
+    float32x4_t vMin = vdupq_n_f32(*pMin), vMax = vdupq_n_f32(*pMax), vSum = vdupq_n_f32(0.0f);
+    int x = 0;
+    for (; x + 4 <= n; x += 4) {
+        float32x4_t v = vld1q_f32(p + x);
+        vMin = vminq_f32(vMin, v);
+        vMax = vmaxq_f32(vMax, v);
+        vSum = vmlaq_f32(vSum, v, v);
+    }
+    float aMin[4], aMax[4], aSum[4];
+    vst1q_f32(aMin, vMin);
+    vst1q_f32(aMax, vMax);
+    vst1q_f32(aSum, vSum);
+    for (int i = 1; i < 4; i++) {
+        aMin[0] = aMin[i] < aMin[0] ? aMin[i] : aMin[0];
+        aMax[0] = aMax[i] > aMax[0] ? aMax[i] : aMax[0];
+    }
+    *pMin = aMin[0];
+    *pMax = aMax[0];
+    *pSumSq += (aSum[0] + aSum[1]) + (aSum[2] + aSum[3]);
+    PeakReduce_Scalar(p + x, n - x, pMin, pMax, pSumSq);
+}
+
+void MixRamp_NEON(const float* pSrc, float* pDst, int n, float fGain, float fStep) {
+    const float aIdx[4] = { 0.0f, 1.0f, 2.0f, 3.0f };
+    float32x4_t vGain = vdupq_n_f32(fGain), vStep = vdupq_n_f32(fStep);
+    float32x4_t vIdx = vld1q_f32(aIdx), vFour = vdupq_n_f32(4.0f);
+    int x = 0;
+    for (; x + 4 <= n; x += 4) {
+        float32x4_t g = vaddq_f32(vGain, vmulq_f32(vStep, vIdx));
+        vst1q_f32(pDst + x, vaddq_f32(vld1q_f32(pDst + x), vmulq_f32(vld1q_f32(pSrc + x), g)));
+        vIdx = vaddq_f32(vIdx, vFour);
+    }
+    MixRampFrom(pSrc, pDst, x, n, fGain, fStep);
+}
+
+void ClampUnit_NEON(float* p, int n) {
+    float32x4_t vLo = vdupq_n_f32(-1.0f), vHi = vdupq_n_f32(1.0f);
+    int x = 0;
+    for (; x + 4 <= n; x += 4) {
+        vst1q_f32(p + x, vminq_f32(vmaxq_f32(vld1q_f32(p + x), vLo), vHi));
+    }
+    ClampUnit_Scalar(p + x, n - x);
+}
+
+void Blend8_NEON(const uint8_t* pSrc, const uint8_t* pAlpha, uint8_t* pDst, int n, int nOpacity) {
+    const uint16x8_t full = vdupq_n_u16(256);
+    uint16x8_t op = vdupq_n_u16((uint16_t)nOpacity);
+    int x = 0;
+    for (; x + 8 <= n; x += 8) {
+        uint16x8_t s = vmovl_u8(vld1_u8(pSrc + x));
+        uint16x8_t d = vmovl_u8(vld1_u8(pDst + x));
+        uint16x8_t a = op;
+        if (pAlpha) {
+            a = vmovl_u8(vld1_u8(pAlpha + x));
+            a = vaddq_u16(a, vshrq_n_u16(a, 7));
+            if (nOpacity < 256) {
+                a = vrshrq_n_u16(vmulq_u16(a, op), 8);
+            }
+        }
+        uint16x8_t r = vmlaq_u16(vmulq_u16(s, a), d, vsubq_u16(full, a));
+        vst1_u8(pDst + x, vmovn_u16(vrshrq_n_u16(r, 8)));
+    }
+    BlendFrom(pSrc, pAlpha, pDst, x, n, nOpacity, 8);
+}
+
+void Blend16_NEON(const uint16_t* pSrc, const uint16_t* pAlpha, uint16_t* pDst, int n, int nOpacity, int nBits) {
+    const uint16x8_t full = vdupq_n_u16(256);
+    const int16x8_t shiftHi = vdupq_n_s16((int16_t)-(nBits - 1)), shiftDown = vdupq_n_s16((int16_t)-(nBits - 8));
+    uint16x8_t op = vdupq_n_u16((uint16_t)nOpacity);
+    int x = 0;
+    for (; x + 8 <= n; x += 8) {
+        uint16x8_t s = vld1q_u16(pSrc + x);
+        uint16x8_t d = vld1q_u16(pDst + x);
+        uint16x8_t a = op;
+        if (pAlpha) {
+            a = vld1q_u16(pAlpha + x);
+            // negative counts shift right
+            a = vshlq_u16(vaddq_u16(a, vshlq_u16(a, shiftHi)), shiftDown);
+            if (nOpacity < 256) {
+                a = vrshrq_n_u16(vmulq_u16(a, op), 8);
+            }
+        }
+        uint16x8_t ia = vsubq_u16(full, a);
+        uint32x4_t lo = vmlal_u16(vmull_u16(vget_low_u16(s), vget_low_u16(a)), vget_low_u16(d), vget_low_u16(ia));
+        uint32x4_t hi = vmlal_u16(vmull_u16(vget_high_u16(s), vget_high_u16(a)), vget_high_u16(d), vget_high_u16(ia));
+        vst1q_u16(pDst + x, vcombine_u16(vrshrn_n_u32(lo, 8), vrshrn_n_u32(hi, 8)));
+    }
+    BlendFrom(pSrc, pAlpha, pDst, x, n, nOpacity, nBits);
+}
+
+#endif // SIMD_NEON
+
+const YuvKernels aYuvKernels[ISA_COUNT] = {
+    { InterleaveUV_Scalar<uint8_t>, InterleaveUV_Scalar<uint16_t>, DeinterleaveUV_Scalar<uint8_t>, DeinterleaveUV_Scalar<uint16_t> },
+#ifdef SIMD_X86
+    { InterleaveUV8_SSE2, InterleaveUV16_SSE2, DeinterleaveUV8_SSE2, DeinterleaveUV16_SSE2 },
+    { InterleaveUV8_AVX2, InterleaveUV16_AVX2, DeinterleaveUV8_AVX2, DeinterleaveUV16_AVX2 },
+#else
+    { InterleaveUV_Scalar<uint8_t>, InterleaveUV_Scalar<uint16_t>, DeinterleaveUV_Scalar<uint8_t>, DeinterleaveUV_Scalar<uint16_t> },
+    { InterleaveUV_Scalar<uint8_t>, InterleaveUV_Scalar<uint16_t>, DeinterleaveUV_Scalar<uint8_t>, DeinterleaveUV_Scalar<uint16_t> },
+#endif
+#ifdef SIMD_NEON
+    { InterleaveUV8_NEON, InterleaveUV16_NEON, DeinterleaveUV8_NEON, DeinterleaveUV16_NEON },
+#else
+    { InterleaveUV_Scalar<uint8_t>, InterleaveUV_Scalar<uint16_t>, DeinterleaveUV_Scalar<uint8_t>, DeinterleaveUV_Scalar<uint16_t> },
+#endif
+};
+
+const BlendKernels aBlendKernels[ISA_COUNT] = {
+    { Blend8_Scalar, Blend16_Scalar, Mode8_Scalar, Mode16_Scalar },
+#ifdef SIMD_X86
+    // the blend modes only have scalar and AVX2 versions
+    { Blend8_SSE2, Blend16_SSE2, Mode8_Scalar, Mode16_Scalar },
+    { Blend8_AVX2, Blend16_AVX2, Mode8_AVX2, Mode16_AVX2 },
+#else
+    { Blend8_Scalar, Blend16_Scalar, Mode8_Scalar, Mode16_Scalar },
+    { Blend8_Scalar, Blend16_Scalar, Mode8_Scalar, Mode16_Scalar },
+#endif
+#ifdef SIMD_NEON
+    { Blend8_NEON, Blend16_NEON, Mode8_Scalar, Mode16_Scalar },
+#else
+    { Blend8_Scalar, Blend16_Scalar, Mode8_Scalar, Mode16_Scalar },
+#endif
+};
+
+const AudioKernels aAudioKernels[ISA_COUNT] = {
+    { PeakReduce_Scalar, MixRamp_Scalar, ClampUnit_Scalar },
+#ifdef SIMD_X86
+    { PeakReduce_SSE2, MixRamp_SSE2, ClampUnit_SSE2 },
+    { PeakReduce_AVX2, MixRamp_AVX2, ClampUnit_AVX2 },
+#else
+    { PeakReduce_Scalar, MixRamp_Scalar, ClampUnit_Scalar },
+    { PeakReduce_Scalar, MixRamp_Scalar, ClampUnit_Scalar },
+#endif
+#ifdef SIMD_NEON
+    { PeakReduce_NEON, MixRamp_NEON, ClampUnit_NEON },
+#else
+    { PeakReduce_Scalar, MixRamp_Scalar, ClampUnit_Scalar },
+#endif
+};
+
+}
+
+const char* IsaName(Isa eIsa) {
+    const char* szNames[ISA_COUNT] = { "scalar", "sse2", "avx2", "neon" };
+    return eIsa >= 0 && eIsa < ISA_COUNT ? szNames[eIsa] : "unknown";
+}
+
+bool IsIsaAvailable(Isa eIsa) {
+    int nFlags = av_get_cpu_flags();
+    switch (eIsa) {
+    case ISA_SCALAR:
+        return true;
+#ifdef SIMD_X86
+    case ISA_SSE2:
+        return (nFlags & AV_CPU_FLAG_SSE2) != 0;
+    case ISA_AVX2:
+        // AV_CPU_FLAG_AVX2 is only reported when the OS saves the YMM state
+        return (nFlags & AV_CPU_FLAG_AVX2) != 0;
+#endif
+#ifdef SIMD_NEON
+    case ISA_NEON:
+        return (nFlags & AV_CPU_FLAG_NEON) != 0;
+#endif
+    default:
+        return false;
+    }
+}
+
+Isa DetectIsa() {
+    static const Isa eIsa = []() {
+        const Isa aPreferred[] = { ISA_AVX2, ISA_NEON, ISA_SSE2 };
+        for (Isa e : aPreferred) {
+            if (IsIsaAvailable(e)) {
+                return e;
+            }
+        }
+        return ISA_SCALAR;
+    }();
+    return eIsa;
+}
+
+const YuvKernels& GetYuvKernels(Isa eIsa) {
+    return aYuvKernels[IsIsaAvailable(eIsa) ? eIsa : ISA_SCALAR];
+}
+
+const YuvKernels& GetYuvKernels() {
+    return aYuvKernels[DetectIsa()];
+}
+
+const BlendKernels& GetBlendKernels(Isa eIsa) {
+    return aBlendKernels[IsIsaAvailable(eIsa) ? eIsa : ISA_SCALAR];
+}
+
+const BlendKernels& GetBlendKernels() {
+    return aBlendKernels[DetectIsa()];
+}
+
+const AudioKernels& GetAudioKernels(Isa eIsa) {
+    return aAudioKernels[IsIsaAvailable(eIsa) ? eIsa : ISA_SCALAR];
+}
+
+const AudioKernels& GetAudioKernels() {
+    return aAudioKernels[DetectIsa()];
+}
+
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <stdint.h>
+
+/**
+* @brief Vectorized inner loops with runtime CPU dispatch.
+* Every kernel has a scalar version that serves as the reference implementation.
+*/
+namespace simd {
+
+enum Isa {
+    ISA_SCALAR,
+    ISA_SSE2,
+    ISA_AVX2,
+    ISA_NEON,
+    ISA_COUNT
+};
+
+const char* IsaName(Isa eIsa);
+/**
+* @brief Best instruction set supported by both the build and the running CPU
+*/
+Isa DetectIsa();
+bool IsIsaAvailable(Isa eIsa);
+
+/**
+* @brief Row kernels for chroma interleaving (I420 <-> NV12 style). n is the number of U/V pairs.
+*/
+struct YuvKernels {
+    void (*InterleaveUV8)(const uint8_t* pU, const uint8_t* pV, uint8_t* pUV, int n);
+    void (*InterleaveUV16)(const uint16_t* pU, const uint16_t* pV, uint16_t* pUV, int n);
+    void (*DeinterleaveUV8)(const uint8_t* pUV, uint8_t* pU, uint8_t* pV, int n);
+    void (*DeinterleaveUV16)(const uint16_t* pUV, uint16_t* pU, uint16_t* pV, int n);
+};
+
+/**
+* @brief Kernels for a specific instruction set; falls back to scalar if eIsa is unavailable
+*/
+const YuvKernels& GetYuvKernels(Isa eIsa);
+/**
+* @brief Kernels for the detected instruction set
+*/
+const YuvKernels& GetYuvKernels();
+
+/**
+* @brief How a layer's luma combines with what is below it; chroma always blends as BLEND_NORMAL
+*/
+enum BlendMode {
+    BLEND_NORMAL,
+    BLEND_ADD,
+    BLEND_MULTIPLY,
+    BLEND_SCREEN,
+    BLEND_MODE_COUNT
+};
+
+/**
+* @brief Row kernels for compositing planar YUV. nOpacity is 0..256 with 256 opaque. pAlpha, when
+* not null, is a per-sample alpha row at the same bit depth (full scale opaque) scaled by nOpacity.
+* The 16-bit kernels take samples of up to 12 significant bits.
+*/
+struct BlendKernels {
+    // pDst[i] = (pSrc[i] * a + pDst[i] * (256 - a) + 128) >> 8
+    void (*Blend8)(const uint8_t* pSrc, const uint8_t* pAlpha, uint8_t* pDst, int n, int nOpacity);
+    void (*Blend16)(const uint16_t* pSrc, const uint16_t* pAlpha, uint16_t* pDst, int n, int nOpacity, int nBits);
+    // pOut[i] = pSrc[i] (eMode) pDst[i], computed on [nBlack, nWhite] normalized samples; pOut may be pSrc
+    void (*Mode8)(const uint8_t* pSrc, const uint8_t* pDst, uint8_t* pOut, int n, BlendMode eMode, int nBlack, int nWhite);
+    void (*Mode16)(const uint16_t* pSrc, const uint16_t* pDst, uint16_t* pOut, int n, BlendMode eMode, int nBlack, int nWhite);
+};
+
+const BlendKernels& GetBlendKernels(Isa eIsa);
+const BlendKernels& GetBlendKernels();
+
+/**
+* @brief Float sample kernels for audio
+*/
+struct AudioKernels {
+    // Folds n samples into a running minimum, maximum and sum of squares
+    void (*PeakReduce)(const float* p, int n, float* pMin, float* pMax, float* pSumSq);
+    // pDst[i] += pSrc[i] * (fGain + fStep * i): mixing with a linear gain ramp
+    void (*MixRamp)(const float* pSrc, float* pDst, int n, float fGain, float fStep);
+    // Clamps n samples to [-1, 1]
+    void (*ClampUnit)(float* p, int n);
+};
+
+const AudioKernels& GetAudioKernels(Isa eIsa);
+const AudioKernels& GetAudioKernels();
+
+}
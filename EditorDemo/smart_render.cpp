@@ -0,0 +1,315 @@
+#include "smart_render.h"
+
+#include <algorithm>
+
+namespace {
+
+// output timestamps; fine enough that nudging a dts by one tick at a seam is invisible
+const AVRational kTimelineTb = { 1, 90000 };
+
+int64_t MsToPts(int64_t t, AVRational tb) {
+	return av_rescale_q(t, AVRational{ 1, 1000 }, tb);
+}
+
+}
+
+SmartRender::SmartRender(const std::vector<SmartRenderClip>& vClips, const char* szOutFilePath,
+	const SmartRenderOptions& options)
+	: vClips(vClips), strOutFilePath(szOutFilePath), options(options)
+{
+}
+
+SmartRender::~SmartRender()
+{
+	av_bsf_free(&bsf);
+}
+
+bool SmartRender::Mux(AVPacket* pkt, AVRational tb)
+{
+	av_packet_rescale_ts(pkt, tb, kTimelineTb);
+	// copied and re-encoded GOPs may differ in reordering delay; keep dts increasing across seams
+	if (nLastDts != AV_NOPTS_VALUE && pkt->dts != AV_NOPTS_VALUE && pkt->dts <= nLastDts) {
+		pkt->dts = nLastDts + 1;
+		if (pkt->pts != AV_NOPTS_VALUE && pkt->pts < pkt->dts) {
+			pkt->pts = pkt->dts;
+		}
+	}
+	if (pkt->dts != AV_NOPTS_VALUE) {
+		nLastDts = pkt->dts;
+	}
+	return pStreamer->Stream(pkt, kTimelineTb);
+}
+
+bool SmartRender::CopyRun(FFmpegDecoder& decoder, const std::vector<Gop>& vGops, size_t nBegin, size_t nEnd,
+	int64_t nInPts)
+{
+	const PacketIndex& index = decoder.GetIndex();
+	AVRational tb = index.GetTimeBase();
+	AVPacket* pkt = av_packet_alloc();
+	int ret = decoder.DemuxFrom(index.GetEntries()[vGops[nBegin].first], pkt);
+	int nPackets = vGops[nEnd - 1].last - vGops[nBegin].first;
+	bool bOk = ret == 0;
+	for (int k = 0; bOk && k < nPackets; k++) {
+		if (k > 0 && decoder.Demux(pkt) < 0) {
+			bOk = false;
+			break;
+		}
+		if (pkt->pts != AV_NOPTS_VALUE) {
+			pkt->pts = av_rescale_q(pkt->pts - nInPts, tb, kTimelineTb) + nOffset;
+		}
+		if (pkt->dts != AV_NOPTS_VALUE) {
+			pkt->dts = av_rescale_q(pkt->dts - nInPts, tb, kTimelineTb) + nOffset;
+		}
+		if (!bsf) {
+			bOk = Mux(pkt, kTimelineTb);
+		} else if (av_bsf_send_packet(bsf, pkt) < 0) {
+			bOk = false;
+		} else {
+			while (bOk && av_bsf_receive_packet(bsf, pkt) == 0) {
+				bOk = Mux(pkt, kTimelineTb);
+				av_packet_unref(pkt);
+			}
+		}
+		av_packet_unref(pkt);
+		nCopiedPackets++;
+	}
+	av_packet_free(&pkt);
+	nCopiedGops += (int)(nEnd - nBegin);
+	return bOk;
+}
+
+bool SmartRender::EncodeRun(FFmpegDecoder& decoder, const std::vector<Gop>& vGops, size_t nBegin, size_t nEnd,
+	int64_t nInPts, int64_t nOutPts, const std::vector<std::pair<int64_t, int64_t>>& vEffectPts)
+{
+	const PacketIndex& index = decoder.GetIndex();
+	const std::vector<PacketIndexEntry>& vEntries = index.GetEntries();
+	AVRational tb = index.GetTimeBase();
+
+	// the frames this run shows: its packets' pts inside the kept range
+	std::vector<int64_t> vPts;
+	int64_t nBytes = 0;
+	for (size_t g = nBegin; g < nEnd; g++) {
+		for (int e = vGops[g].first; e < vGops[g].last; e++) {
+			int64_t pts = vEntries[e].PresentationTimestamp();
+			if (pts != AV_NOPTS_VALUE && pts >= nInPts && pts < nOutPts) {
+				vPts.push_back(pts);
+			}
+		}
+		nBytes += vGops[g].bytes;
+	}
+	if (vPts.empty()) {
+		return true;
+	}
+	std::sort(vPts.begin(), vPts.end());
+
+	// re-encoded GOPs have to decode like the copied ones around them
+	const AVCodecParameters* par = decoder.GetVideoCodecParameters();
+	EncoderOptions encoder_options = options.encoder;
+	encoder_options.closed_gop = true;
+	encoder_options.profile = par->profile;
+	encoder_options.level = par->level;
+	encoder_options.gop_size = std::max(1, vGops[nBegin].last - vGops[nBegin].first);
+	if (par->video_delay == 0) {
+		encoder_options.max_b_frames = 0;
+	}
+	if (options.match_bitrate) {
+		double dSeconds = av_q2d(tb) * (vGops[nEnd - 1].max_pts - vGops[nBegin].min_pts) + 1.0 / nFps;
+		if (dSeconds > 0.0 && nBytes > 0) {
+			encoder_options.rate_control = EncoderOptions::RC_VBR;
+			encoder_options.bitrate = (int64_t)(nBytes * 8 / dSeconds);
+			encoder_options.max_bitrate = encoder_options.bitrate * 3 / 2;
+		}
+	}
+	FFmpegEncoder encoder(eCodecId, nWidth, nHeight, nFps, eFormat, encoder_options);
+	if (!encoder.IsValid()) {
+		return false;
+	}
+	AVRational etb = encoder.GetTimeBase();
+	int64_t nEncOffset = av_rescale_q(nOffset, kTimelineTb, etb);
+
+	AVFrame* frame = av_frame_alloc();
+	std::vector<AVPacket*> vPackets;
+	int64_t nLastPts = AV_NOPTS_VALUE;
+	size_t nNext = 0;
+	bool bOk = true;
+	int ret = decoder.SeekToFrame(index.FindFrame(vPts.front()), frame);
+	while (ret == 0 && bOk && nNext < vPts.size()) {
+		int64_t pts = frame->best_effort_timestamp;
+		while (nNext < vPts.size() && vPts[nNext] < pts) {
+			nNext++;
+		}
+		if (nNext < vPts.size() && vPts[nNext] == pts) {
+			nNext++;
+			bool bEffect = false;
+			for (const std::pair<int64_t, int64_t>& range : vEffectPts) {
+				bEffect = bEffect || (pts >= range.first && pts < range.second);
+			}
+			if (!bEffect || !options.effect || options.effect(frame)) {
+				frame->pts = av_rescale_q(pts - nInPts, tb, etb) + nEncOffset;
+				if (nLastPts != AV_NOPTS_VALUE && frame->pts <= nLastPts) {
+					frame->pts = nLastPts + 1;
+				}
+				nLastPts = frame->pts;
+				ret = encoder.EncodeFrame(frame, vPackets);
+				nEncodedFrames++;
+			}
+		}
+		av_frame_unref(frame);
+		for (AVPacket*& p : vPackets) {
+			bOk = bOk && Mux(p, etb);
+			av_packet_free(&p);
+		}
+		vPackets.clear();
+		if (ret >= 0 && nNext < vPts.size()) {
+			ret = decoder.DecodeNextFrame(frame);
+		}
+	}
+	av_frame_free(&frame);
+	if (ret < 0 && ret != AVERROR_EOF) {
+		LOG(ERROR) << "Smart render: re-encoding from pts " << vPts.front() << " failed: " << ret;
+		bOk = false;
+	}
+	// the delayed packets of the last GOP come out of the flush
+	if (encoder.EncodeFrame(nullptr, vPackets) < 0) {
+		LOG(ERROR) << "Smart render: flushing the re-encode from pts " << vPts.front() << " failed";
+		bOk = false;
+	}
+	for (AVPacket*& p : vPackets) {
+		bOk = bOk && Mux(p, etb);
+		av_packet_free(&p);
+	}
+	nEncodedGops += (int)(nEnd - nBegin);
+	return bOk;
+}
+
+bool SmartRender::RenderClip(const SmartRenderClip& clip)
+{
+	FFmpegDecoder decoder(clip.path.c_str(), options.decoder);
+	if (!decoder.IsValid() || decoder.BuildIndex() < 0) {
+		LOG(ERROR) << "Smart render: cannot index " << clip.path;
+		return false;
+	}
+	if (decoder.GetVideoCodec() != eCodecId || decoder.GetWidth() != nWidth || decoder.GetHeight() != nHeight
+		|| decoder.GetChromaFormat() != eFormat) {
+		LOG(ERROR) << "Smart render: " << clip.path << " differs in codec, size or pixel format from the first clip";
+		return false;
+	}
+
+	const PacketIndex& index = decoder.GetIndex();
+	const std::vector<PacketIndexEntry>& vEntries = index.GetEntries();
+	const std::vector<int>& vKeys = index.GetKeyframes();
+	AVRational tb = index.GetTimeBase();
+	int64_t nStart = index.GetFramePts(0);
+	int64_t nInPts = nStart + MsToPts(clip.in, tb);
+	int64_t nOutPts = clip.out >= 0 ? nStart + MsToPts(clip.out, tb) : INT64_MAX;
+	std::vector<std::pair<int64_t, int64_t>> vEffectPts;
+	for (const std::pair<int64_t, int64_t>& range : clip.effect_ranges) {
+		vEffectPts.push_back({ nStart + MsToPts(range.first, tb), nStart + MsToPts(range.second, tb) });
+	}
+
+	// GOPs in decode order that show at least one kept frame
+	std::vector<Gop> vGops;
+	int64_t nLastKept = AV_NOPTS_VALUE;
+	for (size_t k = 0; k < vKeys.size(); k++) {
+		Gop gop = { vKeys[k], k + 1 < vKeys.size() ? vKeys[k + 1] : (int)vEntries.size(), INT64_MAX, INT64_MIN, 0, false };
+		for (int e = gop.first; e < gop.last; e++) {
+			int64_t pts = vEntries[e].PresentationTimestamp();
+			if (pts != AV_NOPTS_VALUE) {
+				gop.min_pts = std::min(gop.min_pts, pts);
+				gop.max_pts = std::max(gop.max_pts, pts);
+				if (pts >= nInPts && pts < nOutPts && (nLastKept == AV_NOPTS_VALUE || pts > nLastKept)) {
+					nLastKept = pts;
+				}
+			}
+			gop.bytes += vEntries[e].size;
+		}
+		if (gop.min_pts > gop.max_pts || gop.max_pts < nInPts || gop.min_pts >= nOutPts) {
+			continue;
+		}
+		bool bInside = gop.min_pts >= nInPts && gop.max_pts < nOutPts;
+		// leading pictures would reference a GOP that may not be copied with it
+		bool bClosed = gop.min_pts >= vEntries[gop.first].PresentationTimestamp();
+		bool bEffect = false;
+		for (const std::pair<int64_t, int64_t>& range : vEffectPts) {
+			bEffect = bEffect || (range.first <= gop.max_pts && range.second > gop.min_pts);
+		}
+		gop.copy = bInside && bClosed && !(bEffect && options.effect);
+		vGops.push_back(gop);
+	}
+	if (vGops.empty()) {
+		LOG(WARNING) << "Smart render: nothing kept of " << clip.path;
+		return true;
+	}
+
+	// length-prefixed H.264/HEVC (MP4, MKV) needs start codes and in-band parameter sets in the output
+	const AVCodecParameters* par = decoder.GetVideoCodecParameters();
+	av_bsf_free(&bsf);
+	if ((eCodecId == AV_CODEC_ID_H264 || eCodecId == AV_CODEC_ID_HEVC) && par->extradata_size > 0 && par->extradata[0] == 1) {
+		const AVBitStreamFilter* filter = av_bsf_get_by_name(eCodecId == AV_CODEC_ID_H264 ? "h264_mp4toannexb" : "hevc_mp4toannexb");
+		if (!filter || av_bsf_alloc(filter, &bsf) < 0 || avcodec_parameters_copy(bsf->par_in, par) < 0) {
+			LOG(ERROR) << "Smart render: cannot convert " << clip.path << " to Annex B";
+			return false;
+		}
+		bsf->time_base_in = kTimelineTb;
+		if (av_bsf_init(bsf) < 0) {
+			return false;
+		}
+	}
+
+	bool bOk = true;
+	for (size_t i = 0; bOk && i < vGops.size();) {
+		size_t j = i;
+		while (j < vGops.size() && vGops[j].copy == vGops[i].copy) {
+			j++;
+		}
+		bOk = vGops[i].copy ? CopyRun(decoder, vGops, i, j, nInPts)
+			: EncodeRun(decoder, vGops, i, j, nInPts, nOutPts, vEffectPts);
+		i = j;
+	}
+	av_bsf_free(&bsf);
+
+	// the next clip starts one frame after the last kept one
+	if (nLastKept != AV_NOPTS_VALUE) {
+		nOffset += av_rescale_q(nLastKept - nInPts, tb, kTimelineTb) + av_rescale_q(1, AVRational{ 1, nFps }, kTimelineTb);
+	}
+	return bOk;
+}
+
+bool SmartRender::Run()
+{
+	if (vClips.empty()) {
+		return false;
+	}
+	{
+		FFmpegDecoder probe(vClips[0].path.c_str());
+		if (!probe.IsValid()) {
+			LOG(ERROR) << "Smart render: cannot open " << vClips[0].path;
+			return false;
+		}
+		eCodecId = probe.GetVideoCodec();
+		nWidth = probe.GetWidth();
+		nHeight = probe.GetHeight();
+		eFormat = probe.GetChromaFormat();
+		AVRational fr = probe.GetFrameRate();
+		nFps = fr.num && fr.den ? (int)(av_q2d(fr) + 0.5) : 25;
+	}
+	if (eCodecId != AV_CODEC_ID_H264 && eCodecId != AV_CODEC_ID_HEVC && eCodecId != AV_CODEC_ID_AV1) {
+		LOG(ERROR) << "Smart render: cannot stream-copy " << avcodec_get_name(eCodecId);
+		return false;
+	}
+
+	StopWatch sw;
+	sw.Start();
+	bool bOk = true;
+	{
+		FFmpegStreamer streamer(eCodecId, nWidth, nHeight, nFps, strOutFilePath.c_str());
+		pStreamer = &streamer;
+		for (size_t i = 0; bOk && i < vClips.size(); i++) {
+			bOk = RenderClip(vClips[i]);
+		}
+		pStreamer = nullptr;
+	}
+	LOG(INFO) << "Smart render: " << nCopiedGops << " GOPs copied (" << nCopiedPackets << " packets), "
+		<< nEncodedGops << " re-encoded (" << nEncodedFrames << " frames) in " << sw.Stop() << "s";
+	return bOk;
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavcodec/bsf.h>
+}
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "utils.h"
+#include "ffmpeg_decoder.h"
+#include "ffmpeg_encoder.h"
+#include "ffmpeg_streamer.h"
+#include "export_pipeline.h"
+
+/**
+* @brief One kept range of a source file. Times are milliseconds from the start of its video stream.
+*/
+struct SmartRenderClip
+{
+	std::string path;
+	int64_t in = 0;
+	// -1 for the end of the stream
+	int64_t out = -1;
+	// source ranges [first, second) the effect is applied to
+	std::vector<std::pair<int64_t, int64_t>> effect_ranges;
+};
+
+struct SmartRenderOptions
+{
+	// base settings for re-encoded GOPs; codec, size, pixel format, profile and level always come
+	// from the source so re-encoded and copied GOPs decode with the same parameters
+	EncoderOptions encoder;
+	// for the sources; the packet index and stream copy do not depend on it
+	DecoderOptions decoder;
+	// target the bitrate the replaced GOPs had instead of encoder's rate control
+	bool match_bitrate = true;
+	ExportPipeline::EffectFunc effect;
+};
+
+/**
+* @brief Cut-and-concat export that avoids decoding where it can. Source GOPs (in decode order, from
+* the packet index) that lie entirely inside a kept range, carry no effect and have no leading
+* pictures referencing the previous GOP are stream-copied packet for packet. Consecutive other GOPs
+* are decoded and re-encoded as one run by a fresh encoder, which starts with an IDR frame, so
+* every seam between copied and re-encoded video is a clean random access point.
+* All clips must share codec, frame size and pixel format. Video only.
+*/
+class SmartRender
+{
+public:
+	SmartRender(const std::vector<SmartRenderClip>& vClips, const char* szOutFilePath,
+		const SmartRenderOptions& options = SmartRenderOptions());
+	SmartRender(const SmartRender&) = delete;
+	SmartRender& operator=(const SmartRender&) = delete;
+	~SmartRender();
+
+	bool Run();
+
+	int64_t GetCopiedPackets() {
+		return nCopiedPackets;
+	}
+	int64_t GetEncodedFrames() {
+		return nEncodedFrames;
+	}
+	int GetCopiedGops() {
+		return nCopiedGops;
+	}
+	int GetEncodedGops() {
+		return nEncodedGops;
+	}
+
+private:
+	// one GOP of a source in decode order: entries [first, last) of its packet index
+	struct Gop
+	{
+		int first, last;
+		int64_t min_pts, max_pts;
+		int64_t bytes;
+		bool copy;
+	};
+
+	bool RenderClip(const SmartRenderClip& clip);
+	// source pts in [nInPts, nOutPts) are placed at nOffset onwards on the output timeline
+	bool CopyRun(FFmpegDecoder& decoder, const std::vector<Gop>& vGops, size_t nBegin, size_t nEnd, int64_t nInPts);
+	bool EncodeRun(FFmpegDecoder& decoder, const std::vector<Gop>& vGops, size_t nBegin, size_t nEnd,
+		int64_t nInPts, int64_t nOutPts, const std::vector<std::pair<int64_t, int64_t>>& vEffectPts);
+	bool Mux(AVPacket* pkt, AVRational tb);
+
+private:
+	std::vector<SmartRenderClip> vClips;
+	std::string strOutFilePath;
+	SmartRenderOptions options;
+
+	FFmpegStreamer* pStreamer = nullptr;
+	// source parameters every clip must match
+	AVCodecID eCodecId = AV_CODEC_ID_NONE;
+	int nWidth = 0, nHeight = 0, nFps = 25;
+	AVPixelFormat eFormat = AV_PIX_FMT_NONE;
+	// converts copied length-prefixed (MP4/MKV) H.264/HEVC to the Annex B the output carries
+	AVBSFContext* bsf = nullptr;
+
+	// output timeline in kTimelineTb: where the current clip starts, and the last dts written
+	int64_t nOffset = 0;
+	int64_t nLastDts = AV_NOPTS_VALUE;
+
+	int64_t nCopiedPackets = 0;
+	int64_t nEncodedFrames = 0;
+	int nCopiedGops = 0;
+	int nEncodedGops = 0;
+};
@@ -0,0 +1,220 @@
+#include "task_scheduler.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace {
+// worker index of the calling thread within the scheduler it belongs to
+thread_local const TaskScheduler* tls_scheduler = nullptr;
+thread_local int tls_worker = -1;
+thread_local TaskScheduler::Priority tls_priority = TaskScheduler::PRIORITY_HIGH;
+}
+
+TaskScheduler::TaskScheduler(int nThreads, bool bPinThreads) : bPinThreads(bPinThreads)
+{
+	if (nThreads <= 0) {
+		nThreads = (int)std::max(1u, std::thread::hardware_concurrency());
+	}
+	for (int i = 0; i < nThreads; i++) {
+		vWorkers.emplace_back(new Worker);
+	}
+	for (int i = 0; i < nThreads; i++) {
+		vThreads.emplace_back(std::thread(&TaskScheduler::Run, this, i));
+	}
+}
+
+TaskScheduler::~TaskScheduler()
+{
+	WaitIdle();
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		bStop = true;
+	}
+	cvWork.notify_all();
+	vThreads.clear();
+}
+
+TaskScheduler& TaskScheduler::Global()
+{
+	static TaskScheduler scheduler;
+	return scheduler;
+}
+
+TaskScheduler::Priority TaskScheduler::CurrentPriority()
+{
+	return tls_priority;
+}
+
+TaskScheduler::PriorityScope::PriorityScope(Priority ePriority) : ePrevious(tls_priority)
+{
+	tls_priority = ePriority;
+}
+
+TaskScheduler::PriorityScope::~PriorityScope()
+{
+	tls_priority = ePrevious;
+}
+
+void TaskScheduler::Submit(Task task, Priority ePriority)
+{
+	int nIndex = tls_scheduler == this ? tls_worker : (int)(nNextWorker++ % vWorkers.size());
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		nPending++;
+	}
+	{
+		std::lock_guard<std::mutex> lock(vWorkers[nIndex]->mtx);
+		vWorkers[nIndex]->tasks[ePriority].push_back(std::move(task));
+	}
+	{
+		// under mtx, so a worker between its last TryPop and its wait cannot miss the wakeup
+		std::lock_guard<std::mutex> lock(mtx);
+		nQueued++;
+	}
+	cvWork.notify_one();
+}
+
+bool TaskScheduler::TryPop(int nIndex, Task& task, Priority& ePriority, bool& bStolen)
+{
+	// a queued preview task anywhere goes before the worker's own export or proxy work
+	int n = (int)vWorkers.size();
+	for (int p = 0; p < PRIORITY_COUNT; p++) {
+		{
+			std::deque<Task>& own = vWorkers[nIndex]->tasks[p];
+			std::lock_guard<std::mutex> lock(vWorkers[nIndex]->mtx);
+			if (!own.empty()) {
+				// oldest first: earlier segments of a job finish first and can be muxed early
+				task = std::move(own.front());
+				own.pop_front();
+				ePriority = (Priority)p;
+				bStolen = false;
+				return true;
+			}
+		}
+		for (int i = 1; i < n; i++) {
+			Worker& victim = *vWorkers[(nIndex + i) % n];
+			std::lock_guard<std::mutex> lock(victim.mtx);
+			if (!victim.tasks[p].empty()) {
+				// the victim's newest task, the one it would get to last
+				task = std::move(victim.tasks[p].back());
+				victim.tasks[p].pop_back();
+				ePriority = (Priority)p;
+				bStolen = true;
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+void TaskScheduler::Pin(int nIndex)
+{
+	int nCore = nIndex % (int)std::max(1u, std::thread::hardware_concurrency());
+#ifdef _WIN32
+	if (nCore < 64 && !SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << nCore)) {
+		LOG(WARNING) << "Task scheduler: cannot pin worker " << nIndex << " to core " << nCore;
+	}
+#else
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(nCore, &set);
+	if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+		LOG(WARNING) << "Task scheduler: cannot pin worker " << nIndex << " to core " << nCore;
+	}
+#endif
+}
+
+void TaskScheduler::Run(int nIndex)
+{
+	tls_scheduler = this;
+	tls_worker = nIndex;
+	if (bPinThreads) {
+		Pin(nIndex);
+	}
+	for (;;) {
+		Task task;
+		Priority ePriority;
+		bool bStolen = false;
+		if (!TryPop(nIndex, task, ePriority, bStolen)) {
+			std::unique_lock<std::mutex> lock(mtx);
+			cvWork.wait(lock, [this] { return bStop || nQueued > 0; });
+			if (bStop && nQueued == 0) {
+				break;
+			}
+			continue;
+		}
+		nQueued--;
+		if (bStolen) {
+			nStolen++;
+		}
+		tls_priority = ePriority;
+		task();
+		nExecuted++;
+
+		bool bIdle;
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			bIdle = --nPending == 0;
+		}
+		if (bIdle) {
+			cvIdle.notify_all();
+		}
+	}
+}
+
+void TaskScheduler::ParallelFor(int nCount, const std::function<void(int, int)>& f, Priority ePriority)
+{
+	// a few chunks per worker so that stealing can even out uneven tiles
+	int nChunks = std::min(nCount, (int)vWorkers.size() * 4);
+	if (nChunks <= 1) {
+		if (nCount > 0) {
+			f(0, nCount);
+		}
+		return;
+	}
+	struct Shared
+	{
+		std::atomic<int> nNext{ 0 };
+		std::mutex mtx;
+		std::condition_variable cv;
+		int nDone = 0;
+	};
+	// helpers that start after the last chunk was taken find nothing to do and must not touch f,
+	// which is gone by then; only the shared counters outlive the call
+	std::shared_ptr<Shared> shared = std::make_shared<Shared>();
+	const std::function<void(int, int)>* pf = &f;
+	auto RunChunks = [shared, pf, nCount, nChunks]() {
+		for (int c = shared->nNext++; c < nChunks; c = shared->nNext++) {
+			(*pf)((int)((int64_t)nCount * c / nChunks), (int)((int64_t)nCount * (c + 1) / nChunks));
+			std::lock_guard<std::mutex> lock(shared->mtx);
+			if (++shared->nDone == nChunks) {
+				shared->cv.notify_all();
+			}
+		}
+	};
+	int nHelpers = std::min(nChunks, (int)vWorkers.size()) - 1;
+	for (int i = 0; i < nHelpers; i++) {
+		Submit(RunChunks, ePriority);
+	}
+	RunChunks();
+	std::unique_lock<std::mutex> lock(shared->mtx);
+	shared->cv.wait(lock, [&] { return shared->nDone == nChunks; });
+}
+
+void TaskScheduler::WaitIdle()
+{
+	std::unique_lock<std::mutex> lock(mtx);
+	cvIdle.wait(lock, [this] { return nPending == 0; });
+}
+
+TaskScheduler::Stats TaskScheduler::GetStats()
+{
+	Stats stats;
+	stats.executed = nExecuted;
+	stats.stolen = nStolen;
+	return stats;
+}
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "utils.h"
+
+/**
+* @brief A fixed set of worker threads running submitted tasks, one deque per worker. A worker takes
+* tasks from the front of its own deque and, when that is empty, steals from the back of another's,
+* so work submitted in bursts (all segments of an export at once) spreads over idle workers without
+* a central queue becoming the bottleneck.
+*
+* Meant to be the single thread budget of a process: work that would otherwise start threads of its
+* own submits tasks here and runs its codecs single-threaded inside them, so concurrent jobs share
+* the cores instead of each sizing its own pools to the whole machine. Global() is that pool for the
+* editor; tasks are not preempted, so a priority decides which queued task a free worker takes next.
+*/
+class TaskScheduler
+{
+public:
+	typedef std::function<void()> Task;
+
+	enum Priority {
+		// interactive preview: prefetch around the playhead, effects of the displayed frame
+		PRIORITY_HIGH,
+		// exports and render jobs
+		PRIORITY_NORMAL,
+		// proxies and thumbnails
+		PRIORITY_LOW,
+		PRIORITY_COUNT
+	};
+
+	/**
+	* @brief Overrides CurrentPriority() on the calling thread until destroyed. For threads outside
+	* the pool that are not the UI, e.g. export stages, so the tiles they fan out do not queue as preview.
+	*/
+	class PriorityScope
+	{
+	public:
+		explicit PriorityScope(Priority ePriority);
+		~PriorityScope();
+		PriorityScope(const PriorityScope&) = delete;
+		PriorityScope& operator=(const PriorityScope&) = delete;
+
+	private:
+		Priority ePrevious;
+	};
+
+	struct Stats
+	{
+		int64_t executed = 0;
+		// tasks a worker took from another worker's deque
+		int64_t stolen = 0;
+	};
+
+	/**
+	* @brief nThreads 0 starts one worker per logical core. bPinThreads binds worker i to logical core
+	* i (modulo the core count), which keeps a worker's codec state in one core's caches.
+	*/
+	explicit TaskScheduler(int nThreads = 0, bool bPinThreads = false);
+	TaskScheduler(const TaskScheduler&) = delete;
+	TaskScheduler& operator=(const TaskScheduler&) = delete;
+	/**
+	* @brief Runs every task still queued, then joins the workers
+	*/
+	~TaskScheduler();
+
+	/**
+	* @brief The process-wide pool, one unpinned worker per logical core, started on first use
+	*/
+	static TaskScheduler& Global();
+	/**
+	* @brief Priority of the task running on the calling thread; outside any worker, the innermost
+	* PriorityScope, or PRIORITY_HIGH where the caller is normally the UI waiting for a result
+	*/
+	static Priority CurrentPriority();
+
+	/**
+	* @brief Queues a task. Called from a worker, it goes to that worker's deque, otherwise the
+	* deques are filled round robin. Tasks may submit further tasks.
+	*/
+	void Submit(Task task, Priority ePriority = PRIORITY_NORMAL);
+	/**
+	* @brief Calls f(nBegin, nEnd) on chunks of [0, nCount) and returns when all are done. The
+	* calling thread works through chunks itself and only waits for chunks already running on
+	* workers, so it finishes even when every worker is busy with longer tasks.
+	*/
+	void ParallelFor(int nCount, const std::function<void(int, int)>& f, Priority ePriority = CurrentPriority());
+	/**
+	* @brief Blocks until no task is queued or running
+	*/
+	void WaitIdle();
+
+	int GetThreadCount() {
+		return (int)vWorkers.size();
+	}
+	Stats GetStats();
+
+private:
+	struct Worker
+	{
+		std::mutex mtx;
+		std::deque<Task> tasks[PRIORITY_COUNT];
+	};
+
+	void Run(int nIndex);
+	void Pin(int nIndex);
+	bool TryPop(int nIndex, Task& task, Priority& ePriority, bool& bStolen);
+
+private:
+	std::vector<std::unique_ptr<Worker>> vWorkers;
+	std::vector<NvThread> vThreads;
+	bool bPinThreads;
+
+	// sleeping workers wait on cvWork; nPending counts queued plus running tasks
+	std::mutex mtx;
+	std::condition_variable cvWork;
+	std::condition_variable cvIdle;
+	std::atomic<int64_t> nQueued{ 0 };
+	int64_t nPending = 0;
+	bool bStop = false;
+
+	std::atomic<unsigned> nNextWorker{ 0 };
+	std::atomic<int64_t> nExecuted{ 0 };
+	std::atomic<int64_t> nStolen{ 0 };
+};
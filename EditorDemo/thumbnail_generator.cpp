@@ -0,0 +1,337 @@
+#include "thumbnail_generator.h"
+
+#include <algorithm>
+
+namespace {
+
+#pragma pack(push, 1)
+struct CacheHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t media_size;
+	int64_t media_mtime;
+	int32_t width;
+	int32_t height;
+};
+struct RecordHeader
+{
+	int64_t pts;
+	int64_t time;
+};
+#pragma pack(pop)
+
+const uint32_t kCacheMagic = MAKE_FOURCC('V', 'T', 'H', 'B');
+const uint32_t kCacheVersion = 1;
+
+}
+
+ThumbnailCache::ThumbnailCache(const std::string& strCacheDir, const char* szMediaPath, int nWidth, int nHeight)
+	: nWidth(nWidth), nHeight(nHeight)
+{
+	std::string strSize = std::to_string(nWidth) + "x" + std::to_string(nHeight);
+	if (strCacheDir.empty()) {
+		strPath = std::string(szMediaPath) + "." + strSize + ".thumbs";
+	} else {
+		char szHash[17];
+		snprintf(szHash, sizeof(szHash), "%016llx", (unsigned long long)HashPath(szMediaPath));
+		strPath = strCacheDir + "/" + szHash + "_" + strSize + ".thumbs";
+	}
+
+	uint64_t nMediaSize;
+	int64_t nMediaMtime;
+	if (!PacketIndex::GetMediaIdentity(szMediaPath, &nMediaSize, &nMediaMtime)) {
+		LOG(ERROR) << "Cannot stat " << szMediaPath;
+		return;
+	}
+	if (!OpenExisting(nMediaSize, nMediaMtime) && !Create(nMediaSize, nMediaMtime)) {
+		LOG(WARNING) << "Thumbnail cache " << strPath << " is not writable";
+	}
+}
+
+bool ThumbnailCache::OpenExisting(uint64_t nMediaSize, int64_t nMediaMtime)
+{
+	file.open(strPath, std::ios::in | std::ios::out | std::ios::binary);
+	if (!file.is_open()) {
+		return false;
+	}
+	CacheHeader header = {};
+	file.read((char*)&header, sizeof(header));
+	if (!file || header.magic != kCacheMagic || header.version != kCacheVersion
+		|| header.media_size != nMediaSize || header.media_mtime != nMediaMtime
+		|| header.width != nWidth || header.height != nHeight) {
+		file.close();
+		return false;
+	}
+
+	// records are fixed size; a partial record left by an interrupted write is overwritten
+	const uint64_t nRecord = sizeof(RecordHeader) + (uint64_t)nWidth * nHeight * 3;
+	uint64_t pos = sizeof(header);
+	RecordHeader rec;
+	while (file.seekg(pos) && file.read((char*)&rec, sizeof(rec))) {
+		file.seekg(pos + nRecord - 1);
+		char c;
+		if (!file.read(&c, 1)) {
+			break;
+		}
+		offsets[rec.pts] = pos;
+		pos += nRecord;
+	}
+	file.clear();
+	nEnd = pos;
+	LOG(INFO) << "Thumbnail cache " << strPath << ": " << offsets.size() << " thumbnails";
+	return true;
+}
+
+bool ThumbnailCache::Create(uint64_t nMediaSize, int64_t nMediaMtime)
+{
+	file.open(strPath, std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!file.is_open()) {
+		return false;
+	}
+	CacheHeader header = { kCacheMagic, kCacheVersion, nMediaSize, nMediaMtime, nWidth, nHeight };
+	file.write((const char*)&header, sizeof(header));
+	nEnd = sizeof(header);
+	return (bool)file;
+}
+
+bool ThumbnailCache::Get(int64_t pts, Thumbnail& thumb)
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	auto it = offsets.find(pts);
+	if (it == offsets.end()) {
+		return false;
+	}
+	RecordHeader rec;
+	thumb.width = nWidth;
+	thumb.height = nHeight;
+	thumb.rgb.resize((size_t)nWidth * nHeight * 3);
+	file.seekg(it->second);
+	file.read((char*)&rec, sizeof(rec));
+	file.read((char*)thumb.rgb.data(), thumb.rgb.size());
+	if (!file) {
+		file.clear();
+		return false;
+	}
+	thumb.time = rec.time;
+	return true;
+}
+
+bool ThumbnailCache::Put(int64_t pts, const Thumbnail& thumb)
+{
+	if (thumb.width != nWidth || thumb.height != nHeight) {
+		return false;
+	}
+	std::lock_guard<std::mutex> lock(mtx);
+	if (!file.is_open() || offsets.count(pts)) {
+		return false;
+	}
+	RecordHeader rec = { pts, thumb.time };
+	file.seekp(nEnd);
+	file.write((const char*)&rec, sizeof(rec));
+	file.write((const char*)thumb.rgb.data(), thumb.rgb.size());
+	file.flush();
+	if (!file) {
+		file.clear();
+		return false;
+	}
+	offsets[pts] = nEnd;
+	nEnd += sizeof(rec) + thumb.rgb.size();
+	return true;
+}
+
+ThumbnailGenerator::ThumbnailGenerator(const char* szFilePath, const ThumbnailOptions& options)
+	: strFilePath(szFilePath), options(options)
+{
+	// only used for stream parameters and the packet index; segments open their own decoders
+	DecoderOptions probe_options;
+	probe_options.threads = 1;
+	probe_options.use_frame_pool = false;
+	pProbe = new FFmpegDecoder(szFilePath, probe_options);
+	if (!pProbe->IsValid() || pProbe->BuildIndex() < 0) {
+		LOG(ERROR) << "Cannot index " << szFilePath << " for thumbnails";
+		return;
+	}
+
+	const PacketIndex& index = pProbe->GetIndex();
+	if (index.GetKeyframes().empty()) {
+		LOG(ERROR) << szFilePath << " has no keyframes";
+		return;
+	}
+	tb = index.GetTimeBase();
+	nStart = index.GetFramePts(0);
+	nDuration = av_rescale_q(index.GetFramePts(index.GetFrameCount() - 1) - nStart, tb, AVRational{ 1, 1000 });
+
+	int nWidth = pProbe->GetWidth(), nHeight = pProbe->GetHeight();
+	nThumbWidth = std::min(options.width, nWidth) & ~1;
+	nThumbHeight = options.height > 0 ? options.height & ~1 : (int)((int64_t)nThumbWidth * nHeight / nWidth) & ~1;
+	if (nThumbWidth <= 0 || nThumbHeight <= 0) {
+		LOG(ERROR) << "Invalid thumbnail size " << nThumbWidth << "x" << nThumbHeight;
+		return;
+	}
+
+	// largest reduction that still leaves at least the thumbnail size to scale from
+	if (options.use_lowres) {
+		while (nLowres < pProbe->GetMaxLowres()
+			&& (nWidth >> (nLowres + 1)) >= nThumbWidth && (nHeight >> (nLowres + 1)) >= nThumbHeight) {
+			nLowres++;
+		}
+	}
+
+	if (options.use_cache) {
+		pCache = new ThumbnailCache(options.cache_dir, szFilePath, nThumbWidth, nThumbHeight);
+	}
+	bValid = true;
+}
+
+ThumbnailGenerator::~ThumbnailGenerator()
+{
+	delete pCache;
+	delete pProbe;
+}
+
+int ThumbnailGenerator::Generate(int nCount, std::vector<Thumbnail>& vThumbs)
+{
+	std::vector<int64_t> vTimes;
+	for (int i = 0; i < nCount; i++) {
+		// centre of each slot, so the first and last thumbnails are not both edge frames
+		vTimes.push_back((2 * i + 1) * nDuration / (2 * nCount));
+	}
+	return Generate(vTimes, vThumbs);
+}
+
+int ThumbnailGenerator::Generate(const std::vector<int64_t>& vTimes, std::vector<Thumbnail>& vThumbs)
+{
+	vThumbs.clear();
+	nCacheHits = nDecoded = 0;
+	if (!bValid) {
+		return 0;
+	}
+
+	// distinct keyframes in stream order, and which one every requested time maps to
+	const PacketIndex& index = pProbe->GetIndex();
+	std::vector<PacketIndexEntry> vKeys;
+	std::vector<int> vKeyOfTime;
+	std::unordered_map<int64_t, int> mSlots;
+	for (int64_t t : vTimes) {
+		const PacketIndexEntry* key = index.FindKeyframe(nStart + av_rescale_q(t, AVRational{ 1, 1000 }, tb));
+		if (!key) {
+			key = &index.GetEntries()[index.GetKeyframes()[0]];
+		}
+		auto it = mSlots.find(key->PresentationTimestamp());
+		if (it == mSlots.end()) {
+			it = mSlots.emplace(key->PresentationTimestamp(), (int)vKeys.size()).first;
+			vKeys.push_back(*key);
+		}
+		vKeyOfTime.push_back(it->second);
+	}
+
+	std::vector<Thumbnail> vResults(vKeys.size());
+	std::vector<PacketIndexEntry> vMissing;
+	std::vector<size_t> vMissingSlot;
+	for (size_t i = 0; i < vKeys.size(); i++) {
+		if (pCache && pCache->Get(vKeys[i].PresentationTimestamp(), vResults[i])) {
+			nCacheHits++;
+		} else {
+			vMissing.push_back(vKeys[i]);
+			vMissingSlot.push_back(i);
+		}
+	}
+
+	if (!vMissing.empty()) {
+		// forward order inside a segment keeps the seeks short
+		std::vector<size_t> vOrder(vMissing.size());
+		for (size_t i = 0; i < vOrder.size(); i++) {
+			vOrder[i] = i;
+		}
+		std::sort(vOrder.begin(), vOrder.end(), [&vMissing](size_t a, size_t b) {
+			return vMissing[a].DecodeTimestamp() < vMissing[b].DecodeTimestamp();
+		});
+		std::vector<PacketIndexEntry> vSorted;
+		for (size_t i : vOrder) {
+			vSorted.push_back(vMissing[i]);
+		}
+
+		TaskScheduler& scheduler = TaskScheduler::Global();
+		size_t nThreads = options.threads > 0 ? options.threads : scheduler.GetThreadCount();
+		nThreads = std::min(nThreads, vSorted.size());
+		std::vector<Thumbnail> vDecoded(vSorted.size());
+		scheduler.ParallelFor((int)nThreads, [&](int nFirst, int nLast) {
+			for (size_t i = nFirst; i < (size_t)nLast; i++) {
+				size_t nBegin = vSorted.size() * i / nThreads, nEnd = vSorted.size() * (i + 1) / nThreads;
+				DecodeSegment(vSorted, nBegin, nEnd, vDecoded);
+			}
+		}, TaskScheduler::PRIORITY_LOW);
+		for (size_t i = 0; i < vOrder.size(); i++) {
+			Thumbnail& thumb = vDecoded[i];
+			if (thumb.rgb.empty()) {
+				continue;
+			}
+			nDecoded++;
+			if (pCache) {
+				pCache->Put(vSorted[i].PresentationTimestamp(), thumb);
+			}
+			vResults[vMissingSlot[vOrder[i]]] = std::move(thumb);
+		}
+	}
+
+	for (int k : vKeyOfTime) {
+		if (!vResults[k].rgb.empty()) {
+			vThumbs.push_back(vResults[k]);
+		}
+	}
+	LOG(INFO) << "Thumbnails: " << vThumbs.size() << " for " << vTimes.size() << " times, "
+		<< nCacheHits << " cached, " << nDecoded << " decoded";
+	return (int)vThumbs.size();
+}
+
+void ThumbnailGenerator::DecodeSegment(const std::vector<PacketIndexEntry>& vKeys, size_t nBegin, size_t nEnd,
+	std::vector<Thumbnail>& vResults)
+{
+	// segments run in parallel, so each decoder stays single-threaded
+	DecoderOptions decoder_options;
+	decoder_options.threads = 1;
+	decoder_options.use_frame_pool = false;
+	decoder_options.lowres = nLowres;
+	decoder_options.skip_frame = AVDISCARD_NONKEY;
+	// deblocking is invisible at thumbnail size
+	decoder_options.skip_loop_filter = AVDISCARD_ALL;
+	FFmpegDecoder decoder(strFilePath.c_str(), decoder_options);
+	if (!decoder.IsValid()) {
+		return;
+	}
+
+	AVFrame* frame = av_frame_alloc();
+	SwsContext* sws = nullptr;
+	for (size_t i = nBegin; i < nEnd; i++) {
+		int ret = decoder.DecodeKeyframe(vKeys[i], frame);
+		if (ret < 0) {
+			LOG(WARNING) << "Thumbnail at pts " << vKeys[i].PresentationTimestamp() << " failed: " << ret;
+			continue;
+		}
+		Thumbnail& thumb = vResults[i];
+		thumb.time = av_rescale_q(vKeys[i].PresentationTimestamp() - nStart, tb, AVRational{ 1, 1000 });
+		if (!Scale(&sws, frame, thumb)) {
+			thumb.rgb.clear();
+		}
+		av_frame_unref(frame);
+	}
+	sws_freeContext(sws);
+	av_frame_free(&frame);
+}
+
+bool ThumbnailGenerator::Scale(SwsContext** ppSws, const AVFrame* frame, Thumbnail& thumb)
+{
+	// straight from the decoded (possibly lowres) picture to the final size and RGB
+	*ppSws = sws_getCachedContext(*ppSws, frame->width, frame->height, (AVPixelFormat)frame->format,
+		nThumbWidth, nThumbHeight, AV_PIX_FMT_RGB24, SWS_AREA, nullptr, nullptr, nullptr);
+	if (!*ppSws) {
+		return false;
+	}
+	thumb.width = nThumbWidth;
+	thumb.height = nThumbHeight;
+	thumb.rgb.resize((size_t)nThumbWidth * nThumbHeight * 3);
+	uint8_t* dst[4] = { thumb.rgb.data() };
+	int dst_stride[4] = { nThumbWidth * 3 };
+	return sws_scale(*ppSws, frame->data, frame->linesize, 0, frame->height, dst, dst_stride) > 0;
+}
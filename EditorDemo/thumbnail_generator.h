@@ -0,0 +1,149 @@
+#pragma once
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libswscale/swscale.h>
+}
+
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "utils.h"
+#include "ffmpeg_decoder.h"
+#include "task_scheduler.h"
+
+/**
+* @brief One filmstrip image
+*/
+struct Thumbnail
+{
+	// presentation time of the keyframe shown, in milliseconds from the start of the stream
+	int64_t time = 0;
+	int width = 0;
+	int height = 0;
+	// packed RGB24, width * 3 bytes per row
+	std::vector<uint8_t> rgb;
+};
+
+/**
+* @brief On-disk thumbnail store for one media file and thumbnail size, keyed by keyframe pts.
+* A single file holds fixed-size records appended as thumbnails are produced. It is discarded
+* when the media file's size or modification time no longer match.
+*/
+class ThumbnailCache
+{
+public:
+	/**
+	* @brief strCacheDir empty keeps the cache next to the media file, like the packet index sidecar
+	*/
+	ThumbnailCache(const std::string& strCacheDir, const char* szMediaPath, int nWidth, int nHeight);
+	ThumbnailCache(const ThumbnailCache&) = delete;
+	ThumbnailCache& operator=(const ThumbnailCache&) = delete;
+
+	bool IsValid() {
+		return file.is_open();
+	}
+	bool Get(int64_t pts, Thumbnail& thumb);
+	bool Put(int64_t pts, const Thumbnail& thumb);
+	size_t GetCount() {
+		std::lock_guard<std::mutex> lock(mtx);
+		return offsets.size();
+	}
+
+private:
+	bool OpenExisting(uint64_t nMediaSize, int64_t nMediaMtime);
+	bool Create(uint64_t nMediaSize, int64_t nMediaMtime);
+
+private:
+	std::string strPath;
+	int nWidth, nHeight;
+	std::fstream file;
+	std::mutex mtx;
+	// record offset by keyframe pts
+	std::unordered_map<int64_t, uint64_t> offsets;
+	uint64_t nEnd = 0;
+};
+
+struct ThumbnailOptions
+{
+	int width = 160;
+	// 0 keeps the aspect ratio of the source
+	int height = 0;
+	// clip segments decoded in parallel, as low-priority tasks of TaskScheduler::Global();
+	// 0 for one per scheduler thread
+	int threads = 0;
+	// let codecs that support it decode at reduced resolution
+	bool use_lowres = true;
+	bool use_cache = true;
+	// empty keeps the cache next to the media file
+	std::string cache_dir;
+};
+
+/**
+* @brief Filmstrip extraction that decodes keyframes only. The packet index maps every requested
+* time to the keyframe at or before it; distinct keyframes are split into contiguous clip segments
+* and each segment is decoded by its own single-threaded decoder, so seeks stay local per thread.
+*/
+class ThumbnailGenerator
+{
+public:
+	ThumbnailGenerator(const char* szFilePath, const ThumbnailOptions& options = ThumbnailOptions());
+	ThumbnailGenerator(const ThumbnailGenerator&) = delete;
+	ThumbnailGenerator& operator=(const ThumbnailGenerator&) = delete;
+	~ThumbnailGenerator();
+
+	bool IsValid() {
+		return bValid;
+	}
+
+	/**
+	* @brief nCount thumbnails evenly spaced over the clip
+	*/
+	int Generate(int nCount, std::vector<Thumbnail>& vThumbs);
+	/**
+	* @brief One thumbnail per time (milliseconds), each showing the keyframe at or before it.
+	* Returns the number of thumbnails produced.
+	*/
+	int Generate(const std::vector<int64_t>& vTimes, std::vector<Thumbnail>& vThumbs);
+
+	int64_t GetDuration() {
+		return nDuration;
+	}
+	int GetThumbnailWidth() {
+		return nThumbWidth;
+	}
+	int GetThumbnailHeight() {
+		return nThumbHeight;
+	}
+	// thumbnails served from the cache and decoded by the last Generate()
+	int GetCacheHits() {
+		return nCacheHits;
+	}
+	int GetDecodedCount() {
+		return nDecoded;
+	}
+
+private:
+	void DecodeSegment(const std::vector<PacketIndexEntry>& vKeys, size_t nBegin, size_t nEnd,
+		std::vector<Thumbnail>& vResults);
+	bool Scale(SwsContext** ppSws, const AVFrame* frame, Thumbnail& thumb);
+
+private:
+	std::string strFilePath;
+	ThumbnailOptions options;
+	FFmpegDecoder* pProbe = nullptr;
+	ThumbnailCache* pCache = nullptr;
+	bool bValid = false;
+
+	AVRational tb = { 0, 1 };
+	int64_t nStart = 0;
+	int64_t nDuration = 0;
+	int nThumbWidth = 0, nThumbHeight = 0;
+	int nLowres = 0;
+
+	int nCacheHits = 0;
+	int nDecoded = 0;
+};
@@ -11,9 +11,13 @@
 #include <thread>
 #include <list>
 #include <vector>
+#include <algorithm>
 #include <condition_variable>
 
 #include "logger.h"
+#include "ring_buffer.h"
+#include "simd_kernels.h"
+#include "instrumentation.h"
 
 extern simplelogger::Logger* logger;
 
@@ -101,58 +105,90 @@ private:
 #ifndef _WIN32
 #define _stricmp strcasecmp
 #define _stat64 stat64
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
 #endif
 
 /**
-* @brief Utility class to allocate buffer memory. Helps avoid I/O during the encode/decode loop in case of performance tests.
+* @brief Read-only memory mapping of a whole file. Helps avoid I/O during the encode/decode loop in case of
+* performance tests, and lets multi-GB clips open instantly: pages are faulted in on demand and can be
+* dropped again, so nothing is copied up front and resident memory stays bounded.
 */
 class BufferedFileReader {
 public:
     /**
-    * @brief Constructor function to allocate appropriate memory and copy file contents into it
+    * @brief Maps szFileName. bPartial is kept for source compatibility; a mapping never needs a partial load.
     */
     BufferedFileReader(const char* szFileName, bool bPartial = false) {
-        struct _stat64 st;
-
-        if (_stat64(szFileName, &st) != 0) {
+#ifdef _WIN32
+        hFile = CreateFileA(szFileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+            FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        if (hFile == INVALID_HANDLE_VALUE) {
+            LOG(ERROR) << "Unable to open input file: " << szFileName;
             return;
         }
-
-        nSize = st.st_size;
-        while (nSize) {
-            try {
-                pBuf = new uint8_t[(size_t)nSize];
-                if (nSize != st.st_size) {
-                    LOG(WARNING) << "File is too large - only " << std::setprecision(4) << 100.0 * nSize / st.st_size << "% is loaded";
-                }
-                break;
-            }
-            catch (std::bad_alloc) {
-                if (!bPartial) {
-                    LOG(ERROR) << "Failed to allocate memory in BufferedReader";
-                    return;
-                }
-                nSize = (uint32_t)(nSize * 0.9);
-            }
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(hFile, &size) || size.QuadPart == 0) {
+            return;
         }
-
-        std::ifstream fpIn(szFileName, std::ifstream::in | std::ifstream::binary);
-        if (!fpIn)
-        {
+        hMapping = CreateFileMappingA(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (!hMapping) {
+            LOG(ERROR) << "CreateFileMapping failed for " << szFileName;
+            return;
+        }
+        pBuf = (uint8_t*)MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+        if (!pBuf) {
+            LOG(ERROR) << "MapViewOfFile failed for " << szFileName;
+            return;
+        }
+        nSize = (uint64_t)size.QuadPart;
+#else
+        fd = open(szFileName, O_RDONLY);
+        if (fd < 0) {
             LOG(ERROR) << "Unable to open input file: " << szFileName;
             return;
         }
-
-        std::streamsize nRead = fpIn.read(reinterpret_cast<char*>(pBuf), nSize).gcount();
-        fpIn.close();
-
-        assert(nRead == nSize);
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0) {
+            return;
+        }
+        void* p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED) {
+            LOG(ERROR) << "mmap failed for " << szFileName;
+            return;
+        }
+        pBuf = (uint8_t*)p;
+        nSize = (uint64_t)st.st_size;
+        // demuxing is mostly a forward scan: ask for aggressive read-ahead
+        madvise(pBuf, (size_t)nSize, MADV_SEQUENTIAL);
+#endif
     }
+    BufferedFileReader(const BufferedFileReader&) = delete;
+    BufferedFileReader& operator=(const BufferedFileReader&) = delete;
     ~BufferedFileReader() {
+#ifdef _WIN32
         if (pBuf) {
-            delete[] pBuf;
+            UnmapViewOfFile(pBuf);
+        }
+        if (hMapping) {
+            CloseHandle(hMapping);
+        }
+        if (hFile != INVALID_HANDLE_VALUE) {
+            CloseHandle(hFile);
         }
+#else
+        if (pBuf) {
+            munmap(pBuf, (size_t)nSize);
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+#endif
     }
+    /**
+    * @brief The mapping is read-only; writing through *ppBuf faults
+    */
     bool GetBuffer(uint8_t** ppBuf, uint64_t* pnSize) {
         if (!pBuf) {
             return false;
@@ -163,84 +199,60 @@ public:
         return true;
     }
 
-private:
-    uint8_t* pBuf = NULL;
-    uint64_t nSize = 0;
-};
-
-/**
-* @brief Template class to facilitate color space conversion
-*/
-template<typename T>
-class YuvConverter {
-public:
-    YuvConverter(int nWidth, int nHeight) : nWidth(nWidth), nHeight(nHeight) {
-        pQuad = new T[((nWidth + 1) / 2) * ((nHeight + 1) / 2)];
-    }
-    ~YuvConverter() {
-        delete[] pQuad;
-    }
-    void PlanarToUVInterleaved(T* pFrame, int nPitch = 0) {
-        if (nPitch == 0) {
-            nPitch = nWidth;
+    /**
+    * @brief Hints that [nOffset, nOffset + nLength) is about to be read, e.g. right after a seek
+    */
+    void WillNeed(uint64_t nOffset, uint64_t nLength) {
+        if (!ClampRange(nOffset, nLength)) {
+            return;
         }
+#ifdef _WIN32
+        WIN32_MEMORY_RANGE_ENTRY range = { pBuf + nOffset, (SIZE_T)nLength };
+        PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+#else
+        madvise(pBuf + nOffset, (size_t)nLength, MADV_WILLNEED);
+#endif
+    }
 
-        // sizes of source surface plane
-        int nSizePlaneY = nPitch * nHeight;
-        int nSizePlaneU = ((nPitch + 1) / 2) * ((nHeight + 1) / 2);
-        int nSizePlaneV = nSizePlaneU;
-
-        T* puv = pFrame + nSizePlaneY;
-        if (nPitch == nWidth) {
-            memcpy(pQuad, puv, nSizePlaneU * sizeof(T));
-        }
-        else {
-            for (int i = 0; i < (nHeight + 1) / 2; i++) {
-                memcpy(pQuad + ((nWidth + 1) / 2) * i, puv + ((nPitch + 1) / 2) * i, ((nWidth + 1) / 2) * sizeof(T));
-            }
-        }
-        T* pv = puv + nSizePlaneU;
-        for (int y = 0; y < (nHeight + 1) / 2; y++) {
-            for (int x = 0; x < (nWidth + 1) / 2; x++) {
-                puv[y * nPitch + x * 2] = pQuad[y * ((nWidth + 1) / 2) + x];
-                puv[y * nPitch + x * 2 + 1] = pv[y * ((nPitch + 1) / 2) + x];
-            }
+    /**
+    * @brief Drops resident pages of a range that has been consumed; they are re-read from the file if touched again
+    */
+    void DontNeed(uint64_t nOffset, uint64_t nLength) {
+        if (!ClampRange(nOffset, nLength)) {
+            return;
         }
+#ifdef _WIN32
+        VirtualUnlock(pBuf + nOffset, (SIZE_T)nLength);
+#else
+        madvise(pBuf + nOffset, (size_t)nLength, MADV_DONTNEED);
+#endif
     }
-    void UVInterleavedToPlanar(T* pFrame, int nPitch = 0) {
-        if (nPitch == 0) {
-            nPitch = nWidth;
-        }
-
-        // sizes of source surface plane
-        int nSizePlaneY = nPitch * nHeight;
-        int nSizePlaneU = ((nPitch + 1) / 2) * ((nHeight + 1) / 2);
-        int nSizePlaneV = nSizePlaneU;
-
-        T* puv = pFrame + nSizePlaneY,
-            * pu = puv,
-            * pv = puv + nSizePlaneU;
 
-        // split chroma from interleave to planar
-        for (int y = 0; y < (nHeight + 1) / 2; y++) {
-            for (int x = 0; x < (nWidth + 1) / 2; x++) {
-                pu[y * ((nPitch + 1) / 2) + x] = puv[y * nPitch + x * 2];
-                pQuad[y * ((nWidth + 1) / 2) + x] = puv[y * nPitch + x * 2 + 1];
-            }
-        }
-        if (nPitch == nWidth) {
-            memcpy(pv, pQuad, nSizePlaneV * sizeof(T));
+private:
+    // page-aligns the start of the range and clips it to the mapping
+    bool ClampRange(uint64_t& nOffset, uint64_t& nLength) {
+        const uint64_t nPage = 4096;
+        if (!pBuf || nOffset >= nSize) {
+            return false;
         }
-        else {
-            for (int i = 0; i < (nHeight + 1) / 2; i++) {
-                memcpy(pv + ((nPitch + 1) / 2) * i, pQuad + ((nWidth + 1) / 2) * i, ((nWidth + 1) / 2) * sizeof(T));
-            }
+        uint64_t nAligned = nOffset & ~(nPage - 1);
+        nLength += nOffset - nAligned;
+        nOffset = nAligned;
+        if (nLength > nSize - nOffset) {
+            nLength = nSize - nOffset;
         }
+        return nLength > 0;
     }
 
 private:
-    T* pQuad;
-    int nWidth, nHeight;
+    uint8_t* pBuf = NULL;
+    uint64_t nSize = 0;
+#ifdef _WIN32
+    HANDLE hFile = INVALID_HANDLE_VALUE;
+    HANDLE hMapping = NULL;
+#else
+    int fd = -1;
+#endif
 };
 
 /**
@@ -299,21 +311,36 @@ private:
 };
 
 /**
-* @brief Utility class to measure elapsed time in seconds between the block of executed code
+* @brief Utility class to measure elapsed time in seconds between the block of executed code.
+* Uses the monotonic clock; high_resolution_clock may follow wall-clock adjustments.
 */
 class StopWatch {
 public:
     void Start() {
-        t0 = std::chrono::high_resolution_clock::now();
+        t0 = std::chrono::steady_clock::now();
     }
     double Stop() {
-        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::now().time_since_epoch() - t0.time_since_epoch()).count() / 1.0e9;
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - t0).count() / 1.0e9;
+    }
+    /**
+    * @brief Stop() that also records the interval as one latency sample of eStage
+    */
+    double Stop(PipelineStage eStage) {
+        std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+        int64_t nStart = std::chrono::duration_cast<std::chrono::nanoseconds>(t0.time_since_epoch()).count();
+        int64_t nDuration = std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count();
+        Instrumentation::Get().Record(eStage, nStart, nDuration);
+        return nDuration / 1.0e9;
     }
 
 private:
-    std::chrono::high_resolution_clock::time_point t0;
+    std::chrono::steady_clock::time_point t0;
 };
 
+/**
+* @brief Mutex/condition variable based bounded queue. Shares its interface with the lock-free
+* SpscRingBuffer/MpmcRingBuffer in ring_buffer.h.
+*/
 template<typename T>
 class ConcurrentQueue
 {
@@ -325,54 +352,135 @@ public:
     ConcurrentQueue& operator=(const ConcurrentQueue&) = delete;
 
     void setSize(size_t s) {
+        std::unique_lock<std::mutex> lock(m_mutex);
         maxSize = s;
+        lock.unlock();
+        m_condNotFull.notify_all();
     }
 
     void push_back(const T& value) {
+        push(value);
+    }
+
+    T pop_front() {
+        T data{};
+        pop(data);
+        return data;
+    }
+
+    /**
+    * @brief Blocks while the queue is full. Returns false if the queue is closed.
+    */
+    bool push(const T& value) {
         // Do not use a std::lock_guard here. We will need to explicitly
         // unlock before notify_one as the other waiting thread will
         // automatically try to acquire mutex once it wakes up
         // (which will happen on notify_one)
         std::unique_lock<std::mutex> lock(m_mutex);
-        auto wasEmpty = m_List.empty();
-
-        while (full()) {
-            m_cond.wait(lock);
+        m_condNotFull.wait(lock, [this] { return !full() || m_bClosed; });
+        if (m_bClosed) {
+            return false;
         }
-
         m_List.push_back(value);
-        if (wasEmpty && !m_List.empty()) {
-            lock.unlock();
-            m_cond.notify_one();
-        }
+        lock.unlock();
+        m_condNotEmpty.notify_one();
+        return true;
     }
 
-    T pop_front() {
+    /**
+    * @brief Blocks while the queue is empty. Returns false once the queue is closed and drained.
+    */
+    bool pop(T& value) {
         std::unique_lock<std::mutex> lock(m_mutex);
+        m_condNotEmpty.wait(lock, [this] { return !m_List.empty() || m_bClosed; });
+        return popLocked(value, lock);
+    }
 
-        while (m_List.empty()) {
-            m_cond.wait(lock);
+    bool try_push(const T& value) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (full() || m_bClosed) {
+            return false;
         }
-        auto wasFull = full();
-        T data = std::move(m_List.front());
-        m_List.pop_front();
+        m_List.push_back(value);
+        lock.unlock();
+        m_condNotEmpty.notify_one();
+        return true;
+    }
 
-        if (wasFull && !full()) {
-            lock.unlock();
-            m_cond.notify_one();
+    bool try_pop(T& value) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        return popLocked(value, lock);
+    }
+
+    template<typename Rep, typename Period>
+    bool push_for(const T& value, const std::chrono::duration<Rep, Period>& timeout) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (!m_condNotFull.wait_for(lock, timeout, [this] { return !full() || m_bClosed; }) || m_bClosed) {
+            return false;
         }
+        m_List.push_back(value);
+        lock.unlock();
+        m_condNotEmpty.notify_one();
+        return true;
+    }
 
-        return data;
+    template<typename Rep, typename Period>
+    bool pop_for(T& value, const std::chrono::duration<Rep, Period>& timeout) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_condNotEmpty.wait_for(lock, timeout, [this] { return !m_List.empty() || m_bClosed; });
+        return popLocked(value, lock);
     }
 
-    T front() {
+    /**
+    * @brief Blocks until all n items are queued. Returns fewer than n only if the queue was closed.
+    */
+    size_t push_many(const T* pItems, size_t n) {
+        size_t nDone = 0;
         std::unique_lock<std::mutex> lock(m_mutex);
+        while (nDone < n) {
+            m_condNotFull.wait(lock, [this] { return !full() || m_bClosed; });
+            if (m_bClosed) {
+                break;
+            }
+            while (nDone < n && !full()) {
+                m_List.push_back(pItems[nDone++]);
+            }
+            m_condNotEmpty.notify_all();
+        }
+        return nDone;
+    }
 
-        while (m_List.empty()) {
-            m_cond.wait(lock);
+    /**
+    * @brief Blocks until at least one item is available and pops up to nMax.
+    * Returns 0 once the queue is closed and drained.
+    */
+    size_t pop_many(T* pItems, size_t nMax) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_condNotEmpty.wait(lock, [this] { return !m_List.empty() || m_bClosed; });
+        size_t n = 0;
+        while (n < nMax && !m_List.empty()) {
+            pItems[n++] = std::move(m_List.front());
+            m_List.pop_front();
+        }
+        lock.unlock();
+        if (n) {
+            m_condNotFull.notify_all();
         }
+        return n;
+    }
 
-        return m_List.front();
+    /**
+    * @brief Blocks while the queue is empty and copies the oldest item without removing it.
+    * Returns false once the queue is closed and drained, like pop().
+    */
+    bool front(T& value) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_condNotEmpty.wait(lock, [this] { return !m_List.empty() || m_bClosed; });
+        if (m_List.empty()) {
+            return false;
+        }
+        value = m_List.front();
+        return true;
     }
 
     size_t size() {
@@ -387,20 +495,48 @@ public:
     void clear() {
         std::unique_lock<std::mutex> lock(m_mutex);
         m_List.clear();
+        lock.unlock();
+        m_condNotFull.notify_all();
+    }
+
+    /**
+    * @brief Wakes every blocked caller. Further pushes fail; pops drain what is left.
+    */
+    void close() {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_bClosed = true;
+        lock.unlock();
+        m_condNotFull.notify_all();
+        m_condNotEmpty.notify_all();
+    }
+    bool closed() {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        return m_bClosed;
     }
 
 private:
     bool full() {
-        if (m_List.size() == maxSize)
-            return true;
-        return false;
+        return m_List.size() >= maxSize;
+    }
+
+    bool popLocked(T& value, std::unique_lock<std::mutex>& lock) {
+        if (m_List.empty()) {
+            return false;
+        }
+        value = std::move(m_List.front());
+        m_List.pop_front();
+        lock.unlock();
+        m_condNotFull.notify_one();
+        return true;
     }
 
 private:
     std::list<T> m_List;
     std::mutex m_mutex;
-    std::condition_variable m_cond;
-    size_t maxSize;
+    std::condition_variable m_condNotEmpty;
+    std::condition_variable m_condNotFull;
+    size_t maxSize = SIZE_MAX;
+    bool m_bClosed = false;
 };
 
 inline void CheckInputFile(const char* szInFilePath) {
@@ -420,3 +556,14 @@ inline void ValidateResolution(int nWidth, int nHeight) {
         throw std::invalid_argument(err.str());
     }
 }
+
+/**
+* @brief 64-bit FNV-1a hash of a media path, stable across runs: keys caches and names derived files
+*/
+inline uint64_t HashPath(const char* szPath) {
+    uint64_t h = 14695981039346656037ULL;
+    for (const char* p = szPath; *p; p++) {
+        h = (h ^ (uint8_t)*p) * 1099511628211ULL;
+    }
+    return h;
+}
@@ -0,0 +1,205 @@
+#pragma once
+
+#include "utils.h"
+#include "simd_kernels.h"
+#include "task_scheduler.h"
+
+namespace yuv_detail {
+
+/**
+* @brief Chroma row kernels. The generic version is the scalar reference; 8- and 16-bit samples
+* dispatch to the SIMD kernels of the running CPU.
+*/
+template<typename T>
+struct ChromaRowKernels {
+    static void Interleave(const T* pU, const T* pV, T* pUV, int n) {
+        for (int x = 0; x < n; x++) {
+            pUV[x * 2] = pU[x];
+            pUV[x * 2 + 1] = pV[x];
+        }
+    }
+    static void Deinterleave(const T* pUV, T* pU, T* pV, int n) {
+        for (int x = 0; x < n; x++) {
+            T u = pUV[x * 2], v = pUV[x * 2 + 1];
+            pU[x] = u;
+            pV[x] = v;
+        }
+    }
+};
+
+template<>
+struct ChromaRowKernels<uint8_t> {
+    static void Interleave(const uint8_t* pU, const uint8_t* pV, uint8_t* pUV, int n) {
+        simd::GetYuvKernels().InterleaveUV8(pU, pV, pUV, n);
+    }
+    static void Deinterleave(const uint8_t* pUV, uint8_t* pU, uint8_t* pV, int n) {
+        simd::GetYuvKernels().DeinterleaveUV8(pUV, pU, pV, n);
+    }
+};
+
+template<>
+struct ChromaRowKernels<uint16_t> {
+    static void Interleave(const uint16_t* pU, const uint16_t* pV, uint16_t* pUV, int n) {
+        simd::GetYuvKernels().InterleaveUV16(pU, pV, pUV, n);
+    }
+    static void Deinterleave(const uint16_t* pUV, uint16_t* pU, uint16_t* pV, int n) {
+        simd::GetYuvKernels().DeinterleaveUV16(pUV, pU, pV, n);
+    }
+};
+
+}
+
+/**
+* @brief Template class to facilitate color space conversion
+*/
+template<typename T>
+class YuvConverter {
+public:
+    YuvConverter(int nWidth, int nHeight, int nThreads = 1) : nWidth(nWidth), nHeight(nHeight), nThreads(nThreads) {}
+    ~YuvConverter() {
+        delete[] pQuad;
+    }
+    /**
+    * @brief Rows are split into at most nThreads bands in the out-of-place conversions
+    */
+    void SetThreads(int n) {
+        nThreads = n > 0 ? n : 1;
+    }
+
+    void PlanarToUVInterleaved(T* pFrame, int nPitch = 0) {
+        ScopedTimer timer(STAGE_CONVERT);
+        if (nPitch == 0) {
+            nPitch = nWidth;
+        }
+
+        // sizes of source surface plane
+        int nSizePlaneY = nPitch * nHeight;
+        int nSizePlaneU = ((nPitch + 1) / 2) * ((nHeight + 1) / 2);
+
+        T* puv = pFrame + nSizePlaneY;
+        T* pQuad = GetQuad();
+        if (nPitch == nWidth) {
+            memcpy(pQuad, puv, nSizePlaneU * sizeof(T));
+        }
+        else {
+            for (int i = 0; i < (nHeight + 1) / 2; i++) {
+                memcpy(pQuad + ((nWidth + 1) / 2) * i, puv + ((nPitch + 1) / 2) * i, ((nWidth + 1) / 2) * sizeof(T));
+            }
+        }
+        // In place, row y of the interleaved plane overwrites V rows that later rows still read,
+        // so this runs top to bottom on one thread
+        T* pv = puv + nSizePlaneU;
+        for (int y = 0; y < (nHeight + 1) / 2; y++) {
+            yuv_detail::ChromaRowKernels<T>::Interleave(pQuad + y * ((nWidth + 1) / 2), pv + y * ((nPitch + 1) / 2),
+                puv + y * nPitch, (nWidth + 1) / 2);
+        }
+    }
+    void UVInterleavedToPlanar(T* pFrame, int nPitch = 0) {
+        ScopedTimer timer(STAGE_CONVERT);
+        if (nPitch == 0) {
+            nPitch = nWidth;
+        }
+
+        // sizes of source surface plane
+        int nSizePlaneY = nPitch * nHeight;
+        int nSizePlaneU = ((nPitch + 1) / 2) * ((nHeight + 1) / 2);
+        int nSizePlaneV = nSizePlaneU;
+
+        T* puv = pFrame + nSizePlaneY,
+            * pu = puv,
+            * pv = puv + nSizePlaneU;
+        T* pQuad = GetQuad();
+
+        // split chroma from interleave to planar
+        for (int y = 0; y < (nHeight + 1) / 2; y++) {
+            yuv_detail::ChromaRowKernels<T>::Deinterleave(puv + y * nPitch, pu + y * ((nPitch + 1) / 2),
+                pQuad + y * ((nWidth + 1) / 2), (nWidth + 1) / 2);
+        }
+        if (nPitch == nWidth) {
+            memcpy(pv, pQuad, nSizePlaneV * sizeof(T));
+        }
+        else {
+            for (int i = 0; i < (nHeight + 1) / 2; i++) {
+                memcpy(pv + ((nPitch + 1) / 2) * i, pQuad + ((nWidth + 1) / 2) * i, ((nWidth + 1) / 2) * sizeof(T));
+            }
+        }
+    }
+
+    /**
+    * @brief Out-of-place planar to interleaved, luma included. Needs no scratch buffer;
+    * pSrc and pDst use the same pitch and must not overlap.
+    */
+    void PlanarToUVInterleaved(const T* pSrc, T* pDst, int nPitch = 0) {
+        ScopedTimer timer(STAGE_CONVERT);
+        if (nPitch == 0) {
+            nPitch = nWidth;
+        }
+        int nSizePlaneY = nPitch * nHeight;
+        int nSizePlaneU = ((nPitch + 1) / 2) * ((nHeight + 1) / 2);
+        const T* pu = pSrc + nSizePlaneY, * pv = pu + nSizePlaneU;
+        T* puv = pDst + nSizePlaneY;
+
+        ParallelRows(nHeight, [&](int y0, int y1) {
+            memcpy(pDst + y0 * nPitch, pSrc + y0 * nPitch, (size_t)(y1 - y0) * nPitch * sizeof(T));
+            for (int y = (y0 + 1) / 2; y < (y1 + 1) / 2; y++) {
+                yuv_detail::ChromaRowKernels<T>::Interleave(pu + y * ((nPitch + 1) / 2), pv + y * ((nPitch + 1) / 2),
+                    puv + y * nPitch, (nWidth + 1) / 2);
+            }
+        });
+    }
+    /**
+    * @brief Out-of-place interleaved to planar, luma included. Same constraints as above.
+    */
+    void UVInterleavedToPlanar(const T* pSrc, T* pDst, int nPitch = 0) {
+        ScopedTimer timer(STAGE_CONVERT);
+        if (nPitch == 0) {
+            nPitch = nWidth;
+        }
+        int nSizePlaneY = nPitch * nHeight;
+        int nSizePlaneU = ((nPitch + 1) / 2) * ((nHeight + 1) / 2);
+        const T* puv = pSrc + nSizePlaneY;
+        T* pu = pDst + nSizePlaneY, * pv = pu + nSizePlaneU;
+
+        ParallelRows(nHeight, [&](int y0, int y1) {
+            memcpy(pDst + y0 * nPitch, pSrc + y0 * nPitch, (size_t)(y1 - y0) * nPitch * sizeof(T));
+            for (int y = (y0 + 1) / 2; y < (y1 + 1) / 2; y++) {
+                yuv_detail::ChromaRowKernels<T>::Deinterleave(puv + y * nPitch, pu + y * ((nPitch + 1) / 2),
+                    pv + y * ((nPitch + 1) / 2), (nWidth + 1) / 2);
+            }
+        });
+    }
+
+private:
+    T* GetQuad() {
+        if (!pQuad) {
+            pQuad = new T[((nWidth + 1) / 2) * ((nHeight + 1) / 2)];
+        }
+        return pQuad;
+    }
+
+    /**
+    * @brief Calls f(y0, y1) on bands of luma rows, spread over TaskScheduler::Global() at the caller's
+    * priority; bands start on even rows so chroma rows are not shared
+    */
+    template<typename F>
+    void ParallelRows(int nRows, F f) {
+        // below roughly 1080p handing bands to workers costs more than it saves
+        int nBands = (int64_t)nWidth * nHeight < 1920 * 1080 ? 1 : std::min(nThreads, nRows / 16);
+        if (nBands <= 1) {
+            f(0, nRows);
+            return;
+        }
+        int nBandRows = ((nRows + nBands - 1) / nBands + 1) & ~1;
+        TaskScheduler::Global().ParallelFor(nBands, [&](int b0, int b1) {
+            int y0 = std::min(b0 * nBandRows, nRows), y1 = std::min(b1 * nBandRows, nRows);
+            if (y0 < y1) {
+                f(y0, y1);
+            }
+        });
+    }
+
+private:
+    T* pQuad = nullptr;
+    int nWidth, nHeight;
+    int nThreads;
+};
@@ -0,0 +1,184 @@
+#pragma once
+
+#include <fstream>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#include "utils.h"
+#include "ffmpeg_encoder.h"
+#include "smart_render.h"
+
+/**
+* @brief One render of a job file.
+*
+* Job files are line based: "[job]" starts a job, "key = value" sets one of its fields, '#' starts
+* a comment. Keys:
+*   name            label for the log, defaults to the output path
+*   mode            transcode (default): whole input through a segmented export
+*                   smart: cut and concat of the clips, stream-copying untouched GOPs
+*   input           source file; in smart mode the same as one clip line without a range
+*   clip            smart mode only, repeatable: path[, in_ms[, out_ms]]
+*   output          destination file (.ts for H.264/HEVC, .ivf for AV1)
+*   codec           h264 (default), hevc or av1; smart mode always keeps the source codec
+*   preset, crf, bitrate, max_bitrate, gop, bframes, encoder
+*                   EncoderOptions; a bitrate switches rate control to VBR
+*   segment_frames  smallest segment of a transcode, in frames
+*/
+struct RenderJob {
+    enum Mode {
+        MODE_TRANSCODE,
+        MODE_SMART
+    };
+
+    std::string name;
+    Mode mode = MODE_TRANSCODE;
+    std::string input;
+    std::string output;
+    AVCodecID codec = AV_CODEC_ID_H264;
+    std::vector<SmartRenderClip> clips;
+    EncoderOptions encoder;
+    int segment_frames = 300;
+};
+
+namespace render_job_detail {
+
+inline std::string Trim(const std::string& str) {
+    size_t first = str.find_first_not_of(" \t\r\n");
+    if (first == std::string::npos) {
+        return std::string();
+    }
+    return str.substr(first, str.find_last_not_of(" \t\r\n") - first + 1);
+}
+
+inline bool ParseClip(const std::string& strValue, SmartRenderClip& clip) {
+    std::vector<std::string> vFields;
+    size_t nStart = 0;
+    for (;;) {
+        size_t nComma = strValue.find(',', nStart);
+        vFields.push_back(Trim(strValue.substr(nStart, nComma == std::string::npos ? std::string::npos : nComma - nStart)));
+        if (nComma == std::string::npos) {
+            break;
+        }
+        nStart = nComma + 1;
+    }
+    if (vFields.empty() || vFields[0].empty() || vFields.size() > 3) {
+        return false;
+    }
+    clip.path = vFields[0];
+    clip.in = vFields.size() > 1 ? atoll(vFields[1].c_str()) : 0;
+    clip.out = vFields.size() > 2 ? atoll(vFields[2].c_str()) : -1;
+    return true;
+}
+
+inline bool SetField(RenderJob& job, const std::string& strKey, const std::string& strValue) {
+    if (strKey == "name") {
+        job.name = strValue;
+    } else if (strKey == "mode") {
+        if (strValue == "transcode") {
+            job.mode = RenderJob::MODE_TRANSCODE;
+        } else if (strValue == "smart") {
+            job.mode = RenderJob::MODE_SMART;
+        } else {
+            return false;
+        }
+    } else if (strKey == "input") {
+        job.input = strValue;
+    } else if (strKey == "clip") {
+        SmartRenderClip clip;
+        if (!ParseClip(strValue, clip)) {
+            return false;
+        }
+        job.clips.push_back(clip);
+    } else if (strKey == "output") {
+        job.output = strValue;
+    } else if (strKey == "codec") {
+        if (strValue == "h264") {
+            job.codec = AV_CODEC_ID_H264;
+        } else if (strValue == "hevc") {
+            job.codec = AV_CODEC_ID_HEVC;
+        } else if (strValue == "av1") {
+            job.codec = AV_CODEC_ID_AV1;
+        } else {
+            return false;
+        }
+    } else if (strKey == "preset") {
+        job.encoder.preset = strValue;
+    } else if (strKey == "crf") {
+        job.encoder.crf = atoi(strValue.c_str());
+    } else if (strKey == "bitrate") {
+        job.encoder.bitrate = atoll(strValue.c_str());
+        job.encoder.rate_control = EncoderOptions::RC_VBR;
+    } else if (strKey == "max_bitrate") {
+        job.encoder.max_bitrate = atoll(strValue.c_str());
+    } else if (strKey == "gop") {
+        job.encoder.gop_size = atoi(strValue.c_str());
+    } else if (strKey == "bframes") {
+        job.encoder.max_b_frames = atoi(strValue.c_str());
+    } else if (strKey == "encoder") {
+        job.encoder.encoder_name = strValue;
+    } else if (strKey == "segment_frames") {
+        job.segment_frames = atoi(strValue.c_str());
+    } else {
+        return false;
+    }
+    return true;
+}
+
+inline bool Validate(RenderJob& job) {
+    if (job.mode == RenderJob::MODE_SMART && job.clips.empty() && !job.input.empty()) {
+        SmartRenderClip clip;
+        clip.path = job.input;
+        job.clips.push_back(clip);
+    }
+    bool bHasSource = job.mode == RenderJob::MODE_SMART ? !job.clips.empty() : !job.input.empty();
+    if (!bHasSource || job.output.empty()) {
+        return false;
+    }
+    if (job.name.empty()) {
+        job.name = job.output;
+    }
+    return true;
+}
+
+}
+
+/**
+* @brief Appends the jobs of szPath to vJobs. Returns false, with the offending line logged, if
+* the file cannot be read or a job is malformed.
+*/
+inline bool LoadRenderJobs(const char* szPath, std::vector<RenderJob>& vJobs) {
+    using namespace render_job_detail;
+    std::ifstream file(szPath);
+    if (!file) {
+        LOG(ERROR) << "Cannot open job file " << szPath;
+        return false;
+    }
+    std::vector<RenderJob> vParsed;
+    std::string strLine;
+    for (int nLine = 1; std::getline(file, strLine); nLine++) {
+        size_t nComment = strLine.find('#');
+        strLine = Trim(strLine.substr(0, nComment));
+        if (strLine.empty()) {
+            continue;
+        }
+        if (strLine == "[job]") {
+            vParsed.emplace_back();
+            continue;
+        }
+        size_t nEquals = strLine.find('=');
+        if (vParsed.empty() || nEquals == std::string::npos
+            || !SetField(vParsed.back(), Trim(strLine.substr(0, nEquals)), Trim(strLine.substr(nEquals + 1)))) {
+            LOG(ERROR) << szPath << ":" << nLine << ": cannot parse \"" << strLine << "\"";
+            return false;
+        }
+    }
+    for (size_t i = 0; i < vParsed.size(); i++) {
+        if (!Validate(vParsed[i])) {
+            LOG(ERROR) << szPath << ": job " << i + 1 << " needs an output and an input or clips";
+            return false;
+        }
+    }
+    vJobs.insert(vJobs.end(), vParsed.begin(), vParsed.end());
+    return true;
+}
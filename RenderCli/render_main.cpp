@@ -0,0 +1,127 @@
+#include <iostream>
+#include <memory>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "render_job.h"
+#include "segmented_export.h"
+#include "smart_render.h"
+#include "task_scheduler.h"
+
+// Log I/O runs on a background thread so render threads never block on the console
+simplelogger::Logger* logger = simplelogger::LoggerFactory::CreateAsyncLogger(
+    simplelogger::LoggerFactory::CreateConsoleLogger());
+
+namespace {
+
+struct JobState {
+    RenderJob job;
+    std::unique_ptr<SegmentedExport> segmented;
+    std::unique_ptr<SmartRender> smart;
+    bool ok = false;
+    int64_t frames = 0;
+};
+
+void PrintUsage() {
+    std::cerr << "render [--threads N] job_file...\n"
+        "render [--threads N] --input in.mp4 --output out.ts [--codec h264|hevc|av1] [--preset p] [--crf n]\n"
+        "Renders every job on one shared pool of N worker threads (default: one per logical core).\n"
+        "See render_job.h for the job file format." << std::endl;
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    int nThreads = 0;
+    std::vector<RenderJob> vJobs;
+    RenderJob single;
+    bool bSingle = false;
+    for (int i = 1; i < argc; i++) {
+        bool bHasValue = i + 1 < argc;
+        if (!strcmp(argv[i], "--threads") && bHasValue) {
+            nThreads = atoi(argv[++i]);
+        } else if (!strncmp(argv[i], "--", 2) && bHasValue && strcmp(argv[i], "--help")) {
+            // --key value is the same as "key = value" in a job file
+            if (!render_job_detail::SetField(single, argv[i] + 2, argv[i + 1])) {
+                LOG(ERROR) << "Unknown option " << argv[i] << " " << argv[i + 1];
+                PrintUsage();
+                return 2;
+            }
+            bSingle = true;
+            i++;
+        } else if (argv[i][0] == '-') {
+            PrintUsage();
+            return 2;
+        } else if (!LoadRenderJobs(argv[i], vJobs)) {
+            return 2;
+        }
+    }
+    if (bSingle) {
+        if (!render_job_detail::Validate(single)) {
+            LOG(ERROR) << "--output and --input are required";
+            return 2;
+        }
+        vJobs.push_back(single);
+    }
+    if (vJobs.empty()) {
+        PrintUsage();
+        return 2;
+    }
+
+    StopWatch sw;
+    sw.Start();
+    std::vector<std::unique_ptr<JobState>> vStates;
+    int nWorkers;
+    {
+        TaskScheduler scheduler(nThreads);
+        nWorkers = scheduler.GetThreadCount();
+        LOG(INFO) << "Rendering " << vJobs.size() << " jobs on " << nWorkers << " threads";
+        for (const RenderJob& job : vJobs) {
+            vStates.emplace_back(new JobState);
+            JobState* state = vStates.back().get();
+            state->job = job;
+            if (job.mode == RenderJob::MODE_SMART) {
+                SmartRenderOptions options;
+                options.encoder = job.encoder;
+                // one task: the codecs must not start threads beyond the scheduler's budget
+                options.encoder.threads = 1;
+                options.decoder.threads = 1;
+                state->smart.reset(new SmartRender(job.clips, job.output.c_str(), options));
+                scheduler.Submit([state]() {
+                    state->ok = state->smart->Run();
+                    state->frames = state->smart->GetEncodedFrames() + state->smart->GetCopiedPackets();
+                });
+            } else {
+                SegmentedExportOptions options;
+                options.codec = job.codec;
+                options.encoder = job.encoder;
+                // every segment is a task of its own; threaded codecs would oversubscribe the pool
+                options.encoder.threads = 1;
+                options.segment_frames = job.segment_frames;
+                state->segmented.reset(new SegmentedExport(job.input.c_str(), job.output.c_str(), options));
+                state->segmented->Start(scheduler, [state](bool bOk) {
+                    state->ok = bOk;
+                    state->frames = state->segmented->GetFramesOut();
+                });
+            }
+        }
+        scheduler.WaitIdle();
+        TaskScheduler::Stats stats = scheduler.GetStats();
+        LOG(INFO) << "Scheduler: " << stats.executed << " tasks, " << stats.stolen << " stolen";
+    }
+    double dSeconds = sw.Stop();
+
+    int nFailed = 0;
+    int64_t nFrames = 0;
+    for (const std::unique_ptr<JobState>& state : vStates) {
+        std::cout << (state->ok ? "ok     " : "FAILED ") << state->job.name << " (" << state->frames << " frames)" << std::endl;
+        nFailed += !state->ok;
+        nFrames += state->frames;
+    }
+    std::cout << vStates.size() - nFailed << "/" << vStates.size() << " jobs in " << dSeconds << "s, "
+        << (dSeconds > 0.0 ? nFrames / dSeconds : 0.0) << " frames/s on " << nWorkers << " threads" << std::endl;
+    logger->Flush();
+    return nFailed ? 1 : 0;
+}